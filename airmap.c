@@ -0,0 +1,159 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "airmap.h"
+#include <string.h>
+
+/**
+ * Initializes the air map of a workpart.
+ *
+ * @return Zero on success, -1 if out of memory.
+ */
+int airmap_init(struct airmap *map, struct workpart *wp)
+{
+    memset(map, 0, sizeof(*map));
+    map->wp      = wp;
+    map->tiles_x = (wp->width + AIRMAP_TILE_SIZE - 1) / AIRMAP_TILE_SIZE;
+    map->tiles_y = (wp->height + AIRMAP_TILE_SIZE - 1) / AIRMAP_TILE_SIZE;
+    map->tiles   = malloc((size_t)map->tiles_x * map->tiles_y * sizeof(*map->tiles));
+    if (map->tiles == NULL) return -1;
+    airmap_reset(map);
+
+    return 0;
+}
+
+void airmap_clear(struct airmap *map)
+{
+    free(map->tiles);
+    memset(map, 0, sizeof(*map));
+}
+
+/** Assumes that the workpart is solid, e.g. after workpart_set_all(). */
+void airmap_reset(struct airmap *map)
+{
+    size_t i, num_tiles = (size_t)map->tiles_x * map->tiles_y;
+
+    for (i = 0; i < num_tiles; ++i) {
+        map->tiles[i].max     = map->wp->thickness;
+        map->tiles[i].dirty   = 0;
+        map->tiles[i].dirty_z = 0;
+    }
+}
+
+/**
+ * Clips a rectangle to the tiles it overlaps.
+ *
+ * @return Zero if the rectangle overlaps the workpart, -1 otherwise.
+ */
+static int airmap_tile_range(struct airmap *map, const struct workpart_rect *rect,
+                             int *tx0, int *ty0, int *tx1, int *ty1)
+{
+    int x0 = rect->x0 < 0 ? 0 : rect->x0;
+    int y0 = rect->y0 < 0 ? 0 : rect->y0;
+    int x1 = rect->x1 > (int)map->wp->width ? (int)map->wp->width : rect->x1;
+    int y1 = rect->y1 > (int)map->wp->height ? (int)map->wp->height : rect->y1;
+
+    if (x0 >= x1 || y0 >= y1) return -1;
+    *tx0 = x0 / AIRMAP_TILE_SIZE;
+    *ty0 = y0 / AIRMAP_TILE_SIZE;
+    *tx1 = (x1 - 1) / AIRMAP_TILE_SIZE;
+    *ty1 = (y1 - 1) / AIRMAP_TILE_SIZE;
+
+    return 0;
+}
+
+/**
+ * Records that material may have been removed.
+ *
+ * @param rect Affected columns.
+ * @param z Lowest layer of the tool.
+ */
+void airmap_mark(struct airmap *map, const struct workpart_rect *rect, int z)
+{
+    struct airmap_tile *tile;
+    int tx, ty, tx0, ty0, tx1, ty1;
+
+    if (airmap_tile_range(map, rect, &tx0, &ty0, &tx1, &ty1) != 0) return;
+
+    for (ty = ty0; ty <= ty1; ++ty) {
+        for (tx = tx0; tx <= tx1; ++tx) {
+            tile = &map->tiles[ty * map->tiles_x + tx];
+            if (z >= tile->max) continue; /* nothing to remove */
+            if (!tile->dirty || z < tile->dirty_z) tile->dirty_z = z;
+            tile->dirty = 1;
+        }
+    }
+}
+
+/** Computes the exact material height of a tile. */
+static void airmap_update(struct airmap *map, int tx, int ty)
+{
+    struct airmap_tile *tile = &map->tiles[ty * map->tiles_x + tx];
+    int x, y, x0, y0, x1, y1, top, max = 0;
+
+    x0 = tx * AIRMAP_TILE_SIZE;
+    y0 = ty * AIRMAP_TILE_SIZE;
+    x1 = x0 + AIRMAP_TILE_SIZE;
+    y1 = y0 + AIRMAP_TILE_SIZE;
+    if (x1 > (int)map->wp->width) x1 = map->wp->width;
+    if (y1 > (int)map->wp->height) y1 = map->wp->height;
+
+    for (y = y0; y < y1 && max < tile->max; ++y) {
+        for (x = x0; x < x1; ++x) {
+            top = workpart_get_top(map->wp, x, y);
+            if (top > max) max = top;
+        }
+    }
+    tile->max   = max;
+    tile->dirty = 0;
+    map->num_updates++;
+}
+
+/**
+ * Tests if a tool touches no material.
+ *
+ * @param rect Columns covered by the tool.
+ * @param z Lowest layer of the tool.
+ *
+ * @return 1 if all material below \c rect is lower than \c z, 0 otherwise.
+ */
+int airmap_is_air(struct airmap *map, const struct workpart_rect *rect, int z)
+{
+    struct airmap_tile *tile;
+    int tx, ty, tx0, ty0, tx1, ty1;
+
+    map->num_checks++;
+    if (z >= (int)map->wp->thickness ||
+        airmap_tile_range(map, rect, &tx0, &ty0, &tx1, &ty1) != 0) {
+        map->num_culled++;
+        return 1;
+    }
+
+    for (ty = ty0; ty <= ty1; ++ty) {
+        for (tx = tx0; tx <= tx1; ++tx) {
+            tile = &map->tiles[ty * map->tiles_x + tx];
+            if (z >= tile->max) continue;
+            /* only rescan when the tool is above the layer that was cut */
+            if (!tile->dirty || z <= tile->dirty_z) return 0;
+            airmap_update(map, tx, ty);
+            if (z < tile->max) return 0;
+        }
+    }
+    map->num_culled++;
+
+    return 1;
+}
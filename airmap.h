@@ -0,0 +1,55 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AIRMAP_H_K7RQ2M4T
+#define AIRMAP_H_K7RQ2M4T
+
+#include "workpart.h"
+
+/** Tile edge length in voxels. */
+#define AIRMAP_TILE_SIZE 16
+
+/** Summary of the material below one tile of XY columns. */
+struct airmap_tile {
+    int max;     /**< upper bound of the material height in all columns */
+    int dirty;   /**< material has been removed since max was computed */
+    int dirty_z; /**< lowest tool layer which removed material since then */
+};
+
+/**
+ * Coarse summary of the material height to cull tool positions in air.
+ * Each tile stores an upper bound of the topmost material of its
+ * columns. Removing material marks the tiles dirty; the bound is only
+ * recomputed when the tool passes above the layer that made the tile
+ * dirty, so cutting at one level does not rescan the tiles.
+ */
+struct airmap {
+    struct workpart *wp;
+    int tiles_x, tiles_y;
+    struct airmap_tile *tiles;
+    unsigned long num_checks;  /**< number of airmap_is_air() calls */
+    unsigned long num_culled;  /**< number of checks which were in air */
+    unsigned long num_updates; /**< number of recomputed tiles */
+};
+
+int airmap_init(struct airmap *map, struct workpart *wp);
+void airmap_clear(struct airmap *map);
+void airmap_reset(struct airmap *map);
+void airmap_mark(struct airmap *map, const struct workpart_rect *rect, int z);
+int airmap_is_air(struct airmap *map, const struct workpart_rect *rect, int z);
+
+#endif /* end of include guard: AIRMAP_H_K7RQ2M4T */
@@ -0,0 +1,493 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "animlog.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ANIMLOG_HEADER_SIZE 24
+#define ANIMLOG_FRAME_SIZE  40
+#define ANIMLOG_RECT_SIZE   20
+
+/** One frame, encoded by a thread of the pool. */
+struct animlog_job {
+    struct animlog_frame_info info;
+    unsigned int num_rows;
+    unsigned int *row_index; /**< image rows of the frame, ascending */
+    uint16_t *old_values;    /**< gray values of these rows in the previous frame */
+    uint16_t *new_values;
+    int32_t *delta;          /**< differences of one rectangle */
+    uint8_t *out;            /**< encoded frame */
+    size_t out_len;
+    size_t out_size;
+};
+
+static uint8_t *animlog_put_u32(uint8_t *p, uint32_t val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+    return p + 4;
+}
+
+static uint8_t *animlog_put_f32(uint8_t *p, float val)
+{
+    uint32_t u;
+
+    memcpy(&u, &val, sizeof(u));
+    return animlog_put_u32(p, u);
+}
+
+static uint32_t animlog_get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static float animlog_get_f32(const uint8_t *p)
+{
+    uint32_t u = animlog_get_u32(p);
+    float val;
+
+    memcpy(&val, &u, sizeof(val));
+    return val;
+}
+
+static uint8_t *animlog_put_varint(uint8_t *p, uint32_t val)
+{
+    while (val >= 0x80) {
+        *p++ = val | 0x80;
+        val >>= 7;
+    }
+    *p++ = val;
+    return p;
+}
+
+/** Reads a varint, returns NULL if it exceeds end. */
+static const uint8_t *animlog_get_varint(const uint8_t *p, const uint8_t *end, uint32_t *val)
+{
+    unsigned int shift = 0;
+
+    *val = 0;
+    while (p < end && shift < 32) {
+        *val |= (uint32_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+/** Makes room for n more bytes of output, returns the end of the output. */
+static uint8_t *animlog_reserve(struct animlog_job *job, size_t n)
+{
+    size_t size = job->out_size;
+    uint8_t *out;
+
+    if (job->out_len + n <= size) return job->out + job->out_len;
+    while (job->out_len + n > size) size = size ? 2 * size : 4096;
+    out = realloc(job->out, size);
+    if (out == NULL) return NULL;
+    job->out      = out;
+    job->out_size = size;
+    return job->out + job->out_len;
+}
+
+/**
+ * Encodes the dirty rectangle of the job rows [r0,r1), which are
+ * consecutive image rows.
+ *
+ * @return Number of rectangles (0 or 1), -1 if out of memory.
+ */
+static int animlog_encode_band(struct animlog *log, struct animlog_job *job, unsigned int r0, unsigned int r1)
+{
+    unsigned int x, r, x0 = log->width, x1 = 0, y0 = r1, y1 = 0, w, n, i, zeros, literals;
+    const uint16_t *o, *v;
+    uint8_t *p, *rect;
+    int32_t d;
+
+    for (r = r0; r < r1; ++r) {
+        o = job->old_values + (size_t)r * log->width;
+        v = job->new_values + (size_t)r * log->width;
+        for (x = 0; x < log->width; ++x) {
+            if (o[x] == v[x]) continue;
+            if (x < x0) x0 = x;
+            if (x >= x1) x1 = x + 1;
+            if (r < y0) y0 = r;
+            y1 = r + 1;
+        }
+    }
+    if (x0 >= x1) return 0;
+
+    w = x1 - x0;
+    n = 0;
+    for (r = y0; r < y1; ++r) {
+        o = job->old_values + (size_t)r * log->width;
+        v = job->new_values + (size_t)r * log->width;
+        for (x = x0; x < x1; ++x) job->delta[n++] = (int32_t)v[x] - o[x];
+    }
+
+    /* rectangle header, two varints and up to 3 bytes per value */
+    p = animlog_reserve(job, ANIMLOG_RECT_SIZE + 13 * n);
+    if (p == NULL) return -1;
+    rect = p;
+    p += ANIMLOG_RECT_SIZE;
+    for (i = 0; i < n; i += zeros + literals) {
+        for (zeros = 0; i + zeros < n && job->delta[i + zeros] == 0; ++zeros) ;
+        for (literals = 0; i + zeros + literals < n && job->delta[i + zeros + literals] != 0; ++literals) ;
+        p = animlog_put_varint(p, zeros);
+        p = animlog_put_varint(p, literals);
+        for (x = i + zeros; x < i + zeros + literals; ++x) {
+            d = job->delta[x];
+            p = animlog_put_varint(p, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+        }
+    }
+    animlog_put_u32(rect, x0);
+    animlog_put_u32(rect + 4, job->row_index[y0]);
+    animlog_put_u32(rect + 8, w);
+    animlog_put_u32(rect + 12, y1 - y0);
+    animlog_put_u32(rect + 16, p - rect - ANIMLOG_RECT_SIZE);
+    job->out_len = p - job->out;
+
+    return 1;
+}
+
+/** Encodes the frame header and the dirty rectangles of all bands. */
+static int animlog_encode(struct animlog *log, struct animlog_job *job)
+{
+    unsigned int r0, r1, num_rects = 0;
+    uint8_t *p;
+    int ret;
+
+    job->out_len = 0;
+    if (animlog_reserve(job, ANIMLOG_FRAME_SIZE) == NULL) return -1;
+    job->out_len = ANIMLOG_FRAME_SIZE;
+    for (r0 = 0; r0 < job->num_rows; r0 = r1) {
+        for (r1 = r0 + 1; r1 < job->num_rows && r1 - r0 < ANIMLOG_BAND_ROWS &&
+                          job->row_index[r1] == job->row_index[r1 - 1] + 1; ++r1) ;
+        ret = animlog_encode_band(log, job, r0, r1);
+        if (ret < 0) return -1;
+        num_rects += ret;
+    }
+
+    p = animlog_put_u32(job->out, job->info.frame);
+    p = animlog_put_f32(p, job->info.time);
+    p = animlog_put_f32(p, job->info.distance);
+    p = animlog_put_f32(p, job->info.tool_x);
+    p = animlog_put_f32(p, job->info.tool_y);
+    p = animlog_put_f32(p, job->info.tool_z);
+    p = animlog_put_f32(p, job->info.tool_diameter);
+    p = animlog_put_u32(p, job->info.tool);
+    p = animlog_put_u32(p, num_rects);
+    animlog_put_u32(p, job->out_len - ANIMLOG_FRAME_SIZE);
+
+    return 0;
+}
+
+static void animlog_job_free(struct animlog_job *job)
+{
+    free(job->row_index);
+    free(job->old_values);
+    free(job->new_values);
+    free(job->delta);
+    free(job->out);
+    free(job);
+}
+
+/** Encoder thread, frames are encoded in parallel and written in order. */
+static void *animlog_worker(void *arg)
+{
+    struct animlog *log = arg;
+    struct animlog_job *job;
+    int ret;
+
+    pthread_mutex_lock(&log->lock);
+    for (;;) {
+        while (log->num_taken == log->num_frames && !log->shutdown) pthread_cond_wait(&log->cond, &log->lock);
+        if (log->num_taken == log->num_frames) break;
+        job = log->queue[log->num_taken % ANIMLOG_QUEUE_SIZE];
+        log->num_taken++;
+        pthread_mutex_unlock(&log->lock);
+
+        ret = animlog_encode(log, job);
+
+        pthread_mutex_lock(&log->lock);
+        while (log->next_write != job->info.frame) pthread_cond_wait(&log->cond, &log->lock);
+        if (ret != 0 || fwrite(job->out, 1, job->out_len, log->f) != job->out_len) {
+            log->error = 1;
+        } else {
+            log->size += job->out_len;
+        }
+        log->next_write++;
+        pthread_cond_broadcast(&log->cond);
+        animlog_job_free(job);
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    return NULL;
+}
+
+/**
+ * Creates the frame log and starts the encoder threads.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int animlog_init(struct animlog *log, const char *filename, unsigned int width, unsigned int height, unsigned int maxval, float resolution, unsigned int num_threads)
+{
+    uint8_t header[ANIMLOG_HEADER_SIZE], *p;
+    unsigned int i;
+
+    memset(log, 0, sizeof(*log));
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > ANIMLOG_MAX_THREADS) num_threads = ANIMLOG_MAX_THREADS;
+    log->width  = width;
+    log->height = height;
+    log->values = calloc((size_t)width * height, sizeof(*log->values));
+    log->prev   = calloc((size_t)width * height, sizeof(*log->prev));
+    log->rows   = calloc(height, 1);
+    if (log->values == NULL || log->prev == NULL || log->rows == NULL) goto error;
+
+    log->f = fopen(filename, "wb");
+    if (log->f == NULL) goto error;
+    memcpy(header, "GSAF", 4);
+    p = animlog_put_u32(header + 4, ANIMLOG_VERSION);
+    p = animlog_put_u32(p, width);
+    p = animlog_put_u32(p, height);
+    p = animlog_put_u32(p, maxval);
+    animlog_put_f32(p, resolution);
+    if (fwrite(header, 1, sizeof(header), log->f) != sizeof(header)) goto error;
+    log->size = sizeof(header);
+
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->cond, NULL);
+    for (i = 0; i < num_threads; ++i) {
+        if (pthread_create(&log->threads[i], NULL, animlog_worker, log) != 0) break;
+        log->num_threads++;
+    }
+    if (log->num_threads == 0) {
+        pthread_cond_destroy(&log->cond);
+        pthread_mutex_destroy(&log->lock);
+        goto error;
+    }
+
+    return 0;
+
+error:
+    if (log->f) fclose(log->f);
+    free(log->rows);
+    free(log->prev);
+    free(log->values);
+    memset(log, 0, sizeof(*log));
+    return -1;
+}
+
+/**
+ * Adds a frame with the flagged rows of values, the flags are cleared.
+ * Only the changed rows are copied, the frame is encoded and written by
+ * the encoder threads. Waits while ANIMLOG_QUEUE_SIZE frames are pending.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int animlog_add_frame(struct animlog *log, const struct animlog_frame_info *info)
+{
+    struct animlog_job *job;
+    unsigned int y, n = 0;
+    size_t offset;
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL) return -1;
+    for (y = 0; y < log->height; ++y) n += log->rows[y];
+    job->info      = *info;
+    job->num_rows  = n;
+    job->row_index = malloc((n + 1) * sizeof(*job->row_index));
+    job->old_values = malloc(((size_t)n * log->width + 1) * sizeof(*job->old_values));
+    job->new_values = malloc(((size_t)n * log->width + 1) * sizeof(*job->new_values));
+    job->delta     = malloc(((size_t)ANIMLOG_BAND_ROWS * log->width) * sizeof(*job->delta));
+    if (job->row_index == NULL || job->old_values == NULL || job->new_values == NULL || job->delta == NULL) {
+        animlog_job_free(job);
+        return -1;
+    }
+
+    n = 0;
+    for (y = 0; y < log->height; ++y) {
+        if (!log->rows[y]) continue;
+        offset = (size_t)y * log->width;
+        job->row_index[n] = y;
+        memcpy(job->old_values + (size_t)n * log->width, log->prev + offset, log->width * sizeof(*log->prev));
+        memcpy(job->new_values + (size_t)n * log->width, log->values + offset, log->width * sizeof(*log->values));
+        memcpy(log->prev + offset, log->values + offset, log->width * sizeof(*log->prev));
+        log->rows[y] = 0;
+        n++;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    while (log->num_frames - log->next_write >= ANIMLOG_QUEUE_SIZE) pthread_cond_wait(&log->cond, &log->lock);
+    job->info.frame = log->num_frames;
+    log->queue[log->num_frames % ANIMLOG_QUEUE_SIZE] = job;
+    log->num_frames++;
+    pthread_cond_broadcast(&log->cond);
+    pthread_mutex_unlock(&log->lock);
+
+    return 0;
+}
+
+/**
+ * Writes all pending frames, stops the encoder threads and closes the file.
+ *
+ * @return Zero on success, -1 if a frame could not be written.
+ */
+int animlog_close(struct animlog *log)
+{
+    unsigned int i;
+    int ret;
+
+    if (log->f == NULL) return -1;
+
+    pthread_mutex_lock(&log->lock);
+    log->shutdown = 1;
+    pthread_cond_broadcast(&log->cond);
+    pthread_mutex_unlock(&log->lock);
+    for (i = 0; i < log->num_threads; ++i) pthread_join(log->threads[i], NULL);
+    pthread_cond_destroy(&log->cond);
+    pthread_mutex_destroy(&log->lock);
+
+    ret = log->error ? -1 : 0;
+    if (fclose(log->f) != 0) ret = -1;
+    log->f = NULL;
+    free(log->rows);
+    free(log->prev);
+    free(log->values);
+    log->rows   = NULL;
+    log->prev   = NULL;
+    log->values = NULL;
+
+    return ret;
+}
+
+/**
+ * Opens a frame log for reading, the image is black before the first frame.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int animlog_reader_open(struct animlog_reader *reader, const char *filename)
+{
+    uint8_t header[ANIMLOG_HEADER_SIZE];
+
+    memset(reader, 0, sizeof(*reader));
+    reader->f = fopen(filename, "rb");
+    if (reader->f == NULL) return -1;
+    if (fread(header, 1, sizeof(header), reader->f) != sizeof(header) ||
+        memcmp(header, "GSAF", 4) != 0 || animlog_get_u32(header + 4) != ANIMLOG_VERSION) {
+        goto error;
+    }
+    reader->width      = animlog_get_u32(header + 8);
+    reader->height     = animlog_get_u32(header + 12);
+    reader->maxval     = animlog_get_u32(header + 16);
+    reader->resolution = animlog_get_f32(header + 20);
+    reader->values     = calloc((size_t)reader->width * reader->height + 1, sizeof(*reader->values));
+    if (reader->values == NULL) goto error;
+
+    return 0;
+
+error:
+    fclose(reader->f);
+    memset(reader, 0, sizeof(*reader));
+    return -1;
+}
+
+/** Applies the differences of one rectangle to the image. */
+static int animlog_reader_apply(struct animlog_reader *reader, const uint8_t *p, const uint8_t *end,
+                                unsigned int x0, unsigned int y0, unsigned int w, unsigned int h)
+{
+    uint32_t zeros, literals, val;
+    size_t i = 0, n = (size_t)w * h;
+    uint16_t *v;
+
+    if (x0 + w > reader->width || y0 + h > reader->height) return -1;
+    while (i < n) {
+        p = animlog_get_varint(p, end, &zeros);
+        if (p == NULL) return -1;
+        p = animlog_get_varint(p, end, &literals);
+        if (p == NULL || i + zeros + literals > n) return -1;
+        i += zeros;
+        while (literals--) {
+            p = animlog_get_varint(p, end, &val);
+            if (p == NULL) return -1;
+            v  = &reader->values[(size_t)(y0 + i / w) * reader->width + x0 + i % w];
+            *v = *v + (int32_t)((val >> 1) ^ -(val & 1));
+            i++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the next frame and updates the image.
+ *
+ * @return Zero on success, 1 at the end of the log, -1 on error.
+ */
+int animlog_reader_next(struct animlog_reader *reader, struct animlog_frame_info *info)
+{
+    uint8_t header[ANIMLOG_FRAME_SIZE], *buf;
+    const uint8_t *p, *end;
+    unsigned int num_rects, i;
+    uint32_t size;
+
+    if (fread(header, 1, sizeof(header), reader->f) != sizeof(header)) return 1;
+    info->frame         = animlog_get_u32(header);
+    info->time          = animlog_get_f32(header + 4);
+    info->distance      = animlog_get_f32(header + 8);
+    info->tool_x        = animlog_get_f32(header + 12);
+    info->tool_y        = animlog_get_f32(header + 16);
+    info->tool_z        = animlog_get_f32(header + 20);
+    info->tool_diameter = animlog_get_f32(header + 24);
+    info->tool          = animlog_get_u32(header + 28);
+    num_rects           = animlog_get_u32(header + 32);
+    size                = animlog_get_u32(header + 36);
+
+    if (size > reader->buf_size) {
+        buf = realloc(reader->buf, size);
+        if (buf == NULL) return -1;
+        reader->buf      = buf;
+        reader->buf_size = size;
+    }
+    if (fread(reader->buf, 1, size, reader->f) != size) return -1;
+
+    p   = reader->buf;
+    end = reader->buf + size;
+    for (i = 0; i < num_rects; ++i) {
+        if (end - p < ANIMLOG_RECT_SIZE) return -1;
+        size = animlog_get_u32(p + 16);
+        if ((size_t)(end - p - ANIMLOG_RECT_SIZE) < size) return -1;
+        if (animlog_reader_apply(reader, p + ANIMLOG_RECT_SIZE, p + ANIMLOG_RECT_SIZE + size,
+                                 animlog_get_u32(p), animlog_get_u32(p + 4),
+                                 animlog_get_u32(p + 8), animlog_get_u32(p + 12)) != 0) {
+            return -1;
+        }
+        p += ANIMLOG_RECT_SIZE + size;
+    }
+
+    return 0;
+}
+
+void animlog_reader_close(struct animlog_reader *reader)
+{
+    if (reader->f) fclose(reader->f);
+    free(reader->values);
+    free(reader->buf);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,102 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ANIMLOG_H_J4TW9NQE
+#define ANIMLOG_H_J4TW9NQE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Animation frame log.
+ * The file starts with a header of 24 bytes: "GSAF", the format version,
+ * width, height and maximum gray value of the frames and the voxel size
+ * in mm. Each frame is a header of 40 bytes (animlog_frame_info, number of
+ * rectangles, payload size) and the dirty rectangles of the height image
+ * since the previous frame: x, y, width, height, size and the gray value
+ * differences in row order. The differences are coded as runs of
+ * unchanged values and runs of zigzag coded differences, all counts and
+ * values as LEB128 varints. Numbers are little endian, floats IEEE 754.
+ * The first frame contains the complete image.
+ */
+#define ANIMLOG_VERSION 1
+/** Maximum number of image rows of one dirty rectangle. */
+#define ANIMLOG_BAND_ROWS 16
+/** Maximum number of frames being queued or encoded. */
+#define ANIMLOG_QUEUE_SIZE 16
+/** Maximum number of encoder threads. */
+#define ANIMLOG_MAX_THREADS 16
+
+/** Frame information besides the image. */
+struct animlog_frame_info {
+    unsigned int frame;
+    float time;                   /**< machine time in s */
+    float distance;               /**< length of the tool path in mm */
+    float tool_x, tool_y, tool_z; /**< tool center and lowest layer in voxels */
+    float tool_diameter;          /**< mm */
+    unsigned int tool;            /**< tool number */
+};
+
+struct animlog_job;
+
+/**
+ * Writer of a frame log. The caller stores the gray values of the changed
+ * rows of a frame in values and flags them in rows. The frames are encoded
+ * by a pool of threads and written in order.
+ */
+struct animlog {
+    FILE *f;
+    unsigned int width;
+    unsigned int height;
+    uint16_t *values;        /**< gray values of the next frame, row 0 is the top row */
+    unsigned char *rows;     /**< rows changed since the last frame */
+    uint16_t *prev;          /**< gray values of the last frame */
+    unsigned int num_frames; /**< number of added frames */
+    uint64_t size;           /**< bytes written */
+    int error;
+    pthread_t threads[ANIMLOG_MAX_THREADS];
+    unsigned int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct animlog_job *queue[ANIMLOG_QUEUE_SIZE]; /**< frame n is in slot n % ANIMLOG_QUEUE_SIZE */
+    unsigned int num_taken;   /**< frames taken by a thread */
+    unsigned int next_write;  /**< frame which is written next */
+    int shutdown;
+};
+
+/** Reader of a frame log. */
+struct animlog_reader {
+    FILE *f;
+    unsigned int width;
+    unsigned int height;
+    unsigned int maxval;
+    float resolution;  /**< voxel size in mm */
+    uint16_t *values;  /**< gray values of the last frame, row 0 is the top row */
+    uint8_t *buf;
+    size_t buf_size;
+};
+
+int animlog_init(struct animlog *log, const char *filename, unsigned int width, unsigned int height, unsigned int maxval, float resolution, unsigned int num_threads);
+int animlog_add_frame(struct animlog *log, const struct animlog_frame_info *info);
+int animlog_close(struct animlog *log);
+
+int animlog_reader_open(struct animlog_reader *reader, const char *filename);
+int animlog_reader_next(struct animlog_reader *reader, struct animlog_frame_info *info);
+void animlog_reader_close(struct animlog_reader *reader);
+
+#endif /* end of include guard: ANIMLOG_H_J4TW9NQE */
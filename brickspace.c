@@ -0,0 +1,229 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "brickspace.h"
+#include <string.h>
+#include <stdio.h>
+
+/* Shared uniform bricks, never written. Allocated border bricks have the
+ * voxels outside of the space cleared, so they become empty like all others.
+ */
+static struct brick g_brick_empty = { { 0 } };
+static struct brick g_brick_solid = { {
+    UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX,
+    UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX
+} };
+
+#define BRICK_EMPTY (&g_brick_empty)
+#define BRICK_SOLID (&g_brick_solid)
+
+static void brick_space_free(struct brick_space *space, struct brick **brick, struct brick *value)
+{
+    if (*brick != BRICK_EMPTY && *brick != BRICK_SOLID) {
+        free(*brick);
+        __atomic_fetch_sub(&space->size, sizeof(struct brick), __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&space->num_mixed, 1, __ATOMIC_RELAXED);
+    }
+    *brick = value;
+}
+
+/** Sets all bricks to the given uniform brick. */
+static void brick_space_fill(struct brick_space *space, struct brick *value)
+{
+    size_t i, n = space->bw * space->bh * space->bt;
+
+    for (i = 0; i < n; ++i) {
+        brick_space_free(space, &space->bricks[i], value);
+    }
+}
+
+int brick_space_init(struct brick_space *space, size_t w, size_t h, size_t t)
+{
+    size_t i, n;
+
+    space->width     = w;
+    space->height    = h;
+    space->thickness = t;
+    space->bw        = (w + BRICK_SIZE - 1) / BRICK_SIZE;
+    space->bh        = (h + BRICK_SIZE - 1) / BRICK_SIZE;
+    space->bt        = (t + BRICK_SIZE - 1) / BRICK_SIZE;
+    space->num_mixed = 0;
+    n = space->bw * space->bh * space->bt;
+    space->size      = n * sizeof(*space->bricks);
+    space->bricks    = malloc(n * sizeof(*space->bricks));
+    if (space->bricks == NULL) return -1;
+    for (i = 0; i < n; ++i) {
+        space->bricks[i] = BRICK_EMPTY;
+    }
+    return 0;
+}
+
+void brick_space_clear(struct brick_space *space)
+{
+    if (space->bricks) {
+        brick_space_fill(space, BRICK_EMPTY);
+        free(space->bricks);
+    }
+    memset(space, 0, sizeof(*space));
+}
+
+void brick_space_set_all(struct brick_space *space)
+{
+    brick_space_fill(space, BRICK_SOLID);
+}
+
+void brick_space_clr_all(struct brick_space *space)
+{
+    brick_space_fill(space, BRICK_EMPTY);
+}
+
+/**
+ * Clears the voxels of a new brick which lie outside of the space.
+ * x, y and z are the coordinates of any voxel of the brick.
+ */
+static void brick_space_mask_edges(struct brick_space *space, struct brick *brick, int x, int y, int z)
+{
+    int bx = x - x % BRICK_SIZE, by = y - y % BRICK_SIZE, bz = z - z % BRICK_SIZE;
+    int nx = space->width - bx, ny = space->height - by, nz = space->thickness - bz;
+    uint64_t row, mask = 0;
+    int i;
+
+    if (nx >= BRICK_SIZE && ny >= BRICK_SIZE && nz >= BRICK_SIZE) return;
+    if (nx > BRICK_SIZE) nx = BRICK_SIZE;
+    if (ny > BRICK_SIZE) ny = BRICK_SIZE;
+    row = (UINT64_C(1) << nx) - 1;
+    for (i = 0; i < ny; ++i) mask |= row << (i * BRICK_SIZE);
+    for (i = 0; i < BRICK_SIZE; ++i) {
+        brick->layer[i] = (i < nz) ? brick->layer[i] & mask : 0;
+    }
+}
+
+/** Returns the bottom brick of the brick column containing x/y. */
+static struct brick **brick_space_column(struct brick_space *space, int x, int y)
+{
+    if (x < 0 || x >= space->width) return NULL;
+    if (y < 0 || y >= space->height) return NULL;
+
+    x /= BRICK_SIZE;
+    y /= BRICK_SIZE;
+    return &space->bricks[(y * space->bw + x) * space->bt];
+}
+
+/**
+ * Gets voxel status at given position.
+ *
+ * @return 1 if voxel is set, 0 if it is not set, -1 if the pos is out of range.
+ */
+int brick_space_get_xyz(struct brick_space *space, int x, int y, int z)
+{
+    struct brick **column = brick_space_column(space, x, y);
+    struct brick *brick;
+    unsigned int bit;
+
+    if (column == NULL || z < 0 || z >= space->thickness) return -1;
+
+    brick = column[z / BRICK_SIZE];
+    bit = (y % BRICK_SIZE) * BRICK_SIZE + x % BRICK_SIZE;
+    return (brick->layer[z % BRICK_SIZE] >> bit) & 1;
+}
+
+/**
+ * Gets the height of the topmost material in a column.
+ * Empty bricks are skipped without looking at their layers.
+ *
+ * @return Index of the topmost solid layer plus one, 0 if the column is empty,
+ * -1 if the column is out of range.
+ */
+int brick_space_get_top(struct brick_space *space, int x, int y)
+{
+    struct brick **column = brick_space_column(space, x, y);
+    struct brick *brick;
+    uint64_t mask;
+    int bz, z, z1;
+
+    if (column == NULL) return -1;
+
+    mask = UINT64_C(1) << ((y % BRICK_SIZE) * BRICK_SIZE + x % BRICK_SIZE);
+    for (bz = space->bt - 1; bz >= 0; --bz) {
+        brick = column[bz];
+        if (brick == BRICK_EMPTY) continue;
+        z1 = bz * BRICK_SIZE + BRICK_SIZE;
+        if (z1 > (int)space->thickness) z1 = space->thickness;
+        if (brick == BRICK_SOLID) return z1;
+        for (z = z1 - 1; z >= bz * BRICK_SIZE; --z) {
+            if (brick->layer[z % BRICK_SIZE] & mask) return z + 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Clears a range of voxels in one XY column.
+ * Solid bricks are copied before they are modified, and bricks which
+ * become empty are released again.
+ *
+ * @param space The brick space.
+ * @param x X coordinate of the column.
+ * @param y Y coordinate of the column.
+ * @param z0 First voxel to clear.
+ * @param z1 End of range (exclusive).
+ *
+ * @return Zero on success, -1 if the column is out of range or out of memory.
+ */
+int brick_space_clr_column(struct brick_space *space, int x, int y, int z0, int z1)
+{
+    struct brick **column = brick_space_column(space, x, y);
+    struct brick *brick;
+    uint64_t mask, any;
+    int bz, z, end;
+
+    if (column == NULL) return -1;
+    if (z0 < 0) z0 = 0;
+    if (z1 > (int)space->thickness) z1 = space->thickness;
+    if (z0 >= z1) return 0;
+
+    mask = UINT64_C(1) << ((y % BRICK_SIZE) * BRICK_SIZE + x % BRICK_SIZE);
+    for (bz = z0 / BRICK_SIZE; bz * BRICK_SIZE < z1; ++bz) {
+        brick = column[bz];
+        if (brick == BRICK_EMPTY) continue;
+        if (brick == BRICK_SOLID) {
+            brick = malloc(sizeof(*brick));
+            if (brick == NULL) return -1;
+            *brick = g_brick_solid;
+            brick_space_mask_edges(space, brick, x, y, bz * BRICK_SIZE);
+            column[bz] = brick;
+            __atomic_fetch_add(&space->size, sizeof(*brick), __ATOMIC_RELAXED);
+            __atomic_fetch_add(&space->num_mixed, 1, __ATOMIC_RELAXED);
+        }
+
+        z = bz * BRICK_SIZE;
+        if (z < z0) z = z0;
+        end = bz * BRICK_SIZE + BRICK_SIZE;
+        if (end > z1) end = z1;
+        for (; z < end; ++z) {
+            brick->layer[z % BRICK_SIZE] &= ~mask;
+        }
+
+        for (z = 0, any = 0; z < BRICK_SIZE; ++z) {
+            any |= brick->layer[z];
+        }
+        if (any == 0) brick_space_free(space, &column[bz], BRICK_EMPTY);
+    }
+
+    return 0;
+}
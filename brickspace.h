@@ -0,0 +1,62 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BRICKSPACE_H_K4WT9XQE
+#define BRICKSPACE_H_K4WT9XQE
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Edge length of a brick in voxels. */
+#define BRICK_SIZE 8
+
+/**
+ * 8x8x8 voxels, one 64 bit word per layer.
+ * Bit (y*8+x) of layer z is the voxel x/y/z inside the brick.
+ */
+struct brick {
+    uint64_t layer[BRICK_SIZE];
+};
+
+/**
+ * Sparse voxel space made of bricks.
+ * Uniform bricks point to the shared empty or solid brick and need no
+ * memory, only mixed bricks are allocated. The bricks of one XY brick
+ * column are stored consecutively, bottom to top. Different brick columns
+ * may be modified concurrently, the counters are updated atomically.
+ */
+struct brick_space {
+    size_t width;
+    size_t height;
+    size_t thickness;
+    size_t bw, bh, bt;      /**< number of bricks in X, Y, Z */
+    size_t size;            /**< size in bytes, including allocated bricks */
+    size_t num_mixed;       /**< number of allocated bricks */
+    struct brick **bricks;
+};
+
+int brick_space_init(struct brick_space *space, size_t w, size_t h, size_t t);
+void brick_space_clear(struct brick_space *space);
+
+void brick_space_set_all(struct brick_space *space);
+void brick_space_clr_all(struct brick_space *space);
+int brick_space_get_xyz(struct brick_space *space, int x, int y, int z);
+int brick_space_get_top(struct brick_space *space, int x, int y);
+int brick_space_clr_column(struct brick_space *space, int x, int y, int z0, int z1);
+
+
+#endif /* end of include guard: BRICKSPACE_H_K4WT9XQE */
@@ -0,0 +1,171 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "dda.h"
+#include <stdlib.h>
+#include <math.h>
+
+/** Maximum distance of an arc's chords from the real arc in voxels. */
+#define DDA_ARC_TOLERANCE 0.5
+
+void dda_init(struct dda *dda, dda_cb cb, void *arg)
+{
+    dda->cb          = cb;
+    dda->arg         = arg;
+    dda->has_last    = 0;
+    dda->num_emitted = 0;
+}
+
+/**
+ * Forgets the last position, so the next one is emitted in any case.
+ * This is required after a tool change.
+ */
+void dda_reset(struct dda *dda)
+{
+    dda->has_last = 0;
+}
+
+static void dda_emit(struct dda *dda, const struct voxel_pos *pos)
+{
+    if (dda->has_last && dda->last.x == pos->x && dda->last.y == pos->y && dda->last.z == pos->z) return;
+
+    dda->last     = *pos;
+    dda->has_last = 1;
+    dda->num_emitted++;
+    dda->cb(dda->arg, pos);
+}
+
+/** Converts a position in voxel units to the voxel containing it. */
+static void dda_voxel(struct voxel_pos *res, const struct gvector *v)
+{
+    res->x = floorf(v->x);
+    res->y = floorf(v->y);
+    res->z = floorf(v->z);
+}
+
+static int dda_sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+/**
+ * Walks the voxels from a to b using the 3D Bresenham algorithm. Each step
+ * advances the dominant axis by one voxel, so the path is 26-connected and
+ * visits every voxel exactly once.
+ */
+static void dda_walk(struct dda *dda, const struct voxel_pos *a, const struct voxel_pos *b)
+{
+    struct voxel_pos p = *a;
+    int dx = abs(b->x - a->x), dy = abs(b->y - a->y), dz = abs(b->z - a->z);
+    int sx = dda_sign(b->x - a->x), sy = dda_sign(b->y - a->y), sz = dda_sign(b->z - a->z);
+    int n = dx, ex, ey, ez, i;
+
+    if (dy > n) n = dy;
+    if (dz > n) n = dz;
+    ex = ey = ez = n / 2;
+
+    dda_emit(dda, &p);
+    for (i = 0; i < n; ++i) {
+        ex -= dx;
+        if (ex < 0) {
+            ex += n;
+            p.x += sx;
+        }
+        ey -= dy;
+        if (ey < 0) {
+            ey += n;
+            p.y += sy;
+        }
+        ez -= dz;
+        if (ez < 0) {
+            ez += n;
+            p.z += sz;
+        }
+        dda_emit(dda, &p);
+    }
+}
+
+/**
+ * Rasterizes a linear move.
+ *
+ * @param dda The rasterizer.
+ * @param start Start position in voxel units.
+ * @param end End position in voxel units.
+ */
+void dda_line(struct dda *dda, struct gvector *start, struct gvector *end)
+{
+    struct voxel_pos a, b;
+
+    dda_voxel(&a, start);
+    dda_voxel(&b, end);
+    dda_walk(dda, &a, &b);
+}
+
+/**
+ * Rasterizes an arc move (helix if Z changes). The arc is split into
+ * chords which deviate less than DDA_ARC_TOLERANCE voxels from the arc,
+ * each chord is rasterized like a line. If start and end are identical
+ * this is a full circle.
+ *
+ * @param dda The rasterizer.
+ * @param start Start position in voxel units.
+ * @param end End position in voxel units.
+ * @param center Absolute center in voxel units.
+ * @param mode ARC_CW or ARC_CCW.
+ */
+void dda_arc(struct dda *dda, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode)
+{
+    struct voxel_pos a, b;
+    struct gvector p;
+    double r_start, r_end, s_alpha, e_alpha, d_alpha, max_step, alpha, r, t;
+    unsigned int i, num_segments;
+
+    r_start = hypot(start->x - center->x, start->y - center->y);
+    r_end   = hypot(end->x - center->x, end->y - center->y);
+    if (r_start < 1) {
+        /* arc is smaller than one voxel */
+        dda_line(dda, start, end);
+        return;
+    }
+
+    s_alpha = atan2(start->y - center->y, start->x - center->x);
+    e_alpha = atan2(end->y - center->y, end->x - center->x);
+    d_alpha = (mode == ARC_CW) ? s_alpha - e_alpha : e_alpha - s_alpha;
+    if (d_alpha <= 0) d_alpha += 2 * M_PI;
+
+    /* chord angle with a sagitta of DDA_ARC_TOLERANCE */
+    max_step = 2 * acos(1 - DDA_ARC_TOLERANCE / fmax(r_start, r_end));
+    num_segments = ceil(d_alpha / max_step);
+    if (num_segments == 0) num_segments = 1;
+
+    dda_voxel(&a, start);
+    for (i = 1; i <= num_segments; ++i) {
+        if (i == num_segments) {
+            p = *end;
+        } else {
+            t     = (double)i / num_segments;
+            alpha = s_alpha + ((mode == ARC_CW) ? -d_alpha : d_alpha) * t;
+            r     = r_start + (r_end - r_start) * t;
+            p.x   = center->x + r * cos(alpha);
+            p.y   = center->y + r * sin(alpha);
+            p.z   = start->z + (end->z - start->z) * t;
+        }
+        dda_voxel(&b, &p);
+        dda_walk(dda, &a, &b);
+        a = b;
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DDA_H_F2KX7MUE
+#define DDA_H_F2KX7MUE
+
+#include "voxelspace.h"
+#include "gcode.h"
+
+/** Gets called once for each voxel visited by the path. */
+typedef void (*dda_cb)(void *arg, const struct voxel_pos *pos);
+
+/**
+ * Rasterizes a tool path in voxel units.
+ * Consecutive moves share their end points, so a position is only
+ * emitted if it differs from the last one.
+ */
+struct dda {
+    dda_cb cb;
+    void *arg;
+    struct voxel_pos last; /**< last emitted position */
+    int has_last;
+    unsigned long num_emitted;
+};
+
+void dda_init(struct dda *dda, dda_cb cb, void *arg);
+void dda_reset(struct dda *dda);
+void dda_line(struct dda *dda, struct gvector *start, struct gvector *end);
+void dda_arc(struct dda *dda, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode);
+
+#endif /* end of include guard: DDA_H_F2KX7MUE */
@@ -0,0 +1,211 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "dexel.h"
+#include <string.h>
+#include <stdio.h>
+
+static struct dexel_interval *dexel_column_data(struct dexel_column *col)
+{
+    return col->capacity ? col->u.list : col->u.local;
+}
+
+/** Frees the allocated interval list of a column. */
+static void dexel_column_free(struct dexel_space *space, struct dexel_column *col)
+{
+    if (col->capacity) {
+        free(col->u.list);
+        __atomic_fetch_sub(&space->size, col->capacity * sizeof(struct dexel_interval), __ATOMIC_RELAXED);
+    }
+    col->capacity = 0;
+    col->count    = 0;
+}
+
+/**
+ * Makes sure the column can hold \c count intervals.
+ *
+ * @return Zero on success, -1 if out of memory.
+ */
+static int dexel_column_reserve(struct dexel_space *space, struct dexel_column *col, unsigned int count)
+{
+    struct dexel_interval *list;
+    unsigned int capacity;
+
+    if (count <= DEXEL_LOCAL && col->capacity == 0) return 0;
+    if (count <= col->capacity) return 0;
+
+    capacity = col->capacity ? col->capacity * 2 : DEXEL_LOCAL * 2;
+    while (capacity < count) capacity *= 2;
+    if (capacity > UINT16_MAX) return -1;
+
+    list = malloc(capacity * sizeof(*list));
+    if (list == NULL) return -1;
+    memcpy(list, dexel_column_data(col), col->count * sizeof(*list));
+    if (col->capacity) {
+        free(col->u.list);
+        __atomic_fetch_sub(&space->size, col->capacity * sizeof(*list), __ATOMIC_RELAXED);
+    }
+    col->u.list   = list;
+    col->capacity = capacity;
+    __atomic_fetch_add(&space->size, capacity * sizeof(*list), __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+int dexel_space_init(struct dexel_space *space, size_t w, size_t h, size_t t)
+{
+    if (t > UINT16_MAX) return -1;
+
+    space->width     = w;
+    space->height    = h;
+    space->thickness = t;
+    space->size      = w * h * sizeof(*space->columns);
+    space->columns   = calloc(w * h, sizeof(*space->columns));
+    if (space->columns == NULL) return -1;
+    return 0;
+}
+
+void dexel_space_clear(struct dexel_space *space)
+{
+    if (space->columns) {
+        dexel_space_clr_all(space);
+        free(space->columns);
+    }
+    memset(space, 0, sizeof(*space));
+}
+
+void dexel_space_set_all(struct dexel_space *space)
+{
+    size_t i, n = space->width * space->height;
+    struct dexel_column *col;
+
+    for (i = 0; i < n; ++i) {
+        col = &space->columns[i];
+        dexel_column_free(space, col);
+        col->count = 1;
+        col->u.local[0].bottom = 0;
+        col->u.local[0].top    = space->thickness;
+    }
+}
+
+void dexel_space_clr_all(struct dexel_space *space)
+{
+    size_t i, n = space->width * space->height;
+
+    for (i = 0; i < n; ++i) {
+        dexel_column_free(space, &space->columns[i]);
+    }
+}
+
+static struct dexel_column *dexel_space_column(struct dexel_space *space, int x, int y)
+{
+    if (x < 0 || x >= space->width) return NULL;
+    if (y < 0 || y >= space->height) return NULL;
+
+    return &space->columns[y * space->width + x];
+}
+
+/**
+ * Gets voxel status at given position.
+ *
+ * @return 1 if voxel is set, 0 if it is not set, -1 if the pos is out of range.
+ */
+int dexel_space_get_xyz(struct dexel_space *space, int x, int y, int z)
+{
+    struct dexel_column *col = dexel_space_column(space, x, y);
+    struct dexel_interval *iv;
+    unsigned int i;
+
+    if (col == NULL || z < 0 || z >= space->thickness) return -1;
+
+    iv = dexel_column_data(col);
+    for (i = 0; i < col->count; ++i) {
+        if (z < iv[i].bottom) break;
+        if (z < iv[i].top) return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Gets the height of the topmost material in a column.
+ *
+ * @return Index of the topmost solid layer plus one, 0 if the column is empty,
+ * -1 if the column is out of range.
+ */
+int dexel_space_get_top(struct dexel_space *space, int x, int y)
+{
+    struct dexel_column *col = dexel_space_column(space, x, y);
+
+    if (col == NULL) return -1;
+    if (col->count == 0) return 0;
+
+    return dexel_column_data(col)[col->count - 1].top;
+}
+
+/**
+ * Clears a range of voxels in one XY column by clipping its intervals.
+ *
+ * @param space The dexel space.
+ * @param x X coordinate of the column.
+ * @param y Y coordinate of the column.
+ * @param z0 First voxel to clear.
+ * @param z1 End of range (exclusive).
+ *
+ * @return Zero on success, -1 if the column is out of range or out of memory.
+ */
+int dexel_space_clr_column(struct dexel_space *space, int x, int y, int z0, int z1)
+{
+    struct dexel_column *col = dexel_space_column(space, x, y);
+    struct dexel_interval *iv, pieces[2];
+    unsigned int i, j, n, num_pieces = 0, count;
+
+    if (col == NULL) return -1;
+    if (z0 < 0) z0 = 0;
+    if (z1 > (int)space->thickness) z1 = space->thickness;
+    if (z0 >= z1) return 0;
+
+    iv = dexel_column_data(col);
+    /* find the intervals [i,j) overlapping [z0,z1) */
+    for (i = 0; i < col->count && iv[i].top <= z0; ++i);
+    for (j = i; j < col->count && iv[j].bottom < z1; ++j);
+    if (i == j) return 0; /* nothing to clear */
+
+    /* the remains of the first and last overlapping interval */
+    if (iv[i].bottom < z0) {
+        pieces[num_pieces].bottom = iv[i].bottom;
+        pieces[num_pieces].top    = z0;
+        num_pieces++;
+    }
+    if (iv[j - 1].top > z1) {
+        pieces[num_pieces].bottom = z1;
+        pieces[num_pieces].top    = iv[j - 1].top;
+        num_pieces++;
+    }
+
+    n = j - i;
+    count = col->count - n + num_pieces;
+    if (count > col->count) {
+        if (dexel_column_reserve(space, col, count) != 0) return -1;
+        iv = dexel_column_data(col);
+    }
+    memmove(&iv[i + num_pieces], &iv[j], (col->count - j) * sizeof(*iv));
+    memcpy(&iv[i], pieces, num_pieces * sizeof(*iv));
+    col->count = count;
+
+    return 0;
+}
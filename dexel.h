@@ -0,0 +1,68 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DEXEL_H_7RNEC1PA
+#define DEXEL_H_7RNEC1PA
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Number of intervals stored inside the column without allocation. */
+#define DEXEL_LOCAL 2
+
+/** Solid material in the layers [bottom,top). */
+struct dexel_interval {
+    uint16_t bottom;
+    uint16_t top;
+};
+
+/**
+ * One XY column: a sorted list of disjoint solid intervals.
+ * Short lists are stored inline, longer ones are allocated.
+ */
+struct dexel_column {
+    uint16_t count;
+    uint16_t capacity; /**< capacity of list, 0 if the local storage is used */
+    union {
+        struct dexel_interval local[DEXEL_LOCAL];
+        struct dexel_interval *list;
+    } u;
+};
+
+/**
+ * Dexel workpart: exact like a voxel space, but memory is proportional to
+ * the number of material boundaries per column instead of the thickness.
+ */
+struct dexel_space {
+    size_t width;
+    size_t height;
+    size_t thickness;
+    size_t size; /**< size in bytes, including allocated interval lists, updated atomically */
+    struct dexel_column *columns;
+};
+
+int dexel_space_init(struct dexel_space *space, size_t w, size_t h, size_t t);
+void dexel_space_clear(struct dexel_space *space);
+
+void dexel_space_set_all(struct dexel_space *space);
+void dexel_space_clr_all(struct dexel_space *space);
+int dexel_space_get_xyz(struct dexel_space *space, int x, int y, int z);
+int dexel_space_get_top(struct dexel_space *space, int x, int y);
+int dexel_space_clr_column(struct dexel_space *space, int x, int y, int z0, int z1);
+
+
+#endif /* end of include guard: DEXEL_H_7RNEC1PA */
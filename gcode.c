@@ -16,29 +16,31 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "gcode.h"
+#include "mapfile.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
 #include <math.h>
 
 #define sqr(x) (x)*(x)
+/** Number of incremental rotations between two re-normalizations. */
+#define GCODE_ARC_NORMALIZE 32
 
 static FILE *g_output = NULL;
 static const char *g_ofilename = NULL;
 static float g_offset_x, g_offset_y, g_offset_z;
 static int   g_verbose = 0;
 static int   g_header_written = 0;
+static float g_step_len = 0.05;       /* mm, distance of interpolated points */
+static float g_arc_tolerance = 0.005; /* mm, maximum chord error of arcs */
+static float g_arc_spacing = 0;       /* mm, maximum distance of arc points, 0 for none */
 extern volatile int g_terminate;
 
 /* Write custom header after G90 has been detected. */
 static char g_custom_header[4096] = "";
 
-enum gcode_arc_mode {
-    ARC_NONE = 0,
-    ARC_CW,
-    ARC_CCW
-};
-
 /**
  * Verbose output.
  *
@@ -93,6 +95,32 @@ float gvector_len(struct gvector *v)
     return len;
 }
 
+/**
+ * Length of the tool path of a move in mm. Arcs are measured along the
+ * mean radius, a helix includes its Z travel.
+ */
+float gcode_move_length(const struct gcode_move *move)
+{
+    double r, s_alpha, e_alpha, d_alpha;
+    struct gvector diff;
+
+    if (move->mode == ARC_NONE) {
+        diff.x = move->end.x - move->start.x;
+        diff.y = move->end.y - move->start.y;
+        diff.z = move->end.z - move->start.z;
+        return gvector_len(&diff);
+    }
+
+    r = (hypot(move->start.x - move->center.x, move->start.y - move->center.y) +
+         hypot(move->end.x - move->center.x, move->end.y - move->center.y)) / 2;
+    s_alpha = atan2(move->start.y - move->center.y, move->start.x - move->center.x);
+    e_alpha = atan2(move->end.y - move->center.y, move->end.x - move->center.x);
+    d_alpha = (move->mode == ARC_CW) ? s_alpha - e_alpha : e_alpha - s_alpha;
+    if (d_alpha <= 0) d_alpha += 2*M_PI;
+
+    return hypot(d_alpha * r, move->end.z - move->start.z);
+}
+
 void gcode_ctx_init(struct gcode_ctx *ctx)
 {
     memset(ctx, 0, sizeof(*ctx));
@@ -106,16 +134,42 @@ static void gcode_send_pos_cb(struct gcode_ctx *ctx)
     if (ctx->newpos_cb) ctx->newpos_cb(ctx);
 }
 
+/**
+ * Passes the complete move to the move callback.
+ *
+ * @return Zero if the callback has handled the move, non-zero if it must be
+ * interpolated.
+ */
+static int gcode_send_move_cb(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    if (ctx->move_cb == NULL) return 1;
+
+    verbose(3, "%s: X%.2f, Y%.2f, Z%.2f\n", __func__, move->end.x, move->end.y, move->end.z);
+
+    if (ctx->move_cb(ctx, move) != 0) return 1;
+    ctx->pos = move->end;
+
+    return 0;
+}
+
 int gcode_linear_move(struct gcode_ctx *ctx, struct gvector *newpos)
 {
     int ret = 0;
     struct gvector diff, step;
-    float len, step_len = 0.05;
+    struct gcode_move move;
+    float len, step_len = g_step_len;
     unsigned int i, num_steps;
 
     gvector_sub(&diff, newpos, &ctx->pos);
     len = gvector_len(&diff);
     if (len == 0) return 0;
+
+    memset(&move, 0, sizeof(move));
+    move.mode  = ARC_NONE;
+    move.start = ctx->pos;
+    move.end   = *newpos;
+    if (gcode_send_move_cb(ctx, &move) == 0) return 0;
+
     step = diff;
     gvector_mul(&step, step_len / len);
 
@@ -135,69 +189,120 @@ int gcode_linear_move(struct gcode_ctx *ctx, struct gvector *newpos)
     return ret;
 }
 
-int gcode_arc_move(struct gcode_ctx *ctx, struct gvector *endpos, struct gvector *center, enum gcode_arc_mode mode)
+/**
+ * Arc move with absolute center.
+ * The number of points is chosen so that the chords deviate at most
+ * g_arc_tolerance from the arc, and if set that the points are at most
+ * g_arc_spacing apart. The points are generated by rotating the
+ * radius vector incrementally, which needs no sin/cos per point. The
+ * vector is re-normalized periodically to avoid drift. The radius is
+ * interpolated from start to end radius, Z from start to end Z (helix).
+ */
+static int gcode_arc_move_abs(struct gcode_ctx *ctx, struct gvector *endpos, struct gvector *center, enum gcode_arc_mode mode)
 {
-    int ret = 0;
-    struct gvector startpos = ctx->pos, v;
-    float radius = gvector_len(center);
-    float len = radius * 2 * M_PI;
-    float step_len = 0.05;
-    float s_alpha, e_alpha, d_alpha; /* start and end angles */
-    float alpha;
-    float dx, dy;
-    unsigned int i, num_steps;
-
-    verbose(2, "start pos =%.04f/%.04f/%.04f\n", startpos.x, startpos.y, startpos.z);
-    verbose(2, "end pos   =%.04f/%.04f/%.04f\n", endpos->x, endpos->y, endpos->z);
-
-    /* compute absolute center */
-    gvector_add(center, center, &startpos);
-    verbose(2, "center    =%.04f/%.04f/%.04f\n", center->x, center->y, center->z);
-
-    /* compute number of steps (for full circle) */
-    num_steps = len / step_len;
-    verbose(2, "num_steps=%u\n", num_steps);
-
-    /* compute start angle */
-    dx = startpos.x - center->x;
-    dy = startpos.y - center->y;
-    s_alpha = atan2(dy, dx);
-    verbose(3, "start: dx=%f, dy=%f, alpha=%f (%f°)\n", dx, dy, s_alpha, RAD2DEG(s_alpha));
-    /* compute end angle */
-    dx = endpos->x - center->x;
-    dy = endpos->y - center->y;
-    e_alpha = atan2(dy, dx);
-    verbose(3, "end: dx=%f, dy=%f, alpha=%f (%f°)\n", dx, dy, e_alpha, RAD2DEG(e_alpha));
-    /* compute steps angle: not atan2 returns a range from -PI:PI */
+    struct gvector startpos = ctx->pos;
+    struct gcode_move move;
+    double r_start, r_end, r, max_r, len;
+    double s_alpha, e_alpha, d_alpha; /* start and end angles */
+    double step_alpha, c, s, vx, vy, tx, t;
+    unsigned int i, num_steps, tol_steps;
+
+    move.mode   = mode;
+    move.start  = startpos;
+    move.end    = *endpos;
+    move.center = *center;
+    if (gcode_send_move_cb(ctx, &move) == 0) return 0;
+
+    r_start = hypot(startpos.x - center->x, startpos.y - center->y);
+    r_end   = hypot(endpos->x - center->x, endpos->y - center->y);
+    max_r   = fmax(r_start, r_end);
+
+    /* compute start and end angle */
+    s_alpha = atan2(startpos.y - center->y, startpos.x - center->x);
+    e_alpha = atan2(endpos->y - center->y, endpos->x - center->x);
+    verbose(3, "start: alpha=%f (%f°), end: alpha=%f (%f°)\n",
+            s_alpha, RAD2DEG(s_alpha), e_alpha, RAD2DEG(e_alpha));
+    /* compute angle of the arc: note atan2 returns a range from -PI:PI */
     if (mode == ARC_CW) {
         d_alpha = (s_alpha - e_alpha);
     } else {
         d_alpha = (e_alpha - s_alpha);
     }
+    /* same start and end point is a full circle */
+    if (d_alpha <= 0) d_alpha += 2*M_PI;
     verbose(3, "d_alpha=%f (%f°)\n", d_alpha, RAD2DEG(d_alpha));
-    if (d_alpha < 0) {
-        d_alpha += 2*M_PI;
-        verbose(3, "d_alpha(corrected)=%f (%f°)\n", d_alpha, RAD2DEG(d_alpha));
+
+    /* number of steps for the chord tolerance and for the point spacing */
+    num_steps = 1;
+    if (max_r > g_arc_tolerance) {
+        tol_steps = ceil(d_alpha / (2 * acos(1 - g_arc_tolerance / max_r)));
+        if (tol_steps > num_steps) num_steps = tol_steps;
     }
-    /* correct number of steps from 360° to alpha */
-    num_steps = num_steps * RAD2DEG(d_alpha) / 360;
-    /* compute step angle */
-    d_alpha /= num_steps;
-    if (mode == ARC_CW) d_alpha = -d_alpha;
+    len = d_alpha * max_r;
+    if (g_arc_spacing > 0 && len / g_arc_spacing > num_steps) num_steps = ceil(len / g_arc_spacing);
+    verbose(2, "num_steps=%u\n", num_steps);
+
+    /* rotation per step */
+    step_alpha = d_alpha / num_steps;
+    if (mode == ARC_CW) step_alpha = -step_alpha;
+    c = cos(step_alpha);
+    s = sin(step_alpha);
 
-    alpha = s_alpha;
+    /* unit vector from center to the current point */
+    vx = cos(s_alpha);
+    vy = sin(s_alpha);
     for (i = 1; i < num_steps; ++i) {
-        alpha += d_alpha;
-        v.x = radius * cos(alpha);
-        v.y = radius * sin(alpha);
-        v.z = 0;
-        gvector_add(&ctx->pos, center, &v);
+        tx = vx * c - vy * s;
+        vy = vx * s + vy * c;
+        vx = tx;
+        if ((i % GCODE_ARC_NORMALIZE) == 0) {
+            tx = 1 / sqrt(vx * vx + vy * vy);
+            vx *= tx;
+            vy *= tx;
+        }
+        t = (double)i / num_steps;
+        r = r_start + (r_end - r_start) * t;
+        ctx->pos.x = center->x + r * vx;
+        ctx->pos.y = center->y + r * vy;
+        ctx->pos.z = startpos.z + (endpos->z - startpos.z) * t;
         gcode_send_pos_cb(ctx);
     }
     ctx->pos = *endpos;
     gcode_send_pos_cb(ctx);
 
-    return ret;
+    return 0;
+}
+
+int gcode_arc_move(struct gcode_ctx *ctx, struct gvector *endpos, struct gvector *center, enum gcode_arc_mode mode)
+{
+    struct gvector startpos = ctx->pos;
+
+    verbose(2, "start pos =%.04f/%.04f/%.04f\n", startpos.x, startpos.y, startpos.z);
+    verbose(2, "end pos   =%.04f/%.04f/%.04f\n", endpos->x, endpos->y, endpos->z);
+
+    /* compute absolute center */
+    gvector_add(center, center, &startpos);
+    verbose(2, "center    =%.04f/%.04f/%.04f\n", center->x, center->y, center->z);
+
+    return gcode_arc_move_abs(ctx, endpos, center, mode);
+}
+
+/**
+ * Executes a move which has been recorded by a move callback before.
+ * The tool jumps to the move's start position first, then the move is
+ * passed to the move callback or interpolated exactly like in gcode_parse().
+ *
+ * @return Zero on success.
+ */
+int gcode_replay_move(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    ctx->pos = move->start;
+
+    if (move->mode == ARC_NONE) {
+        return gcode_linear_move(ctx, &move->end);
+    }
+
+    return gcode_arc_move_abs(ctx, &move->end, &move->center, move->mode);
 }
 
 int gcode_parse_float(const char *line, const char *key, float *val)
@@ -213,11 +318,159 @@ int gcode_parse_float(const char *line, const char *key, float *val)
     return -1;
 }
 
+/**
+ * Word table of one line: the first value of each address letter.
+ * This is filled by a single pass over the line, see gcode_tokenize().
+ */
+struct gcode_words {
+    uint32_t mask;  /**< bit (letter - 'A') is set if the letter is present */
+    unsigned int retract; /**< 98 or 99 if the line contains G98/G99, else 0 */
+    float val[26];
+};
+
+#define WORD(letter) (UINT32_C(1) << ((letter) - 'A'))
+#define WORD_VAL(w, letter) ((w)->val[(letter) - 'A'])
+
+static void gcode_tokenize(const char *p, const char *end, struct gcode_words *w);
+
+/** Returns true if code is a supported canned drill cycle. */
+static bool gcode_is_cycle(unsigned int code)
+{
+    return code == 73 || code == 81 || code == 82 || code == 83;
+}
+
+/** Moves straight to the given Z, keeping X and Y. */
+static void gcode_move_z(struct gcode_ctx *ctx, float z)
+{
+    struct gvector newpos = ctx->pos;
+
+    newpos.z = z;
+    gcode_linear_move(ctx, &newpos);
+}
+
+/**
+ * Executes one hole of a canned drill cycle (G73, G81, G82, G83).
+ * A new cycle (code != 0) takes R and Z from the words, R and Z are
+ * modal like the cycle itself. A line with only X/Y words (code == 0)
+ * repeats the active cycle at the new position.
+ *
+ * The hole is decomposed into plain linear moves: rapid to the hole at
+ * the current level, down to R, plunge to Z, retract to R (G99) or to the
+ * initial level (G98). Pecking (G73/G83) and dwell (G82) remove the same
+ * material as a single plunge, so Q and P are ignored. The vertical moves
+ * reach the move callback as Z-only moves and are simulated in one go.
+ */
+static void gcode_exec_cycle(struct gcode_ctx *ctx, const struct gcode_words *w, unsigned int code)
+{
+    struct gvector newpos = ctx->pos;
+    float retract;
+
+    if (code != 0) {
+        if (ctx->cycle == 0) ctx->cycle_initial_z = ctx->pos.z;
+        ctx->cycle = code;
+        if (ctx->pos_absolute) {
+            if (w->mask & WORD('R')) ctx->cycle_r = WORD_VAL(w, 'R') + g_offset_z;
+            if (w->mask & WORD('Z')) ctx->cycle_z = WORD_VAL(w, 'Z') + g_offset_z;
+        } else {
+            /* G91: R is relative to the initial level, Z relative to R */
+            if (w->mask & WORD('R')) ctx->cycle_r = ctx->pos.z + WORD_VAL(w, 'R');
+            if (w->mask & WORD('Z')) ctx->cycle_z = ctx->cycle_r + WORD_VAL(w, 'Z');
+        }
+        if (w->mask & WORD('F')) ctx->feedrate = WORD_VAL(w, 'F');
+    }
+    if (ctx->cycle == 0) return;
+
+    if (w->mask & WORD('X')) {
+        newpos.x = ctx->pos_absolute ? WORD_VAL(w, 'X') + g_offset_x : newpos.x + WORD_VAL(w, 'X');
+    }
+    if (w->mask & WORD('Y')) {
+        newpos.y = ctx->pos_absolute ? WORD_VAL(w, 'Y') + g_offset_y : newpos.y + WORD_VAL(w, 'Y');
+    }
+    verbose(2, "Drill cycle G%u at X=%.2f, Y=%.2f, Z=%.2f, R=%.2f\n",
+            ctx->cycle, newpos.x, newpos.y, ctx->cycle_z, ctx->cycle_r);
+
+    /* never move sideways below the retract plane */
+    if (ctx->pos.z < ctx->cycle_r) gcode_move_z(ctx, ctx->cycle_r);
+    newpos.z = ctx->pos.z;
+    gcode_linear_move(ctx, &newpos);
+    gcode_move_z(ctx, ctx->cycle_r);
+    gcode_move_z(ctx, ctx->cycle_z);
+    retract = ctx->cycle_r;
+    if (!ctx->cycle_retract_r && ctx->cycle_initial_z > retract) retract = ctx->cycle_initial_z;
+    gcode_move_z(ctx, retract);
+}
+
+/** Applies G98/G99 of the line and executes the cycle of it, if any. */
+static void gcode_exec_cycle_words(struct gcode_ctx *ctx, const struct gcode_words *w)
+{
+    unsigned int code = 0;
+
+    if (w->retract) ctx->cycle_retract_r = (w->retract == 99);
+    if (w->mask & WORD('G')) code = WORD_VAL(w, 'G');
+    if (gcode_is_cycle(code)) {
+        gcode_exec_cycle(ctx, w, code);
+    } else if ((w->mask & WORD('G')) == 0 && (w->mask & (WORD('X') | WORD('Y')))) {
+        gcode_exec_cycle(ctx, w, 0);
+    }
+}
+
 #define APPEND(fmt, arg) ret = snprintf(newline + pos, sizeof(newline) - pos, fmt, arg); \
                                if (ret > 0) { \
                                    pos += ret; \
                                }
 
+/**
+ * Parses a line with a canned drill cycle, G98/G99 or a further hole of
+ * the active cycle. Like for moves, the offsets are applied to the output
+ * in absolute mode.
+ */
+static void gcode_parse_cycle(struct gcode_ctx *ctx, const char *line)
+{
+    struct gcode_words w;
+    char newline[256];
+    int pos = 0, ret;
+
+    gcode_tokenize(line, line + strlen(line), &w);
+    gcode_exec_cycle_words(ctx, &w);
+    if (g_output == NULL) return;
+
+    if (!ctx->pos_absolute) {
+        /* relative pos, take as-is */
+        fprintf(g_output, "%s", line);
+        return;
+    }
+    newline[0] = 0;
+    if (w.retract) {
+        APPEND("G%02u ", w.retract);
+    }
+    if (w.mask & WORD('G')) {
+        APPEND("G%02u ", (unsigned int)WORD_VAL(&w, 'G'));
+    }
+    if (w.mask & WORD('X')) {
+        APPEND("X%.4f ", WORD_VAL(&w, 'X') + g_offset_x);
+    }
+    if (w.mask & WORD('Y')) {
+        APPEND("Y%.4f ", WORD_VAL(&w, 'Y') + g_offset_y);
+    }
+    if (w.mask & WORD('Z')) {
+        APPEND("Z%.4f ", WORD_VAL(&w, 'Z') + g_offset_z);
+    }
+    if (w.mask & WORD('R')) {
+        APPEND("R%.4f ", WORD_VAL(&w, 'R') + g_offset_z);
+    }
+    if (w.mask & WORD('Q')) {
+        APPEND("Q%.4f ", WORD_VAL(&w, 'Q'));
+    }
+    if (w.mask & WORD('P')) {
+        APPEND("P%.4f ", WORD_VAL(&w, 'P'));
+    }
+    if (w.mask & WORD('F')) {
+        APPEND("F%.2f ", WORD_VAL(&w, 'F'));
+    }
+    if (pos > 0) newline[pos - 1] = 0;
+    fprintf(g_output, "%s\n", newline);
+}
+
 int gcode_parse_gcode(struct gcode_ctx *ctx, const char *line)
 {
     int ret = 0;
@@ -235,6 +488,7 @@ int gcode_parse_gcode(struct gcode_ctx *ctx, const char *line)
     switch (code) {
     case 0: /* rapid move */
     case 1: /* linear move */
+        ctx->cycle = 0;
         APPEND("G%02u", code);
         if (gcode_parse_float(line, "X", &val) == 0) {
             if (ctx->pos_absolute) {
@@ -280,6 +534,7 @@ int gcode_parse_gcode(struct gcode_ctx *ctx, const char *line)
         /* implicit fall-through */
     case 3: /* arc CCW */
         if (mode == ARC_NONE) mode = ARC_CCW;
+        ctx->cycle = 0;
         APPEND("G%02u", code);
         if (gcode_parse_float(line, "X", &val) == 0) {
             if (ctx->pos_absolute) {
@@ -349,6 +604,18 @@ int gcode_parse_gcode(struct gcode_ctx *ctx, const char *line)
     case 28: /* homeing */
         verbose(1, "Homeing\n");
         break;
+    case 73: /* peck drilling */
+    case 81: /* drilling */
+    case 82: /* drilling with dwell */
+    case 83: /* peck drilling */
+    case 98: /* retract to initial level */
+    case 99: /* retract to R */
+        gcode_parse_cycle(ctx, line);
+        break;
+    case 80: /* cancel canned cycle */
+        verbose(1, "Canned cycle cancelled\n");
+        ctx->cycle = 0;
+        break;
     case 90: /* position absolute */
         verbose(1, "Positioning absolute\n");
         ctx->pos_absolute = true;
@@ -399,7 +666,8 @@ int gcode_parse_gcode(struct gcode_ctx *ctx, const char *line)
         break;
     }
 
-    if (g_output && code != 0 && code != 1 && code != 2 && code != 3 && code != 92) {
+    if (g_output && code != 0 && code != 1 && code != 2 && code != 3 && code != 92 &&
+        !gcode_is_cycle(code) && code != 98 && code != 99) {
         fprintf(g_output, "%s", line);
         if (code == 90 && g_header_written == 0) {
             fprintf(g_output, "%s", g_custom_header);
@@ -493,6 +761,16 @@ int gcode_parse_line(struct gcode_ctx *ctx, const char *line)
     case 'T':
         ret = gcode_parse_tcode(ctx, line);
         break;
+    case 'X':
+    case 'Y':
+        /* next hole of the active canned cycle */
+        if (ctx->cycle == 0) {
+            verbose(1, "Unknown code: %s\n", line);
+            ret = -1;
+            break;
+        }
+        gcode_parse_cycle(ctx, line);
+        break;
     case '(':
     case ';':
         /* ignore comments */
@@ -512,15 +790,346 @@ int gcode_parse_line(struct gcode_ctx *ctx, const char *line)
     return ret;
 }
 
-int gcode_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx), void (*toolchange_cb)(unsigned int tool))
+/* Exact powers of ten as double. */
+static const double g_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Parses a decimal number like [+-]digits[.digits].
+ * Numbers with up to 15 significant digits are converted exactly via
+ * double, longer ones fall back to strtof().
+ *
+ * @param p Start of the number.
+ * @param end End of the line.
+ * @param val Returns the value.
+ *
+ * @return Pointer behind the number, or NULL if there is no number.
+ */
+static const char *gcode_parse_number(const char *p, const char *end, float *val)
+{
+    const char *start = p;
+    char buf[64];
+    uint64_t mant = 0;
+    unsigned int digits = 0, frac = 0;
+    int neg = 0, exact = 1;
+    size_t len;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (mant < UINT64_C(1) << 53 && mant * 10 + (*p - '0') < UINT64_C(1) << 53) {
+            mant = mant * 10 + (*p - '0');
+        } else {
+            exact = 0;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if (mant * 10 + (*p - '0') < UINT64_C(1) << 53 && frac < 22) {
+                mant = mant * 10 + (*p - '0');
+                frac++;
+            } else if (*p != '0') {
+                exact = 0;
+            }
+        }
+    }
+    if (digits == 0) return NULL;
+
+    if (exact) {
+        *val = (float)((double)mant / g_pow10[frac]);
+        if (neg) *val = -*val;
+    } else {
+        len = p - start;
+        if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+        memcpy(buf, start, len);
+        buf[len] = 0;
+        *val = strtof(buf, NULL);
+    }
+
+    return p;
+}
+
+/**
+ * Splits one line into words. Comments in parentheses and after ';' are
+ * skipped, so letters inside of comments are never taken as words.
+ *
+ * @param p Start of the line.
+ * @param end End of the line (exclusive).
+ * @param w Returns the word table.
+ */
+static void gcode_tokenize(const char *p, const char *end, struct gcode_words *w)
+{
+    char c;
+    float val;
+    const char *next;
+
+    w->mask = 0;
+    w->retract = 0;
+    while (p < end) {
+        c = *p++;
+        if (c == '(') {
+            while (p < end && *p != ')') p++;
+            p++;
+            continue;
+        }
+        if (c == ';') break;
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c < 'A' || c > 'Z') continue;
+
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        next = gcode_parse_number(p, end, &val);
+        if (next == NULL) continue;
+        p = next;
+        /* G98/G99 may precede the cycle code on the same line */
+        if (c == 'G' && (val == 98 || val == 99)) {
+            w->retract = val;
+            continue;
+        }
+        /* the first occurrence counts */
+        if ((w->mask & WORD(c)) == 0) {
+            w->mask |= WORD(c);
+            WORD_VAL(w, c) = val;
+        }
+    }
+}
+
+/** Computes the target position from the X, Y and Z words. */
+static void gcode_words_target(struct gcode_ctx *ctx, const struct gcode_words *w, struct gvector *newpos)
+{
+    *newpos = ctx->pos;
+    if (w->mask & WORD('X')) {
+        if (ctx->pos_absolute) {
+            newpos->x = WORD_VAL(w, 'X') + g_offset_x;
+        } else {
+            newpos->x += WORD_VAL(w, 'X');
+        }
+    }
+    if (w->mask & WORD('Y')) {
+        if (ctx->pos_absolute) {
+            newpos->y = WORD_VAL(w, 'Y') + g_offset_y;
+        } else {
+            newpos->y += WORD_VAL(w, 'Y');
+        }
+    }
+    if (w->mask & WORD('Z')) {
+        if (ctx->pos_absolute) {
+            newpos->z = WORD_VAL(w, 'Z') + g_offset_z;
+        } else {
+            newpos->z += WORD_VAL(w, 'Z');
+        }
+    }
+}
+
+/** Executes a G code from the word table, same as gcode_parse_gcode(). */
+static int gcode_exec_gcode(struct gcode_ctx *ctx, const struct gcode_words *w)
+{
+    unsigned int code = WORD_VAL(w, 'G');
+    struct gvector newpos;
+    struct gvector center;
+    enum gcode_arc_mode mode;
+
+    switch (code) {
+    case 0: /* rapid move */
+    case 1: /* linear move */
+        ctx->cycle = 0;
+        gcode_words_target(ctx, w, &newpos);
+        if (w->mask & WORD('F')) ctx->feedrate = WORD_VAL(w, 'F');
+        verbose(2, "Linear move to X=%.2f, Y=%.2f, Z=%.2f\n",
+                newpos.x, newpos.y, newpos.z);
+        gcode_linear_move(ctx, &newpos);
+        break;
+    case 2: /* arc CW */
+    case 3: /* arc CCW */
+        ctx->cycle = 0;
+        mode = (code == 2) ? ARC_CW : ARC_CCW;
+        gcode_words_target(ctx, w, &newpos);
+        /* note that IJK is always relative to starting pos */
+        center.x = (w->mask & WORD('I')) ? WORD_VAL(w, 'I') : 0;
+        center.y = (w->mask & WORD('J')) ? WORD_VAL(w, 'J') : 0;
+        center.z = (w->mask & WORD('K')) ? WORD_VAL(w, 'K') : 0;
+        if (w->mask & WORD('F')) ctx->feedrate = WORD_VAL(w, 'F');
+        verbose(2, "Arc to X=%.2f, Y=%.2f, Z=%.2f (rel. center=%.2f/%.2f/%.2f)\n",
+                newpos.x, newpos.y, newpos.z, center.x, center.y, center.z);
+        gcode_arc_move(ctx, &newpos, &center, mode);
+        break;
+    case 4: /* Dwell */
+        verbose(1, "Pausing ignored. We want to do a quick simulation.\n");
+        break;
+    case 20: /* inch */
+        verbose(1, "Units set to inch\n");
+        break;
+    case 21: /* mm */
+        verbose(1, "Units set to mm\n");
+        break;
+    case 28: /* homeing */
+        verbose(1, "Homeing\n");
+        break;
+    case 90: /* position absolute */
+        verbose(1, "Positioning absolute\n");
+        ctx->pos_absolute = true;
+        break;
+    case 91: /* position relative */
+        verbose(1, "Positioning relative\n");
+        ctx->pos_absolute = false;
+        break;
+    case 73: /* peck drilling */
+    case 81: /* drilling */
+    case 82: /* drilling with dwell */
+    case 83: /* peck drilling */
+        gcode_exec_cycle(ctx, w, code);
+        break;
+    case 80: /* cancel canned cycle */
+        verbose(1, "Canned cycle cancelled\n");
+        ctx->cycle = 0;
+        break;
+    case 92: /* set position */
+        gcode_words_target(ctx, w, &newpos);
+        ctx->pos = newpos;
+        verbose(1, "Setting position to X=%.2f, Y=%.2f, Z=%.2f\n",
+                newpos.x, newpos.y, newpos.z);
+        break;
+    default:
+        verbose(1, "ignoring: G%u\n", code);
+        break;
+    }
+
+    return 0;
+}
+
+/** Executes a M code from the word table, same as gcode_parse_mcode(). */
+static int gcode_exec_mcode(struct gcode_ctx *ctx, const struct gcode_words *w)
+{
+    unsigned int code = WORD_VAL(w, 'M');
+    unsigned int tool;
+
+    switch (code) {
+    case 2: /* program off */
+        verbose(1, "program off\n");
+        break;
+    case 3: /* spindle on CW */
+        verbose(1, "spindle on CW\n");
+        break;
+    case 4: /* spindle on CCW */
+        verbose(1, "spindle on CCW\n");
+        break;
+    case 5: /* spindle off */
+        verbose(1, "spindle off\n");
+        break;
+    case 6: /* tool chain */
+        if ((w->mask & WORD('T')) == 0) {
+            printf("error in %s: missing tool number\n", __func__);
+            return -1;
+        }
+        tool = WORD_VAL(w, 'T');
+        verbose(1, "select tool %u\n", tool);
+        if (ctx->toolchange_cb) ctx->toolchange_cb(tool);
+        break;
+    default:
+        verbose(1, "ignoring: M%u\n", code);
+        break;
+    }
+
+    return 0;
+}
+
+/** Executes one tokenized line. */
+static int gcode_exec_words(struct gcode_ctx *ctx, const struct gcode_words *w)
+{
+    if (w->retract) ctx->cycle_retract_r = (w->retract == 99);
+    if (w->mask & WORD('G')) return gcode_exec_gcode(ctx, w);
+    if (w->mask & WORD('M')) return gcode_exec_mcode(ctx, w);
+    if (w->mask & WORD('T')) {
+        verbose(1, "select tool %u\n", (unsigned int)WORD_VAL(w, 'T'));
+        return 0;
+    }
+    if (ctx->cycle && (w->mask & (WORD('X') | WORD('Y')))) {
+        /* next hole of the active canned cycle */
+        gcode_exec_cycle(ctx, w, 0);
+        return 0;
+    }
+    if (w->mask) {
+        verbose(1, "Unknown code in line %u\n", ctx->lineno);
+        return -1;
+    }
+
+    return 0; /* empty line or comment */
+}
+
+/**
+ * Parses a file with the single pass tokenizer.
+ * The file is mapped into memory and each line is tokenized in place.
+ */
+static int gcode_parse_mapped(struct gcode_ctx *ctx, const char *filename)
+{
+    struct mapped_file file;
+    struct gcode_words words;
+    const char *p, *end, *eol;
+    unsigned int lineno = 0;
+
+    if (mapped_file_open(&file, filename) != 0) return -1;
+
+    p   = file.data;
+    end = p + file.size;
+    while (p < end && !g_terminate) {
+        eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        lineno++;
+        ctx->lineno = lineno;
+
+        gcode_tokenize(p, eol, &words);
+        gcode_exec_words(ctx, &words);
+        p = eol + 1;
+    }
+    if (g_terminate) {
+        printf("Stopped parsing on user request at line %u\n", lineno);
+    }
+
+    mapped_file_close(&file);
+
+    return 0;
+}
+
+/**
+ * Removes comments in parentheses and after ';' from a code line, so that
+ * gcode_parse_float() does not find letters inside of comments.
+ * Lines that are comments as a whole are kept for the rewritten output.
+ */
+static void gcode_strip_comments(char *line)
+{
+    char *src = line, *dst = line;
+
+    if (line[0] == '(' || line[0] == ';') return;
+
+    while (*src) {
+        if (*src == '(') {
+            while (*src && *src != ')' && *src != '\n') src++;
+            if (*src == ')') src++;
+            continue;
+        }
+        if (*src == ';') {
+            while (*src && *src != '\n') src++;
+            continue;
+        }
+        *dst++ = *src++;
+    }
+    *dst = 0;
+}
+
+/**
+ * Parses a file line by line with gcode_parse_line().
+ * This is used when the GCode gets rewritten, as the output is created
+ * from the original text.
+ */
+static int gcode_parse_lines(struct gcode_ctx *ctx, const char *filename)
 {
     char line[4096];
     char *result;
     FILE *f;
-    unsigned int code;
-    float x, y, z, F;
     int ret, lineno = 0;
-    struct gcode_ctx ctx;
 
     f = fopen(filename, "r");
     if (f == NULL) return -1;
@@ -533,16 +1142,14 @@ int gcode_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx),
         }
     }
 
-    gcode_ctx_init(&ctx);
-    ctx.newpos_cb     = newpos_cb;
-    ctx.toolchange_cb = toolchange_cb;
-
     while (!g_terminate) {
         result = fgets(line, sizeof(line), f);
         if (result == NULL) break;
         lineno++;
+        ctx->lineno = lineno;
 
-        ret = gcode_parse_line(&ctx, line);
+        gcode_strip_comments(line);
+        ret = gcode_parse_line(ctx, line);
     }
     if (g_terminate) {
         printf("Stopped parsing on user request at line %i\n", lineno);
@@ -557,6 +1164,20 @@ int gcode_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx),
     return 0;
 }
 
+int gcode_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx), gcode_move_cb move_cb, void (*toolchange_cb)(unsigned int tool))
+{
+    struct gcode_ctx ctx;
+
+    gcode_ctx_init(&ctx);
+    ctx.newpos_cb     = newpos_cb;
+    ctx.move_cb       = move_cb;
+    ctx.toolchange_cb = toolchange_cb;
+
+    if (g_ofilename) return gcode_parse_lines(&ctx, filename);
+
+    return gcode_parse_mapped(&ctx, filename);
+}
+
 void gcode_set_output(const char *filename)
 {
     g_ofilename = filename;
@@ -582,3 +1203,37 @@ void gcode_set_offset(float x, float y, float z)
     g_offset_z = z;
 }
 
+void gcode_get_offset(float *x, float *y, float *z)
+{
+    *x = g_offset_x;
+    *y = g_offset_y;
+    *z = g_offset_z;
+}
+
+/**
+ * Sets the maximum distance between an arc and the chords used to
+ * interpolate it.
+ *
+ * @param tolerance Chord error in mm, must be greater than zero.
+ */
+void gcode_set_arc_tolerance(float tolerance)
+{
+    if (tolerance > 0) g_arc_tolerance = tolerance;
+}
+
+/**
+ * Sets the maximum distance between the interpolated points of arcs,
+ * e.g. so that stamps of the tool at the points leave no gaps.
+ *
+ * @param spacing Distance in mm, zero to only apply the chord error.
+ */
+void gcode_set_arc_spacing(float spacing)
+{
+    if (spacing >= 0) g_arc_spacing = spacing;
+}
+
+/** Returns the distance of the points of interpolated linear moves in mm. */
+float gcode_get_step_len(void)
+{
+    return g_step_len;
+}
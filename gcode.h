@@ -32,20 +32,59 @@ void gvector_sub(struct gvector *res, struct gvector *a, struct gvector *b);
 void gvector_mul(struct gvector *v, float factor);
 float gvector_len(struct gvector *v);
 
+enum gcode_arc_mode {
+    ARC_NONE = 0,
+    ARC_CW,
+    ARC_CCW
+};
+
+/**
+ * A complete move as decoded from one G0/G1/G2/G3 line.
+ * All positions are absolute and in mm.
+ */
+struct gcode_move {
+    enum gcode_arc_mode mode; /**< ARC_NONE for linear moves */
+    struct gvector start;
+    struct gvector end;
+    struct gvector center;    /**< absolute arc center, only valid for arcs */
+};
+
+struct gcode_ctx;
+
+/**
+ * Move callback. Gets called once per move before it gets interpolated.
+ *
+ * @return Zero if the move was handled completely by the callback,
+ * non-zero if the parser should interpolate it and call newpos_cb.
+ */
+typedef int (*gcode_move_cb)(struct gcode_ctx *ctx, struct gcode_move *move);
+
 struct gcode_ctx {
     struct gvector pos;
     bool pos_absolute;
     float feedrate; /* mm/min */
+    unsigned int lineno; /* line number of the current command */
+    unsigned int cycle;  /* active canned drill cycle (73, 81, 82, 83), 0 if none */
+    bool cycle_retract_r; /* G99: retract to R instead of the initial level */
+    float cycle_z, cycle_r; /* absolute hole bottom and retract plane */
+    float cycle_initial_z;  /* Z when the cycle was started */
     void (*newpos_cb)(struct gcode_ctx *ctx);
+    gcode_move_cb move_cb;
     void (*toolchange_cb)(unsigned int tool);
 };
 
 void gcode_ctx_init(struct gcode_ctx *ctx);
+float gcode_move_length(const struct gcode_move *move);
 
-int gcode_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx), void (*toolchange_cb)(unsigned int tool));
+int gcode_replay_move(struct gcode_ctx *ctx, struct gcode_move *move);
+int gcode_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx), gcode_move_cb move_cb, void (*toolchange_cb)(unsigned int tool));
 void gcode_set_output(const char *filename);
 int gcode_load_custom_header(const char *filename);
 void gcode_set_offset(float x, float y, float z);
+void gcode_get_offset(float *x, float *y, float *z);
+void gcode_set_arc_tolerance(float tolerance);
+void gcode_set_arc_spacing(float spacing);
+float gcode_get_step_len(void);
 void gcode_verbose(void);
 
 #endif /* end of include guard: GCODE_H_MQ1JX08Y */
@@ -0,0 +1,96 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "heightmap.h"
+#include <string.h>
+#include <stdio.h>
+
+int heightmap_init(struct heightmap *map, size_t w, size_t h, size_t t)
+{
+    if (t > UINT16_MAX) return -1;
+
+    map->width     = w;
+    map->height    = h;
+    map->thickness = t;
+    map->size      = w * h * sizeof(*map->data);
+    map->data      = malloc(map->size);
+    if (map->data == NULL) return -1;
+    heightmap_clr_all(map);
+    return 0;
+}
+
+void heightmap_clear(struct heightmap *map)
+{
+    if (map->data)
+        free(map->data);
+    memset(map, 0, sizeof(*map));
+}
+
+void heightmap_set_all(struct heightmap *map)
+{
+    size_t i, n = map->width * map->height;
+
+    for (i = 0; i < n; ++i) {
+        map->data[i] = map->thickness;
+    }
+}
+
+void heightmap_clr_all(struct heightmap *map)
+{
+    memset(map->data, 0, map->size);
+}
+
+/**
+ * Gets the material height of a column.
+ *
+ * @return Number of solid layers, -1 if the column is out of range.
+ */
+int heightmap_get(struct heightmap *map, int x, int y)
+{
+    if (x < 0 || x >= map->width) return -1;
+    if (y < 0 || y >= map->height) return -1;
+
+    return map->data[y * map->width + x];
+}
+
+/**
+ * Removes material of one column.
+ * A heightmap cannot represent undercuts, so the tool is treated as
+ * infinitely long: everything above \c z0 gets removed.
+ *
+ * @param map The heightmap.
+ * @param x X coordinate of the column.
+ * @param y Y coordinate of the column.
+ * @param z0 Lowest voxel to clear.
+ * @param z1 End of range (exclusive), unused.
+ *
+ * @return Zero on success, -1 if the column is out of range.
+ */
+int heightmap_clr_column(struct heightmap *map, int x, int y, int z0, int z1)
+{
+    uint16_t *h;
+
+    if (x < 0 || x >= map->width) return -1;
+    if (y < 0 || y >= map->height) return -1;
+    if (z1 <= 0) return 0;
+    if (z0 < 0) z0 = 0;
+
+    h = &map->data[y * map->width + x];
+    if (z0 < *h) *h = z0;
+
+    return 0;
+}
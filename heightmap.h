@@ -0,0 +1,45 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HEIGHTMAP_H_5TGX2WQL
+#define HEIGHTMAP_H_5TGX2WQL
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/**
+ * 2.5D workpart: stores the material height of each XY column.
+ * A column of height h is solid in the layers 0..h-1.
+ */
+struct heightmap {
+    size_t width;
+    size_t height;
+    size_t thickness;
+    size_t size; /**< size in bytes */
+    uint16_t *data;
+};
+
+int heightmap_init(struct heightmap *map, size_t w, size_t h, size_t t);
+void heightmap_clear(struct heightmap *map);
+
+void heightmap_set_all(struct heightmap *map);
+void heightmap_clr_all(struct heightmap *map);
+int heightmap_get(struct heightmap *map, int x, int y);
+int heightmap_clr_column(struct heightmap *map, int x, int y, int z0, int z1);
+
+
+#endif /* end of include guard: HEIGHTMAP_H_5TGX2WQL */
@@ -19,8 +19,23 @@
 #include <string.h>
 #include <limits.h>
 #include <getopt.h>
+#include <math.h>
 #include "voxelspace.h"
+#include "pnm.h"
+#include "voxelkernel.h"
 #include "gcode.h"
+#include "tool.h"
+#include "workpart.h"
+#include "tilesim.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "toolpath.h"
+#include "dda.h"
+#include "airmap.h"
+#include "snapshot.h"
+#include "animlog.h"
+#include "render.h"
+#include "mesh.h"
 #include "version.h"
 #ifdef __linux__
 #include <signal.h>
@@ -34,6 +49,7 @@
 
 #define sqr(x) (x)*(x)
 static float g_resolution = 0.05; /* mm */
+static float g_arc_tolerance = 0.1; /* voxels */
 /* eagle pcbcode can generate negative coordinates when not mirroring.
  * We compensate this by adding the PCB width when this flag is set.
  */
@@ -42,6 +58,98 @@ static float g_tool1_d = 2;
 static float g_tool2_d = 0.8;
 static unsigned int g_file_index = 0;
 
+enum sim_mode {
+    MODE_STEP = 0, /* stamp the tool at each interpolated position */
+    MODE_SWEEP,    /* remove the swept volume of complete moves */
+    MODE_DDA       /* stamp the tool once per voxel visited by the path */
+};
+static enum sim_mode g_mode = MODE_STEP;
+static enum workpart_backend g_backend = WORKPART_VOXEL;
+static enum voxel_layout g_layout = VOXEL_LAYOUT_LAYER;
+
+static struct workpart g_workpart;
+static struct airmap g_airmap;
+static unsigned int g_threads = 1; /* 0 = one per CPU */
+static int g_tiled = 0; /* tile-parallel simulation is used */
+static struct tilesim g_tilesim;
+static int g_pipelined = 0; /* parse in a separate thread */
+static int g_compiled = 0; /* replay compiled toolpaths */
+static struct dda g_dda;
+static struct voxel_space g_tool1;
+static struct voxel_space g_tool2;
+static struct voxel_space *g_tool = &g_tool1;
+static struct tool_profile g_profile1;
+static struct tool_profile g_profile2;
+static struct tool_deltas g_deltas1;
+static struct tool_deltas g_deltas2;
+volatile int              g_terminate = 0;
+static volatile int       g_save_state = 0; /* set by SIGALRM */
+static struct snapshot    g_snapshot; /* writes the periodic snapshots */
+static unsigned int       g_snapshot_since = 0; /* see workpart_copy_changes() */
+
+/* animation frame log, frames are taken every g_anim_interval s or mm */
+static const char        *g_anim_file = NULL;
+static struct animlog     g_anim;
+static unsigned int       g_anim_since = 0;
+static float              g_anim_interval = 1;
+static int                g_anim_by_distance = 0; /* interval is a feed distance */
+static float              g_anim_time = 0;      /* machine time in s */
+static float              g_anim_distance = 0;  /* tool path length in mm */
+static float              g_anim_next = 0;      /* time or distance of the next frame */
+static struct gvector     g_anim_pos;           /* tool position of the last frame clock update */
+
+/**
+ * Last stamp of a tool. Stamping a tool at the same XY position again
+ * removes no new material, unless it is lower than before or its top
+ * reaches into the workpart. Such stamps are skipped.
+ */
+struct stamp_cache {
+    int valid;
+    struct voxel_pos pos; /* lowest stamp at the last XY position */
+};
+static struct stamp_cache g_cache1;
+static struct stamp_cache g_cache2;
+static unsigned long g_num_stamps = 0;
+static unsigned long g_num_skipped = 0;
+static unsigned long g_num_deltas = 0;
+static unsigned long g_num_plunges = 0;
+
+/** Returns the profile belonging to the given tool. */
+static struct tool_profile *tool_profile_of(struct voxel_space *tool)
+{
+    return (tool == &g_tool1) ? &g_profile1 : &g_profile2;
+}
+
+/** Returns the unit step deltas belonging to the given tool. */
+static struct tool_deltas *tool_deltas_of(struct voxel_space *tool)
+{
+    return (tool == &g_tool1) ? &g_deltas1 : &g_deltas2;
+}
+
+/** Returns the stamp cache belonging to the given tool. */
+static struct stamp_cache *stamp_cache_of(struct voxel_space *tool)
+{
+    return (tool == &g_tool1) ? &g_cache1 : &g_cache2;
+}
+
+/** Computes the profile and the unit step deltas of a new tool. */
+static void update_tool_profile(struct voxel_space *tool)
+{
+    struct tool_profile *profile = tool_profile_of(tool);
+    int ret;
+
+    tool_profile_clear(profile);
+    ret = tool_profile_init(profile, tool);
+    if (ret == 0) ret = tool_deltas_init(tool_deltas_of(tool), tool);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to init tool profile.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* the tool has changed, so the last stamp is not valid anymore */
+    stamp_cache_of(tool)->valid = 0;
+}
+
 void create_etch_tool(struct voxel_space *tool, float diameter)
 {
     int ret;
@@ -56,7 +164,7 @@ void create_etch_tool(struct voxel_space *tool, float diameter)
 
     voxel_space_clear(tool);
 
-    ret = voxel_space_init(tool, w, h, t);
+    ret = voxel_space_init_layout(tool, w, h, t, g_layout);
     if (ret != 0) {
         fprintf(stderr, "Failed to init voxel space.\n");
         exit(EXIT_FAILURE);
@@ -82,6 +190,7 @@ void create_etch_tool(struct voxel_space *tool, float diameter)
     tool->pos.x = 0;
     tool->pos.y = 0;
     tool->pos.z = 10 / g_resolution;
+    update_tool_profile(tool);
 }
 
 void create_drill_tool(struct voxel_space *tool, float diameter)
@@ -96,7 +205,7 @@ void create_drill_tool(struct voxel_space *tool, float diameter)
     h = diameter / g_resolution;
     t = 1 / g_resolution;
 
-    ret = voxel_space_init(tool, w, h, t);
+    ret = voxel_space_init_layout(tool, w, h, t, g_layout);
     if (ret != 0) {
         fprintf(stderr, "Failed to init voxel space.\n");
         exit(EXIT_FAILURE);
@@ -119,34 +228,192 @@ void create_drill_tool(struct voxel_space *tool, float diameter)
     tool->pos.x = 0;
     tool->pos.y = 0;
     tool->pos.z = 10 / g_resolution;
+    update_tool_profile(tool);
 }
 
-static struct voxel_space g_workpart;
-static struct voxel_space g_tool1;
-static struct voxel_space g_tool2;
-static struct voxel_space *g_tool = &g_tool1;
-volatile int              g_terminate = 0;
-
 #ifdef __linux__
 void signal_handler(int signo)
 {
+    const char *msg;
+    ssize_t ret;
+
+    /* only async-signal-safe functions may be used here */
     switch (signo) {
     case SIGALRM:
-        /* save current state periodically */
-        printf("Saving current state to workpart.pgm.\n");
-        voxel_space_to_pgm(&g_workpart, "workpart.pgm");
+        /* save current state periodically, see save_state() */
+        g_save_state = 1;
         alarm(5);
         break;
     case SIGINT:
     case SIGTERM:
         /* save current state when program is terminated */
-        printf("Receive signal %i. Terminating now.\n", signo);
+        msg = (signo == SIGINT) ? "Receive SIGINT. Terminating now.\n" : "Receive SIGTERM. Terminating now.\n";
+        ret = write(STDOUT_FILENO, msg, strlen(msg));
+        (void)ret;
         g_terminate = 1;
         break;
     }
 }
 #endif
 
+/**
+ * Saves the current state to workpart.pgm when the periodic timer has
+ * expired. This is not done in the signal handler, which may interrupt
+ * the simulation in the middle of modifying the workpart.
+ * Only the heights changed since the last snapshot are copied here, the
+ * image is encoded and written by the snapshot thread. While it is still
+ * busy the snapshot is retried later.
+ */
+static void save_state(void)
+{
+    if (!g_save_state) return;
+    if (g_snapshot.values == NULL) {
+        if (snapshot_init(&g_snapshot, "workpart.pgm", g_workpart.width, g_workpart.height,
+                          g_workpart.thickness) != 0) {
+            fprintf(stderr, "error: Failed to start snapshot writer.\n");
+            g_save_state = 0;
+            return;
+        }
+    } else if (snapshot_busy(&g_snapshot)) {
+        return;
+    }
+    g_save_state = 0;
+
+    printf("Saving current state to workpart.pgm.\n");
+    if (g_tiled) tilesim_flush(&g_tilesim);
+    workpart_copy_changes(&g_workpart, &g_snapshot_since, g_snapshot.values, g_snapshot.rows);
+    snapshot_submit(&g_snapshot);
+}
+
+/**
+ * Removes the current tool at its position g_tool->pos from the workpart.
+ * Stamps which cannot remove new material are skipped. After a unit step
+ * from the last stamp only the delta of the step is removed.
+ *
+ * @return Zero if the tool is in air, 1 otherwise.
+ */
+static int stamp_tool(void)
+{
+    struct stamp_cache *cache = stamp_cache_of(g_tool);
+    struct tool_profile *profile = tool_profile_of(g_tool);
+    struct voxel_pos *pos = &g_tool->pos;
+    const struct tool_delta *delta = NULL;
+    struct workpart_rect rect;
+    int dx, dy, dz;
+
+    if (cache->valid) {
+        dx = pos->x - cache->pos.x;
+        dy = pos->y - cache->pos.y;
+        dz = pos->z - cache->pos.z;
+        if (dx == 0 && dy == 0) {
+            if (dz == 0) {
+                g_num_skipped++;
+                return 1;
+            }
+            /* the raised tool only reaches new layers above the workpart */
+            if (dz > 0 && cache->pos.z + profile->min_top + 1 >= (int)g_workpart.thickness) {
+                g_num_skipped++;
+                return 1;
+            }
+        }
+        if (abs(dx) <= 1 && abs(dy) <= 1 && abs(dz) <= 1) {
+            delta = &tool_deltas_of(g_tool)->dir[TOOL_DELTA_INDEX(dx, dy, dz)];
+        }
+    }
+
+    rect.x0 = pos->x;
+    rect.y0 = pos->y;
+    rect.x1 = pos->x + (int)g_tool->width;
+    rect.y1 = pos->y + (int)g_tool->height;
+    if (profile->min_bottom < 0 || airmap_is_air(&g_airmap, &rect, pos->z + profile->min_bottom)) {
+        return 0;
+    }
+    airmap_mark(&g_airmap, &rect, pos->z + profile->min_bottom);
+
+    if (!cache->valid || pos->x != cache->pos.x || pos->y != cache->pos.y ||
+        pos->z < cache->pos.z) {
+        cache->pos   = *pos;
+        cache->valid = 1;
+    }
+    g_num_stamps++;
+
+    if (delta) {
+        g_num_deltas++;
+        if (g_tiled) {
+            tilesim_stamp_delta(&g_tilesim, g_tool, tool_profile_of(g_tool), delta);
+        } else {
+            workpart_stamp_delta(&g_workpart, g_tool, tool_profile_of(g_tool), delta);
+        }
+    } else if (g_tiled) {
+        tilesim_stamp(&g_tilesim, g_tool, tool_profile_of(g_tool));
+    } else {
+        workpart_stamp(&g_workpart, g_tool, tool_profile_of(g_tool));
+    }
+
+    return 1;
+}
+
+/** Converts a position in mm into the voxel of the tool center in step mode. */
+static void gcode_to_stamp(struct voxel_pos *res, const struct gvector *pos)
+{
+    res->x = (pos->x / g_resolution);
+    if (g_x_mirror) res->x += g_workpart.width;
+    res->y = (pos->y / g_resolution);
+    res->z = ((pos->z + 1.6) / g_resolution);
+}
+
+/** Converts a position in mm into voxel units (tool center and lowest tool layer). */
+static void gcode_to_voxel(struct gvector *res, struct gvector *pos)
+{
+    res->x = pos->x / g_resolution;
+    if (g_x_mirror) res->x += g_workpart.width;
+    res->y = pos->y / g_resolution;
+    res->z = (pos->z + 1.6) / g_resolution;
+}
+
+/** Adds the changes of the workpart since the last frame to the frame log. */
+static void anim_frame(void)
+{
+    struct animlog_frame_info info;
+    struct gvector pos;
+
+    if (g_tiled) tilesim_flush(&g_tilesim);
+    workpart_copy_changes(&g_workpart, &g_anim_since, g_anim.values, g_anim.rows);
+    pos = g_anim_pos;
+    gcode_to_voxel(&pos, &pos);
+    memset(&info, 0, sizeof(info));
+    info.time          = g_anim_time;
+    info.distance      = g_anim_distance;
+    info.tool_x        = pos.x;
+    info.tool_y        = pos.y;
+    info.tool_z        = pos.z;
+    info.tool          = (g_tool == &g_tool1) ? 1 : 2;
+    info.tool_diameter = (g_tool == &g_tool1) ? g_tool1_d : g_tool2_d;
+    if (animlog_add_frame(&g_anim, &info) != 0) {
+        fprintf(stderr, "error: Failed to add animation frame.\n");
+    }
+}
+
+/**
+ * Advances the frame clock by a tool movement of len mm to pos and adds a
+ * frame when the next frame time or distance has been reached.
+ */
+static void anim_advance(const struct gvector *pos, float len, float feedrate)
+{
+    float clock;
+
+    if (g_anim_file == NULL) return;
+    g_anim_distance += len;
+    /* moves before the first F word take no time, rapid moves use the programmed feed rate */
+    if (feedrate > 0) g_anim_time += len * 60 / feedrate;
+    g_anim_pos = *pos;
+
+    clock = g_anim_by_distance ? g_anim_distance : g_anim_time;
+    if (clock < g_anim_next) return;
+    g_anim_next = (floorf(clock / g_anim_interval) + 1) * g_anim_interval;
+    anim_frame();
+}
+
 void gcode_callback(struct gcode_ctx *ctx)
 {
 #ifdef POVRAY_ANIM_OUTPUT
@@ -156,27 +423,28 @@ void gcode_callback(struct gcode_ctx *ctx)
     static unsigned int frame = 0;
 #endif
     struct voxel_pos bak;
+    struct gvector diff;
 
-    g_tool->pos.x = (ctx->pos.x / g_resolution);
-    if (g_x_mirror) g_tool->pos.x += g_workpart.width;
-    g_tool->pos.y = (ctx->pos.y / g_resolution);
-    g_tool->pos.z = ((ctx->pos.z + 1.6) / g_resolution);
+    save_state();
+    gcode_to_stamp(&g_tool->pos, &ctx->pos);
     // center tool before difference
     bak = g_tool->pos; // backup
     g_tool->pos.x -= g_tool->width/2;
     g_tool->pos.y -= g_tool->height/2;
 
-    /* validate position */
-    if (g_tool->pos.x < 0 || g_tool->pos.x >= g_workpart.width ||
-        g_tool->pos.y < 0 || g_tool->pos.y >= g_workpart.height) {
+    /* cut out material, positions in air are not validated */
+    if (stamp_tool() &&
+        (g_tool->pos.x < 0 || g_tool->pos.x >= g_workpart.width ||
+         g_tool->pos.y < 0 || g_tool->pos.y >= g_workpart.height)) {
         /* note: it is normal to be outside in Z axis */
         fprintf(stderr, "warning: position outside of workpart (%.04f/%.04f/%.04f)\n",
                 ctx->pos.x, ctx->pos.y, ctx->pos.z);
     }
-
-    /* cut out material */
-    voxel_space_difference(&g_workpart, g_tool);
     g_tool->pos = bak; // restore
+    if (g_anim_file) {
+        gvector_sub(&diff, &ctx->pos, &g_anim_pos);
+        anim_advance(&ctx->pos, gvector_len(&diff), ctx->feedrate);
+    }
 
 #ifdef POVRAY_ANIM_OUTPUT
     cnt++;
@@ -206,12 +474,196 @@ void gcode_callback(struct gcode_ctx *ctx)
     }
 
     snprintf(filename, sizeof(filename), "povray/workpart%04u.pgm", frame);
-    voxel_space_to_pgm(&g_workpart, filename);
+    if (g_tiled) tilesim_flush(&g_tilesim);
+    workpart_to_pgm(&g_workpart, filename);
 
     frame++;
 #endif
 }
 
+/** DDA callback: stamps the tool with its center at the given voxel. */
+static void dda_callback(void *arg, const struct voxel_pos *pos)
+{
+    struct voxel_pos bak = g_tool->pos;
+
+    (void)arg;
+    g_tool->pos.x = pos->x - (int)g_tool->width/2;
+    g_tool->pos.y = pos->y - (int)g_tool->height/2;
+    g_tool->pos.z = pos->z;
+    stamp_tool();
+    g_tool->pos = bak;
+}
+
+/**
+ * Simulates a vertical move, e.g. a drill hole, by removing the tool
+ * extruded from the lowest to the highest Z of the move at once.
+ * In step mode the voxels are the ones of the interpolated stamps.
+ *
+ * @return Zero, the move is handled completely.
+ */
+static int plunge_tool(struct gcode_move *move)
+{
+    struct stamp_cache *cache = stamp_cache_of(g_tool);
+    struct tool_profile *profile = tool_profile_of(g_tool);
+    struct voxel_pos bak = g_tool->pos;
+    struct voxel_pos lo, hi;
+    struct gvector v;
+    struct workpart_rect rect;
+    float len, step;
+    int in_air, z;
+
+    if (g_mode == MODE_STEP) {
+        /* like gcode_linear_move() the stamps start one step past the start,
+         * which is the end of the previous move or the unknown initial position */
+        v    = move->end;
+        len  = fabsf(move->end.z - move->start.z);
+        step = gcode_get_step_len();
+        if ((unsigned int)(len / step) >= 2) v.z = move->start.z + (move->end.z - move->start.z) * (step / len);
+        gcode_to_stamp(&lo, &v);
+        gcode_to_stamp(&hi, &move->end);
+    } else {
+        gcode_to_voxel(&v, &move->start);
+        lo.x = floorf(v.x);
+        lo.y = floorf(v.y);
+        lo.z = floorf(v.z);
+        gcode_to_voxel(&v, &move->end);
+        hi   = lo;
+        hi.z = floorf(v.z);
+        /* the next DDA move starts with a fresh stamp */
+        dda_reset(&g_dda);
+    }
+    if (hi.z < lo.z) {
+        z    = lo.z;
+        lo.z = hi.z;
+        hi.z = z;
+    }
+
+    g_tool->pos = lo;
+    g_tool->pos.x -= g_tool->width/2;
+    g_tool->pos.y -= g_tool->height/2;
+    rect.x0 = g_tool->pos.x;
+    rect.y0 = g_tool->pos.y;
+    rect.x1 = g_tool->pos.x + (int)g_tool->width;
+    rect.y1 = g_tool->pos.y + (int)g_tool->height;
+    in_air = airmap_is_air(&g_airmap, &rect, lo.z + profile->min_bottom);
+    if (!in_air) {
+        airmap_mark(&g_airmap, &rect, lo.z + profile->min_bottom);
+        g_num_plunges++;
+        if (g_tiled) {
+            tilesim_extrude(&g_tilesim, g_tool, profile, hi.z);
+        } else {
+            workpart_extrude(&g_workpart, g_tool, profile, hi.z);
+        }
+        if (g_tool->pos.x < 0 || g_tool->pos.x >= g_workpart.width ||
+            g_tool->pos.y < 0 || g_tool->pos.y >= g_workpart.height) {
+            fprintf(stderr, "warning: position outside of workpart (%.04f/%.04f/%.04f)\n",
+                    move->end.x, move->end.y, move->end.z);
+        }
+    }
+    /* all stamps along the move are done, the lowest one counts */
+    cache->pos   = g_tool->pos;
+    cache->valid = 1;
+    g_tool->pos  = bak;
+
+    return 0;
+}
+
+/**
+ * Simulates a complete move: removes the volume swept by the current tool
+ * (MODE_SWEEP) or stamps the tool once per voxel of the path (MODE_DDA).
+ * Vertical moves are extruded in all modes, other moves in MODE_STEP are
+ * only culled if they are in air and interpolated otherwise.
+ *
+ * @return Zero if the move was handled, 1 if it must be interpolated.
+ */
+static int simulate_move(struct gcode_move *move)
+{
+    struct tool_profile *profile = tool_profile_of(g_tool);
+    struct gvector start, end, center;
+    struct voxel_pos lo, hi;
+    struct workpart_rect rect;
+    float r, ra;
+    int z;
+
+    save_state();
+    gcode_to_voxel(&start, &move->start);
+    gcode_to_voxel(&end, &move->end);
+
+    /* columns and lowest layer touched by the move */
+    if (profile->min_bottom < 0) return 0; /* empty tool */
+    if (move->mode == ARC_NONE && move->start.x == move->end.x && move->start.y == move->end.y) {
+        return plunge_tool(move);
+    }
+    r = sqrt(profile->max_radius2) + 1;
+    if (move->mode == ARC_NONE) {
+        rect.x0 = floor(fmin(start.x, end.x) - r);
+        rect.y0 = floor(fmin(start.y, end.y) - r);
+        rect.x1 = ceil(fmax(start.x, end.x) + r) + 1;
+        rect.y1 = ceil(fmax(start.y, end.y) + r) + 1;
+    } else {
+        gcode_to_voxel(&center, &move->center);
+        ra = hypot(start.x - center.x, start.y - center.y) + r;
+        rect.x0 = floor(center.x - ra);
+        rect.y0 = floor(center.y - ra);
+        rect.x1 = ceil(center.x + ra) + 1;
+        rect.y1 = ceil(center.y + ra) + 1;
+    }
+    if (g_mode == MODE_STEP) {
+        /* the layer of the stamps, gcode_to_voxel() may round up to the next one */
+        gcode_to_stamp(&lo, &move->start);
+        gcode_to_stamp(&hi, &move->end);
+        z = ((lo.z < hi.z) ? lo.z : hi.z) + profile->min_bottom;
+    } else {
+        z = floor(fmin(start.z, end.z)) + profile->min_bottom;
+    }
+    if (airmap_is_air(&g_airmap, &rect, z)) return 0;
+    if (g_mode != MODE_DDA) airmap_mark(&g_airmap, &rect, z);
+    if (g_mode == MODE_STEP) return 1; /* the stamps validate the positions */
+
+    /* validate position */
+    if (end.x < 0 || end.x >= g_workpart.width ||
+        end.y < 0 || end.y >= g_workpart.height) {
+        /* note: it is normal to be outside in Z axis */
+        fprintf(stderr, "warning: position outside of workpart (%.04f/%.04f/%.04f)\n",
+                move->end.x, move->end.y, move->end.z);
+    }
+
+    if (g_mode == MODE_DDA) {
+        if (move->mode == ARC_NONE) {
+            dda_line(&g_dda, &start, &end);
+        } else {
+            dda_arc(&g_dda, &start, &end, &center, move->mode);
+        }
+        return 0;
+    }
+
+    if (move->mode == ARC_NONE) {
+        if (g_tiled) {
+            tilesim_sweep_line(&g_tilesim, tool_profile_of(g_tool), &start, &end);
+        } else {
+            workpart_sweep_line(&g_workpart, tool_profile_of(g_tool), &start, &end);
+        }
+    } else {
+        if (g_tiled) {
+            tilesim_sweep_arc(&g_tilesim, tool_profile_of(g_tool), &start, &end, &center, move->mode);
+        } else {
+            workpart_sweep_arc(&g_workpart, tool_profile_of(g_tool), &start, &end, &center, move->mode);
+        }
+    }
+
+    return 0;
+}
+
+/** Move callback, moves which are not interpolated advance the frame clock at once. */
+int gcode_move_callback(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    int ret = simulate_move(move);
+
+    if (ret == 0) anim_advance(&move->end, gcode_move_length(move), ctx->feedrate);
+
+    return ret;
+}
+
 void gcode_toolchange_callback(unsigned int tool)
 {
     switch (tool) {
@@ -222,6 +674,84 @@ void gcode_toolchange_callback(unsigned int tool)
         g_tool = &g_tool2;
         break;
     }
+    /* the new tool must be applied at the current position too */
+    dda_reset(&g_dda);
+}
+
+/**
+ * Simulates a GCode file by replaying its compiled toolpath.
+ * The toolpath is compiled first if necessary.
+ *
+ * @return Zero on success, -1 on error.
+ */
+static int replay_toolpath(const char *filename)
+{
+    char tpfilename[PATH_MAX];
+    struct toolpath tp;
+    int ret;
+
+    snprintf(tpfilename, sizeof(tpfilename), "%s%s", filename, TOOLPATH_SUFFIX);
+    ret = toolpath_open(&tp, filename, tpfilename);
+    if (ret != 0) return -1;
+
+    ret = toolpath_replay(&tp, gcode_callback, gcode_move_callback,
+                          gcode_toolchange_callback);
+    toolpath_close(&tp);
+
+    return ret;
+}
+
+/**
+ * Renders all frames of an animation log to frame%04u.ppm in the current
+ * directory, the rows of each frame with the threads given by -j.
+ *
+ * @return Zero on success, -1 on error.
+ */
+static int render_animation(const char *filename)
+{
+    struct animlog_reader reader;
+    struct animlog_frame_info info;
+    struct render_scene scene;
+    char framename[PATH_MAX];
+    unsigned int num_frames = 0;
+    int ret;
+
+    ret = animlog_reader_open(&reader, filename);
+    if (ret != 0) return -1;
+    ret = parallel_init(g_threads);
+    if (ret != 0) {
+        animlog_reader_close(&reader);
+        return -1;
+    }
+    printf("Rendering %ux%u frames of %s with %u threads.\n", RENDER_WIDTH, RENDER_HEIGHT,
+           filename, parallel_num_threads());
+
+    memset(&scene, 0, sizeof(scene));
+    scene.values     = reader.values;
+    scene.width      = reader.width;
+    scene.height     = reader.height;
+    scene.maxval     = reader.maxval;
+    scene.resolution = reader.resolution;
+    scene.show_tool  = 1;
+    while ((ret = animlog_reader_next(&reader, &info)) == 0) {
+        scene.tool_x        = info.tool_x;
+        scene.tool_y        = info.tool_y;
+        scene.tool_z        = info.tool_z;
+        scene.tool_diameter = info.tool_diameter;
+        snprintf(framename, sizeof(framename), "frame%04u.ppm", info.frame);
+        ret = render_ppm(&scene, RENDER_WIDTH, RENDER_HEIGHT, framename);
+        if (ret != 0) {
+            fprintf(stderr, "error: Failed to write '%s'.\n", framename);
+            break;
+        }
+        num_frames++;
+    }
+    printf("Rendered %u frames.\n", num_frames);
+    animlog_reader_close(&reader);
+    parallel_cleanup();
+
+    /* 1 is the end of the log */
+    return (ret == 1) ? 0 : -1;
 }
 
 /**
@@ -321,6 +851,32 @@ void usage(const char *appname)
     fprintf(stderr, "  -y: Applies given offset in mm at Y axis\n");
     fprintf(stderr, "  -z: Applies given offset in mm at Z axis\n");
     fprintf(stderr, "  -m: PCBGcode mirror compensation. Makes the coordinates positive by adding the PCB width.\n");
+    fprintf(stderr, "  -i: Specifies the simulation mode (default=step)\n");
+    fprintf(stderr, "      step: stamps the tool every 0.05mm along the path\n");
+    fprintf(stderr, "      sweep: removes the swept volume of each move at once\n");
+    fprintf(stderr, "      dda: stamps the tool once per voxel visited by the path\n");
+    fprintf(stderr, "  -b: Specifies the workpart backend (default=voxel)\n");
+    fprintf(stderr, "      voxel: full voxel cube\n");
+    fprintf(stderr, "      heightmap: one height per XY column (2.5D), uses much less memory\n");
+    fprintf(stderr, "      dexel: list of solid Z intervals per XY column, exact like voxel\n");
+    fprintf(stderr, "      brick: sparse voxels, memory proportional to the milled surface\n");
+    fprintf(stderr, "  -L: Specifies the memory layout of voxel spaces (default=layer)\n");
+    fprintf(stderr, "      layer: one bit plane per Z layer\n");
+    fprintf(stderr, "      column: Z columns of 64 bit words, fast top of material queries\n");
+    fprintf(stderr, "      morton: bricks of 8x8x8 voxels in one cache line, Morton order inside\n");
+    fprintf(stderr, "      Must precede -t, the tools use the same layout.\n");
+    fprintf(stderr, "  -j: Number of threads for tile-parallel simulation and -R, 0=one per CPU (default=1)\n");
+    fprintf(stderr, "  -p: Pipelined mode, parses the GCode in a separate thread\n");
+    fprintf(stderr, "  -C: Compiles the GCode to a binary toolpath <file>%s and replays it.\n", TOOLPATH_SUFFIX);
+    fprintf(stderr, "      The toolpath is reused as long as GCode file and offsets are unchanged.\n");
+    fprintf(stderr, "      Ignored together with -o, which needs to parse the GCode. Overrides -p.\n");
+    fprintf(stderr, "  -e: Maximum chord error of interpolated arcs in voxels (default=0.1)\n");
+    fprintf(stderr, "      The step mode adds points so that they are at most 0.05mm and one voxel apart.\n");
+    fprintf(stderr, "  -A: Writes an animation frame log with the changes of the height map per frame\n");
+    fprintf(stderr, "  -F: Frame interval of -A as machine time (e.g. 0.5s) or feed distance (e.g. 2mm) (default=1s)\n");
+    fprintf(stderr, "  -R: Renders the frames of an animation log to frame0000.ppm... and exits, no GCode is needed\n");
+    fprintf(stderr, "  -M: Writes the surface of the result as mesh, binary STL for *.stl, otherwise binary PLY\n");
+    fprintf(stderr, "  -a: Writes ASCII images (PGM P2, PBM P1, PPM P3) instead of binary ones (P5, P4, P6)\n");
     fprintf(stderr, "Example: ./gcodesim -W 30 -m -x-5 -o drill.gcode ~/eagle/isp_adapter/isp_adapter.bot.drill.gcode\n");
 }
 
@@ -329,8 +885,12 @@ int main(int argc, char *argv[])
     int ret;
     char filename[PATH_MAX] = "test.gcode";
     char ofilename[PATH_MAX] = "output.gcode";
+    int rewrite = 0;
     char toolfilename[PATH_MAX] = "";
     char customfilename[PATH_MAX] = "";
+    const char *render_file = NULL;
+    const char *mesh_file = NULL;
+    struct mesh mesh;
     float w = 100; /* mm */
     float h = 80; /* mm */
     float t = 1.6; /* mm */
@@ -344,8 +904,9 @@ int main(int argc, char *argv[])
     unsigned int z;
     int opt;
     int tool;
+    char *end;
 
-    while ((opt = getopt(argc, argv, "hW:H:r:mt:x:y:z:o:vc:")) != -1) {
+    while ((opt = getopt(argc, argv, "hW:H:r:mt:x:y:z:o:vc:i:b:L:j:pCe:aA:F:R:M:")) != -1) {
         switch (opt) {
         case 'h':
             usage(argv[0]);
@@ -408,6 +969,7 @@ int main(int argc, char *argv[])
         case 'o':
             strncpy(ofilename, optarg, sizeof(ofilename));
             gcode_set_output(ofilename);
+            rewrite = 1;
             break;
         case 'c':
             strncpy(customfilename, optarg, sizeof(customfilename));
@@ -420,29 +982,127 @@ int main(int argc, char *argv[])
         case 'v':
             gcode_verbose();
             break;
+        case 'i':
+            if (strcmp(optarg, "step") == 0) {
+                g_mode = MODE_STEP;
+            } else if (strcmp(optarg, "sweep") == 0) {
+                g_mode = MODE_SWEEP;
+            } else if (strcmp(optarg, "dda") == 0) {
+                g_mode = MODE_DDA;
+            } else {
+                fprintf(stderr, "error: unknown simulation mode '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            ret = workpart_backend_parse(optarg, &g_backend);
+            if (ret != 0) {
+                fprintf(stderr, "error: unknown workpart backend '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            ret = voxel_layout_parse(optarg, &g_layout);
+            if (ret != 0) {
+                fprintf(stderr, "error: unknown voxel layout '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'j':
+            g_threads = atoi(optarg);
+            break;
+        case 'p':
+            g_pipelined = 1;
+            break;
+        case 'C':
+            g_compiled = 1;
+            break;
+        case 'e':
+            g_arc_tolerance = atof(optarg);
+            if (g_arc_tolerance <= 0) {
+                fprintf(stderr, "error: invalid arc tolerance '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a':
+            pnm_set_format(PNM_ASCII);
+            break;
+        case 'A':
+            g_anim_file = optarg;
+            break;
+        case 'R':
+            render_file = optarg;
+            break;
+        case 'M':
+            mesh_file = optarg;
+            break;
+        case 'F':
+            g_anim_interval = strtof(optarg, &end);
+            if (strcmp(end, "mm") == 0) {
+                g_anim_by_distance = 1;
+            } else if (*end != 0 && strcmp(end, "s") != 0) {
+                g_anim_interval = 0;
+            }
+            if (g_anim_interval <= 0) {
+                fprintf(stderr, "error: invalid frame interval '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         default: /* '?' */
             usage(argv[0]);
             exit(EXIT_FAILURE);
         }
     }
 
+    if (render_file) {
+        ret = render_animation(render_file);
+        if (ret != 0) {
+            fprintf(stderr, "error: Failed to render '%s'.\n", render_file);
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
     while (argc <= optind) {
         fprintf(stderr, "error: No filename was given.\n");
         usage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    if (g_compiled && g_pipelined && !rewrite) {
+        fprintf(stderr, "warning: -p has no effect together with -C, the toolpath is replayed without parsing.\n");
+    }
+
     gcode_set_offset(offset_x, offset_y, offset_z);
+    gcode_set_arc_tolerance(g_arc_tolerance * g_resolution);
+    /* the stamps of arcs are as dense as those of linear moves but at most
+     * one voxel apart, the other modes take whole arcs */
+    if (g_mode == MODE_STEP) gcode_set_arc_spacing(fminf(gcode_get_step_len(), g_resolution));
 
     x = w / g_resolution;
     y = h / g_resolution;
     z = t / g_resolution;
-    ret = voxel_space_init(&g_workpart, x, y, z);
+    ret = workpart_init_layout(&g_workpart, g_backend, g_layout, x, y, z);
     if (ret != 0) {
-        fprintf(stderr, "error: Failed to init voxel space.\n");
+        fprintf(stderr, "error: Failed to init workpart.\n");
         exit(EXIT_FAILURE);
     }
-    printf("Initialized voxel space [%u,%u,%u]: %u MB\n", x, y, z, (unsigned int)(g_workpart.size / 1024 / 1024));
+    printf("Initialized %s workpart [%u,%u,%u]: %u MB\n", workpart_backend_name(g_backend),
+           x, y, z, (unsigned int)(workpart_size(&g_workpart) / 1024 / 1024));
+    if (g_backend == WORKPART_VOXEL) printf("Using %s voxel layout.\n", voxel_layout_name(g_layout));
+    voxel_kernel_select(VOXEL_KERNEL_AUTO);
+    printf("Using %s voxel kernel.\n", voxel_kernel_name());
+    if (g_threads != 1) {
+        ret = parallel_init(g_threads);
+        if (ret == 0) ret = tilesim_init(&g_tilesim, &g_workpart);
+        if (ret != 0) {
+            fprintf(stderr, "error: Failed to init worker threads.\n");
+            exit(EXIT_FAILURE);
+        }
+        g_tiled = 1;
+        printf("Using %u threads on %ux%u tiles.\n", parallel_num_threads(),
+               TILESIM_TILE_SIZE, TILESIM_TILE_SIZE);
+    }
 
     //create_etch_tool(&g_tool1, g_tool1_d);
     //create_drill_tool(&g_tool1, 0.15);
@@ -451,10 +1111,25 @@ int main(int argc, char *argv[])
     //create_drill_tool(&g_tool2, g_tool2_d);
     //voxel_space_to_ppm(&g_tool1, "etch");
 
-    voxel_space_set_all(&g_workpart);
+    workpart_set_all(&g_workpart);
+    ret = airmap_init(&g_airmap, &g_workpart);
+    if (ret != 0) {
+        fprintf(stderr, "error: Failed to init air map.\n");
+        exit(EXIT_FAILURE);
+    }
 #ifdef POVRAY_ANIM_OUTPUT
-    voxel_space_to_pgm(&g_workpart, "povray/workpart0000.pgm");
+    workpart_to_pgm(&g_workpart, "povray/workpart0000.pgm");
 #endif
+    if (g_anim_file) {
+        ret = animlog_init(&g_anim, g_anim_file, x, y, z, g_resolution, parallel_num_cpus());
+        if (ret != 0) {
+            fprintf(stderr, "error: Failed to create animation log '%s'.\n", g_anim_file);
+            exit(EXIT_FAILURE);
+        }
+        /* the first frame is the untouched workpart */
+        anim_frame();
+        g_anim_next = g_anim_interval;
+    }
 
 #ifdef __linux__
     /* install some signal handlers */
@@ -467,6 +1142,7 @@ int main(int argc, char *argv[])
 
     /* parse all given gcode files */
     g_file_index = 1;
+    dda_init(&g_dda, dda_callback, NULL);
     while (argc > optind) {
         strncpy(filename, argv[optind++], sizeof(filename));
         ret = parse_headers(filename);
@@ -483,16 +1159,67 @@ int main(int argc, char *argv[])
         voxel_space_to_d3f(&g_tool2, toolfilename);
 #endif
 
-        gcode_parse(filename, gcode_callback, gcode_toolchange_callback);
+        if (g_compiled && !rewrite) {
+            /* rewriting the GCode needs the text, so -o always parses */
+            ret = replay_toolpath(filename);
+        } else if (g_pipelined) {
+            ret = pipeline_parse(filename, gcode_callback, gcode_move_callback,
+                                 gcode_toolchange_callback);
+        } else {
+            ret = gcode_parse(filename, gcode_callback, gcode_move_callback,
+                              gcode_toolchange_callback);
+        }
+        if (ret != 0) {
+            fprintf(stderr, "error: could not parse '%s'.\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        if (g_tiled) tilesim_flush(&g_tilesim);
         g_file_index++;
     }
+    if (g_mode != MODE_SWEEP) {
+        printf("Stamped %lu tool positions (%lu incremental), skipped %lu redundant stamps.\n",
+               g_num_stamps, g_num_deltas, g_num_skipped);
+    }
+    printf("Extruded %lu vertical moves.\n", g_num_plunges);
+    printf("Culled %lu of %lu tool positions and moves in air, %lu tile updates.\n",
+           g_airmap.num_culled, g_airmap.num_checks, g_airmap.num_updates);
+    if (g_anim_file) {
+        anim_frame();
+        ret = animlog_close(&g_anim);
+        printf("Wrote %u animation frames to %s (%lu kB).\n", g_anim.num_frames, g_anim_file,
+               (unsigned long)(g_anim.size / 1024));
+        if (ret != 0) fprintf(stderr, "error: Failed to write animation log '%s'.\n", g_anim_file);
+    }
+    /* a pending snapshot must not replace the result */
+    snapshot_clear(&g_snapshot);
     printf("Saving result to workpart.pgm.\n");
-    voxel_space_to_pgm(&g_workpart, "workpart.pgm");
-    //voxel_space_to_d3f(&g_workpart, "workpart.d3f");
+    workpart_to_pgm(&g_workpart, "workpart.pgm");
+    //voxel_space_to_d3f(&g_workpart.voxel, "workpart.d3f");
+    if (mesh_file) {
+        ret = mesh_init(&mesh, &g_workpart, g_resolution);
+        if (ret == 0) ret = mesh_write(&mesh, mesh_file);
+        if (ret == 0) {
+            printf("Wrote surface mesh with %lu vertices and %lu faces to %s (%lu kB).\n",
+                   (unsigned long)mesh.num_vertices, (unsigned long)mesh.num_faces, mesh_file,
+                   (unsigned long)(mesh.size / 1024));
+        } else {
+            fprintf(stderr, "error: Failed to write mesh '%s'.\n", mesh_file);
+        }
+        mesh_clear(&mesh);
+    }
 
-    voxel_space_clear(&g_workpart);
+    if (g_tiled) {
+        tilesim_clear(&g_tilesim);
+        parallel_cleanup();
+    }
+    airmap_clear(&g_airmap);
+    workpart_clear(&g_workpart);
     voxel_space_clear(&g_tool1);
     voxel_space_clear(&g_tool2);
+    tool_profile_clear(&g_profile1);
+    tool_profile_clear(&g_profile2);
+    tool_deltas_clear(&g_deltas1);
+    tool_deltas_clear(&g_deltas2);
 
     return 0;
 }
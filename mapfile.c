@@ -0,0 +1,86 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mapfile.h"
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
+
+/**
+ * Maps a file read-only into memory. Without mmap (_WIN32) the file is
+ * read into an allocated buffer instead.
+ *
+ * @return Zero on success, -1 if the file cannot be read.
+ */
+int mapped_file_open(struct mapped_file *file, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    memset(file, 0, sizeof(*file));
+#ifdef _WIN32
+    fd = open(filename, O_RDONLY | O_BINARY);
+#else
+    fd = open(filename, O_RDONLY);
+#endif
+    if (fd == -1) return -1;
+    if (fstat(fd, &st) != 0) goto error;
+    file->size = st.st_size;
+    if (file->size == 0) {
+        close(fd);
+        return 0;
+    }
+
+#ifdef _WIN32
+    file->data = malloc(file->size);
+    if (file->data == NULL) goto error;
+    if (read(fd, file->data, file->size) != (int)file->size) goto error;
+#else
+    file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file->data == MAP_FAILED) {
+        file->data = NULL;
+        goto error;
+    }
+    madvise(file->data, file->size, MADV_SEQUENTIAL);
+#endif
+    close(fd);
+
+    return 0;
+error:
+    close(fd);
+    mapped_file_close(file);
+    return -1;
+}
+
+void mapped_file_close(struct mapped_file *file)
+{
+    if (file->data) {
+#ifdef _WIN32
+        free(file->data);
+#else
+        munmap(file->data, file->size);
+#endif
+    }
+    memset(file, 0, sizeof(*file));
+}
@@ -0,0 +1,32 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MAPFILE_H_9VCY2NRK
+#define MAPFILE_H_9VCY2NRK
+
+#include <stdlib.h>
+
+/** A read-only file in memory. */
+struct mapped_file {
+    void *data;  /**< file content, NULL for empty files */
+    size_t size;
+};
+
+int mapped_file_open(struct mapped_file *file, const char *filename);
+void mapped_file_close(struct mapped_file *file);
+
+#endif /* end of include guard: MAPFILE_H_9VCY2NRK */
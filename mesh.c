@@ -0,0 +1,907 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mesh.h"
+#include "parallel.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The voxels are the samples, a cell is the cube between the centers of
+ * 2x2x2 voxels. Voxels outside of the workpart are empty. Each slab owns
+ * the cell layers [c0,c1) along Y: it creates the vertices of these cells
+ * and the faces of the voxel edges of these rows. Faces of the first row
+ * also use cells of the last layer of the previous slab. The slab
+ * computes this layer again but only notes the cells, their indices are
+ * resolved once all slabs know the global index of their first vertex.
+ * So each vertex exists once and the slabs are welded.
+ *
+ * Flat areas, where the 3x3 voxels on one side of a quad are solid and
+ * the ones on the other side are empty, are merged into rectangles per
+ * plane. The polygon of a rectangle runs through all vertices of its
+ * border, so the neighbours share all edges. A vertex which no face uses
+ * as corner lies on straight edges only and is removed from all of its
+ * polygons. For the layers shared by two slabs both decide the same once
+ * both are extracted. The planes of an axis are spanned by the axes (u,v), so that
+ * (u,v,axis) is right-handed: (y,z) for X, (z,x) for Y and (x,y) for Z.
+ */
+
+/** Flags a cell of the previous slab in the faces of a slab. */
+#define MESH_FOREIGN 0x80000000u
+/** Flags a vertex on a straight edge of a polygon in the faces of a slab, not a corner. */
+#define MESH_EDGE 0x40000000u
+/** Cell without vertex. */
+#define MESH_NONE 0xffffffffu
+/** Maximum edge length of merged rectangles, the PLY vertex count of a face is one byte. */
+#define MESH_MAX_EDGE 63
+#define MESH_PLY_VERTEX_SIZE 12
+#define MESH_STL_HEADER_SIZE 84
+#define MESH_STL_FACE_SIZE   50
+#define MESH_HEADER_SIZE     256
+
+struct mesh_slab {
+    int c0, c1;              /**< cell layers [c0,c1), layer c is between voxel rows c and c + 1 */
+    float *vertices;         /**< x, y, z in mm */
+    size_t num_vertices;
+    size_t max_vertices;
+    uint32_t *faces;         /**< per face the number of vertices and the vertex indices, local until resolved */
+    size_t faces_len;
+    size_t faces_size;
+    size_t num_faces;
+    size_t num_triangles;    /**< triangles of the faces in STL files */
+    uint32_t *last;          /**< local vertex indices of the cells of layer c1 - 1 */
+    uint8_t *last_corner;    /**< per cell of layer c1 - 1: a face of this slab has a corner at its vertex */
+    uint8_t *foreign_corner; /**< per cell of layer c0 - 1: a face of this slab has a corner at its vertex */
+    uint32_t offset;         /**< global index of the first vertex */
+    uint8_t *out;            /**< encoded vertices (PLY) and faces */
+    size_t out_vertices;
+    size_t out_len;
+    int error;
+};
+
+/** Arguments of the parallel_for() callbacks. */
+struct mesh_job {
+    struct mesh *mesh;
+    struct workpart *wp;
+    float resolution;
+    enum mesh_format format;
+};
+
+/** State of the extraction of one slab. */
+struct mesh_build {
+    struct mesh_slab *slab;
+    int width;
+    int thickness;
+    int stride;              /**< voxels per column of a row, with border */
+    int cells;               /**< cells per column of a layer */
+    size_t layer_size;
+    uint32_t *index;         /**< vertex of each cell of the layers c0 - 1 to c1 - 1 */
+    struct mesh_planes *planes[3];
+};
+
+/** Flat quads of the planes of one axis of a slab. */
+struct mesh_planes {
+    int axis;                /**< 0 = X, 1 = Y, 2 = Z */
+    int p0, num_planes;      /**< first plane and number of planes */
+    int u0, nu;              /**< first u and number of quads along u */
+    int v0, nv;
+    uint8_t *flat;           /**< per orientation, plane, v and u, orientation 1 is solid on the upper side */
+};
+
+/**
+ * Position of the vertex of a cell for each combination of solid corners,
+ * the mean of the midpoints of the edges between solid and empty corners.
+ * Corner i is at x = i & 1, y = (i >> 1) & 1, z = (i >> 2) & 1.
+ */
+static float g_mesh_vertex[256][3];
+static int g_mesh_vertex_init = 0;
+
+static void mesh_vertex_init(void)
+{
+    int mask, i, bit, n;
+    float *v;
+
+    if (g_mesh_vertex_init) return;
+    for (mask = 1; mask < 255; ++mask) {
+        v = g_mesh_vertex[mask];
+        n = 0;
+        for (i = 0; i < 8; ++i) {
+            for (bit = 1; bit < 8; bit <<= 1) {
+                if ((i & bit) || ((mask >> i) & 1) == ((mask >> (i | bit)) & 1)) continue;
+                v[0] += (i & 1) + ((bit == 1) ? 0.5f : 0);
+                v[1] += ((i >> 1) & 1) + ((bit == 2) ? 0.5f : 0);
+                v[2] += ((i >> 2) & 1) + ((bit == 4) ? 0.5f : 0);
+                n++;
+            }
+        }
+        v[0] /= n;
+        v[1] /= n;
+        v[2] /= n;
+    }
+    g_mesh_vertex_init = 1;
+}
+
+/** Fills a row of voxels, 1 for solid ones, including a border of empty voxels. */
+static void mesh_fill_row(struct workpart *wp, int y, uint8_t *row)
+{
+    int x, z, top, stride = wp->thickness + 2;
+    uint8_t *col;
+
+    memset(row, 0, (wp->width + 2) * stride);
+    if (y < 0 || y >= (int)wp->height) return;
+    for (x = 0; x < (int)wp->width; ++x) {
+        top = workpart_get_top(wp, x, y);
+        col = row + (x + 1) * stride + 1;
+        for (z = 0; z < top; ++z) col[z] = (workpart_get_xyz(wp, x, y, z) == 1);
+    }
+}
+
+static uint32_t mesh_add_vertex(struct mesh_slab *slab, float x, float y, float z)
+{
+    float *v;
+
+    if (slab->num_vertices == slab->max_vertices) {
+        slab->max_vertices = slab->max_vertices ? 2 * slab->max_vertices : 4096;
+        v = realloc(slab->vertices, slab->max_vertices * 3 * sizeof(*v));
+        if (v == NULL) {
+            slab->error = 1;
+            slab->num_vertices = 0;
+        } else {
+            slab->vertices = v;
+        }
+    }
+    if (slab->error) return 0;
+    v = &slab->vertices[3 * slab->num_vertices];
+    v[0] = x;
+    v[1] = y;
+    v[2] = z;
+
+    return slab->num_vertices++;
+}
+
+/** Reserves a face of n vertices and returns the place of its vertex indices. */
+static uint32_t *mesh_add_face(struct mesh_slab *slab, unsigned int n)
+{
+    uint32_t *f;
+
+    if (slab->faces_len + n + 1 > slab->faces_size) {
+        slab->faces_size = slab->faces_size ? 2 * slab->faces_size : 16384;
+        f = realloc(slab->faces, slab->faces_size * sizeof(*f));
+        if (f == NULL) {
+            slab->error = 1;
+            slab->faces_len = 0;
+        } else {
+            slab->faces = f;
+        }
+    }
+    if (slab->error) return NULL;
+    f = &slab->faces[slab->faces_len];
+    f[0] = n;
+    slab->faces_len += n + 1;
+    slab->num_faces++;
+    slab->num_triangles += (n == 4) ? 2 : n;
+
+    return f + 1;
+}
+
+/** Adds a quad a, b, c, d, or d, c, b, a if flip is set. */
+static void mesh_add_quad(struct mesh_slab *slab, int flip, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t *f = mesh_add_face(slab, 4);
+
+    if (f == NULL) return;
+    f[0] = flip ? d : a;
+    f[1] = flip ? c : b;
+    f[2] = flip ? b : c;
+    f[3] = flip ? a : d;
+}
+
+/** Returns the vertex indices of the cells of layer y. */
+static uint32_t *mesh_layer(struct mesh_build *b, int y)
+{
+    return &b->index[(size_t)(y - b->slab->c0 + 1) * b->layer_size];
+}
+
+/** Returns the vertex of the cell at (u,v) of plane p of an axis. */
+static uint32_t mesh_plane_cell(struct mesh_build *b, int axis, int p, int u, int v)
+{
+    int x, y, z;
+
+    switch (axis) {
+    case 0:  x = p; y = u; z = v; break;
+    case 1:  x = v; y = p; z = u; break;
+    default: x = u; y = v; z = p; break;
+    }
+
+    return mesh_layer(b, y)[(x + 1) * b->cells + z + 1];
+}
+
+/**
+ * Checks if the 3x3 voxels around the voxel q of row s0 in the plane of
+ * the axis equal it and the ones on the upper side equal the upper
+ * neighbour of q. rows are the voxel rows y - 1, y and y + 1.
+ */
+static int mesh_is_flat(const struct mesh_build *b, int axis, uint8_t *const *rows, size_t q)
+{
+    /* row and offset steps along u, v and to the upper side */
+    int u_row = 0, u_off = 0, v_row = 0, v_off = 0, up_row = 0, up_off = 0;
+    int du, dv, r;
+    uint8_t lo, hi;
+    size_t o;
+
+    switch (axis) {
+    case 0:  u_row = 1; v_off = 1; up_off = b->stride; break;
+    case 1:  u_off = 1; v_off = b->stride; up_row = 1; break;
+    default: u_off = b->stride; v_row = 1; up_off = 1; break;
+    }
+    lo = rows[1][q];
+    hi = rows[1 + up_row][q + up_off];
+    for (dv = -1; dv <= 1; ++dv) {
+        for (du = -1; du <= 1; ++du) {
+            r = 1 + du * u_row + dv * v_row;
+            o = q + du * u_off + dv * v_off;
+            if (rows[r][o] != lo || rows[r + up_row][o + up_off] != hi) return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Adds the quad of the voxel edge q of row y to the axis, or only notes
+ * it if it is part of a flat area.
+ */
+static void mesh_add_edge(struct mesh_build *b, int axis, uint8_t *const *rows, size_t q,
+                          int p, int u, int v, int upper)
+{
+    struct mesh_planes *planes = b->planes[axis];
+    size_t i;
+
+    if (mesh_is_flat(b, axis, rows, q)) {
+        i = (((size_t)upper * planes->num_planes + p - planes->p0) * planes->nv + v - planes->v0) * planes->nu + u - planes->u0;
+        planes->flat[i] = 1;
+        return;
+    }
+    mesh_add_quad(b->slab, upper, mesh_plane_cell(b, axis, p, u - 1, v - 1), mesh_plane_cell(b, axis, p, u, v - 1),
+                  mesh_plane_cell(b, axis, p, u, v), mesh_plane_cell(b, axis, p, u - 1, v));
+}
+
+/**
+ * Adds the faces of the voxel edges of row y: along Y between the rows y
+ * and y + 1 and along X and Z inside of row y. The faces point from the
+ * solid voxel to the empty one.
+ */
+static void mesh_add_quads(struct mesh_build *b, int y, uint8_t *const *rows)
+{
+    const uint8_t *s0 = rows[1], *s1 = rows[2];
+    int x, z, stride = b->stride;
+    size_t q;
+
+    for (x = -1; x < b->width; ++x) {
+        for (z = -1; z < b->thickness; ++z) {
+            q = (x + 1) * stride + z + 1;
+            if (x >= 0 && z >= 0 && s0[q] != s1[q]) mesh_add_edge(b, 1, rows, q, y, z, x, s1[q]);
+            if (z >= 0 && s0[q] != s0[q + stride]) mesh_add_edge(b, 0, rows, q, x, y, z, s0[q + stride]);
+            if (x >= 0 && s0[q] != s0[q + 1]) mesh_add_edge(b, 2, rows, q, z, x, y, s0[q + 1]);
+        }
+    }
+}
+
+/** Initializes the flat quads of an axis, planes p0 + i, u0 + i and v0 + i. */
+static int mesh_planes_init(struct mesh_planes *planes, int axis, int p0, int num_planes, int u0, int nu, int v0, int nv)
+{
+    planes->axis       = axis;
+    planes->p0         = p0;
+    planes->num_planes = num_planes;
+    planes->u0         = u0;
+    planes->nu         = nu;
+    planes->v0         = v0;
+    planes->nv         = nv;
+    planes->flat       = calloc(2 * (size_t)num_planes * nu * nv + 1, 1);
+
+    return (planes->flat == NULL) ? -1 : 0;
+}
+
+static void mesh_border_cell(int *cell, int u, int v)
+{
+    cell[0] = u;
+    cell[1] = v;
+}
+
+/**
+ * Merges the flat quads of each plane into rectangles. The polygon of a
+ * rectangle runs along the cells of its border, counterclockwise seen
+ * from the empty side.
+ */
+static void mesh_add_rectangles(struct mesh_build *b, struct mesh_planes *planes)
+{
+    size_t plane_size = (size_t)planes->nu * planes->nv;
+    int upper, p, u, v, w, h, i, n, k, ok;
+    int cells[4 * MESH_MAX_EDGE][2];
+    uint8_t *flat, *next;
+    uint32_t *f;
+
+    for (upper = 0; upper < 2; ++upper) {
+        for (p = 0; p < planes->num_planes; ++p) {
+            flat = &planes->flat[((size_t)upper * planes->num_planes + p) * plane_size];
+            for (v = 0; v < planes->nv; ++v) {
+                /* most quads are not flat, memchr() skips them fast */
+                for (u = 0; (next = memchr(&flat[v * planes->nu + u], 1, planes->nu - u)) != NULL; u += w) {
+                    u = next - &flat[v * planes->nu];
+                    for (w = 1; u + w < planes->nu && w < MESH_MAX_EDGE && flat[v * planes->nu + u + w]; ++w) {}
+                    for (h = 1, ok = 1; v + h < planes->nv && h < MESH_MAX_EDGE && ok; h += ok) {
+                        for (i = 0; i < w && ok; ++i) ok = flat[(v + h) * planes->nu + u + i];
+                    }
+                    for (i = 0; i < h; ++i) memset(&flat[(v + i) * planes->nu + u], 0, w);
+
+                    /* cells of the border, starting at the lower left corner */
+                    n = 0;
+                    for (i = 0; i < w; ++i) mesh_border_cell(cells[n++], u - 1 + i, v - 1);
+                    for (i = 0; i < h; ++i) mesh_border_cell(cells[n++], u - 1 + w, v - 1 + i);
+                    for (i = 0; i < w; ++i) mesh_border_cell(cells[n++], u - 1 + w - i, v - 1 + h);
+                    for (i = 0; i < h; ++i) mesh_border_cell(cells[n++], u - 1, v - 1 + h - i);
+                    f = mesh_add_face(b->slab, n);
+                    if (f == NULL) return;
+                    for (i = 0; i < n; ++i) {
+                        k = upper ? n - 1 - i : i;
+                        f[i] = mesh_plane_cell(b, planes->axis, planes->p0 + p, planes->u0 + cells[k][0],
+                                               planes->v0 + cells[k][1]);
+                        if (k != 0 && k != w && k != w + h && k != 2 * w + h) f[i] |= MESH_EDGE;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Removes the vertices on straight edges from the polygons and drops the
+ * vertices which are not used by any face. The vertices of the shared
+ * layers keep their flags, mesh_weld_slab() decides about them.
+ */
+static int mesh_compact(struct mesh_build *b)
+{
+    struct mesh_slab *slab = b->slab;
+    uint32_t *map, *last = mesh_layer(b, slab->c1 - 1), *f = slab->faces;
+    size_t i, k, n, m, len = 0, num_used = 0;
+    uint8_t *corner;
+    uint32_t index;
+
+    map    = malloc(slab->num_vertices * sizeof(*map) + 1);
+    corner = calloc(slab->num_vertices + 1, 1);
+    slab->last           = malloc(b->layer_size * sizeof(*slab->last));
+    slab->last_corner    = calloc(b->layer_size, 1);
+    slab->foreign_corner = calloc(b->layer_size, 1);
+    if (map == NULL || corner == NULL || slab->last == NULL || slab->last_corner == NULL || slab->foreign_corner == NULL) {
+        free(map);
+        free(corner);
+        return -1;
+    }
+    for (i = 0; i < slab->faces_len; i += f[i] + 1) {
+        for (k = i + 1; k <= i + f[i]; ++k) {
+            if (f[k] & MESH_EDGE) continue;
+            if (f[k] & MESH_FOREIGN) {
+                slab->foreign_corner[f[k] & ~MESH_FOREIGN] = 1;
+            } else {
+                corner[f[k]] = 1;
+            }
+        }
+    }
+    /* the shared layer is marked with 2 */
+    for (i = 0; i < b->layer_size; ++i) {
+        if (last[i] == MESH_NONE) continue;
+        slab->last_corner[i] = corner[last[i]];
+        corner[last[i]] = 2;
+    }
+
+    /* the faces only shrink, so they are rewritten in place */
+    slab->num_triangles = 0;
+    memset(map, 0xff, slab->num_vertices * sizeof(*map));
+    for (i = 0; i < slab->faces_len; i += n + 1) {
+        n = f[i];
+        for (k = i + 1, m = 0; k <= i + n; ++k) {
+            index = f[k];
+            if (!(index & MESH_FOREIGN)) {
+                index &= ~MESH_EDGE;
+                if (!corner[index]) continue;
+                map[index] = 0;
+                if (corner[index] == 1) f[k] = index;
+            }
+            f[len + 1 + m++] = f[k];
+        }
+        f[len] = m;
+        slab->num_triangles += (m == 4) ? 2 : m;
+        len += m + 1;
+    }
+    slab->faces_len = len;
+    free(corner);
+
+    for (i = 0; i < b->layer_size; ++i) {
+        if (last[i] != MESH_NONE) map[last[i]] = 0;
+    }
+    for (i = 0; i < slab->num_vertices; ++i) {
+        if (map[i] == MESH_NONE) continue;
+        map[i] = num_used;
+        memmove(&slab->vertices[3 * num_used++], &slab->vertices[3 * i], 3 * sizeof(float));
+    }
+    slab->num_vertices = num_used;
+
+    for (i = 0; i < slab->faces_len; i += f[i] + 1) {
+        for (k = i + 1; k <= i + f[i]; ++k) {
+            if (!(f[k] & MESH_FOREIGN)) f[k] = map[f[k] & ~MESH_EDGE] | (f[k] & MESH_EDGE);
+        }
+    }
+    for (i = 0; i < b->layer_size; ++i) slab->last[i] = (last[i] != MESH_NONE) ? map[last[i]] : MESH_NONE;
+    free(map);
+
+    return 0;
+}
+
+/** parallel_for() callback, extracts the surface of one slab. */
+static void mesh_build_slab(void *arg, size_t index)
+{
+    struct mesh_job *job = arg;
+    struct mesh_slab *slab = &job->mesh->slabs[index];
+    struct workpart *wp = job->wp;
+    struct mesh_build b;
+    struct mesh_planes planes[3];
+    size_t row_size, p;
+    uint8_t *buf[3], *rows[3], *s0, *s1, *tmp;
+    uint32_t *cur, c;
+    const float *v;
+    float res = job->resolution;
+    int i, x, y, z, mask, row0, ret = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.slab       = slab;
+    b.width      = wp->width;
+    b.thickness  = wp->thickness;
+    b.stride     = b.thickness + 2;
+    b.cells      = b.thickness + 1;
+    b.layer_size = (size_t)(b.width + 1) * b.cells;
+    row_size     = (size_t)(b.width + 2) * b.stride;
+    /* voxel row -1 has no edges along X and Z */
+    row0 = (slab->c0 > 0) ? slab->c0 : 0;
+
+    memset(planes, 0, sizeof(planes));
+    for (i = 0; i < 3; ++i) {
+        b.planes[i] = &planes[i];
+        buf[i] = malloc(row_size);
+        if (buf[i] == NULL) ret = -1;
+    }
+    b.index = malloc((slab->c1 - slab->c0 + 1) * b.layer_size * sizeof(*b.index));
+    if (b.index == NULL) ret = -1;
+    if (mesh_planes_init(&planes[0], 0, -1, b.width + 1, row0, slab->c1 - row0, 0, b.thickness) != 0) ret = -1;
+    if (mesh_planes_init(&planes[1], 1, slab->c0, slab->c1 - slab->c0, 0, b.thickness, 0, b.width) != 0) ret = -1;
+    if (mesh_planes_init(&planes[2], 2, -1, b.thickness + 1, 0, b.width, row0, slab->c1 - row0) != 0) ret = -1;
+    if (ret != 0) {
+        slab->error = 1;
+        goto done;
+    }
+
+    /* voxel row -1 is empty, so the first slab has no faces with a previous layer */
+    y = (slab->c0 > -1) ? slab->c0 - 1 : slab->c0;
+    for (i = 0; i < 3; ++i) rows[i] = buf[i];
+    mesh_fill_row(wp, y - 1, rows[0]);
+    mesh_fill_row(wp, y, rows[1]);
+    for (; y < slab->c1 && !slab->error; ++y) {
+        s0 = rows[1];
+        s1 = rows[2];
+        mesh_fill_row(wp, y + 1, s1);
+        cur = mesh_layer(&b, y);
+        memset(cur, 0xff, b.layer_size * sizeof(*cur));
+        for (x = -1; x < b.width; ++x) {
+            for (z = -1; z < b.thickness; ++z) {
+                p = (x + 1) * b.stride + z + 1;
+                mask = s0[p] | (s0[p + b.stride] << 1) | (s1[p] << 2) | (s1[p + b.stride] << 3) |
+                       (s0[p + 1] << 4) | (s0[p + b.stride + 1] << 5) | (s1[p + 1] << 6) | (s1[p + b.stride + 1] << 7);
+                if (mask == 0 || mask == 255) continue;
+                c = (x + 1) * b.cells + z + 1;
+                if (y < slab->c0) {
+                    cur[c] = MESH_FOREIGN | c;
+                    continue;
+                }
+                v = g_mesh_vertex[mask];
+                cur[c] = mesh_add_vertex(slab, (x + v[0] + 0.5f) * res, (y + v[1] + 0.5f) * res, (z + v[2] + 0.5f) * res);
+            }
+        }
+        if (y >= slab->c0) mesh_add_quads(&b, y, rows);
+        /* the rows rotate through the three buffers */
+        tmp     = rows[0];
+        rows[0] = rows[1];
+        rows[1] = rows[2];
+        rows[2] = tmp;
+    }
+    for (i = 0; i < 3 && !slab->error; ++i) mesh_add_rectangles(&b, &planes[i]);
+    if (!slab->error && mesh_compact(&b) != 0) slab->error = 1;
+
+done:
+    for (i = 0; i < 3; ++i) {
+        free(buf[i]);
+        free(planes[i].flat);
+    }
+    free(b.index);
+}
+
+/**
+ * Checks if the vertex of cell c of the layer shared by slab and the next
+ * one lies on straight edges only. Both slabs get the same result.
+ */
+static int mesh_is_edge(const struct mesh_slab *slab, const struct mesh_slab *next, uint32_t c)
+{
+    return !slab->last_corner[c] && (next == NULL || !next->foreign_corner[c]);
+}
+
+/**
+ * parallel_for() callback, removes the vertices of the layers shared with
+ * the neighbour slabs which lie on straight edges only.
+ */
+static void mesh_weld_slab(void *arg, size_t index)
+{
+    struct mesh_job *job = arg;
+    struct mesh_slab *slab = &job->mesh->slabs[index];
+    const struct mesh_slab *prev = (index > 0) ? slab - 1 : NULL;
+    const struct mesh_slab *next = (index + 1 < job->mesh->num_slabs) ? slab + 1 : NULL;
+    size_t layer_size = (job->wp->width + 1) * (job->wp->thickness + 1);
+    size_t i, k, n, m, len = 0, first = slab->num_vertices;
+    uint32_t *f = slab->faces, *cells, e, c;
+
+    /* the vertices of the last layer are the last ones */
+    for (i = 0; i < layer_size; ++i) {
+        if (slab->last[i] != MESH_NONE) --first;
+    }
+    cells = malloc((slab->num_vertices - first) * sizeof(*cells) + 1);
+    if (cells == NULL) {
+        slab->error = 1;
+        return;
+    }
+    for (i = 0; i < layer_size; ++i) {
+        if (slab->last[i] != MESH_NONE) cells[slab->last[i] - first] = i;
+    }
+
+    slab->num_triangles = 0;
+    for (i = 0; i < slab->faces_len; i += n + 1) {
+        n = f[i];
+        for (k = i + 1, m = 0; k <= i + n; ++k) {
+            e = f[k] & ~MESH_EDGE;
+            if (f[k] & MESH_EDGE) {
+                if (e & MESH_FOREIGN) {
+                    if (mesh_is_edge(prev, slab, e & ~MESH_FOREIGN)) continue;
+                } else if (mesh_is_edge(slab, next, cells[e - first])) {
+                    continue;
+                }
+            }
+            f[len + 1 + m++] = e;
+        }
+        f[len] = m;
+        slab->num_triangles += (m == 4) ? 2 : m;
+        len += m + 1;
+    }
+    slab->faces_len = len;
+
+    /* drop the removed vertices, they are not used by the next slab either */
+    for (i = first, m = first; i < slab->num_vertices; ++i) {
+        c = cells[i - first];
+        if (mesh_is_edge(slab, next, c)) {
+            slab->last[c] = MESH_NONE;
+            cells[i - first] = MESH_NONE;
+            continue;
+        }
+        slab->last[c] = m;
+        cells[i - first] = m;
+        memmove(&slab->vertices[3 * m++], &slab->vertices[3 * i], 3 * sizeof(float));
+    }
+    slab->num_vertices = m;
+    for (i = 0; i < slab->faces_len; i += f[i] + 1) {
+        for (k = i + 1; k <= i + f[i]; ++k) {
+            if (!(f[k] & MESH_FOREIGN) && f[k] >= first) f[k] = cells[f[k] - first];
+        }
+    }
+    free(cells);
+}
+
+/** parallel_for() callback, converts the vertex indices of a slab into global ones. */
+static void mesh_resolve_slab(void *arg, size_t index)
+{
+    struct mesh_job *job = arg;
+    struct mesh_slab *slab = &job->mesh->slabs[index];
+    const struct mesh_slab *prev = (index > 0) ? slab - 1 : NULL;
+    uint32_t *f = slab->faces;
+    size_t i, k;
+
+    for (i = 0; i < slab->faces_len; i += f[i] + 1) {
+        for (k = i + 1; k <= i + f[i]; ++k) {
+            if (f[k] & MESH_FOREIGN) {
+                f[k] = prev->offset + prev->last[f[k] & ~MESH_FOREIGN];
+            } else {
+                f[k] += slab->offset;
+            }
+        }
+    }
+}
+
+/**
+ * Extracts the surface of the workpart. The slabs are processed in
+ * parallel if worker threads are running.
+ *
+ * @param mesh The mesh to initialize.
+ * @param wp The workpart.
+ * @param resolution Voxel size in mm.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int mesh_init(struct mesh *mesh, struct workpart *wp, float resolution)
+{
+    struct mesh_job job;
+    unsigned int i;
+    size_t num_vertices = 0;
+    int ret = 0;
+
+    memset(mesh, 0, sizeof(*mesh));
+    mesh_vertex_init();
+    /* cell layers -1 to height - 1 */
+    mesh->num_slabs = (wp->height + 1 + MESH_SLAB_ROWS - 1) / MESH_SLAB_ROWS;
+    mesh->slabs = calloc(mesh->num_slabs, sizeof(*mesh->slabs));
+    if (mesh->slabs == NULL) return -1;
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        mesh->slabs[i].c0 = -1 + (int)(i * MESH_SLAB_ROWS);
+        mesh->slabs[i].c1 = mesh->slabs[i].c0 + MESH_SLAB_ROWS;
+        if (mesh->slabs[i].c1 > (int)wp->height) mesh->slabs[i].c1 = wp->height;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.mesh       = mesh;
+    job.wp         = wp;
+    job.resolution = resolution;
+    /* the slabs read the height cache */
+    workpart_update_top(wp);
+    parallel_for(mesh->num_slabs, mesh_build_slab, &job);
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        if (mesh->slabs[i].error) ret = -1;
+    }
+    if (ret == 0) parallel_for(mesh->num_slabs, mesh_weld_slab, &job);
+
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        if (mesh->slabs[i].error) ret = -1;
+        mesh->slabs[i].offset = num_vertices;
+        num_vertices        += mesh->slabs[i].num_vertices;
+        mesh->num_faces     += mesh->slabs[i].num_faces;
+        mesh->num_triangles += mesh->slabs[i].num_triangles;
+    }
+    mesh->num_vertices = num_vertices;
+    if (num_vertices >= MESH_EDGE) ret = -1;
+    if (ret != 0) {
+        mesh_clear(mesh);
+        return -1;
+    }
+    parallel_for(mesh->num_slabs, mesh_resolve_slab, &job);
+
+    return 0;
+}
+
+/** Frees the memory of the mesh. */
+void mesh_clear(struct mesh *mesh)
+{
+    unsigned int i;
+
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        free(mesh->slabs[i].vertices);
+        free(mesh->slabs[i].faces);
+        free(mesh->slabs[i].last);
+        free(mesh->slabs[i].last_corner);
+        free(mesh->slabs[i].foreign_corner);
+        free(mesh->slabs[i].out);
+    }
+    free(mesh->slabs);
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+/** Returns MESH_STL for file names ending with .stl, otherwise MESH_PLY. */
+enum mesh_format mesh_format_of(const char *filename)
+{
+    const char *suffix = ".stl";
+    size_t i, len = strlen(filename);
+
+    if (len < 4) return MESH_PLY;
+    for (i = 0; i < 4; ++i) {
+        if (tolower((unsigned char)filename[len - 4 + i]) != suffix[i]) return MESH_PLY;
+    }
+
+    return MESH_STL;
+}
+
+static uint8_t *mesh_put_u32(uint8_t *p, uint32_t val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+    return p + 4;
+}
+
+static uint8_t *mesh_put_f32(uint8_t *p, float val)
+{
+    uint32_t u;
+
+    memcpy(&u, &val, sizeof(u));
+    return mesh_put_u32(p, u);
+}
+
+/** Writes an STL triangle: normal, vertices and an empty attribute. */
+static uint8_t *mesh_put_triangle(uint8_t *p, const float *a, const float *b, const float *c)
+{
+    float u[3], v[3], n[3], len;
+    int i;
+
+    for (i = 0; i < 3; ++i) {
+        u[i] = b[i] - a[i];
+        v[i] = c[i] - a[i];
+    }
+    n[0] = u[1] * v[2] - u[2] * v[1];
+    n[1] = u[2] * v[0] - u[0] * v[2];
+    n[2] = u[0] * v[1] - u[1] * v[0];
+    len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (i = 0; i < 3; ++i) p = mesh_put_f32(p, (len > 0) ? n[i] / len : 0);
+    for (i = 0; i < 3; ++i) p = mesh_put_f32(p, a[i]);
+    for (i = 0; i < 3; ++i) p = mesh_put_f32(p, b[i]);
+    for (i = 0; i < 3; ++i) p = mesh_put_f32(p, c[i]);
+    *p++ = 0;
+    *p++ = 0;
+
+    return p;
+}
+
+/** Returns the coordinates of a vertex by its global index. */
+static const float *mesh_vertex(const struct mesh_slab *slab, uint32_t index)
+{
+    /* the vertices of a face are in this slab or in the previous one */
+    if (index < slab->offset) --slab;
+    return &slab->vertices[3 * (index - slab->offset)];
+}
+
+/**
+ * Writes the triangles of a face: quads as two triangles, the polygons
+ * of merged rectangles as fan around their center, which is not on a
+ * line with any border edge.
+ */
+static uint8_t *mesh_put_face(uint8_t *p, const struct mesh_slab *slab, const uint32_t *f, unsigned int n)
+{
+    float center[3] = { 0, 0, 0 };
+    const float *v;
+    unsigned int i;
+
+    if (n == 4) {
+        p = mesh_put_triangle(p, mesh_vertex(slab, f[0]), mesh_vertex(slab, f[1]), mesh_vertex(slab, f[2]));
+        return mesh_put_triangle(p, mesh_vertex(slab, f[0]), mesh_vertex(slab, f[2]), mesh_vertex(slab, f[3]));
+    }
+    for (i = 0; i < n; ++i) {
+        v = mesh_vertex(slab, f[i]);
+        center[0] += v[0] / n;
+        center[1] += v[1] / n;
+        center[2] += v[2] / n;
+    }
+    for (i = 0; i < n; ++i) {
+        p = mesh_put_triangle(p, center, mesh_vertex(slab, f[i]), mesh_vertex(slab, f[(i + 1) % n]));
+    }
+
+    return p;
+}
+
+/** parallel_for() callback, encodes the vertices and faces of one slab. */
+static void mesh_encode_slab(void *arg, size_t index)
+{
+    struct mesh_job *job = arg;
+    struct mesh_slab *slab = &job->mesh->slabs[index];
+    const uint32_t *f = slab->faces;
+    uint8_t *p;
+    size_t i, k;
+
+    if (job->format == MESH_STL) {
+        slab->out_vertices = 0;
+        slab->out_len = slab->num_triangles * MESH_STL_FACE_SIZE;
+    } else {
+        /* a count byte and four bytes per vertex index */
+        slab->out_vertices = slab->num_vertices * MESH_PLY_VERTEX_SIZE;
+        slab->out_len = slab->out_vertices + slab->num_faces + 4 * (slab->faces_len - slab->num_faces);
+    }
+    slab->out = malloc(slab->out_len + 1);
+    if (slab->out == NULL) {
+        slab->error = 1;
+        return;
+    }
+
+    p = slab->out;
+    if (job->format == MESH_PLY) {
+        for (i = 0; i < 3 * slab->num_vertices; ++i) p = mesh_put_f32(p, slab->vertices[i]);
+    }
+    for (i = 0; i < slab->faces_len; i += f[i] + 1) {
+        if (job->format == MESH_STL) {
+            p = mesh_put_face(p, slab, &f[i + 1], f[i]);
+        } else {
+            *p++ = f[i];
+            for (k = i + 1; k <= i + f[i]; ++k) p = mesh_put_u32(p, f[k]);
+        }
+    }
+}
+
+/**
+ * Writes the mesh as binary PLY or STL, depending on the file name, see
+ * mesh_format_of(). The slabs are encoded in parallel if worker threads
+ * are running and written with one fwrite() each.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int mesh_write(struct mesh *mesh, const char *filename)
+{
+    struct mesh_job job;
+    struct mesh_slab *slab;
+    uint8_t header[MESH_HEADER_SIZE];
+    size_t hlen, n, len = 0;
+    unsigned int i;
+    int ret = 0;
+    FILE *f;
+
+    memset(&job, 0, sizeof(job));
+    job.mesh   = mesh;
+    job.format = mesh_format_of(filename);
+    if (job.format == MESH_STL) {
+        memset(header, 0, MESH_STL_HEADER_SIZE);
+        snprintf((char *)header, 80, "gcodesim workpart, units mm");
+        mesh_put_u32(header + 80, mesh->num_triangles);
+        hlen = MESH_STL_HEADER_SIZE;
+    } else {
+        hlen = snprintf((char *)header, sizeof(header),
+                        "ply\nformat binary_little_endian 1.0\ncomment gcodesim workpart, units mm\n"
+                        "element vertex %lu\nproperty float x\nproperty float y\nproperty float z\n"
+                        "element face %lu\nproperty list uchar int vertex_indices\nend_header\n",
+                        (unsigned long)mesh->num_vertices, (unsigned long)mesh->num_faces);
+    }
+
+    parallel_for(mesh->num_slabs, mesh_encode_slab, &job);
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        if (mesh->slabs[i].error) ret = -1;
+    }
+
+    f = (ret == 0) ? fopen(filename, "wb") : NULL;
+    if (f == NULL) ret = -1;
+    if (ret == 0 && fwrite(header, 1, hlen, f) != hlen) ret = -1;
+    len = hlen;
+    /* PLY has all vertices before the faces */
+    for (i = 0; i < mesh->num_slabs && ret == 0; ++i) {
+        slab = &mesh->slabs[i];
+        if (fwrite(slab->out, 1, slab->out_vertices, f) != slab->out_vertices) ret = -1;
+        len += slab->out_vertices;
+    }
+    for (i = 0; i < mesh->num_slabs && ret == 0; ++i) {
+        slab = &mesh->slabs[i];
+        n    = slab->out_len - slab->out_vertices;
+        if (fwrite(slab->out + slab->out_vertices, 1, n, f) != n) ret = -1;
+        len += n;
+    }
+    if (f && fclose(f) != 0) ret = -1;
+
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        free(mesh->slabs[i].out);
+        mesh->slabs[i].out = NULL;
+    }
+    mesh->size = len;
+
+    return ret;
+}
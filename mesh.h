@@ -0,0 +1,61 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MESH_H_Q2N5ZC8L
+#define MESH_H_Q2N5ZC8L
+
+#include <stddef.h>
+#include <stdint.h>
+#include "workpart.h"
+
+/**
+ * Number of voxel rows per slab. The slabs of a mesh are extracted in
+ * parallel, see parallel_init().
+ */
+#define MESH_SLAB_ROWS 32
+
+/** File formats of mesh_write(), selected by the suffix of the file name. */
+enum mesh_format {
+    MESH_PLY = 0, /**< binary PLY with shared vertices, quads and polygons */
+    MESH_STL      /**< binary STL, the faces split into triangles */
+};
+
+struct mesh_slab;
+
+/**
+ * Surface of the workpart extracted with surface nets: one vertex per
+ * cell of eight voxels with solid and empty voxels, one quad per pair of
+ * neighboured voxels of which one is solid. Flat areas are
+ * merged into larger polygons. Vertices are in mm, faces are
+ * counterclockwise seen from outside. The vertices and faces are stored
+ * per slab, in order.
+ */
+struct mesh {
+    size_t num_vertices;
+    size_t num_faces;
+    size_t num_triangles; /**< triangles of the faces in STL files */
+    unsigned int num_slabs;
+    struct mesh_slab *slabs;
+    uint64_t size; /**< bytes written by mesh_write() */
+};
+
+int mesh_init(struct mesh *mesh, struct workpart *wp, float resolution);
+void mesh_clear(struct mesh *mesh);
+enum mesh_format mesh_format_of(const char *filename);
+int mesh_write(struct mesh *mesh, const char *filename);
+
+#endif /* end of include guard: MESH_H_Q2N5ZC8L */
@@ -0,0 +1,178 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "parallel.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/**
+ * Persistent worker pool. The threads are created once and wait for the
+ * next parallel_for() call, the calling thread takes part in the work.
+ */
+struct parallel_pool {
+    pthread_t *threads;
+    unsigned int num_threads;  /**< number of worker threads, without the caller */
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned int generation;   /**< incremented for each parallel_for() call */
+    unsigned int active;       /**< number of workers still busy */
+    int shutdown;
+    parallel_fn fn;
+    void *arg;
+    size_t n;
+    size_t next;               /**< next work item, updated atomically */
+};
+
+static struct parallel_pool g_pool = {
+    .lock  = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done  = PTHREAD_COND_INITIALIZER
+};
+
+/** Processes work items until all are taken. */
+static void parallel_run(void)
+{
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&g_pool.next, 1, __ATOMIC_RELAXED)) < g_pool.n) {
+        g_pool.fn(g_pool.arg, i);
+    }
+}
+
+static void *parallel_worker(void *arg)
+{
+    unsigned int generation = 0;
+
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_pool.lock);
+        while (!g_pool.shutdown && g_pool.generation == generation) {
+            pthread_cond_wait(&g_pool.start, &g_pool.lock);
+        }
+        if (g_pool.shutdown) {
+            pthread_mutex_unlock(&g_pool.lock);
+            break;
+        }
+        generation = g_pool.generation;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        parallel_run();
+
+        pthread_mutex_lock(&g_pool.lock);
+        if (--g_pool.active == 0) pthread_cond_signal(&g_pool.done);
+        pthread_mutex_unlock(&g_pool.lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts the worker pool.
+ *
+ * @param num_threads Total number of threads including the caller.
+ * 0 uses one thread per CPU.
+ *
+ * @return Zero on success, -1 if the threads could not be created.
+ */
+int parallel_init(unsigned int num_threads)
+{
+    unsigned int i;
+
+    if (num_threads == 0) num_threads = parallel_num_cpus();
+    if (num_threads <= 1) return 0;
+
+    g_pool.threads = malloc((num_threads - 1) * sizeof(*g_pool.threads));
+    if (g_pool.threads == NULL) return -1;
+    g_pool.shutdown   = 0;
+    g_pool.generation = 0;
+
+    for (i = 0; i < num_threads - 1; ++i) {
+        if (pthread_create(&g_pool.threads[i], NULL, parallel_worker, NULL) != 0) {
+            g_pool.num_threads = i;
+            parallel_cleanup();
+            return -1;
+        }
+    }
+    g_pool.num_threads = num_threads - 1;
+
+    return 0;
+}
+
+/** Stops all worker threads. */
+void parallel_cleanup(void)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.shutdown = 1;
+    pthread_cond_broadcast(&g_pool.start);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    for (i = 0; i < g_pool.num_threads; ++i) {
+        pthread_join(g_pool.threads[i], NULL);
+    }
+    free(g_pool.threads);
+    g_pool.threads     = NULL;
+    g_pool.num_threads = 0;
+}
+
+/** Returns the total number of threads including the caller. */
+unsigned int parallel_num_threads(void)
+{
+    return g_pool.num_threads + 1;
+}
+
+/** Returns the number of online CPUs. */
+unsigned int parallel_num_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? n : 1;
+}
+
+/**
+ * Calls fn(arg, i) for all i in [0,n) and returns when all calls are done.
+ * The items are distributed dynamically over the pool, so the order of
+ * the calls is undefined.
+ */
+void parallel_for(size_t n, parallel_fn fn, void *arg)
+{
+    size_t i;
+
+    if (g_pool.num_threads == 0 || n <= 1) {
+        for (i = 0; i < n; ++i) fn(arg, i);
+        return;
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.fn     = fn;
+    g_pool.arg    = arg;
+    g_pool.n      = n;
+    g_pool.next   = 0;
+    g_pool.active = g_pool.num_threads;
+    g_pool.generation++;
+    pthread_cond_broadcast(&g_pool.start);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    parallel_run();
+
+    pthread_mutex_lock(&g_pool.lock);
+    while (g_pool.active > 0) {
+        pthread_cond_wait(&g_pool.done, &g_pool.lock);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+}
@@ -0,0 +1,32 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PARALLEL_H_5GZ2MTWD
+#define PARALLEL_H_5GZ2MTWD
+
+#include <stdlib.h>
+
+/** Work item callback of parallel_for(). */
+typedef void (*parallel_fn)(void *arg, size_t index);
+
+int parallel_init(unsigned int num_threads);
+void parallel_cleanup(void);
+unsigned int parallel_num_threads(void);
+unsigned int parallel_num_cpus(void);
+void parallel_for(size_t n, parallel_fn fn, void *arg);
+
+#endif /* end of include guard: PARALLEL_H_5GZ2MTWD */
@@ -0,0 +1,239 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pipeline.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+extern volatile int g_terminate;
+
+/** Number of polls before a waiting thread yields the CPU. */
+#define PIPELINE_SPIN 64
+
+enum pipeline_event_type {
+    PIPELINE_POS = 0, /**< interpolated position for newpos_cb */
+    PIPELINE_MOVE,    /**< complete move for move_cb */
+    PIPELINE_TOOL     /**< tool change */
+};
+
+struct pipeline_event {
+    enum pipeline_event_type type;
+    float feedrate; /**< feed rate of the position or move */
+    union {
+        struct gvector pos;
+        struct gcode_move move;
+        unsigned int tool;
+    } u;
+};
+
+/**
+ * Bounded single-producer/single-consumer ring.
+ * head is only written by the consumer, tail only by the producer. Both
+ * keep a cached copy of the other index to avoid touching its cache line
+ * on every event.
+ */
+struct pipeline_ring {
+    _Alignas(64) atomic_size_t head; /**< next event to consume */
+    size_t cached_tail;              /**< consumer's copy of tail */
+    _Alignas(64) atomic_size_t tail; /**< next free slot */
+    size_t cached_head;              /**< producer's copy of head */
+    _Alignas(64) atomic_int done;    /**< the producer has finished */
+    struct pipeline_event events[PIPELINE_RING_SIZE];
+};
+
+struct pipeline {
+    struct pipeline_ring ring;
+    const char *filename;
+    void (*newpos_cb)(struct gcode_ctx *ctx);
+    gcode_move_cb move_cb;
+    void (*toolchange_cb)(unsigned int tool);
+    int result;                      /**< return value of gcode_parse */
+};
+
+/* The parser callbacks have no user data, so the active pipeline is global. */
+static struct pipeline *g_pipeline = NULL;
+
+static void pipeline_wait(unsigned int *spin)
+{
+    if (++*spin >= PIPELINE_SPIN) {
+        *spin = 0;
+        sched_yield();
+    }
+}
+
+/**
+ * Appends an event, waits while the ring is full.
+ *
+ * @return Zero on success, -1 if the program is terminating.
+ */
+static int pipeline_push(struct pipeline_ring *ring, const struct pipeline_event *ev)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int spin = 0;
+
+    while (tail - ring->cached_head == PIPELINE_RING_SIZE) {
+        if (g_terminate) return -1;
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->cached_head < PIPELINE_RING_SIZE) break;
+        pipeline_wait(&spin);
+    }
+
+    ring->events[tail & (PIPELINE_RING_SIZE - 1)] = *ev;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * Takes the next event, waits while the ring is empty.
+ *
+ * @return Zero on success, -1 if the producer has finished and the ring is empty.
+ */
+static int pipeline_pop(struct pipeline_ring *ring, struct pipeline_event *ev)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int spin = 0;
+
+    while (head == ring->cached_tail) {
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head != ring->cached_tail) break;
+        /* check done before reloading tail, so the last events are not lost */
+        if (atomic_load_explicit(&ring->done, memory_order_acquire)) {
+            ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            if (head == ring->cached_tail) return -1;
+            break;
+        }
+        pipeline_wait(&spin);
+    }
+
+    *ev = ring->events[head & (PIPELINE_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+static void pipeline_newpos(struct gcode_ctx *ctx)
+{
+    struct pipeline_event ev;
+
+    ev.type     = PIPELINE_POS;
+    ev.feedrate = ctx->feedrate;
+    ev.u.pos    = ctx->pos;
+    pipeline_push(&g_pipeline->ring, &ev);
+}
+
+static int pipeline_move(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    struct pipeline_event ev;
+
+    ev.type     = PIPELINE_MOVE;
+    ev.feedrate = ctx->feedrate;
+    ev.u.move   = *move;
+    pipeline_push(&g_pipeline->ring, &ev);
+    return 0;
+}
+
+static void pipeline_toolchange(unsigned int tool)
+{
+    struct pipeline_event ev;
+
+    ev.type   = PIPELINE_TOOL;
+    ev.u.tool = tool;
+    pipeline_push(&g_pipeline->ring, &ev);
+}
+
+static void *pipeline_parser(void *arg)
+{
+    struct pipeline *p = arg;
+
+    p->result = gcode_parse(p->filename,
+                            p->newpos_cb ? pipeline_newpos : NULL,
+                            p->move_cb ? pipeline_move : NULL,
+                            p->toolchange_cb ? pipeline_toolchange : NULL);
+    atomic_store_explicit(&p->ring.done, 1, memory_order_release);
+
+    return NULL;
+}
+
+/**
+ * Same as gcode_parse(), but the file is parsed by a separate thread while
+ * the callbacks are called from the calling thread. Parser and callbacks
+ * are decoupled by a bounded queue, the parser waits when it is full.
+ * Moves which the move callback does not handle are interpolated by the
+ * calling thread. The ctx passed to the callbacks only contains the current
+ * position and feed rate.
+ *
+ * @return Zero on success, -1 if the file could not be parsed.
+ */
+int pipeline_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx), gcode_move_cb move_cb, void (*toolchange_cb)(unsigned int tool))
+{
+    struct pipeline *p;
+    struct pipeline_event ev;
+    struct gcode_ctx ctx;
+    pthread_t thread;
+    int ret;
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL) return -1;
+    p->filename      = filename;
+    p->newpos_cb     = newpos_cb;
+    p->move_cb       = move_cb;
+    p->toolchange_cb = toolchange_cb;
+    atomic_init(&p->ring.head, 0);
+    atomic_init(&p->ring.tail, 0);
+    atomic_init(&p->ring.done, 0);
+    g_pipeline = p;
+
+    if (pthread_create(&thread, NULL, pipeline_parser, p) != 0) {
+        g_pipeline = NULL;
+        free(p);
+        return -1;
+    }
+
+    gcode_ctx_init(&ctx);
+    ctx.newpos_cb = newpos_cb;
+    /* on termination stop consuming, the parser stops when it sees g_terminate */
+    while (!g_terminate && pipeline_pop(&p->ring, &ev) == 0) {
+        switch (ev.type) {
+        case PIPELINE_POS:
+            ctx.feedrate = ev.feedrate;
+            ctx.pos      = ev.u.pos;
+            newpos_cb(&ctx);
+            break;
+        case PIPELINE_MOVE:
+            ctx.feedrate = ev.feedrate;
+            ctx.pos      = ev.u.move.start;
+            if (move_cb(&ctx, &ev.u.move) != 0) {
+                /* not handled by the callback, interpolate it here */
+                gcode_replay_move(&ctx, &ev.u.move);
+            }
+            ctx.pos = ev.u.move.end;
+            break;
+        case PIPELINE_TOOL:
+            toolchange_cb(ev.u.tool);
+            break;
+        }
+    }
+
+    pthread_join(thread, NULL);
+    ret = p->result;
+    g_pipeline = NULL;
+    free(p);
+
+    return ret;
+}
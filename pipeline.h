@@ -0,0 +1,28 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PIPELINE_H_H6QZ3TLC
+#define PIPELINE_H_H6QZ3TLC
+
+#include "gcode.h"
+
+/** Number of events buffered between parser and simulation, a power of two. */
+#define PIPELINE_RING_SIZE 4096
+
+int pipeline_parse(const char *filename, void (*newpos_cb)(struct gcode_ctx *ctx), gcode_move_cb move_cb, void (*toolchange_cb)(unsigned int tool));
+
+#endif /* end of include guard: PIPELINE_H_H6QZ3TLC */
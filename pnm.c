@@ -0,0 +1,441 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pnm.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of image rows per parallel work item. */
+#define PNM_ROWS_PER_ITEM 16
+/** Maximum size of a PNM header. */
+#define PNM_HEADER_SIZE 64
+/** Maximum line length of the ASCII formats. */
+#define PNM_LINE_LEN 70
+
+static enum pnm_format g_format = PNM_BINARY;
+
+/** One image which is generated by parallel_for(). */
+struct pnm_job {
+    unsigned int width;
+    unsigned int height;
+    unsigned int bpp;   /**< bytes per pixel of P5 data, 0 for the other formats */
+    size_t stride;      /**< bytes per row of the packed data */
+    uint16_t *values;   /**< gray values, only for PGM */
+    uint8_t *data;      /**< packed binary rows */
+    pnm_gray_fn gray;
+    pnm_bit_fn bit;
+    pnm_rgb_fn rgb;
+    void *arg;
+};
+
+/**
+ * Selects the encoding of all following images.
+ * Binary images are much smaller and faster to write.
+ */
+void pnm_set_format(enum pnm_format format)
+{
+    g_format = format;
+}
+
+/** Fills and packs the rows of one work item. */
+static void pnm_process_rows(void *arg, size_t index)
+{
+    struct pnm_job *job = arg;
+    unsigned int y = index * PNM_ROWS_PER_ITEM;
+    unsigned int y1 = y + PNM_ROWS_PER_ITEM;
+    unsigned int x;
+    uint16_t *values;
+    uint8_t *row;
+
+    if (y1 > job->height) y1 = job->height;
+    for (; y < y1; ++y) {
+        row = job->data + y * job->stride;
+        if (job->rgb) {
+            job->rgb(job->arg, y, row);
+            continue;
+        }
+        if (job->bit) {
+            memset(row, 0, job->stride);
+            job->bit(job->arg, y, row);
+            continue;
+        }
+        values = job->values + (size_t)y * job->width;
+        job->gray(job->arg, y, values);
+        if (job->bpp == 1) {
+            for (x = 0; x < job->width; ++x) row[x] = values[x];
+        } else if (job->bpp == 2) {
+            for (x = 0; x < job->width; ++x) {
+                row[2 * x]     = values[x] >> 8;
+                row[2 * x + 1] = values[x];
+            }
+        }
+    }
+}
+
+/** Fills all rows of the job, in parallel if worker threads are running. */
+static void pnm_process(struct pnm_job *job)
+{
+    parallel_for((job->height + PNM_ROWS_PER_ITEM - 1) / PNM_ROWS_PER_ITEM, pnm_process_rows, job);
+}
+
+/** Writes header and data with a single write. */
+static int pnm_write_file(const char *filename, const char *buf, size_t len)
+{
+    FILE *f;
+    size_t ret;
+
+    f = fopen(filename, "wb");
+    if (f == NULL) return -1;
+    ret = fwrite(buf, 1, len, f);
+    if (fclose(f) != 0 || ret != len) return -1;
+
+    return 0;
+}
+
+/** Appends the decimal value to p and returns the new end. */
+static char *pnm_format_uint(char *p, unsigned int val)
+{
+    char tmp[10];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    while (n > 0) *p++ = tmp[--n];
+
+    return p;
+}
+
+/** Formats the gray values as ASCII text, lines are wrapped at PNM_LINE_LEN. */
+static size_t pnm_format_gray(char *out, const struct pnm_job *job)
+{
+    const uint16_t *v = job->values;
+    char *p = out, *line;
+    unsigned int x, y;
+
+    for (y = 0; y < job->height; ++y) {
+        line = p;
+        for (x = 0; x < job->width; ++x, ++v) {
+            if (p - line > PNM_LINE_LEN - 6) {
+                p[-1] = '\n';
+                line  = p;
+            }
+            p = pnm_format_uint(p, *v);
+            *p++ = ' ';
+        }
+        if (p > out) p[-1] = '\n';
+    }
+
+    return p - out;
+}
+
+/** Formats the bytes of the packed rows as ASCII text, like pnm_format_gray(). */
+static size_t pnm_format_bytes(char *out, const struct pnm_job *job)
+{
+    const uint8_t *v = job->data;
+    char *p = out, *line;
+    size_t x;
+    unsigned int y;
+
+    for (y = 0; y < job->height; ++y) {
+        line = p;
+        for (x = 0; x < job->stride; ++x, ++v) {
+            if (p - line > PNM_LINE_LEN - 4) {
+                p[-1] = '\n';
+                line  = p;
+            }
+            p = pnm_format_uint(p, *v);
+            *p++ = ' ';
+        }
+        if (p > out) p[-1] = '\n';
+    }
+
+    return p - out;
+}
+
+/**
+ * Writes a grayscale image (PGM). The rows are generated by fn, in parallel
+ * if worker threads are running, and written at once.
+ *
+ * @param filename Name of the file.
+ * @param width Width in pixels.
+ * @param height Height in pixels.
+ * @param maxval Maximum gray value, up to 65535.
+ * @param fn Row callback.
+ * @param arg Argument of the row callback.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int pnm_write_pgm(const char *filename, unsigned int width, unsigned int height, unsigned int maxval, pnm_gray_fn fn, void *arg)
+{
+    struct pnm_job job;
+    size_t size, len, pixels = (size_t)width * height;
+    char *buf;
+    int hlen, ret;
+
+    if (maxval == 0 || maxval > 65535) return -1;
+
+    memset(&job, 0, sizeof(job));
+    job.width  = width;
+    job.height = height;
+    job.gray   = fn;
+    job.arg    = arg;
+    if (g_format == PNM_BINARY) {
+        job.bpp = (maxval < 256) ? 1 : 2;
+        size    = pixels * job.bpp;
+    } else {
+        /* up to 5 digits and a separator per value */
+        size    = pixels * 6 + height;
+    }
+    job.stride = (size_t)width * job.bpp;
+
+    buf         = malloc(PNM_HEADER_SIZE + size);
+    job.values  = malloc(pixels * sizeof(*job.values) + 1);
+    if (buf == NULL || job.values == NULL) {
+        free(buf);
+        free(job.values);
+        return -1;
+    }
+
+    hlen = snprintf(buf, PNM_HEADER_SIZE, "%s\n%u %u\n%u\n",
+                    (g_format == PNM_BINARY) ? "P5" : "P2", width, height, maxval);
+    job.data = (uint8_t *)buf + hlen;
+    pnm_process(&job);
+    if (g_format == PNM_BINARY) {
+        len = size;
+    } else {
+        len = pnm_format_gray(buf + hlen, &job);
+    }
+    ret = pnm_write_file(filename, buf, hlen + len);
+
+    free(job.values);
+    free(buf);
+
+    return ret;
+}
+
+/**
+ * Creates a black image in memory. The format is the one selected by
+ * pnm_set_format() at this time.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int pnm_image_init(struct pnm_image *image, unsigned int width, unsigned int height, unsigned int maxval)
+{
+    uint16_t *zero;
+    unsigned int y;
+    char tmp[PNM_HEADER_SIZE];
+    int hlen;
+
+    if (maxval == 0 || maxval > 65535) return -1;
+
+    memset(image, 0, sizeof(*image));
+    image->width  = width;
+    image->height = height;
+    image->format = g_format;
+    if (g_format == PNM_BINARY) {
+        image->bpp    = (maxval < 256) ? 1 : 2;
+        image->stride = (size_t)width * image->bpp;
+    } else {
+        image->digits = pnm_format_uint(tmp, maxval) - tmp;
+        image->stride = (size_t)width * (image->digits + 1);
+    }
+
+    hlen = snprintf(tmp, PNM_HEADER_SIZE, "%s\n%u %u\n%u\n",
+                    (g_format == PNM_BINARY) ? "P5" : "P2", width, height, maxval);
+    image->hlen = hlen;
+    image->buf  = malloc(image->hlen + image->stride * height);
+    if (image->buf == NULL) return -1;
+    memcpy(image->buf, tmp, hlen);
+    if (g_format == PNM_BINARY) {
+        memset(image->buf + hlen, 0, image->stride * height);
+        return 0;
+    }
+
+    zero = calloc(width + 1, sizeof(*zero));
+    if (zero == NULL) {
+        pnm_image_clear(image);
+        return -1;
+    }
+    for (y = 0; y < height; ++y) pnm_image_set_row(image, y, zero);
+    free(zero);
+
+    return 0;
+}
+
+void pnm_image_clear(struct pnm_image *image)
+{
+    free(image->buf);
+    image->buf = NULL;
+}
+
+/**
+ * Encodes the gray values of image row y, row 0 is the top row.
+ * ASCII values are right aligned, lines are wrapped at PNM_LINE_LEN.
+ */
+void pnm_image_set_row(struct pnm_image *image, unsigned int y, const uint16_t *values)
+{
+    uint8_t *row = (uint8_t *)image->buf + image->hlen + y * image->stride;
+    unsigned int x, i, per_line, val;
+    char *p;
+
+    if (image->format == PNM_BINARY) {
+        if (image->bpp == 1) {
+            for (x = 0; x < image->width; ++x) row[x] = values[x];
+        } else {
+            for (x = 0; x < image->width; ++x) {
+                row[2 * x]     = values[x] >> 8;
+                row[2 * x + 1] = values[x];
+            }
+        }
+        return;
+    }
+
+    per_line = PNM_LINE_LEN / (image->digits + 1);
+    p = (char *)row;
+    for (x = 0; x < image->width; ++x) {
+        val = values[x];
+        i   = image->digits;
+        do {
+            p[--i] = '0' + val % 10;
+            val /= 10;
+        } while (val && i > 0);
+        while (i > 0) p[--i] = ' ';
+        p += image->digits;
+        *p++ = (x % per_line == per_line - 1 || x == image->width - 1) ? '\n' : ' ';
+    }
+}
+
+/** Writes the image with a single write. */
+int pnm_image_write(struct pnm_image *image, const char *filename)
+{
+    return pnm_write_file(filename, image->buf, image->hlen + image->stride * image->height);
+}
+
+/**
+ * Writes a black and white image (PBM). The rows are generated by fn, in
+ * parallel if worker threads are running, and written at once.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int pnm_write_pbm(const char *filename, unsigned int width, unsigned int height, pnm_bit_fn fn, void *arg)
+{
+    struct pnm_job job;
+    size_t size, len;
+    unsigned int x, y;
+    char *buf, *p, *line;
+    uint8_t *row;
+    int hlen, ret;
+
+    memset(&job, 0, sizeof(job));
+    job.width  = width;
+    job.height = height;
+    job.stride = (width + 7) / 8;
+    job.bit    = fn;
+    job.arg    = arg;
+
+    size = job.stride * height;
+    if (g_format == PNM_ASCII) {
+        /* the packed rows are stored behind the text */
+        size += (size_t)width * height + height + width * height / PNM_LINE_LEN;
+    }
+    buf = malloc(PNM_HEADER_SIZE + size);
+    if (buf == NULL) return -1;
+
+    hlen = snprintf(buf, PNM_HEADER_SIZE, "%s\n%u %u\n",
+                    (g_format == PNM_BINARY) ? "P4" : "P1", width, height);
+    if (g_format == PNM_BINARY) {
+        job.data = (uint8_t *)buf + hlen;
+        pnm_process(&job);
+        len = job.stride * height;
+    } else {
+        job.data = (uint8_t *)buf + PNM_HEADER_SIZE + size - job.stride * height;
+        pnm_process(&job);
+        p = buf + hlen;
+        for (y = 0; y < height; ++y) {
+            row  = job.data + y * job.stride;
+            line = p;
+            for (x = 0; x < width; ++x) {
+                if (p - line == PNM_LINE_LEN) {
+                    *p++ = '\n';
+                    line = p;
+                }
+                *p++ = (row[x >> 3] & (0x80 >> (x & 7))) ? '1' : '0';
+            }
+            *p++ = '\n';
+        }
+        len = p - (buf + hlen);
+    }
+    ret = pnm_write_file(filename, buf, hlen + len);
+    free(buf);
+
+    return ret;
+}
+
+/**
+ * Writes a color image (PPM) with 8 bits per channel. The rows are
+ * generated by fn, in parallel if worker threads are running.
+ *
+ * @param filename Name of the file.
+ * @param width Width in pixels.
+ * @param height Height in pixels.
+ * @param fn Row callback.
+ * @param arg Argument of the row callback.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int pnm_write_ppm(const char *filename, unsigned int width, unsigned int height, pnm_rgb_fn fn, void *arg)
+{
+    struct pnm_job job;
+    size_t size, len;
+    char *buf;
+    int hlen, ret;
+
+    memset(&job, 0, sizeof(job));
+    job.width  = width;
+    job.height = height;
+    job.stride = (size_t)width * 3;
+    job.rgb    = fn;
+    job.arg    = arg;
+
+    size = job.stride * height;
+    if (g_format == PNM_ASCII) {
+        /* up to 3 digits and a separator per byte, the packed rows are stored behind the text */
+        size += size * 4;
+    }
+    buf = malloc(PNM_HEADER_SIZE + size);
+    if (buf == NULL) return -1;
+
+    hlen = snprintf(buf, PNM_HEADER_SIZE, "%s\n%u %u\n255\n",
+                    (g_format == PNM_BINARY) ? "P6" : "P3", width, height);
+    if (g_format == PNM_BINARY) {
+        job.data = (uint8_t *)buf + hlen;
+        pnm_process(&job);
+        len = size;
+    } else {
+        job.data = (uint8_t *)buf + PNM_HEADER_SIZE + size - job.stride * height;
+        pnm_process(&job);
+        len = pnm_format_bytes(buf + hlen, &job);
+    }
+    ret = pnm_write_file(filename, buf, hlen + len);
+    free(buf);
+
+    return ret;
+}
@@ -0,0 +1,72 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PNM_H_W3V8QD1X
+#define PNM_H_W3V8QD1X
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Encoding of written images. */
+enum pnm_format {
+    PNM_BINARY = 0, /**< P5 (PGM), P4 (PBM) and P6 (PPM) */
+    PNM_ASCII       /**< P2 (PGM), P1 (PBM) and P3 (PPM) */
+};
+
+/**
+ * Row callback of pnm_write_pgm(): fills the gray values of image row y,
+ * row 0 is the top row of the image.
+ */
+typedef void (*pnm_gray_fn)(void *arg, unsigned int y, uint16_t *row);
+
+/**
+ * Row callback of pnm_write_pbm(): fills image row y with one bit per pixel,
+ * most significant bit first, 1 is black. The row is zeroed before.
+ */
+typedef void (*pnm_bit_fn)(void *arg, unsigned int y, uint8_t *row);
+
+/**
+ * Row callback of pnm_write_ppm(): fills image row y with red, green and
+ * blue bytes per pixel, row 0 is the top row of the image.
+ */
+typedef void (*pnm_rgb_fn)(void *arg, unsigned int y, uint8_t *row);
+
+/**
+ * Grayscale image (PGM) kept in memory in the current format. All rows
+ * have the same encoded size, so single rows can be updated in place.
+ */
+struct pnm_image {
+    unsigned int width;
+    unsigned int height;
+    enum pnm_format format;
+    unsigned int bpp;    /**< bytes per pixel of P5 data */
+    unsigned int digits; /**< digits per value of P2 data, padded with spaces */
+    size_t hlen;         /**< size of the header */
+    size_t stride;       /**< bytes per encoded row */
+    char *buf;           /**< header and rows */
+};
+
+void pnm_set_format(enum pnm_format format);
+int pnm_write_pgm(const char *filename, unsigned int width, unsigned int height, unsigned int maxval, pnm_gray_fn fn, void *arg);
+int pnm_image_init(struct pnm_image *image, unsigned int width, unsigned int height, unsigned int maxval);
+void pnm_image_clear(struct pnm_image *image);
+void pnm_image_set_row(struct pnm_image *image, unsigned int y, const uint16_t *values);
+int pnm_image_write(struct pnm_image *image, const char *filename);
+int pnm_write_pbm(const char *filename, unsigned int width, unsigned int height, pnm_bit_fn fn, void *arg);
+int pnm_write_ppm(const char *filename, unsigned int width, unsigned int height, pnm_rgb_fn fn, void *arg);
+
+#endif /* end of include guard: PNM_H_W3V8QD1X */
@@ -1,5 +1,5 @@
 #!/bin/bash
-INPUT=frame%04d.png
+INPUT=${INPUT:-frame%04d.png}
 OUTPUT=demo.mp4
 FRAMERATE=30
 
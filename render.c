@@ -0,0 +1,417 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "render.h"
+#include "pnm.h"
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+/*
+ * Ray caster for preview frames, modelled on povray/render.pov: the camera
+ * looks from the front onto the workpart lying on a wooden table, X is to
+ * the right and Y goes away from the camera. Each voxel column is a box
+ * which is hit either on its top or on a side, so the march over the
+ * columns is a 2D DDA. Copper, FR4, tool and table are shaded with the two
+ * lights of render.pov, shadows and reflections are left out.
+ */
+
+/** Sub samples per pixel and axis (anti-aliasing). */
+#define RENDER_SAMPLES 2
+/** Thickness of the copper layer in mm. */
+#define RENDER_COPPER 0.035f
+/** Visible length of the tool in mm. */
+#define RENDER_TOOL_LENGTH 5.0f
+/** Board size of render.pov, the camera is scaled to other boards. */
+#define RENDER_POV_SIZE 23.0f
+
+struct render_vec {
+    float x, y, z;
+};
+
+enum render_material {
+    RENDER_NONE = 0,
+    RENDER_COPPER_SURFACE,
+    RENDER_FR4,
+    RENDER_TOOL,
+    RENDER_TABLE
+};
+
+/** Camera and precomputed scene geometry of one frame. */
+struct render_view {
+    const struct render_scene *scene;
+    unsigned int width;     /**< image size */
+    unsigned int height;
+    struct render_vec eye;
+    struct render_vec dir;  /**< view direction of the image center */
+    struct render_vec right;
+    struct render_vec up;
+    float aspect;
+    float size_x, size_z;   /**< workpart size in mm */
+    float thickness;        /**< mm */
+    float copper;           /**< y below which the material is FR4 */
+    float table_radius;     /**< like the clipped plane of render.pov */
+    struct render_vec tool; /**< center of the tool tip */
+    float tool_radius;
+};
+
+/** Material and surface normal of a hit. */
+struct render_hit {
+    float t;
+    enum render_material material;
+    struct render_vec n;
+};
+
+/* POV-Ray's P_Copper1 and rgb 0.8 of the tool */
+static const struct render_vec g_copper = { 0.72f, 0.45f, 0.20f };
+static const struct render_vec g_fr4    = { 0.86f, 0.84f, 0.66f };
+static const struct render_vec g_tool   = { 0.80f, 0.80f, 0.80f };
+static const struct render_vec g_wood   = { 0.55f, 0.35f, 0.18f };
+
+static struct render_vec vec(float x, float y, float z)
+{
+    struct render_vec v = { x, y, z };
+    return v;
+}
+
+static float vec_dot(struct render_vec a, struct render_vec b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static struct render_vec vec_cross(struct render_vec a, struct render_vec b)
+{
+    return vec(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static struct render_vec vec_norm(struct render_vec v)
+{
+    float len = sqrtf(vec_dot(v, v));
+    return vec(v.x / len, v.y / len, v.z / len);
+}
+
+/** Height of the material of a column in world coordinates, the surface is at 0. */
+static float render_column_top(const struct render_view *view, int i, int j)
+{
+    const struct render_scene *s = view->scene;
+    uint16_t gray = s->values[(size_t)(s->height - 1 - j) * s->width + i];
+
+    return (gray + 1) * s->resolution - view->thickness;
+}
+
+/** Returns the material at height y of the workpart. */
+static enum render_material render_workpart_material(const struct render_view *view, float y)
+{
+    return (y > view->copper) ? RENDER_COPPER_SURFACE : RENDER_FR4;
+}
+
+/**
+ * Intersects the ray with the workpart: clips it at the bounding box and
+ * walks the columns along the ray until one is hit.
+ */
+static int render_workpart(const struct render_view *view, struct render_vec o, struct render_vec d, struct render_hit *hit)
+{
+    const struct render_scene *s = view->scene;
+    float lo[3], hi[3], org[3], dir[3];
+    float t0 = 0, t1 = FLT_MAX, ta, tb, t, t_exit, tx, tz, dtx, dtz, top, y;
+    float res = s->resolution;
+    int axis = 1, a, i, j, step_i, step_j;
+
+    lo[0] = -view->size_x / 2; hi[0] = view->size_x / 2;
+    lo[1] = -view->thickness;  hi[1] = 0;
+    lo[2] = -view->size_z / 2; hi[2] = view->size_z / 2;
+    org[0] = o.x; org[1] = o.y; org[2] = o.z;
+    dir[0] = d.x; dir[1] = d.y; dir[2] = d.z;
+    for (a = 0; a < 3; ++a) {
+        if (dir[a] == 0) {
+            if (org[a] < lo[a] || org[a] > hi[a]) return 0;
+            continue;
+        }
+        ta = (lo[a] - org[a]) / dir[a];
+        tb = (hi[a] - org[a]) / dir[a];
+        if (ta > tb) {
+            t = ta; ta = tb; tb = t;
+        }
+        if (ta > t0) {
+            t0   = ta;
+            axis = a;
+        }
+        if (tb < t1) t1 = tb;
+    }
+    if (t0 > t1) return 0;
+
+    /* columns in workpart coordinates, j is the Y index of the workpart */
+    i = (int)((o.x + t0 * d.x - lo[0]) / res);
+    j = (int)((o.z + t0 * d.z - lo[2]) / res);
+    if (i < 0) i = 0;
+    if (i >= (int)s->width) i = s->width - 1;
+    if (j < 0) j = 0;
+    if (j >= (int)s->height) j = s->height - 1;
+    step_i = (d.x > 0) ? 1 : -1;
+    step_j = (d.z > 0) ? 1 : -1;
+    dtx = (d.x != 0) ? res / fabsf(d.x) : FLT_MAX;
+    dtz = (d.z != 0) ? res / fabsf(d.z) : FLT_MAX;
+    tx  = (d.x != 0) ? (lo[0] + (i + (step_i > 0)) * res - o.x) / d.x : FLT_MAX;
+    tz  = (d.z != 0) ? (lo[2] + (j + (step_j > 0)) * res - o.z) / d.z : FLT_MAX;
+
+    t = t0;
+    for (;;) {
+        top = render_column_top(view, i, j);
+        y   = o.y + t * d.y;
+        if (y <= top) {
+            /* entered the column through a side or the top of the box */
+            hit->t        = t;
+            hit->material = render_workpart_material(view, y);
+            if (axis == 0) {
+                hit->n = vec(-step_i, 0, 0);
+            } else if (axis == 2) {
+                hit->n = vec(0, 0, -step_j);
+            } else {
+                hit->n = vec(0, 1, 0);
+            }
+            return 1;
+        }
+        t_exit = (tx < tz) ? tx : tz;
+        if (t_exit > t1) t_exit = t1;
+        if (d.y < 0 && o.y + t_exit * d.y <= top) {
+            hit->t        = (top - o.y) / d.y;
+            hit->material = render_workpart_material(view, top);
+            hit->n        = vec(0, 1, 0);
+            return 1;
+        }
+        if (t_exit >= t1) return 0;
+        if (tx < tz) {
+            i   += step_i;
+            t    = tx;
+            tx  += dtx;
+            axis = 0;
+            if (i < 0 || i >= (int)s->width) return 0;
+        } else {
+            j   += step_j;
+            t    = tz;
+            tz  += dtz;
+            axis = 2;
+            if (j < 0 || j >= (int)s->height) return 0;
+        }
+    }
+}
+
+/** Intersects the ray with the tool, a vertical cylinder. */
+static int render_tool(const struct render_view *view, struct render_vec o, struct render_vec d, struct render_hit *hit)
+{
+    float r = view->tool_radius;
+    float ox = o.x - view->tool.x, oz = o.z - view->tool.z;
+    float a, b, c, disc, t, y, y_top = view->tool.y + RENDER_TOOL_LENGTH;
+
+    if (!view->scene->show_tool || r <= 0) return 0;
+    a = d.x * d.x + d.z * d.z;
+    b = ox * d.x + oz * d.z;
+    c = ox * ox + oz * oz - r * r;
+    disc = b * b - a * c;
+    if (a == 0 || disc < 0) return 0;
+    t = (-b - sqrtf(disc)) / a;
+    y = o.y + t * d.y;
+    if (t > 0 && y >= view->tool.y && y <= y_top) {
+        hit->t        = t;
+        hit->material = RENDER_TOOL;
+        hit->n        = vec((ox + t * d.x) / r, 0, (oz + t * d.z) / r);
+        return 1;
+    }
+    /* the top face, the camera looks from above */
+    if (d.y >= 0 || o.y <= y_top) return 0;
+    t  = (y_top - o.y) / d.y;
+    ox += t * d.x;
+    oz += t * d.z;
+    if (ox * ox + oz * oz > r * r) return 0;
+    hit->t        = t;
+    hit->material = RENDER_TOOL;
+    hit->n        = vec(0, 1, 0);
+    return 1;
+}
+
+/** Intersects the ray with the table below the workpart. */
+static int render_table(const struct render_view *view, struct render_vec o, struct render_vec d, struct render_hit *hit)
+{
+    float t, x, z;
+
+    if (d.y >= 0) return 0;
+    t = (-view->thickness - o.y) / d.y;
+    x = o.x + t * d.x;
+    z = o.z + t * d.z;
+    if (x * x + z * z > view->table_radius * view->table_radius) return 0;
+    hit->t        = t;
+    hit->material = RENDER_TABLE;
+    hit->n        = vec(0, 1, 0);
+    return 1;
+}
+
+/** Wood grain along X, scaled with the table. */
+static struct render_vec render_wood(const struct render_view *view, struct render_vec p)
+{
+    float s = RENDER_POV_SIZE * 4 / view->table_radius;
+    float grain = sinf(p.z * s * 0.8f + 2 * sinf(p.x * s * 0.1f) + sinf(p.z * s * 0.2f));
+    float f = 0.8f + 0.2f * grain * grain;
+
+    return vec(g_wood.x * f, g_wood.y * f, g_wood.z * f);
+}
+
+/** Shades a hit with the two lights of render.pov. */
+static struct render_vec render_shade(const struct render_view *view, const struct render_hit *hit, struct render_vec d)
+{
+    /* directions towards the lights <-140,200,300> rgb 1.5 and <140,200,-300> rgb 0.9 */
+    static const struct render_vec light[2] = {
+        { -0.3704f, 0.5291f, 0.7937f }, { 0.3624f, 0.5177f, -0.7766f }
+    };
+    static const float intensity[2] = { 1.5f, 0.9f };
+    struct render_vec p, c, h;
+    float ambient = 0.1f, diffuse = 0.6f, specular = 0, light_sum = 0, spec_sum = 0, nl, nh;
+    int k;
+
+    switch (hit->material) {
+    case RENDER_COPPER_SURFACE:
+        c = g_copper;
+        /* finish of Chain_Copper */
+        diffuse  = 0.4f;
+        specular = 1;
+        break;
+    case RENDER_FR4:
+        c = g_fr4;
+        break;
+    case RENDER_TOOL:
+        c = g_tool;
+        diffuse  = 0.5f;
+        specular = 0.6f;
+        break;
+    case RENDER_TABLE:
+        p = vec(view->eye.x + hit->t * d.x, 0, view->eye.z + hit->t * d.z);
+        c = render_wood(view, p);
+        break;
+    default:
+        return vec(0, 0, 0);
+    }
+
+    for (k = 0; k < 2; ++k) {
+        nl = vec_dot(hit->n, light[k]);
+        if (nl <= 0) continue;
+        light_sum += intensity[k] * nl;
+        if (specular == 0) continue;
+        /* Blinn highlight, a bit sharper than the default roughness of POV-Ray */
+        h  = vec_norm(vec(light[k].x - d.x, light[k].y - d.y, light[k].z - d.z));
+        nh = vec_dot(hit->n, h);
+        if (nh > 0) spec_sum += intensity[k] * powf(nh, 40);
+    }
+    /* metallic highlights take the color of the surface */
+    return vec(c.x * (ambient + diffuse * light_sum + specular * spec_sum),
+               c.y * (ambient + diffuse * light_sum + specular * spec_sum),
+               c.z * (ambient + diffuse * light_sum + specular * spec_sum));
+}
+
+/** Traces the primary ray through image position (u,v) in [0,1]. */
+static struct render_vec render_sample(const struct render_view *view, float u, float v)
+{
+    struct render_hit hit, best;
+    struct render_vec d;
+    float su = (u - 0.5f) * view->aspect, sv = 0.5f - v;
+
+    d = vec_norm(vec(view->dir.x + su * view->right.x + sv * view->up.x,
+                     view->dir.y + su * view->right.y + sv * view->up.y,
+                     view->dir.z + su * view->right.z + sv * view->up.z));
+
+    best.t        = FLT_MAX;
+    best.material = RENDER_NONE;
+    if (render_workpart(view, view->eye, d, &hit)) best = hit;
+    if (render_tool(view, view->eye, d, &hit) && hit.t < best.t) best = hit;
+    if (best.material == RENDER_NONE && render_table(view, view->eye, d, &hit)) best = hit;
+
+    return render_shade(view, &best, d);
+}
+
+static uint8_t render_byte(float c)
+{
+    if (c >= 1) return 255;
+    if (c <= 0) return 0;
+    return (uint8_t)(c * 255 + 0.5f);
+}
+
+/** Row callback of pnm_write_ppm(). */
+static void render_row(void *arg, unsigned int y, uint8_t *row)
+{
+    const struct render_view *view = arg;
+    const float n = RENDER_SAMPLES * RENDER_SAMPLES;
+    struct render_vec c, sum;
+    unsigned int x, sx, sy;
+
+    for (x = 0; x < view->width; ++x) {
+        sum = vec(0, 0, 0);
+        for (sy = 0; sy < RENDER_SAMPLES; ++sy) {
+            for (sx = 0; sx < RENDER_SAMPLES; ++sx) {
+                c = render_sample(view, (x + (sx + 0.5f) / RENDER_SAMPLES) / view->width,
+                                  (y + (sy + 0.5f) / RENDER_SAMPLES) / view->height);
+                sum.x += c.x;
+                sum.y += c.y;
+                sum.z += c.z;
+            }
+        }
+        row[3 * x]     = render_byte(sum.x / n);
+        row[3 * x + 1] = render_byte(sum.y / n);
+        row[3 * x + 2] = render_byte(sum.z / n);
+    }
+}
+
+/**
+ * Renders the scene into a PPM image. The rows are rendered in parallel
+ * if worker threads are running, see parallel_init().
+ *
+ * @param scene Height image and tool.
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param filename Name of the image file.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int render_ppm(const struct render_scene *scene, unsigned int width, unsigned int height, const char *filename)
+{
+    struct render_view view;
+    float scale;
+
+    if (scene->width == 0 || scene->height == 0 || width == 0 || height == 0) return -1;
+
+    memset(&view, 0, sizeof(view));
+    view.scene     = scene;
+    view.width     = width;
+    view.height    = height;
+    view.aspect    = (float)width / height;
+    view.size_x    = scene->width * scene->resolution;
+    view.size_z    = scene->height * scene->resolution;
+    view.thickness = scene->maxval * scene->resolution;
+    view.copper    = -(RENDER_COPPER > scene->resolution ? RENDER_COPPER : scene->resolution) + scene->resolution / 2;
+
+    /* camera of render.pov at <0,15,-25> looking at the center, scaled to the board */
+    scale = (view.size_x > view.size_z ? view.size_x : view.size_z) / RENDER_POV_SIZE;
+    view.eye          = vec(0, 15 * scale, -25 * scale);
+    view.dir          = vec_norm(vec(-view.eye.x, -view.eye.y, -view.eye.z));
+    view.right        = vec_norm(vec_cross(vec(0, 1, 0), view.dir));
+    view.up           = vec_cross(view.dir, view.right);
+    view.table_radius = 100 * scale;
+
+    view.tool        = vec(scene->tool_x * scene->resolution - view.size_x / 2,
+                           scene->tool_z * scene->resolution - view.thickness,
+                           scene->tool_y * scene->resolution - view.size_z / 2);
+    view.tool_radius = scene->tool_diameter / 2;
+
+    return pnm_write_ppm(filename, width, height, render_row, &view);
+}
@@ -0,0 +1,44 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RENDER_H_K7PX2RVM
+#define RENDER_H_K7PX2RVM
+
+#include <stdint.h>
+
+/** Default size of rendered frames. */
+#define RENDER_WIDTH  640
+#define RENDER_HEIGHT 480
+
+/**
+ * Scene of a preview frame: the height image of the workpart, as written
+ * to workpart.pgm and stored in animation logs, and the tool.
+ */
+struct render_scene {
+    const uint16_t *values;       /**< gray values, row 0 is the top row */
+    unsigned int width;
+    unsigned int height;
+    unsigned int maxval;          /**< thickness of the workpart in voxels */
+    float resolution;             /**< voxel size in mm */
+    int show_tool;
+    float tool_x, tool_y, tool_z; /**< tool center and lowest layer in voxels */
+    float tool_diameter;          /**< mm */
+};
+
+int render_ppm(const struct render_scene *scene, unsigned int width, unsigned int height, const char *filename);
+
+#endif /* end of include guard: RENDER_H_K7PX2RVM */
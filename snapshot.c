@@ -0,0 +1,164 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+/** Replaces filename by tmpname. */
+static int snapshot_rename(const char *tmpname, const char *filename)
+{
+#ifdef _WIN32
+    /* rename() fails if the target exists */
+    return MoveFileExA(tmpname, filename, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(tmpname, filename);
+#endif
+}
+
+/** Encodes the changed rows and writes the image. */
+static void snapshot_write(struct snapshot *snap)
+{
+    unsigned int y;
+
+    for (y = 0; y < snap->image.height; ++y) {
+        if (!snap->rows[y]) continue;
+        pnm_image_set_row(&snap->image, y, snap->values + (size_t)y * snap->image.width);
+        snap->rows[y] = 0;
+    }
+    if (pnm_image_write(&snap->image, snap->tmpname) != 0 ||
+        snapshot_rename(snap->tmpname, snap->filename) != 0) {
+        fprintf(stderr, "error: Failed to write snapshot '%s'.\n", snap->filename);
+    }
+}
+
+static void *snapshot_writer(void *arg)
+{
+    struct snapshot *snap = arg;
+
+    pthread_mutex_lock(&snap->lock);
+    for (;;) {
+        while (!snap->pending && !snap->shutdown) pthread_cond_wait(&snap->cond, &snap->lock);
+        if (!snap->pending) break;
+        pthread_mutex_unlock(&snap->lock);
+        snapshot_write(snap);
+        pthread_mutex_lock(&snap->lock);
+        snap->pending = 0;
+        pthread_cond_broadcast(&snap->cond);
+    }
+    pthread_mutex_unlock(&snap->lock);
+
+    return NULL;
+}
+
+/**
+ * Creates a black image and starts the writer thread. Nothing is written
+ * before the first snapshot_submit().
+ *
+ * @return Zero on success, -1 on error.
+ */
+int snapshot_init(struct snapshot *snap, const char *filename, unsigned int width, unsigned int height, unsigned int maxval)
+{
+    size_t len = strlen(filename);
+
+    memset(snap, 0, sizeof(*snap));
+    if (pnm_image_init(&snap->image, width, height, maxval) != 0) return -1;
+    snap->values   = calloc((size_t)width * height, sizeof(*snap->values));
+    snap->rows     = calloc(height, 1);
+    snap->filename = malloc(len + 1);
+    snap->tmpname  = malloc(len + 5);
+    if (snap->values == NULL || snap->rows == NULL || snap->filename == NULL || snap->tmpname == NULL) goto error;
+    memcpy(snap->filename, filename, len + 1);
+    memcpy(snap->tmpname, filename, len);
+    memcpy(snap->tmpname + len, ".tmp", 5);
+
+    pthread_mutex_init(&snap->lock, NULL);
+    pthread_cond_init(&snap->cond, NULL);
+    if (pthread_create(&snap->thread, NULL, snapshot_writer, snap) != 0) {
+        pthread_cond_destroy(&snap->cond);
+        pthread_mutex_destroy(&snap->lock);
+        goto error;
+    }
+
+    return 0;
+
+error:
+    free(snap->tmpname);
+    free(snap->filename);
+    free(snap->rows);
+    free(snap->values);
+    pnm_image_clear(&snap->image);
+    memset(snap, 0, sizeof(*snap));
+    return -1;
+}
+
+/** Finishes a pending snapshot and stops the writer thread. */
+void snapshot_clear(struct snapshot *snap)
+{
+    if (snap->values == NULL) return;
+
+    pthread_mutex_lock(&snap->lock);
+    snap->shutdown = 1;
+    pthread_cond_broadcast(&snap->cond);
+    pthread_mutex_unlock(&snap->lock);
+    pthread_join(snap->thread, NULL);
+    pthread_cond_destroy(&snap->cond);
+    pthread_mutex_destroy(&snap->lock);
+
+    free(snap->tmpname);
+    free(snap->filename);
+    free(snap->rows);
+    free(snap->values);
+    pnm_image_clear(&snap->image);
+    memset(snap, 0, sizeof(*snap));
+}
+
+/**
+ * Checks if the writer is still busy with the last snapshot. values and
+ * rows must not be modified while it is.
+ */
+int snapshot_busy(struct snapshot *snap)
+{
+    int pending;
+
+    pthread_mutex_lock(&snap->lock);
+    pending = snap->pending;
+    pthread_mutex_unlock(&snap->lock);
+
+    return pending;
+}
+
+/** Hands values and rows over to the writer thread. */
+void snapshot_submit(struct snapshot *snap)
+{
+    pthread_mutex_lock(&snap->lock);
+    snap->pending = 1;
+    pthread_cond_broadcast(&snap->cond);
+    pthread_mutex_unlock(&snap->lock);
+}
+
+/** Waits until the last submitted snapshot has been written. */
+void snapshot_wait(struct snapshot *snap)
+{
+    pthread_mutex_lock(&snap->lock);
+    while (snap->pending) pthread_cond_wait(&snap->cond, &snap->lock);
+    pthread_mutex_unlock(&snap->lock);
+}
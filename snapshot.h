@@ -0,0 +1,50 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPSHOT_H_Q7RK2MZD
+#define SNAPSHOT_H_Q7RK2MZD
+
+#include "pnm.h"
+#include <pthread.h>
+
+/**
+ * Background writer of grayscale snapshots.
+ * The caller stores the gray values of the changed rows in values and
+ * flags them in rows, then submits them. A writer thread encodes only
+ * these rows into the image kept in memory and replaces the file
+ * atomically, so readers never see a partially written image.
+ */
+struct snapshot {
+    struct pnm_image image; /**< encoded image, used by the writer thread */
+    uint16_t *values;       /**< gray values of all rows, row 0 is the top row */
+    unsigned char *rows;    /**< rows changed since the last submit */
+    char *filename;
+    char *tmpname;          /**< written first, then renamed to filename */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending;            /**< values are submitted and not written yet */
+    int shutdown;
+};
+
+int snapshot_init(struct snapshot *snap, const char *filename, unsigned int width, unsigned int height, unsigned int maxval);
+void snapshot_clear(struct snapshot *snap);
+int snapshot_busy(struct snapshot *snap);
+void snapshot_submit(struct snapshot *snap);
+void snapshot_wait(struct snapshot *snap);
+
+#endif /* end of include guard: SNAPSHOT_H_Q7RK2MZD */
@@ -0,0 +1,106 @@
+#include "../animlog.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Writes random frames with a pool of encoder threads and checks that the
+ * reader reproduces every frame and its information.
+ */
+
+#define WIDTH  300
+#define HEIGHT 200
+#define MAXVAL 1000
+#define NUM_FRAMES 200
+#define NUM_THREADS 4
+
+static uint16_t g_frames[NUM_FRAMES][WIDTH * HEIGHT];
+
+/* Changes random rectangles of the image, like tool moves do. */
+static void change_frame(uint16_t *image, unsigned char *changed)
+{
+    unsigned int n, x, y, x0, y0, w, h;
+
+    for (n = rand() % 4; n > 0; --n) {
+        x0 = rand() % WIDTH;
+        y0 = rand() % HEIGHT;
+        w  = 1 + rand() % 40;
+        h  = 1 + rand() % 40;
+        for (y = y0; y < y0 + h && y < HEIGHT; ++y) {
+            for (x = x0; x < x0 + w && x < WIDTH; ++x) {
+                /* unchanged values inside of the rectangle as well */
+                if (rand() % 3) image[y * WIDTH + x] = rand() % (MAXVAL + 1);
+            }
+            changed[y] = 1;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename = "animtest.gsa";
+    struct animlog log;
+    struct animlog_reader reader;
+    struct animlog_frame_info info;
+    unsigned char changed[HEIGHT];
+    unsigned int i, y;
+    int exit_code = EXIT_SUCCESS;
+
+    srand(1);
+    if (animlog_init(&log, filename, WIDTH, HEIGHT, MAXVAL, 0.05, NUM_THREADS) != 0) {
+        fprintf(stdout, "Failed to create %s\n", filename);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < NUM_FRAMES; ++i) {
+        memset(changed, 0, sizeof(changed));
+        if (i > 0) memcpy(g_frames[i], g_frames[i - 1], sizeof(g_frames[i]));
+        change_frame(g_frames[i], changed);
+        /* like the workpart, copy all changed rows */
+        for (y = 0; y < HEIGHT; ++y) {
+            if (!changed[y]) continue;
+            memcpy(&log.values[y * WIDTH], &g_frames[i][y * WIDTH], WIDTH * sizeof(uint16_t));
+            log.rows[y] = 1;
+        }
+        memset(&info, 0, sizeof(info));
+        info.time          = i * 0.5;
+        info.distance      = i * 2;
+        info.tool_x        = i;
+        info.tool          = 1 + i % 2;
+        info.tool_diameter = 0.8;
+        animlog_add_frame(&log, &info);
+    }
+    if (animlog_close(&log) != 0) {
+        fprintf(stdout, "Failed to write %s\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    if (animlog_reader_open(&reader, filename) != 0) {
+        fprintf(stdout, "Failed to open %s\n", filename);
+        return EXIT_FAILURE;
+    }
+    if (reader.width != WIDTH || reader.height != HEIGHT || reader.maxval != MAXVAL) {
+        fprintf(stdout, "Wrong header %ux%u %u\n", reader.width, reader.height, reader.maxval);
+        exit_code = EXIT_FAILURE;
+    }
+    for (i = 0; i < NUM_FRAMES && exit_code == EXIT_SUCCESS; ++i) {
+        if (animlog_reader_next(&reader, &info) != 0) {
+            fprintf(stdout, "Failed to read frame %u\n", i);
+            exit_code = EXIT_FAILURE;
+        } else if (info.frame != i || info.time != i * 0.5f || info.tool_x != i || info.tool != 1 + i % 2) {
+            fprintf(stdout, "Frame %u: wrong information\n", i);
+            exit_code = EXIT_FAILURE;
+        } else if (memcmp(reader.values, g_frames[i], sizeof(g_frames[i])) != 0) {
+            fprintf(stdout, "Frame %u: wrong image\n", i);
+            exit_code = EXIT_FAILURE;
+        }
+    }
+    if (exit_code == EXIT_SUCCESS && animlog_reader_next(&reader, &info) != 1) {
+        fprintf(stdout, "Expected end of log\n");
+        exit_code = EXIT_FAILURE;
+    }
+    animlog_reader_close(&reader);
+    if (exit_code == EXIT_SUCCESS) {
+        fprintf(stdout, "%u frames OK, %lu bytes\n", NUM_FRAMES, (unsigned long)log.size);
+    }
+    remove(filename);
+
+    return exit_code;
+}
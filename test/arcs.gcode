@@ -0,0 +1,14 @@
+G21
+G90
+G00 Z2
+G00 X10 Y10
+G01 Z-0.1 F200
+G02 X20 Y10 I5 J0 F300
+G03 X15 Y15 I-2.5 J2.5
+G02 X15 Y15 I0 J-3
+G01 Z-0.3
+G01 Z2
+G00 X5 Y25
+G01 Z-0.2
+G03 X5 Y25 I2 J0 Z-0.05
+G01 Z2
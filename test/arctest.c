@@ -1,4 +1,5 @@
 #include "../gcode.c"
+#include "testutil.h"
 #include <math.h>
 #include <stdlib.h>
 
@@ -101,6 +102,178 @@ int test_ccw(int start, int end)
     return -1;
 }
 
+/* statistics of the points generated by an arc move */
+struct arc_stats {
+    struct gvector center;
+    struct gvector last;
+    float radius;
+    unsigned int num_points;
+    double max_radius_err;
+    double max_sagitta;
+    double max_spacing;
+    double angle;
+    int invalid;
+};
+
+static struct arc_stats g_stats;
+
+static void stats_newpos(struct gcode_ctx *ctx)
+{
+    struct arc_stats *st = &g_stats;
+    double ax = st->last.x - st->center.x, ay = st->last.y - st->center.y;
+    double bx = ctx->pos.x - st->center.x, by = ctx->pos.y - st->center.y;
+    double mx = (ax + bx) / 2, my = (ay + by) / 2;
+    double err, spacing, sagitta;
+
+    if (isnan(ctx->pos.x) || isnan(ctx->pos.y) || isnan(ctx->pos.z)) st->invalid = 1;
+    err = fabs(hypot(bx, by) - st->radius);
+    if (err > st->max_radius_err) st->max_radius_err = err;
+    spacing = hypot(bx - ax, by - ay);
+    if (spacing > st->max_spacing) st->max_spacing = spacing;
+    sagitta = st->radius - hypot(mx, my);
+    if (sagitta > st->max_sagitta) st->max_sagitta = sagitta;
+    st->angle += fabs(atan2(ax * by - ay * bx, ax * bx + ay * by));
+    st->last = ctx->pos;
+    st->num_points++;
+}
+
+/**
+ * Runs an arc of \c sweep degrees and checks that all points are on the
+ * circle, the chords deviate at most \c tol from it, the points are at
+ * most \c spacing apart, no more points than needed for both are generated
+ * and the whole angle is covered.
+ */
+static int test_accuracy(float radius, float start, float sweep, enum gcode_arc_mode mode, float tol, float spacing)
+{
+    struct gcode_ctx ctx;
+    struct gvector center, end;
+    float s = DEG2RAD(start), e = DEG2RAD(mode == ARC_CW ? start - sweep : start + sweep);
+    double expected = DEG2RAD(sweep);
+    unsigned int num_points = 1;
+    int ret = 0;
+
+    gcode_set_arc_tolerance(tol);
+    gcode_set_arc_spacing(spacing);
+    gcode_ctx_init(&ctx);
+    ctx.newpos_cb = stats_newpos;
+    ctx.pos.x = g_center.x + radius * cos(s);
+    ctx.pos.y = g_center.y + radius * sin(s);
+    ctx.pos.z = 0;
+    end.x = g_center.x + radius * cos(e);
+    end.y = g_center.y + radius * sin(e);
+    end.z = 0;
+    if (sweep >= 360) end = ctx.pos;
+
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.center = g_center;
+    g_stats.last = ctx.pos;
+    g_stats.radius = radius;
+
+    gvector_sub(&center, &g_center, &ctx.pos);
+    gcode_arc_move(&ctx, &end, &center, mode);
+
+    printf("Accuracy r=%g sweep=%g %s tol=%g spacing=%g: points=%u radius_err=%.2e sagitta=%.2e spacing=%.4f\n",
+           radius, sweep, mode == ARC_CW ? "CW" : "CCW", tol, spacing, g_stats.num_points,
+           g_stats.max_radius_err, g_stats.max_sagitta, g_stats.max_spacing);
+    if (g_stats.invalid || g_stats.num_points == 0) {
+        printf("Invalid points generated.\n");
+        ret = -1;
+    }
+    /* float coordinates around 50mm have a resolution of ~4e-6 */
+    if (g_stats.max_radius_err > 1e-4) {
+        printf("Points are not on the circle.\n");
+        ret = -1;
+    }
+    if (g_stats.max_sagitta > tol + 1e-4) {
+        printf("Chord error exceeds tolerance.\n");
+        ret = -1;
+    }
+    if (spacing > 0 && g_stats.max_spacing > spacing + 1e-4) {
+        printf("Points are too far apart.\n");
+        ret = -1;
+    }
+    if (radius > tol) num_points = ceil(expected / (2 * acos(1 - (double)tol / radius)));
+    if (spacing > 0 && expected * radius / spacing > num_points) num_points = ceil(expected * radius / spacing);
+    if (g_stats.num_points > num_points) {
+        printf("More points than the expected %u.\n", num_points);
+        ret = -1;
+    }
+    /* the angle of tiny arcs is limited by the float coordinates */
+    if (fabs(g_stats.angle - expected) > 1e-3 + 1e-5 / radius) {
+        printf("Swept angle %f does not match %f.\n", g_stats.angle, expected);
+        ret = -1;
+    }
+    if (gvector_fuzzy_compare(&ctx.pos, &end, 1e-6) != 0) {
+        printf("End point not reached.\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static void bench_newpos(struct gcode_ctx *ctx)
+{
+    g_stats.last.x += ctx->pos.x;
+    g_stats.num_points++;
+}
+
+/* Legacy interpolation which calls cos/sin for each point. */
+static void bench_reference_arc(struct gcode_ctx *ctx, struct gvector *end, float radius, float s_alpha, float d_alpha)
+{
+    unsigned int i, num_steps = d_alpha * radius / g_step_len;
+    float alpha;
+
+    for (i = 1; i < num_steps; ++i) {
+        alpha = s_alpha + d_alpha * i / num_steps;
+        ctx->pos.x = g_center.x + radius * cos(alpha);
+        ctx->pos.y = g_center.y + radius * sin(alpha);
+        ctx->newpos_cb(ctx);
+    }
+    ctx->pos = *end;
+    ctx->newpos_cb(ctx);
+}
+
+/** Compares the throughput of the arc interpolation with the legacy one. */
+static void benchmark(void)
+{
+    struct gcode_ctx ctx;
+    struct gvector center;
+    unsigned int i, n = 20000;
+    double t0, t1, t2;
+    double sec_ref, sec_new;
+    unsigned long points_ref, points_new;
+
+    /* the same points as the legacy interpolation */
+    gcode_set_arc_tolerance(0.005);
+    gcode_set_arc_spacing(g_step_len);
+    gcode_ctx_init(&ctx);
+    ctx.newpos_cb = bench_newpos;
+
+    memset(&g_stats, 0, sizeof(g_stats));
+    t0 = now();
+    for (i = 0; i < n; ++i) {
+        ctx.pos = g_test_data[0];
+        bench_reference_arc(&ctx, &g_test_data[90], 40, 0, M_PI / 2);
+    }
+    t1 = now();
+    points_ref = g_stats.num_points;
+    g_stats.num_points = 0;
+    for (i = 0; i < n; ++i) {
+        ctx.pos = g_test_data[0];
+        gvector_sub(&center, &g_center, &ctx.pos);
+        gcode_arc_move(&ctx, &g_test_data[90], &center, ARC_CCW);
+    }
+    t2 = now();
+    points_new = g_stats.num_points;
+
+    sec_ref = t1 - t0;
+    sec_new = t2 - t1;
+    printf("Benchmark cos/sin:  %lu points in %.3fs (%.1f Mpoints/s)\n",
+           points_ref, sec_ref, points_ref / sec_ref / 1e6);
+    printf("Benchmark rotation: %lu points in %.3fs (%.1f Mpoints/s)\n",
+           points_new, sec_new, points_new / sec_new / 1e6);
+}
+
 int main(int argc, char *argv[])
 {
     int ret;
@@ -108,6 +281,27 @@ int main(int argc, char *argv[])
 
     prepare_test_data();
 
+    /* accuracy of the chord interpolation, with the point spacing of the step mode */
+    if (test_accuracy(40, 0, 90, ARC_CCW, 0.005, 0.05) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(40, 30, 270, ARC_CW, 0.005, 0.05) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(1000, 10, 45, ARC_CCW, 0.0001, 0.05) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(0.5, 0, 180, ARC_CW, 0.005, 0.05) != 0) exit_code = EXIT_FAILURE;
+    /* without a spacing the tolerance alone sets the number of points */
+    if (test_accuracy(40, 0, 90, ARC_CCW, 0.005, 0) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(40, 30, 270, ARC_CW, 0.1, 0) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(1000, 10, 45, ARC_CCW, 0.0001, 0) != 0) exit_code = EXIT_FAILURE;
+    /* tiny arcs used to produce zero steps and a division by zero */
+    if (test_accuracy(0.01, 0, 90, ARC_CCW, 0.005, 0.05) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(0.001, 45, 10, ARC_CW, 0.005, 0.05) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(0.001, 45, 10, ARC_CW, 0.005, 0) != 0) exit_code = EXIT_FAILURE;
+    /* same start and end point is a full circle */
+    if (test_accuracy(40, 0, 360, ARC_CCW, 0.005, 0.05) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(2, 90, 360, ARC_CW, 0.005, 0.05) != 0) exit_code = EXIT_FAILURE;
+    if (test_accuracy(2, 90, 360, ARC_CW, 0.005, 0) != 0) exit_code = EXIT_FAILURE;
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) benchmark();
+    gcode_set_arc_tolerance(0.005);
+    gcode_set_arc_spacing(0.05); /* the control points are 0.7mm apart */
+
     gcode_verbose();
     gcode_verbose();
 
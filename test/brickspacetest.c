@@ -0,0 +1,83 @@
+#include "../brickspace.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Clears random column ranges of a brick space whose size is no multiple
+ * of the brick size, compares the voxels with a plain array and checks
+ * that the border bricks are released once all their voxels are cleared.
+ */
+
+#define SPACE_W 21
+#define SPACE_H 13
+#define SPACE_T 19
+#define NUM_CUTS 300
+
+static unsigned char g_ref[SPACE_T][SPACE_H][SPACE_W];
+
+static int check_voxels(struct brick_space *space)
+{
+    int x, y, z, top;
+
+    for (y = 0; y < SPACE_H; ++y) {
+        for (x = 0; x < SPACE_W; ++x) {
+            top = 0;
+            for (z = 0; z < SPACE_T; ++z) {
+                if (brick_space_get_xyz(space, x, y, z) != g_ref[z][y][x]) {
+                    fprintf(stdout, "voxel %i/%i/%i is %i, expected %i\n", x, y, z,
+                            brick_space_get_xyz(space, x, y, z), g_ref[z][y][x]);
+                    return -1;
+                }
+                if (g_ref[z][y][x]) top = z + 1;
+            }
+            if (brick_space_get_top(space, x, y) != top) {
+                fprintf(stdout, "height at %i/%i is %i, expected %i\n", x, y,
+                        brick_space_get_top(space, x, y), top);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct brick_space space;
+    size_t size;
+    int i, x, y, z, z0, z1, ret = 0;
+
+    srand(1);
+    if (brick_space_init(&space, SPACE_W, SPACE_H, SPACE_T) != 0) {
+        fprintf(stdout, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    size = space.size;
+    brick_space_set_all(&space);
+    memset(g_ref, 1, sizeof(g_ref));
+
+    for (i = 0; i < NUM_CUTS; ++i) {
+        x  = rand() % SPACE_W;
+        y  = rand() % SPACE_H;
+        z0 = rand() % SPACE_T;
+        z1 = z0 + rand() % (SPACE_T + 1 - z0);
+        brick_space_clr_column(&space, x, y, z0, z1);
+        for (z = z0; z < z1; ++z) g_ref[z][y][x] = 0;
+    }
+    if (check_voxels(&space) != 0) ret = -1;
+
+    /* an empty space needs no allocated bricks */
+    for (y = 0; y < SPACE_H; ++y) {
+        for (x = 0; x < SPACE_W; ++x) brick_space_clr_column(&space, x, y, 0, SPACE_T);
+    }
+    memset(g_ref, 0, sizeof(g_ref));
+    if (check_voxels(&space) != 0) ret = -1;
+    if (space.num_mixed != 0 || space.size != size) {
+        fprintf(stdout, "%lu bricks of the empty space are still allocated\n", (unsigned long)space.num_mixed);
+        ret = -1;
+    }
+    fprintf(stdout, "%s\n", ret == 0 ? "OK" : "FAILED");
+
+    brick_space_clear(&space);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,114 @@
+#include "../gcode.c"
+#include <stdlib.h>
+
+/* Checks that address letters inside of comments are ignored by both
+ * parsers, for comments in parentheses and after ';'.
+ */
+
+volatile int g_terminate = 0;
+
+#define MAX_MOVES 16
+
+struct move {
+    enum gcode_arc_mode mode;
+    struct gvector end;
+    struct gvector center;
+    float feedrate;
+};
+
+static struct move g_moves[MAX_MOVES];
+static unsigned int g_num_moves;
+
+/* Records all moves without interpolating them. */
+static int record_move_cb(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    if (g_num_moves < MAX_MOVES) {
+        g_moves[g_num_moves].mode     = move->mode;
+        g_moves[g_num_moves].end      = move->end;
+        g_moves[g_num_moves].center   = move->center;
+        g_moves[g_num_moves].feedrate = ctx->feedrate;
+    }
+    g_num_moves++;
+    return 0;
+}
+
+static const char *g_gcode =
+    "(X9 Y9 Z9 F9 on a comment line)\n"
+    "; X8 Y8 on a comment line\n"
+    "G90\n"
+    "G01 X1 (to Y5)\n"
+    "G01 Y2 ; then Z9\n"
+    "G01 (X7) Z-1 F100 (F500)\n"
+    "G00 X3 (first) Y4 (second Z8)\n"
+    "G02 X5 Y4 I1 J0 (not I9 J9)\n"
+    "G01 X6;Y6 F300\n";
+
+static const struct move g_expected[] = {
+    { ARC_NONE, { 1, 0, 0 },  { 0, 0, 0 },  0 },
+    { ARC_NONE, { 1, 2, 0 },  { 0, 0, 0 },  0 },
+    { ARC_NONE, { 1, 2, -1 }, { 0, 0, 0 },  100 },
+    { ARC_NONE, { 3, 4, -1 }, { 0, 0, 0 },  100 },
+    { ARC_CW,   { 5, 4, -1 }, { 4, 4, -1 }, 100 },
+    { ARC_NONE, { 6, 4, -1 }, { 0, 0, 0 },  100 },
+};
+
+#define NUM_EXPECTED (sizeof(g_expected) / sizeof(g_expected[0]))
+
+static int vector_differs(const struct gvector *a, const struct gvector *b)
+{
+    return fabsf(a->x - b->x) > 1e-4 || fabsf(a->y - b->y) > 1e-4 || fabsf(a->z - b->z) > 1e-4;
+}
+
+static int check(const char *name, int (*parse)(struct gcode_ctx *, const char *), const char *filename)
+{
+    struct gcode_ctx ctx;
+    const struct move *m, *e;
+    unsigned int i;
+
+    g_num_moves = 0;
+    gcode_ctx_init(&ctx);
+    ctx.move_cb = record_move_cb;
+    parse(&ctx, filename);
+
+    if (g_num_moves != NUM_EXPECTED) {
+        fprintf(stdout, "%s: got %u moves, expected %u\n", name, g_num_moves, (unsigned int)NUM_EXPECTED);
+        return -1;
+    }
+    for (i = 0; i < NUM_EXPECTED; ++i) {
+        m = &g_moves[i];
+        e = &g_expected[i];
+        /* only arcs have a center */
+        if (m->mode != e->mode || vector_differs(&m->end, &e->end) ||
+            (e->mode != ARC_NONE && vector_differs(&m->center, &e->center)) ||
+            fabsf(m->feedrate - e->feedrate) > 1e-4) {
+            fprintf(stdout, "%s: move %u ends at %.3f/%.3f/%.3f F%.1f, expected %.3f/%.3f/%.3f F%.1f\n", name, i,
+                    m->end.x, m->end.y, m->end.z, m->feedrate,
+                    e->end.x, e->end.y, e->end.z, e->feedrate);
+            return -1;
+        }
+    }
+    fprintf(stdout, "%s: %u moves OK\n", name, g_num_moves);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename = "commenttest.gcode";
+    int exit_code = EXIT_SUCCESS;
+    FILE *f;
+
+    f = fopen(filename, "w");
+    if (f == NULL) {
+        fprintf(stdout, "Could not create %s\n", filename);
+        return EXIT_FAILURE;
+    }
+    fputs(g_gcode, f);
+    fclose(f);
+
+    if (check("legacy", gcode_parse_lines, filename) != 0) exit_code = EXIT_FAILURE;
+    if (check("mapped", gcode_parse_mapped, filename) != 0) exit_code = EXIT_FAILURE;
+    remove(filename);
+
+    return exit_code;
+}
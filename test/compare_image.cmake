@@ -0,0 +1,36 @@
+# Simulates GCODE with ARGS in WORK_DIR and compares the resulting
+# workpart.pgm with the image REFERENCE, or with the image simulated with
+# REFERENCE_ARGS instead. GCODE is copied into the working directory, so
+# files written next to it like compiled toolpaths stay there.
+#
+# cmake -DGCODESIM=<exe> [-DTESTDRIVER=<wrapper>] -DARGS="<options>" -DGCODE=<file>
+#       -DREFERENCE=<pgm> | -DREFERENCE_ARGS="<options>" -DWORK_DIR=<dir> -P compare_image.cmake
+
+get_filename_component(GCODE_NAME ${GCODE} NAME)
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(COPY ${GCODE} DESTINATION ${WORK_DIR})
+if (DEFINED REFERENCE_ARGS)
+    separate_arguments(REFERENCE_ARGS)
+    file(MAKE_DIRECTORY ${WORK_DIR}/reference)
+    file(COPY ${GCODE} DESTINATION ${WORK_DIR}/reference)
+    execute_process(COMMAND ${TESTDRIVER} ${GCODESIM} ${REFERENCE_ARGS} ${GCODE_NAME}
+        WORKING_DIRECTORY ${WORK_DIR}/reference
+        RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "gcodesim ${REFERENCE_ARGS} failed: ${result}")
+    endif()
+    set(REFERENCE ${WORK_DIR}/reference/workpart.pgm)
+endif()
+separate_arguments(ARGS)
+execute_process(COMMAND ${TESTDRIVER} ${GCODESIM} ${ARGS} ${GCODE_NAME}
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "gcodesim ${ARGS} failed: ${result}")
+endif()
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK_DIR}/workpart.pgm ${REFERENCE}
+    RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "${WORK_DIR}/workpart.pgm differs from ${REFERENCE}")
+endif()
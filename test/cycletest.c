@@ -0,0 +1,104 @@
+#include "../gcode.c"
+#include <stdlib.h>
+
+/* Checks that canned drill cycles are decomposed into the expected moves
+ * by both parsers.
+ */
+
+volatile int g_terminate = 0;
+
+#define MAX_MOVES 64
+
+static struct gvector g_moves[MAX_MOVES];
+static unsigned int g_num_moves;
+
+/* Records the end position of all moves without interpolating them. */
+static int record_move_cb(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    (void)ctx;
+    if (g_num_moves < MAX_MOVES) g_moves[g_num_moves] = move->end;
+    g_num_moves++;
+    return 0;
+}
+
+static const char *g_gcode =
+    "G90\n"
+    "G00 Z5.0\n"
+    "G98 G81 X10 Y20 Z-1.5 R1.0 F100\n" /* initial level 5 */
+    "X30\n"                             /* next hole, same Z and R */
+    "G99 G83 X40 Y20 Z-2.0 Q0.5\n"      /* retract to R */
+    "Y30\n"
+    "G80\n"
+    "X50\n"                             /* no active cycle, ignored */
+    "G91\n"
+    "G81 X5 R-2.0 Z-3.0\n"              /* R=1-2=-1, Z=-1-3=-4 */
+    "G90\n"
+    "G00 Z5.0\n";
+
+/* Expected end positions, Z-only moves are vertical plunges and retracts. */
+static const struct gvector g_expected[] = {
+    { 0, 0, 5 },
+    /* G81 at 10/20 */
+    { 10, 20, 5 }, { 10, 20, 1 }, { 10, 20, -1.5 }, { 10, 20, 5 },
+    /* repeated at 30/20 */
+    { 30, 20, 5 }, { 30, 20, 1 }, { 30, 20, -1.5 }, { 30, 20, 5 },
+    /* G83 with G99 at 40/20, the tool is at the R plane already */
+    { 40, 20, 5 }, { 40, 20, 1 }, { 40, 20, -2 }, { 40, 20, 1 },
+    /* repeated at 40/30 */
+    { 40, 30, 1 }, { 40, 30, -2 }, { 40, 30, 1 },
+    /* relative G81 at 45/30, R relative to the current level */
+    { 45, 30, 1 }, { 45, 30, -1 }, { 45, 30, -4 }, { 45, 30, -1 },
+    { 45, 30, 5 },
+};
+
+#define NUM_EXPECTED (sizeof(g_expected) / sizeof(g_expected[0]))
+
+static int check(const char *name, int (*parse)(struct gcode_ctx *, const char *), const char *filename)
+{
+    struct gcode_ctx ctx;
+    unsigned int i;
+
+    g_num_moves = 0;
+    gcode_ctx_init(&ctx);
+    ctx.move_cb = record_move_cb;
+    parse(&ctx, filename);
+
+    if (g_num_moves != NUM_EXPECTED) {
+        fprintf(stdout, "%s: got %u moves, expected %u\n", name, g_num_moves, (unsigned int)NUM_EXPECTED);
+        return -1;
+    }
+    for (i = 0; i < NUM_EXPECTED; ++i) {
+        if (fabsf(g_moves[i].x - g_expected[i].x) > 1e-4 ||
+            fabsf(g_moves[i].y - g_expected[i].y) > 1e-4 ||
+            fabsf(g_moves[i].z - g_expected[i].z) > 1e-4) {
+            fprintf(stdout, "%s: move %u is %.3f/%.3f/%.3f, expected %.3f/%.3f/%.3f\n", name, i,
+                    g_moves[i].x, g_moves[i].y, g_moves[i].z,
+                    g_expected[i].x, g_expected[i].y, g_expected[i].z);
+            return -1;
+        }
+    }
+    fprintf(stdout, "%s: %u moves OK\n", name, g_num_moves);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename = "cycletest.gcode";
+    int exit_code = EXIT_SUCCESS;
+    FILE *f;
+
+    f = fopen(filename, "w");
+    if (f == NULL) {
+        fprintf(stdout, "Could not create %s\n", filename);
+        return EXIT_FAILURE;
+    }
+    fputs(g_gcode, f);
+    fclose(f);
+
+    if (check("legacy", gcode_parse_lines, filename) != 0) exit_code = EXIT_FAILURE;
+    if (check("mapped", gcode_parse_mapped, filename) != 0) exit_code = EXIT_FAILURE;
+    remove(filename);
+
+    return exit_code;
+}
@@ -0,0 +1,118 @@
+#include "../dda.c"
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_POINTS 100000
+
+static struct voxel_pos g_points[MAX_POINTS];
+static unsigned int g_num_points;
+
+static void record_cb(void *arg, const struct voxel_pos *pos)
+{
+    (void)arg;
+    if (g_num_points < MAX_POINTS) g_points[g_num_points++] = *pos;
+}
+
+/* Checks that the path is 26-connected and has no repeated positions. */
+static int check_connected(void)
+{
+    unsigned int i;
+    int dx, dy, dz;
+
+    for (i = 1; i < g_num_points; ++i) {
+        dx = abs(g_points[i].x - g_points[i - 1].x);
+        dy = abs(g_points[i].y - g_points[i - 1].y);
+        dz = abs(g_points[i].z - g_points[i - 1].z);
+        if (dx > 1 || dy > 1 || dz > 1) {
+            fprintf(stdout, "Gap at point %u\n", i);
+            return -1;
+        }
+        if (dx == 0 && dy == 0 && dz == 0) {
+            fprintf(stdout, "Duplicate at point %u\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int test_line(struct gvector *a, struct gvector *b)
+{
+    struct dda dda;
+    int n, dx, dy, dz;
+
+    g_num_points = 0;
+    dda_init(&dda, record_cb, NULL);
+    dda_line(&dda, a, b);
+
+    /* exactly one position per step of the dominant axis */
+    dx = abs((int)floorf(b->x) - (int)floorf(a->x));
+    dy = abs((int)floorf(b->y) - (int)floorf(a->y));
+    dz = abs((int)floorf(b->z) - (int)floorf(a->z));
+    n = dx;
+    if (dy > n) n = dy;
+    if (dz > n) n = dz;
+    if (g_num_points != n + 1) {
+        fprintf(stdout, "Line: %u points, expected %i\n", g_num_points, n + 1);
+        return -1;
+    }
+    if (g_points[0].x != (int)floorf(a->x) || g_points[g_num_points - 1].x != (int)floorf(b->x) ||
+        g_points[0].y != (int)floorf(a->y) || g_points[g_num_points - 1].y != (int)floorf(b->y) ||
+        g_points[0].z != (int)floorf(a->z) || g_points[g_num_points - 1].z != (int)floorf(b->z)) {
+        fprintf(stdout, "Line: wrong end points\n");
+        return -1;
+    }
+
+    return check_connected();
+}
+
+static int test_circle(float r)
+{
+    struct gvector start = { 100 + r, 100, 5 }, center = { 100, 100, 5 };
+    struct dda dda;
+    unsigned int i;
+    float d;
+
+    g_num_points = 0;
+    dda_init(&dda, record_cb, NULL);
+    /* start == end is a full circle */
+    dda_arc(&dda, &start, &start, &center, ARC_CCW);
+
+    if (g_num_points < 4 * r) {
+        fprintf(stdout, "Circle r=%f: only %u points\n", r, g_num_points);
+        return -1;
+    }
+    for (i = 0; i < g_num_points; ++i) {
+        d = hypotf(g_points[i].x + 0.5 - center.x, g_points[i].y + 0.5 - center.y);
+        if (fabsf(d - r) > 1.5) {
+            fprintf(stdout, "Circle r=%f: point %u is %f off\n", r, i, d - r);
+            return -1;
+        }
+    }
+
+    return check_connected();
+}
+
+int main(int argc, char *argv[])
+{
+    struct gvector a, b;
+    int i, ret, result = 0;
+
+    srand(1);
+    for (i = 0; i < 1000; ++i) {
+        a.x = (rand() % 20000) / 100.0;
+        a.y = (rand() % 20000) / 100.0;
+        a.z = (rand() % 3000) / 100.0;
+        b.x = (rand() % 20000) / 100.0;
+        b.y = (rand() % 20000) / 100.0;
+        b.z = (rand() % 3000) / 100.0;
+        ret = test_line(&a, &b);
+        if (ret != 0) result = -1;
+    }
+    for (i = 1; i < 200; i += 7) {
+        ret = test_circle(i);
+        if (ret != 0) result = -1;
+    }
+
+    return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,164 @@
+#include "../voxelspace.c"
+#include "../tool.c"
+#include "testutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+volatile int g_terminate = 0;
+static struct voxel_space g_space;
+static struct voxel_space g_expected;
+
+static int compare_spaces(struct voxel_space *a, struct voxel_space *b)
+{
+    unsigned int x, y, z;
+    struct voxel_pos pos;
+
+    for (z = 0; z < a->thickness; ++z) {
+        for (y = 0; y < a->height; ++y) {
+            for (x = 0; x < a->width; ++x) {
+                voxel_pos_set(&pos, x, y, z);
+                if (voxel_space_get_xyz(a, &pos) != voxel_space_get_xyz(b, &pos)) {
+                    fprintf(stdout, "Mismatch at %u/%u/%u\n", x, y, z);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void clr_column(void *space, int x, int y, int z0, int z1)
+{
+    voxel_space_clr_column(space, x, y, z0, z1);
+}
+
+/* Random tool, columns may have several solid intervals. */
+static void create_random(struct voxel_space *tool, int w, int h, int t)
+{
+    size_t i;
+
+    voxel_space_init(tool, w, h, t);
+    for (i = 0; i < tool->size; ++i) {
+        tool->data[i] = rand() & 0xff;
+    }
+}
+
+/*
+ * Stamps the tool at pos and completes it with the delta of the step d,
+ * once with the X runs and once with the Z runs. Both must be equal to
+ * two full stamps at pos and pos + d.
+ */
+static int test_step(struct voxel_space *tool, struct tool_deltas *deltas, struct voxel_pos *pos, int dx, int dy, int dz)
+{
+    const struct tool_delta *delta = &deltas->dir[TOOL_DELTA_INDEX(dx, dy, dz)];
+    struct tool_sweep sweep;
+    struct voxel_pos next;
+    size_t i;
+    int ret = 0;
+
+    next.x = pos->x + dx;
+    next.y = pos->y + dy;
+    next.z = pos->z + dz;
+
+    voxel_space_set_all(&g_expected);
+    tool->pos = *pos;
+    voxel_space_difference(&g_expected, tool);
+    tool->pos = next;
+    voxel_space_difference(&g_expected, tool);
+
+    /* X runs */
+    voxel_space_set_all(&g_space);
+    tool->pos = *pos;
+    voxel_space_difference(&g_space, tool);
+    for (i = 0; i < delta->num_rows; ++i) {
+        voxel_space_clr_row(&g_space, next.x + delta->rows[i].lo, next.x + delta->rows[i].hi,
+                            next.y + delta->rows[i].a, next.z + delta->rows[i].b);
+    }
+    if (compare_spaces(&g_space, &g_expected) != 0) {
+        fprintf(stdout, "X runs of step %i/%i/%i at %i/%i/%i failed.\n", dx, dy, dz, pos->x, pos->y, pos->z);
+        ret = -1;
+    }
+
+    /* Z runs */
+    voxel_space_set_all(&g_space);
+    tool->pos = *pos;
+    voxel_space_difference(&g_space, tool);
+    sweep.profile = NULL;
+    sweep.x0      = 0;
+    sweep.y0      = 0;
+    sweep.x1      = g_space.width;
+    sweep.y1      = g_space.height;
+    sweep.clear   = clr_column;
+    sweep.space   = &g_space;
+    tool_stamp_delta(&sweep, delta, &next);
+    if (compare_spaces(&g_space, &g_expected) != 0) {
+        fprintf(stdout, "Z runs of step %i/%i/%i at %i/%i/%i failed.\n", dx, dy, dz, pos->x, pos->y, pos->z);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Tests all 26 steps inside of the space and crossing its borders. */
+static int test_tool(struct voxel_space *tool)
+{
+    struct tool_deltas deltas;
+    struct voxel_pos pos[3];
+    int dx, dy, dz;
+    unsigned int i;
+    int ret = 0;
+
+    memset(&deltas, 0, sizeof(deltas));
+    if (tool_deltas_init(&deltas, tool) != 0) {
+        fprintf(stdout, "Failed to init deltas.\n");
+        return -1;
+    }
+
+    voxel_pos_set(&pos[0], 10, 11, 3);
+    pos[1].x = -(int)tool->width / 2;
+    pos[1].y = -(int)tool->height / 2;
+    pos[1].z = -2;
+    pos[2].x = g_space.width - tool->width / 2;
+    pos[2].y = g_space.height - tool->height / 2;
+    pos[2].z = g_space.thickness - tool->thickness / 2;
+
+    for (i = 0; i < 3; ++i) {
+        for (dz = -1; dz <= 1; ++dz) {
+            for (dy = -1; dy <= 1; ++dy) {
+                for (dx = -1; dx <= 1; ++dx) {
+                    if (dx == 0 && dy == 0 && dz == 0) continue;
+                    if (test_step(tool, &deltas, &pos[i], dx, dy, dz) != 0) ret = -1;
+                }
+            }
+        }
+    }
+
+    tool_deltas_clear(&deltas);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    struct voxel_space tool;
+    int exit_code = EXIT_SUCCESS;
+
+    srand(1);
+    voxel_space_init(&g_space, 45, 37, 19);
+    voxel_space_init(&g_expected, 45, 37, 19);
+
+    create_cone(&tool, 13, 9, VOXEL_LAYOUT_LAYER);
+    if (test_tool(&tool) != 0) exit_code = EXIT_FAILURE;
+    voxel_space_clear(&tool);
+
+    create_random(&tool, 11, 7, 6);
+    if (test_tool(&tool) != 0) exit_code = EXIT_FAILURE;
+    voxel_space_clear(&tool);
+
+    voxel_space_clear(&g_space);
+    voxel_space_clear(&g_expected);
+
+    if (exit_code == EXIT_SUCCESS) printf("All delta tests passed.\n");
+
+    return exit_code;
+}
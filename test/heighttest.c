@@ -0,0 +1,195 @@
+#include "../workpart.c"
+#include "../voxelkernel.h"
+#include "testutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Checks that the height cache of the voxel workpart and the copies of
+ * its changes follow all ways of removing material in all memory layouts,
+ * and measures the time of
+ * height map exports with a few cuts between them, like snapshots do.
+ */
+
+volatile int g_terminate = 0;
+
+#define WORKPART_W 400
+#define WORKPART_H 300
+#define WORKPART_T 40
+#define TOOL_D     12
+#define NUM_ROUNDS 50
+#define NUM_EXPORTS 20
+
+static const enum voxel_layout g_layouts[] = {
+    VOXEL_LAYOUT_LAYER, VOXEL_LAYOUT_COLUMN, VOXEL_LAYOUT_MORTON
+};
+#define NUM_LAYOUTS (sizeof(g_layouts) / sizeof(g_layouts[0]))
+
+/* gray values updated by workpart_copy_changes() for two independent users */
+struct changes {
+    uint16_t image[WORKPART_W * WORKPART_H];
+    unsigned char rows[WORKPART_H];
+    unsigned int since;
+};
+static struct changes g_changes[2];
+
+/* Compares the cached heights with a scan of the voxel columns. */
+static int check_heights(struct workpart *wp, const char *name)
+{
+    int x, y, top;
+
+    for (y = 0; y < (int)wp->height; ++y) {
+        for (x = 0; x < (int)wp->width; ++x) {
+            top = voxel_space_get_top(&wp->voxel, x, y);
+            if (workpart_get_top(wp, x, y) != top) {
+                fprintf(stdout, "%s: height at %i/%i is %i, expected %i\n", name, x, y,
+                        workpart_get_top(wp, x, y), top);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Updates the image with the changes and compares it with the heights. */
+static int check_changes(struct workpart *wp, const char *name, struct changes *c)
+{
+    int x, y, top;
+    uint16_t gray;
+
+    workpart_copy_changes(wp, &c->since, c->image, c->rows);
+    for (y = 0; y < (int)wp->height; ++y) {
+        for (x = 0; x < (int)wp->width; ++x) {
+            top  = voxel_space_get_top(&wp->voxel, x, y);
+            gray = (top > 0) ? top - 1 : 0;
+            if (c->image[(wp->height - 1 - y) * wp->width + x] != gray) {
+                fprintf(stdout, "%s: copied gray value at %i/%i is %u, expected %u\n", name, x, y,
+                        c->image[(wp->height - 1 - y) * wp->width + x], gray);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Cuts with all workpart functions at random positions. */
+static void cut_random(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile)
+{
+    struct gvector start, end, center;
+    struct workpart_rect clip;
+
+    tool->pos.x = rand() % WORKPART_W - TOOL_D / 2;
+    tool->pos.y = rand() % WORKPART_H - TOOL_D / 2;
+    tool->pos.z = WORKPART_T - 1 - rand() % 8;
+    switch (rand() % 4) {
+    case 0:
+        workpart_stamp(wp, tool, profile);
+        break;
+    case 1:
+        clip.x0 = tool->pos.x + 3;
+        clip.y0 = tool->pos.y + 2;
+        clip.x1 = clip.x0 + TOOL_D / 2;
+        clip.y1 = clip.y0 + TOOL_D / 2;
+        if (clip.x0 < 0) clip.x0 = 0;
+        if (clip.y0 < 0) clip.y0 = 0;
+        if (clip.x1 > WORKPART_W) clip.x1 = WORKPART_W;
+        if (clip.y1 > WORKPART_H) clip.y1 = WORKPART_H;
+        workpart_stamp_clip(wp, tool, profile, &clip);
+        break;
+    case 2:
+        workpart_extrude(wp, tool, profile, tool->pos.z - 1 - rand() % 20);
+        break;
+    default:
+        start.x = tool->pos.x + TOOL_D / 2;
+        start.y = tool->pos.y + TOOL_D / 2;
+        start.z = tool->pos.z;
+        end.x = start.x + rand() % 61 - 30;
+        end.y = start.y + rand() % 61 - 30;
+        end.z = start.z;
+        if (rand() % 2) {
+            workpart_sweep_line(wp, profile, &start, &end);
+        } else {
+            center.x = (start.x + end.x) / 2;
+            center.y = (start.y + end.y) / 2;
+            center.z = start.z;
+            workpart_sweep_arc(wp, profile, &start, &end, &center, ARC_CW);
+        }
+        break;
+    }
+}
+
+/* Writes the height map after each few cuts, returns the time per image. */
+static double time_exports(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, int cached)
+{
+    double t = 0, start;
+    int i, j;
+
+    workpart_set_all(wp);
+    for (i = 0; i < NUM_EXPORTS; ++i) {
+        for (j = 0; j < 5; ++j) cut_random(wp, tool, profile);
+        if (!cached) memset(wp->top_dirty, 1, wp->top_tiles_x * wp->top_tiles_y);
+        start = now();
+        workpart_to_pgm(wp, "heighttest.pgm");
+        t += now() - start;
+    }
+    remove("heighttest.pgm");
+
+    return t / NUM_EXPORTS;
+}
+
+static int test_layout(enum voxel_layout layout)
+{
+    const char *name = voxel_layout_name(layout);
+    struct voxel_space tool;
+    struct tool_profile profile;
+    struct workpart wp;
+    double t_full, t_cached;
+    int i, j, ret = 0;
+
+    if (workpart_init_layout(&wp, WORKPART_VOXEL, layout, WORKPART_W, WORKPART_H, WORKPART_T) != 0) {
+        fprintf(stdout, "Out of memory\n");
+        return -1;
+    }
+    create_cone(&tool, TOOL_D, TOOL_D, layout);
+    tool_profile_init(&profile, &tool);
+
+    workpart_set_all(&wp);
+    memset(g_changes, 0, sizeof(g_changes));
+    if (check_heights(&wp, name) != 0) ret = -1;
+    if (check_changes(&wp, name, &g_changes[0]) != 0) ret = -1;
+    for (i = 0; i < NUM_ROUNDS && ret == 0; ++i) {
+        for (j = 0; j < 10; ++j) cut_random(&wp, &tool, &profile);
+        /* only some rounds query the heights, so dirty tiles accumulate */
+        if (i % 2 && check_heights(&wp, name) != 0) ret = -1;
+        if (i % 3 == 0 && check_changes(&wp, name, &g_changes[0]) != 0) ret = -1;
+        if (i % 5 == 4 && check_changes(&wp, name, &g_changes[1]) != 0) ret = -1;
+    }
+
+    t_full   = time_exports(&wp, &tool, &profile, 0);
+    t_cached = time_exports(&wp, &tool, &profile, 1);
+    if (check_heights(&wp, name) != 0) ret = -1;
+    fprintf(stdout, "%-6s: %s, export with full scan %.2f ms, with height cache %.2f ms\n",
+            name, ret == 0 ? "OK" : "FAILED", t_full * 1e3, t_cached * 1e3);
+
+    tool_profile_clear(&profile);
+    voxel_space_clear(&tool);
+    workpart_clear(&wp);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int exit_code = EXIT_SUCCESS;
+    unsigned int i;
+
+    srand(1);
+    voxel_kernel_select(VOXEL_KERNEL_AUTO);
+
+    for (i = 0; i < NUM_LAYOUTS; ++i) {
+        if (test_layout(g_layouts[i]) != 0) exit_code = EXIT_FAILURE;
+    }
+
+    return exit_code;
+}
@@ -0,0 +1,256 @@
+#include "../voxelspace.c"
+#include "testutil.h"
+#include <stdlib.h>
+
+/* Stamps a drill tool into a workpart in all memory layouts and checks that
+ * all layouts give the same heights. With -b it stamps more often and
+ * measures the number of distinct cache lines touched per stamp and the
+ * time per stamp.
+ */
+
+/* 80x80x1.6mm at 0.05mm with a 1mm drill, like the standard jobs */
+#define WORKPART_W 1600
+#define WORKPART_H 1600
+#define WORKPART_T 32
+#define TOOL_D     20
+#define NUM_STAMPS 20000
+#define NUM_CHECKED 2000 /* stamps without -b */
+#define NUM_COUNTED 500  /* stamps used to count cache lines */
+
+static const enum voxel_layout g_layouts[] = {
+    VOXEL_LAYOUT_LAYER, VOXEL_LAYOUT_COLUMN, VOXEL_LAYOUT_MORTON
+};
+#define NUM_LAYOUTS (sizeof(g_layouts) / sizeof(g_layouts[0]))
+
+static struct voxel_pos g_stamps[NUM_STAMPS];
+static int g_num_stamps = NUM_CHECKED;
+static int g_benchmark = 0;
+
+/* Milling: the tool moves along random lines in unit steps, 8 layers deep. */
+static void create_mill_job(void)
+{
+    int i = 0, x = 0, y = 0, dx = 0, dy = 0, len = 0;
+
+    while (i < NUM_STAMPS) {
+        if (len == 0) {
+            x   = rand() % (WORKPART_W - TOOL_D);
+            y   = rand() % (WORKPART_H - TOOL_D);
+            dx  = rand() % 3 - 1;
+            dy  = rand() % 3 - 1;
+            len = 50 + rand() % 200;
+        }
+        if (x + dx < 0 || x + dx >= WORKPART_W - TOOL_D) dx = -dx;
+        if (y + dy < 0 || y + dy >= WORKPART_H - TOOL_D) dy = -dy;
+        x += dx;
+        y += dy;
+        voxel_pos_set(&g_stamps[i++], x, y, WORKPART_T - 8);
+        len--;
+    }
+}
+
+/* Drilling: the tool plunges through the workpart at random holes. */
+static void create_drill_job(void)
+{
+    int i = 0, x = 0, y = 0, z = 0;
+
+    while (i < NUM_STAMPS) {
+        if (z <= -TOOL_D / 2) {
+            x = rand() % (WORKPART_W - TOOL_D);
+            y = rand() % (WORKPART_H - TOOL_D);
+            z = WORKPART_T;
+        }
+        voxel_pos_set(&g_stamps[i++], x, y, --z);
+    }
+}
+
+static void create_tool(struct voxel_space *tool, enum voxel_layout layout)
+{
+    struct voxel_pos pos;
+    int x, y, z, r2 = TOOL_D * TOOL_D / 4;
+
+    voxel_space_init_layout(tool, TOOL_D, TOOL_D, TOOL_D, layout);
+    for (z = 0; z < TOOL_D; ++z) {
+        for (y = 0; y < TOOL_D; ++y) {
+            for (x = 0; x < TOOL_D; ++x) {
+                if ((x - TOOL_D / 2) * (x - TOOL_D / 2) + (y - TOOL_D / 2) * (y - TOOL_D / 2) > r2) continue;
+                voxel_pos_set(&pos, x, y, z);
+                voxel_space_set_xyz(tool, &pos);
+            }
+        }
+    }
+}
+
+/* Returns the address of the byte holding a voxel. */
+static uintptr_t voxel_address(struct voxel_space *space, int x, int y, int z)
+{
+    struct voxel_pos pos;
+    uint64_t *word, mask;
+    size_t bit;
+
+    if (space->layout == VOXEL_LAYOUT_LAYER) {
+        bit = ((size_t)z * space->height + y) * space->width + x;
+        return (uintptr_t)(space->data + (bit >> 3));
+    }
+    voxel_pos_set(&pos, x, y, z);
+    voxel_space_word_bit(space, &pos, &word, &mask);
+    return (uintptr_t)word;
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+    uintptr_t la = *(const uintptr_t *)a, lb = *(const uintptr_t *)b;
+
+    return (la > lb) - (la < lb);
+}
+
+/* Counts the distinct cache lines of the workpart touched by the tool voxels. */
+static double count_lines(struct voxel_space *space, struct voxel_space *tool)
+{
+    static uintptr_t lines[TOOL_D * TOOL_D * TOOL_D];
+    struct voxel_pos pos, dst;
+    size_t i, n, total = 0;
+    int s;
+
+    for (s = 0; s < NUM_COUNTED; ++s) {
+        n = 0;
+        for (pos.z = 0; pos.z < TOOL_D; ++pos.z) {
+            for (pos.y = 0; pos.y < TOOL_D; ++pos.y) {
+                for (pos.x = 0; pos.x < TOOL_D; ++pos.x) {
+                    if (voxel_space_get_xyz(tool, &pos) != 1) continue;
+                    voxel_pos_add(&dst, &pos, &g_stamps[s]);
+                    if (dst.z < 0 || dst.z >= WORKPART_T) continue;
+                    lines[n++] = voxel_address(space, dst.x, dst.y, dst.z) >> 6;
+                }
+            }
+        }
+        qsort(lines, n, sizeof(lines[0]), compare_lines);
+        for (i = 0; i < n; ++i) {
+            if (i == 0 || lines[i] != lines[i - 1]) total++;
+        }
+    }
+
+    return (double)total / NUM_COUNTED;
+}
+
+/* Checksum of the heights of all columns. */
+static uint64_t height_checksum(struct voxel_space *space)
+{
+    uint64_t sum = 0;
+    int x, y;
+
+    for (y = 0; y < WORKPART_H; ++y) {
+        for (x = 0; x < WORKPART_W; ++x) {
+            sum = sum * 31 + voxel_space_get_top(space, x, y);
+        }
+    }
+
+    return sum;
+}
+
+/* Stamps all positions by subtracting the tool's voxel space. */
+static double stamp_boolean(struct voxel_space *space, struct voxel_space *tool)
+{
+    double start = now();
+    int s;
+
+    for (s = 0; s < g_num_stamps; ++s) {
+        tool->pos = g_stamps[s];
+        voxel_space_difference(space, tool);
+    }
+
+    return now() - start;
+}
+
+/* Stamps all positions by clearing each tool column from its lowest voxel. */
+static double stamp_columns(struct voxel_space *space, struct voxel_space *tool)
+{
+    static int bottom[TOOL_D * TOOL_D];
+    struct voxel_pos pos;
+    double start;
+    int s, x, y;
+
+    for (y = 0; y < TOOL_D; ++y) {
+        for (x = 0; x < TOOL_D; ++x) {
+            bottom[y * TOOL_D + x] = -1;
+            for (pos.z = TOOL_D - 1; pos.z >= 0; --pos.z) {
+                voxel_pos_set(&pos, x, y, pos.z);
+                if (voxel_space_get_xyz(tool, &pos) == 1) bottom[y * TOOL_D + x] = pos.z;
+            }
+        }
+    }
+
+    start = now();
+    for (s = 0; s < g_num_stamps; ++s) {
+        for (y = 0; y < TOOL_D; ++y) {
+            for (x = 0; x < TOOL_D; ++x) {
+                if (bottom[y * TOOL_D + x] < 0) continue;
+                voxel_space_clr_column(space, g_stamps[s].x + x, g_stamps[s].y + y,
+                                       g_stamps[s].z + bottom[y * TOOL_D + x], g_stamps[s].z + TOOL_D);
+            }
+        }
+    }
+
+    return now() - start;
+}
+
+static int bench_job(const char *name)
+{
+    struct voxel_space space, tool;
+    uint64_t ref_boolean = 0, ref_columns = 0, sum;
+    double lines = 0, t_boolean, t_columns;
+    int ret = 0;
+    unsigned int i;
+
+    for (i = 0; i < NUM_LAYOUTS; ++i) {
+        if (voxel_space_init_layout(&space, WORKPART_W, WORKPART_H, WORKPART_T, g_layouts[i]) != 0) {
+            fprintf(stdout, "Out of memory\n");
+            return -1;
+        }
+        create_tool(&tool, g_layouts[i]);
+        if (g_benchmark) lines = count_lines(&space, &tool);
+
+        voxel_space_set_all(&space);
+        t_boolean = stamp_boolean(&space, &tool);
+        sum = height_checksum(&space);
+        if (i == 0) ref_boolean = sum;
+        if (sum != ref_boolean) ret = -1;
+
+        voxel_space_set_all(&space);
+        t_columns = stamp_columns(&space, &tool);
+        sum = height_checksum(&space);
+        if (i == 0) ref_columns = sum;
+        if (sum != ref_columns) ret = -1;
+
+        if (g_benchmark) {
+            fprintf(stdout, "%-5s %-6s: %6.1f cache lines/stamp, boolean %6.2f us/stamp, columns %6.2f us/stamp\n",
+                    name, voxel_layout_name(g_layouts[i]), lines,
+                    t_boolean * 1e6 / g_num_stamps, t_columns * 1e6 / g_num_stamps);
+        }
+
+        voxel_space_clear(&tool);
+        voxel_space_clear(&space);
+    }
+    if (ret != 0) fprintf(stdout, "%s: layouts disagree\n", name);
+    else if (!g_benchmark) fprintf(stdout, "%s: layouts agree\n", name);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int exit_code = EXIT_SUCCESS;
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        g_benchmark  = 1;
+        g_num_stamps = NUM_STAMPS;
+    }
+    srand(1);
+    voxel_kernel_select(VOXEL_KERNEL_AUTO);
+
+    create_mill_job();
+    if (bench_job("mill") != 0) exit_code = EXIT_FAILURE;
+    create_drill_job();
+    if (bench_job("drill") != 0) exit_code = EXIT_FAILURE;
+
+    return exit_code;
+}
@@ -0,0 +1,278 @@
+#include "../mesh.c"
+#include "../workpart.c"
+#include "../voxelkernel.h"
+#include "testutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Extracts the surface of randomly milled workparts of all backends and
+ * layouts and checks that the mesh is closed, that the slabs share their
+ * vertices and that it encloses the solid voxels. The mesh written with
+ * several threads must be the same as the one written with one thread.
+ */
+
+volatile int g_terminate = 0;
+
+#define WORKPART_W 150
+#define WORKPART_H 110
+#define WORKPART_T 24
+#define TOOL_D     10
+#define NUM_CUTS   60
+#define NUM_THREADS 4
+
+struct config {
+    enum workpart_backend backend;
+    enum voxel_layout layout;
+};
+
+static const struct config g_configs[] = {
+    { WORKPART_VOXEL, VOXEL_LAYOUT_LAYER },
+    { WORKPART_VOXEL, VOXEL_LAYOUT_COLUMN },
+    { WORKPART_VOXEL, VOXEL_LAYOUT_MORTON },
+    { WORKPART_HEIGHTMAP, VOXEL_LAYOUT_LAYER },
+    { WORKPART_DEXEL, VOXEL_LAYOUT_LAYER },
+    { WORKPART_BRICK, VOXEL_LAYOUT_LAYER }
+};
+#define NUM_CONFIGS (sizeof(g_configs) / sizeof(g_configs[0]))
+
+/* Mills grooves and drills holes through the workpart, so the mesh has inner walls. */
+static void cut_random(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile)
+{
+    struct gvector start, end;
+    int i;
+
+    for (i = 0; i < NUM_CUTS; ++i) {
+        tool->pos.x = rand() % WORKPART_W - TOOL_D / 2;
+        tool->pos.y = rand() % WORKPART_H - TOOL_D / 2;
+        tool->pos.z = WORKPART_T - 1 - rand() % 6;
+        if (i % 5 == 0) {
+            workpart_extrude(wp, tool, profile, -TOOL_D);
+        } else {
+            start.x = tool->pos.x + TOOL_D / 2;
+            start.y = tool->pos.y + TOOL_D / 2;
+            start.z = tool->pos.z;
+            end.x = start.x + rand() % 81 - 40;
+            end.y = start.y + rand() % 81 - 40;
+            end.z = start.z;
+            workpart_sweep_line(wp, profile, &start, &end);
+        }
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_vertex(const void *a, const void *b)
+{
+    return memcmp(a, b, 3 * sizeof(float));
+}
+
+/* Number of occurrences of the key in the sorted array. */
+static size_t count_edges(const uint64_t *edges, size_t num_edges, uint64_t key)
+{
+    size_t lo = 0, hi = num_edges, n = 0;
+
+    while (lo < hi) {
+        if (edges[(lo + hi) / 2] < key) {
+            lo = (lo + hi) / 2 + 1;
+        } else {
+            hi = (lo + hi) / 2;
+        }
+    }
+    while (lo + n < num_edges && edges[lo + n] == key) ++n;
+
+    return n;
+}
+
+/* Enclosed volume in voxels, the sum of the tetrahedra of the triangles and the origin. */
+static double mesh_volume(struct mesh *mesh, const float *vertices, float resolution)
+{
+    const float *a, *b, *c;
+    const uint32_t *f;
+    double volume = 0;
+    size_t i, j, k;
+
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        f = mesh->slabs[i].faces;
+        for (j = 0; j < mesh->slabs[i].faces_len; j += f[j] + 1) {
+            a = &vertices[3 * f[j + 1]];
+            for (k = 2; k < f[j]; ++k) {
+                b = &vertices[3 * f[j + k]];
+                c = &vertices[3 * f[j + k + 1]];
+                volume += a[0] * ((double)b[1] * c[2] - (double)b[2] * c[1]) +
+                          a[1] * ((double)b[2] * c[0] - (double)b[0] * c[2]) +
+                          a[2] * ((double)b[0] * c[1] - (double)b[1] * c[0]);
+            }
+        }
+    }
+
+    return volume / 6 / ((double)resolution * resolution * resolution);
+}
+
+/* Checks that each directed edge has as many opposite edges, so the mesh
+ * is closed and consistently oriented, that no vertex is duplicated, and
+ * that the mesh encloses about the volume of the solid voxels.
+ */
+static int check_mesh(struct mesh *mesh, struct workpart *wp, const char *name)
+{
+    uint64_t *edges;
+    float *vertices;
+    size_t num_edges = 0, num_vertices = 0, num_solid = 0, i, j, k, n;
+    const uint32_t *f;
+    double volume;
+    int x, y, z, ret = 0;
+
+    for (i = 0; i < mesh->num_slabs; ++i) num_edges += mesh->slabs[i].faces_len - mesh->slabs[i].num_faces;
+    edges    = malloc(num_edges * sizeof(*edges));
+    vertices = malloc(mesh->num_vertices * 3 * sizeof(*vertices));
+    if (edges == NULL || vertices == NULL) {
+        free(edges);
+        free(vertices);
+        return -1;
+    }
+    num_edges = 0;
+    for (i = 0; i < mesh->num_slabs; ++i) {
+        f = mesh->slabs[i].faces;
+        for (j = 0; j < mesh->slabs[i].faces_len; j += f[j] + 1) {
+            n = f[j];
+            for (k = 0; k < n; ++k) {
+                edges[num_edges++] = ((uint64_t)f[j + 1 + k] << 32) | f[j + 1 + (k + 1) % n];
+            }
+        }
+        memcpy(&vertices[3 * num_vertices], mesh->slabs[i].vertices,
+               mesh->slabs[i].num_vertices * 3 * sizeof(float));
+        num_vertices += mesh->slabs[i].num_vertices;
+    }
+
+    qsort(edges, num_edges, sizeof(*edges), compare_u64);
+    for (i = 0; i < num_edges && ret == 0; i = j) {
+        for (j = i + 1; j < num_edges && edges[j] == edges[i]; ++j) ;
+        n = count_edges(edges, num_edges, (edges[i] << 32) | (edges[i] >> 32));
+        if (n != j - i) {
+            fprintf(stdout, "%s: edge %u-%u used %u times, opposite edge %u times\n", name,
+                    (unsigned)(edges[i] >> 32), (unsigned)edges[i], (unsigned)(j - i), (unsigned)n);
+            ret = -1;
+        }
+    }
+
+    for (y = 0; y < (int)wp->height; ++y) {
+        for (x = 0; x < (int)wp->width; ++x) {
+            for (z = 0; z < (int)wp->thickness; ++z) num_solid += workpart_get_xyz(wp, x, y, z);
+        }
+    }
+    volume = mesh_volume(mesh, vertices, 0.1f);
+    if (fabs(volume - num_solid) > 0.005 * num_solid) {
+        fprintf(stdout, "%s: mesh encloses %.0f voxels, expected %lu\n", name, volume, (unsigned long)num_solid);
+        ret = -1;
+    }
+
+    qsort(vertices, num_vertices, 3 * sizeof(float), compare_vertex);
+    for (i = 1; i < num_vertices && ret == 0; ++i) {
+        if (compare_vertex(&vertices[3 * (i - 1)], &vertices[3 * i]) == 0) {
+            fprintf(stdout, "%s: duplicated vertex %g/%g/%g\n", name,
+                    vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2]);
+            ret = -1;
+        }
+    }
+    free(edges);
+    free(vertices);
+
+    return ret;
+}
+
+/* Reads a whole file, returns NULL on error. */
+static char *read_file(const char *filename, long *size)
+{
+    FILE *f = fopen(filename, "rb");
+    char *data = NULL;
+
+    if (f == NULL) return NULL;
+    if (fseek(f, 0, SEEK_END) == 0 && (*size = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        data = malloc(*size);
+        if (data && fread(data, 1, *size, f) != (size_t)*size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(f);
+
+    return data;
+}
+
+/* Writes the mesh with one thread and with a pool of threads, the files must be equal. */
+static int check_files(struct workpart *wp, const char *name, const char *filename)
+{
+    struct mesh mesh;
+    char *data[2] = { NULL, NULL };
+    long size[2] = { 0, 0 };
+    int i, ret = 0;
+
+    for (i = 0; i < 2 && ret == 0; ++i) {
+        if (i == 1) parallel_init(NUM_THREADS);
+        if (mesh_init(&mesh, wp, 0.1f) != 0 || mesh_write(&mesh, filename) != 0) {
+            fprintf(stdout, "%s: failed to write %s\n", name, filename);
+            ret = -1;
+        } else if ((data[i] = read_file(filename, &size[i])) == NULL || (uint64_t)size[i] != mesh.size) {
+            fprintf(stdout, "%s: %s has %ld bytes, expected %lu\n", name, filename, size[i], (unsigned long)mesh.size);
+            ret = -1;
+        }
+        if (ret == 0 && i == 0) ret = check_mesh(&mesh, wp, name);
+        mesh_clear(&mesh);
+        if (i == 1) parallel_cleanup();
+    }
+    if (ret == 0 && (size[0] != size[1] || memcmp(data[0], data[1], size[0]) != 0)) {
+        fprintf(stdout, "%s: %s differs with %i threads\n", name, filename, NUM_THREADS);
+        ret = -1;
+    }
+    free(data[0]);
+    free(data[1]);
+    remove(filename);
+
+    return ret;
+}
+
+static int test_config(const struct config *config)
+{
+    char name[32];
+    struct voxel_space tool;
+    struct tool_profile profile;
+    struct workpart wp;
+    int ret = 0;
+
+    snprintf(name, sizeof(name), "%s/%s", workpart_backend_name(config->backend), voxel_layout_name(config->layout));
+    if (workpart_init_layout(&wp, config->backend, config->layout, WORKPART_W, WORKPART_H, WORKPART_T) != 0) {
+        fprintf(stdout, "Out of memory\n");
+        return -1;
+    }
+    create_cone(&tool, TOOL_D, TOOL_D, config->layout);
+    tool_profile_init(&profile, &tool);
+    workpart_set_all(&wp);
+    cut_random(&wp, &tool, &profile);
+
+    if (check_files(&wp, name, "meshtest.ply") != 0) ret = -1;
+    if (ret == 0 && check_files(&wp, name, "meshtest.stl") != 0) ret = -1;
+    fprintf(stdout, "%-16s: %s\n", name, ret == 0 ? "OK" : "FAILED");
+
+    tool_profile_clear(&profile);
+    voxel_space_clear(&tool);
+    workpart_clear(&wp);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int exit_code = EXIT_SUCCESS;
+    unsigned int i;
+
+    voxel_kernel_select(VOXEL_KERNEL_AUTO);
+    for (i = 0; i < NUM_CONFIGS; ++i) {
+        srand(1);
+        if (test_config(&g_configs[i]) != 0) exit_code = EXIT_FAILURE;
+    }
+
+    return exit_code;
+}
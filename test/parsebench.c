@@ -0,0 +1,151 @@
+#include "../gcode.c"
+#include "testutil.h"
+#include <stdlib.h>
+
+/* Compares the tokenizer with the legacy line parser. With -b it also
+ * measures the throughput of both in moves per second on a larger file.
+ */
+
+#define NUM_LINES       20000
+#define NUM_BENCH_LINES 200000
+
+volatile int g_terminate = 0;
+
+struct move_stats {
+    unsigned long num_moves;
+    unsigned long num_toolchanges;
+    uint64_t checksum;
+};
+
+static struct move_stats g_stats;
+
+static uint64_t float_bits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+/* Records all moves without interpolating them. */
+static int bench_move_cb(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    g_stats.num_moves++;
+    g_stats.checksum = g_stats.checksum * 31 + move->mode;
+    g_stats.checksum = g_stats.checksum * 31 + float_bits(move->end.x);
+    g_stats.checksum = g_stats.checksum * 31 + float_bits(move->end.y);
+    g_stats.checksum = g_stats.checksum * 31 + float_bits(move->end.z);
+    g_stats.checksum = g_stats.checksum * 31 + float_bits(move->center.x);
+    g_stats.checksum = g_stats.checksum * 31 + float_bits(move->center.y);
+    g_stats.checksum = g_stats.checksum * 31 + float_bits(ctx->feedrate);
+    return 0;
+}
+
+static void bench_toolchange_cb(unsigned int tool)
+{
+    g_stats.num_toolchanges++;
+    g_stats.checksum = g_stats.checksum * 31 + tool;
+}
+
+static int create_gcode(const char *filename, unsigned int num_lines)
+{
+    FILE *f;
+    unsigned int i;
+    float x, y;
+
+    f = fopen(filename, "w");
+    if (f == NULL) return -1;
+
+    fprintf(f, "(parser benchmark)\nG21\nG90\nM03\n");
+    for (i = 0; i < num_lines; ++i) {
+        x = (rand() % 100000) / 1000.0;
+        y = (rand() % 80000) / 1000.0;
+        switch (i % 8) {
+        case 0:
+            fprintf(f, "G00 Z1.0000\n");
+            break;
+        case 1:
+            fprintf(f, "G00 X%.4f Y%.4f\n", x, y);
+            break;
+        case 2:
+            fprintf(f, "G01 Z-0.1000 F30.00\n");
+            break;
+        case 3:
+        case 4:
+            fprintf(f, "G01 X%.4f Y%.4f F120.00\n", x, y);
+            break;
+        case 5:
+            fprintf(f, "G02 X%.4f Y%.4f I%.4f J%.4f\n", x, y, -1.25, 0.5);
+            break;
+        case 6:
+            fprintf(f, "G03 X%.4f Y%.4f I0.7500 J-1.0000\n", x, y);
+            break;
+        case 7:
+            if (i % 4096 == 7) {
+                fprintf(f, "M06 T%u\n", 1 + (i / 4096) % 2);
+            } else {
+                fprintf(f, "G01 X%.4f Y%.4f Z-0.1250\n", x, y);
+            }
+            break;
+        }
+    }
+    fprintf(f, "M05\nM02\n");
+    fclose(f);
+
+    return 0;
+}
+
+/* Runs one parser and returns the time in seconds. */
+static double bench(int (*parse)(struct gcode_ctx *, const char *), const char *filename, struct move_stats *stats)
+{
+    struct gcode_ctx ctx;
+    double start;
+
+    memset(&g_stats, 0, sizeof(g_stats));
+    gcode_ctx_init(&ctx);
+    ctx.move_cb       = bench_move_cb;
+    ctx.toolchange_cb = bench_toolchange_cb;
+
+    start = now();
+    parse(&ctx, filename);
+    *stats = g_stats;
+
+    return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename = "parsebench.gcode";
+    struct move_stats legacy, mapped;
+    double t_legacy, t_mapped;
+    int ret, benchmark = (argc > 1 && strcmp(argv[1], "-b") == 0);
+
+    srand(1);
+    ret = create_gcode(filename, benchmark ? NUM_BENCH_LINES : NUM_LINES);
+    if (ret != 0) {
+        fprintf(stdout, "Could not create %s\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    t_legacy = bench(gcode_parse_lines, filename, &legacy);
+    t_mapped = bench(gcode_parse_mapped, filename, &mapped);
+    remove(filename);
+
+    if (benchmark) {
+        fprintf(stdout, "legacy:    %lu moves in %.3f s, %.0f moves/s\n",
+                legacy.num_moves, t_legacy, legacy.num_moves / t_legacy);
+        fprintf(stdout, "tokenizer: %lu moves in %.3f s, %.0f moves/s (%.1fx)\n",
+                mapped.num_moves, t_mapped, mapped.num_moves / t_mapped, t_legacy / t_mapped);
+    }
+
+    if (legacy.num_moves != mapped.num_moves ||
+        legacy.num_toolchanges != mapped.num_toolchanges ||
+        legacy.checksum != mapped.checksum) {
+        fprintf(stdout, "Parsers disagree: moves %lu/%lu, tool changes %lu/%lu\n",
+                legacy.num_moves, mapped.num_moves,
+                legacy.num_toolchanges, mapped.num_toolchanges);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "%lu moves, %lu tool changes OK\n", mapped.num_moves, mapped.num_toolchanges);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include "../render.c"
+#include "../parallel.h"
+#include "testutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Renders a workpart with a milled pocket and the tool, checks the
+ * materials at a few pixels and that the parallel rendering gives the
+ * same image as the serial one.
+ */
+
+#define WIDTH  200
+#define HEIGHT 200
+#define MAXVAL 32
+#define POCKET 60
+#define IMAGE_W 160
+#define IMAGE_H 120
+
+static uint16_t g_values[WIDTH * HEIGHT];
+
+/* Reads the pixels of a binary PPM written by render_ppm(). */
+static uint8_t *read_ppm(const char *filename)
+{
+    unsigned int w, h, m;
+    uint8_t *data;
+    FILE *f;
+
+    f = fopen(filename, "rb");
+    if (f == NULL) return NULL;
+    if (fscanf(f, "P6 %u %u %u", &w, &h, &m) != 3 || w != IMAGE_W || h != IMAGE_H || m != 255) {
+        fclose(f);
+        return NULL;
+    }
+    fgetc(f);
+    data = malloc(IMAGE_W * IMAGE_H * 3);
+    if (data && fread(data, 3, IMAGE_W * IMAGE_H, f) != IMAGE_W * IMAGE_H) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+
+    return data;
+}
+
+/* Copper is reddish, FR4 pale, see g_copper and g_fr4. */
+static int check_pixel(const uint8_t *data, unsigned int x, unsigned int y, enum render_material m)
+{
+    const uint8_t *p = data + (y * IMAGE_W + x) * 3;
+    int copper = p[2] * 2 < p[0];
+
+    if (copper == (m == RENDER_COPPER_SURFACE)) return 0;
+    fprintf(stdout, "pixel %u/%u (%u,%u,%u): expected %s\n", x, y, p[0], p[1], p[2],
+            m == RENDER_COPPER_SURFACE ? "copper" : "FR4");
+    return -1;
+}
+
+static double render(struct render_scene *scene, const char *filename)
+{
+    double start = now();
+
+    if (render_ppm(scene, IMAGE_W, IMAGE_H, filename) != 0) return -1;
+    return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    struct render_scene scene;
+    uint8_t *serial, *parallel;
+    unsigned int x, y;
+    double t_serial, t_parallel;
+    int exit_code = EXIT_SUCCESS;
+
+    /* untouched copper with a pocket down to layer 10 in the center */
+    for (y = 0; y < HEIGHT; ++y) {
+        for (x = 0; x < WIDTH; ++x) {
+            g_values[y * WIDTH + x] = MAXVAL - 1;
+            if (abs((int)x - WIDTH / 2) < POCKET / 2 && abs((int)y - HEIGHT / 2) < POCKET / 2) {
+                g_values[y * WIDTH + x] = 10;
+            }
+        }
+    }
+    memset(&scene, 0, sizeof(scene));
+    scene.values        = g_values;
+    scene.width         = WIDTH;
+    scene.height        = HEIGHT;
+    scene.maxval        = MAXVAL;
+    scene.resolution    = 0.1;
+    scene.show_tool     = 1;
+    scene.tool_x        = WIDTH / 4;
+    scene.tool_y        = HEIGHT / 4;
+    scene.tool_z        = MAXVAL;
+    scene.tool_diameter = 2;
+
+    t_serial = render(&scene, "rendertest1.ppm");
+    if (parallel_init(4) != 0) {
+        fprintf(stdout, "Failed to start threads\n");
+        return EXIT_FAILURE;
+    }
+    t_parallel = render(&scene, "rendertest2.ppm");
+    parallel_cleanup();
+
+    serial   = read_ppm("rendertest1.ppm");
+    parallel = read_ppm("rendertest2.ppm");
+    if (t_serial < 0 || t_parallel < 0 || serial == NULL || parallel == NULL) {
+        fprintf(stdout, "Failed to render\n");
+        exit_code = EXIT_FAILURE;
+    } else if (memcmp(serial, parallel, IMAGE_W * IMAGE_H * 3) != 0) {
+        fprintf(stdout, "Parallel rendering differs\n");
+        exit_code = EXIT_FAILURE;
+    } else {
+        /* the camera looks at the center of the pocket */
+        if (check_pixel(serial, IMAGE_W / 2, IMAGE_H / 2, RENDER_FR4) != 0) exit_code = EXIT_FAILURE;
+        if (check_pixel(serial, IMAGE_W / 2, IMAGE_H * 3 / 4, RENDER_COPPER_SURFACE) != 0) exit_code = EXIT_FAILURE;
+        if (check_pixel(serial, IMAGE_W / 2, IMAGE_H / 3, RENDER_COPPER_SURFACE) != 0) exit_code = EXIT_FAILURE;
+        fprintf(stdout, "%s, %.1f ms serial, %.1f ms with 4 threads\n",
+                exit_code == EXIT_SUCCESS ? "OK" : "FAILED", t_serial * 1e3, t_parallel * 1e3);
+    }
+    free(serial);
+    free(parallel);
+    remove("rendertest1.ppm");
+    remove("rendertest2.ppm");
+
+    return exit_code;
+}
@@ -0,0 +1,10 @@
+G21
+G90
+G00 Z2
+G00 X4 Y4
+G01 Z-0.5 F200
+G01 Z2
+G00 X2 Y6
+G01 Z-0.2
+G01 X6 Y6 F300
+G01 Z2
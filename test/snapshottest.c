@@ -0,0 +1,105 @@
+#include "../snapshot.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Submits snapshots with a few changed rows in both image formats and
+ * checks that the written file always contains all submitted values.
+ */
+
+#define WIDTH  150
+#define HEIGHT 70
+#define NUM_SNAPSHOTS 10
+
+static uint16_t g_expected[WIDTH * HEIGHT];
+
+/* Reads the next number of a PNM header or ASCII raster. */
+static int read_uint(FILE *f, unsigned int *val)
+{
+    return (fscanf(f, "%u", val) == 1) ? 0 : -1;
+}
+
+/* Reads the image and compares it with the expected values. */
+static int check_file(const char *filename, enum pnm_format format, unsigned int maxval)
+{
+    unsigned int w, h, m, val, i;
+    char magic[3] = { 0 };
+    int ret = 0, c;
+    FILE *f;
+
+    f = fopen(filename, "rb");
+    if (f == NULL) return -1;
+    if (fread(magic, 1, 2, f) != 2 || read_uint(f, &w) || read_uint(f, &h) || read_uint(f, &m)) ret = -1;
+    if (ret == 0 && (strcmp(magic, (format == PNM_BINARY) ? "P5" : "P2") != 0 ||
+                     w != WIDTH || h != HEIGHT || m != maxval)) {
+        fprintf(stdout, "%s: wrong header %s %u %u %u\n", filename, magic, w, h, m);
+        ret = -1;
+    }
+    if (ret == 0 && format == PNM_BINARY) fgetc(f);
+    for (i = 0; i < WIDTH * HEIGHT && ret == 0; ++i) {
+        if (format == PNM_ASCII) {
+            if (read_uint(f, &val) != 0) ret = -1;
+        } else if (maxval < 256) {
+            val = fgetc(f);
+        } else {
+            c   = fgetc(f);
+            val = (c << 8) | fgetc(f);
+        }
+        if (ret == 0 && val != g_expected[i]) {
+            fprintf(stdout, "%s: pixel %u/%u is %u, expected %u\n", filename,
+                    i % WIDTH, i / WIDTH, val, g_expected[i]);
+            ret = -1;
+        }
+    }
+    fclose(f);
+
+    return ret;
+}
+
+static int test_format(enum pnm_format format, unsigned int maxval)
+{
+    const char *filename = "snapshottest.pgm";
+    struct snapshot snap;
+    unsigned int i, n, x, y;
+    int ret = 0;
+
+    pnm_set_format(format);
+    if (snapshot_init(&snap, filename, WIDTH, HEIGHT, maxval) != 0) {
+        fprintf(stdout, "Failed to start snapshot writer\n");
+        return -1;
+    }
+    memset(g_expected, 0, sizeof(g_expected));
+
+    for (i = 0; i < NUM_SNAPSHOTS && ret == 0; ++i) {
+        /* change a few random rows, the writer must keep all others */
+        for (n = 0; n < 5; ++n) {
+            y = rand() % HEIGHT;
+            for (x = rand() % WIDTH; x < WIDTH; ++x) g_expected[y * WIDTH + x] = rand() % (maxval + 1);
+            memcpy(&snap.values[y * WIDTH], &g_expected[y * WIDTH], WIDTH * sizeof(*g_expected));
+            snap.rows[y] = 1;
+        }
+        snapshot_submit(&snap);
+        snapshot_wait(&snap);
+        if (snapshot_busy(&snap)) ret = -1;
+        if (check_file(filename, format, maxval) != 0) ret = -1;
+    }
+    snapshot_clear(&snap);
+    remove(filename);
+
+    fprintf(stdout, "%s maxval %u: %s\n", (format == PNM_BINARY) ? "binary" : "ascii",
+            maxval, ret == 0 ? "OK" : "FAILED");
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int exit_code = EXIT_SUCCESS;
+
+    srand(1);
+    if (test_format(PNM_BINARY, 40) != 0) exit_code = EXIT_FAILURE;
+    if (test_format(PNM_BINARY, 1000) != 0) exit_code = EXIT_FAILURE;
+    if (test_format(PNM_ASCII, 40) != 0) exit_code = EXIT_FAILURE;
+    if (test_format(PNM_ASCII, 65535) != 0) exit_code = EXIT_FAILURE;
+
+    return exit_code;
+}
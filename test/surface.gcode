@@ -0,0 +1,10 @@
+G21
+G90
+G00 X1 Y1
+G00 Z2
+G01 X3 Y3 F300
+G01 Z-0.5
+G01 Z2
+G01 X6 Y2
+G01 Z-1
+G01 Z2
@@ -0,0 +1,181 @@
+#include "../workpart.c"
+#include "../voxelkernel.h"
+#include "testutil.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Checks that the swept volumes of lines and arcs, including helical and
+ * full circle arcs, match stamps of the tool at dense points along the same
+ * path within one voxel: each column height of one workpart lies within one
+ * voxel of the heights of the same or a neighbouring column of the other.
+ */
+
+volatile int g_terminate = 0;
+
+#define WORKPART_W 160
+#define WORKPART_H 120
+#define WORKPART_T 24
+#define TOOL_D     10
+#define STAMP_STEP 0.05f /* distance of the stamps in voxels */
+
+/* The tool always reaches above the workpart, the heights describe the cuts. */
+
+/* Path of a test move, a line if radius is zero. */
+struct path {
+    const char *name;
+    float x0, y0, z0;  /**< start of a line or center of an arc */
+    float x1, y1, z1;  /**< end of a line or end height of an arc */
+    float radius;      /**< arc radius */
+    float alpha, span; /**< start angle and signed angle of the arc, positive is CCW */
+};
+
+static const struct path g_paths[] = {
+    { "line",          20.3, 30.7, 18,   90.6,  60.2, 18,   0,    0,    0 },
+    { "ramp",          15.5, 95.2, 22,   140.1, 80.6, 15.4, 0,    0,    0 },
+    { "plunge",        60.4, 60.6, 22,   60.4,  60.6, 15,   0,    0,    0 },
+    { "arc ccw",       80.2, 60.4, 17,   0,     0,    17,   35.3, 0.3,  2.1 },
+    { "arc cw",        75.7, 55.1, 16,   0,     0,    16,   27.6, 2.5,  -4.4 },
+    { "helix",         80.5, 60.5, 22,   0,     0,    15.5, 30,   1.0,  -2*M_PI },
+    { "partial helix", 70.1, 65.9, 15.2, 0,     0,    21.8, 22.4, -0.7, 3.9 },
+};
+#define NUM_PATHS (sizeof(g_paths) / sizeof(g_paths[0]))
+
+/* Point of the path at t in [0,1]. */
+static void path_point(const struct path *p, float t, struct gvector *v)
+{
+    float phi;
+
+    if (p->radius == 0) {
+        v->x = p->x0 + (p->x1 - p->x0) * t;
+        v->y = p->y0 + (p->y1 - p->y0) * t;
+    } else {
+        phi = p->alpha + p->span * t;
+        v->x = p->x0 + p->radius * cos(phi);
+        v->y = p->y0 + p->radius * sin(phi);
+    }
+    v->z = p->z0 + (p->z1 - p->z0) * t;
+}
+
+/* Removes the path with the swept volume functions. */
+static void cut_sweep(struct workpart *wp, struct tool_profile *profile, const struct path *p)
+{
+    struct gvector start, end, center;
+
+    path_point(p, 0, &start);
+    path_point(p, 1, &end);
+    if (p->radius == 0) {
+        workpart_sweep_line(wp, profile, &start, &end);
+        return;
+    }
+    if (fabs(p->span) > 2*M_PI - 1e-3) {
+        /* a full circle has the same start and end point like in G-code */
+        end.x = start.x;
+        end.y = start.y;
+    }
+    center.x = p->x0;
+    center.y = p->y0;
+    center.z = start.z;
+    workpart_sweep_arc(wp, profile, &start, &end, &center, (p->span < 0) ? ARC_CW : ARC_CCW);
+}
+
+/* Removes the path with stamps at the nearest voxel of dense points. */
+static void cut_stamps(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, const struct path *p)
+{
+    struct gvector v, prev;
+    float len = 0;
+    unsigned int i, n;
+
+    /* length of the path from a fine polyline */
+    path_point(p, 0, &prev);
+    for (i = 1; i <= 1000; ++i) {
+        path_point(p, i / 1000.0f, &v);
+        len += hypot(hypot(v.x - prev.x, v.y - prev.y), v.z - prev.z);
+        prev = v;
+    }
+    n = ceil(len / STAMP_STEP);
+
+    for (i = 0; i <= n; ++i) {
+        path_point(p, (float)i / n, &v);
+        tool->pos.x = lround(v.x) - TOOL_D / 2;
+        tool->pos.y = lround(v.y) - TOOL_D / 2;
+        tool->pos.z = floor(v.z);
+        workpart_stamp(wp, tool, profile);
+    }
+}
+
+/* Lowest and highest height of the column and its neighbours. */
+static void neighbour_heights(struct workpart *wp, int x, int y, int *lo, int *hi)
+{
+    int dx, dy, top;
+
+    *lo = WORKPART_T;
+    *hi = 0;
+    for (dy = -1; dy <= 1; ++dy) {
+        for (dx = -1; dx <= 1; ++dx) {
+            if (x + dx < 0 || x + dx >= WORKPART_W || y + dy < 0 || y + dy >= WORKPART_H) continue;
+            top = workpart_get_top(wp, x + dx, y + dy);
+            if (top < *lo) *lo = top;
+            if (top > *hi) *hi = top;
+        }
+    }
+}
+
+/* Checks that each height of a lies within one voxel of the neighbourhood in b. */
+static int compare_heights(struct workpart *a, struct workpart *b, const char *name, const char *what)
+{
+    int x, y, top, lo, hi;
+
+    for (y = 0; y < WORKPART_H; ++y) {
+        for (x = 0; x < WORKPART_W; ++x) {
+            top = workpart_get_top(a, x, y);
+            neighbour_heights(b, x, y, &lo, &hi);
+            if (top < lo - 1 || top > hi + 1) {
+                fprintf(stdout, "%s: %s height at %i/%i is %i, expected %i..%i\n",
+                        name, what, x, y, top, lo - 1, hi + 1);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct voxel_space tool;
+    struct tool_profile profile;
+    struct workpart sweep, stamps;
+    int exit_code = EXIT_SUCCESS;
+    unsigned int i;
+
+    voxel_kernel_select(VOXEL_KERNEL_AUTO);
+
+    if (workpart_init(&sweep, WORKPART_VOXEL, WORKPART_W, WORKPART_H, WORKPART_T) != 0 ||
+        workpart_init(&stamps, WORKPART_VOXEL, WORKPART_W, WORKPART_H, WORKPART_T) != 0) {
+        fprintf(stdout, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    create_cone(&tool, TOOL_D, TOOL_D, VOXEL_LAYOUT_LAYER);
+    tool_profile_init(&profile, &tool);
+
+    for (i = 0; i < NUM_PATHS; ++i) {
+        workpart_set_all(&sweep);
+        workpart_set_all(&stamps);
+        cut_sweep(&sweep, &profile, &g_paths[i]);
+        cut_stamps(&stamps, &tool, &profile, &g_paths[i]);
+        if (compare_heights(&sweep, &stamps, g_paths[i].name, "swept") != 0 ||
+            compare_heights(&stamps, &sweep, g_paths[i].name, "stamped") != 0) {
+            exit_code = EXIT_FAILURE;
+            continue;
+        }
+        fprintf(stdout, "%-13s: OK\n", g_paths[i].name);
+    }
+
+    tool_profile_clear(&profile);
+    voxel_space_clear(&tool);
+    workpart_clear(&sweep);
+    workpart_clear(&stamps);
+
+    return exit_code;
+}
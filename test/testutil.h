@@ -0,0 +1,60 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TESTUTIL_H_Q7XW2MZC
+#define TESTUTIL_H_Q7XW2MZC
+
+/* Helpers shared by the unit tests, include this after the sources under test. */
+
+#include "../voxelspace.h"
+#include <time.h>
+
+/** Monotonic time in seconds. */
+static inline double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Creates a cone shaped tool like the etch tool. The radius grows by one
+ * voxel per layer up to d/2, so the columns are solid up to the top.
+ *
+ * @param tool Returns the tool, free it with voxel_space_clear().
+ * @param d Width and height of the tool in voxels.
+ * @param t Thickness of the tool in voxels.
+ */
+static inline void create_cone(struct voxel_space *tool, int d, int t, enum voxel_layout layout)
+{
+    int x, y, z, r;
+    struct voxel_pos pos;
+
+    voxel_space_init_layout(tool, d, d, t, layout);
+    for (z = 0; z < t; ++z) {
+        r = z < d / 2 ? z : d / 2;
+        for (y = 0; y < d; ++y) {
+            for (x = 0; x < d; ++x) {
+                if ((x - d/2) * (x - d/2) + (y - d/2) * (y - d/2) > r * r) continue;
+                voxel_pos_set(&pos, x, y, z);
+                voxel_space_set_xyz(tool, &pos);
+            }
+        }
+    }
+}
+
+#endif /* end of include guard: TESTUTIL_H_Q7XW2MZC */
@@ -0,0 +1,285 @@
+#include "../toolpath.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <utime.h>
+
+/* Compiles a GCode file to a toolpath, checks that the replay reports the
+ * same moves and tool changes as parsing the text, that damaged toolpaths
+ * are rejected and that an outdated toolpath is compiled again.
+ */
+
+volatile int g_terminate = 0;
+
+#define GCODE_FILE    "toolpathtest.gcode"
+#define TOOLPATH_FILE "toolpathtest.gcode" TOOLPATH_SUFFIX
+#define BROKEN_FILE   "toolpathtest_broken" TOOLPATH_SUFFIX
+#define MAX_EVENTS    64
+
+static const char g_gcode[] =
+    "G21\n"
+    "G90\n"
+    "G00 Z2\n"
+    "G00 X10 Y10\n"
+    "G01 Z-0.1 F200\n"
+    "G02 X20 Y10 I5 J0 F300\n"
+    "G03 X15 Y15 I-2.5 J2.5\n"
+    "G01 Z2\n"
+    "M6 T2\n"
+    "G00 X5 Y25\n"
+    "G01 Z-0.2\n"
+    "G03 X5 Y25 I2 J0 Z-0.05\n"
+    "G01 Z2\n";
+
+/* a move or a tool change, as reported by the callbacks */
+struct event {
+    int type;
+    unsigned int tool;
+    unsigned int line;
+    float feedrate;
+    struct gcode_move move;
+};
+
+static struct event g_events[MAX_EVENTS];
+static unsigned int g_num_events;
+
+static int record_move(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    struct event *ev = &g_events[g_num_events];
+
+    if (g_num_events == MAX_EVENTS) return 0;
+    memset(ev, 0, sizeof(*ev));
+    ev->type     = move->mode;
+    ev->line     = ctx->lineno;
+    ev->feedrate = ctx->feedrate;
+    ev->move     = *move;
+    g_num_events++;
+
+    return 0; /* no interpolation */
+}
+
+static void record_toolchange(unsigned int tool)
+{
+    struct event *ev = &g_events[g_num_events];
+
+    if (g_num_events == MAX_EVENTS) return;
+    memset(ev, 0, sizeof(*ev));
+    ev->type = TOOLPATH_TOOL;
+    ev->tool = tool;
+    g_num_events++;
+}
+
+static int write_file(const char *filename, const void *data, size_t size)
+{
+    FILE *f = fopen(filename, "wb");
+    int ret = 0;
+
+    if (f == NULL) return -1;
+    if (fwrite(data, 1, size, f) != size) ret = -1;
+    if (fclose(f) != 0) ret = -1;
+
+    return ret;
+}
+
+static ino_t file_inode(const char *filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) != 0) return 0;
+    return st.st_ino;
+}
+
+/* Compares the replayed moves and tool changes with the parsed ones. */
+static int test_replay(void)
+{
+    struct event parsed[MAX_EVENTS];
+    unsigned int i, num_parsed;
+    struct toolpath tp;
+    int ret = 0;
+
+    g_num_events = 0;
+    if (gcode_parse(GCODE_FILE, NULL, record_move, record_toolchange) != 0) {
+        fprintf(stdout, "Failed to parse %s\n", GCODE_FILE);
+        return -1;
+    }
+    memcpy(parsed, g_events, sizeof(parsed));
+    num_parsed = g_num_events;
+
+    if (toolpath_open(&tp, GCODE_FILE, TOOLPATH_FILE) != 0) {
+        fprintf(stdout, "Failed to compile %s\n", GCODE_FILE);
+        return -1;
+    }
+    g_num_events = 0;
+    toolpath_replay(&tp, NULL, record_move, record_toolchange);
+    if (g_num_events != num_parsed || num_parsed != tp.header->num_records) {
+        fprintf(stdout, "Replayed %u events, parsed %u, stored %lu\n", g_num_events, num_parsed,
+                (unsigned long)tp.header->num_records);
+        ret = -1;
+    }
+    for (i = 0; i < num_parsed && ret == 0; ++i) {
+        if (memcmp(&g_events[i], &parsed[i], sizeof(parsed[i])) != 0) {
+            fprintf(stdout, "Replayed event %u differs from the parsed one (line %u)\n", i, parsed[i].line);
+            ret = -1;
+        }
+        /* a tool change is stored with the line of the move before it */
+        if (parsed[i].type == TOOLPATH_TOOL && i > 0 && tp.records[i].line != parsed[i - 1].line) {
+            fprintf(stdout, "Tool change stored with line %u, expected %u\n",
+                    (unsigned)tp.records[i].line, parsed[i - 1].line);
+            ret = -1;
+        }
+    }
+    toolpath_close(&tp);
+
+    return ret;
+}
+
+/* Damages a copy of the toolpath and checks that it is rejected. */
+static int test_broken(void)
+{
+    struct mapped_file file;
+    struct toolpath_header *h;
+    struct toolpath tp;
+    char *data;
+    size_t size;
+    int ret = 0;
+
+    if (mapped_file_open(&file, TOOLPATH_FILE) != 0) return -1;
+    size = file.size;
+    data = malloc(size);
+    if (data == NULL) {
+        mapped_file_close(&file);
+        return -1;
+    }
+    memcpy(data, file.data, size);
+    mapped_file_close(&file);
+    h = (struct toolpath_header *)data;
+
+    h->magic[0] = 'X';
+    write_file(BROKEN_FILE, data, size);
+    if (toolpath_load(&tp, BROKEN_FILE) == 0) {
+        fprintf(stdout, "Toolpath with a bad magic accepted\n");
+        toolpath_close(&tp);
+        ret = -1;
+    }
+    h->magic[0] = TOOLPATH_MAGIC[0];
+
+    h->record_size++;
+    write_file(BROKEN_FILE, data, size);
+    if (toolpath_load(&tp, BROKEN_FILE) == 0) {
+        fprintf(stdout, "Toolpath with a bad record size accepted\n");
+        toolpath_close(&tp);
+        ret = -1;
+    }
+    h->record_size--;
+
+    /* the header promises one record more than the file holds */
+    write_file(BROKEN_FILE, data, size - sizeof(struct toolpath_record));
+    if (toolpath_load(&tp, BROKEN_FILE) == 0) {
+        fprintf(stdout, "Truncated toolpath accepted\n");
+        toolpath_close(&tp);
+        ret = -1;
+    }
+
+    write_file(BROKEN_FILE, data, sizeof(*h) - 1);
+    if (toolpath_load(&tp, BROKEN_FILE) == 0) {
+        fprintf(stdout, "Toolpath without a complete header accepted\n");
+        toolpath_close(&tp);
+        ret = -1;
+    }
+
+    write_file(BROKEN_FILE, data, size);
+    if (toolpath_load(&tp, BROKEN_FILE) != 0) {
+        fprintf(stdout, "Intact copy of the toolpath rejected\n");
+        ret = -1;
+    } else {
+        toolpath_close(&tp);
+    }
+    free(data);
+    remove(BROKEN_FILE);
+
+    return ret;
+}
+
+/* Changes the GCode file and checks that the toolpath is compiled again. */
+static int test_outdated(void)
+{
+    struct toolpath tp;
+    struct utimbuf times;
+    struct stat st;
+    uint64_t num_records;
+    ino_t inode;
+    int ret = 0;
+
+    inode = file_inode(TOOLPATH_FILE);
+    if (toolpath_open(&tp, GCODE_FILE, TOOLPATH_FILE) != 0) return -1;
+    num_records = tp.header->num_records;
+    toolpath_close(&tp);
+    if (file_inode(TOOLPATH_FILE) != inode) {
+        fprintf(stdout, "Current toolpath compiled again\n");
+        ret = -1;
+    }
+
+    /* same size, other modification time */
+    stat(GCODE_FILE, &st);
+    times.actime  = st.st_atime;
+    times.modtime = st.st_mtime - 10;
+    utime(GCODE_FILE, &times);
+    if (toolpath_open(&tp, GCODE_FILE, TOOLPATH_FILE) != 0) return -1;
+    toolpath_close(&tp);
+    if (file_inode(TOOLPATH_FILE) == inode) {
+        fprintf(stdout, "Toolpath not compiled again after the modification time changed\n");
+        ret = -1;
+    }
+
+    /* one move more, the modification time is restored so only the size differs */
+    inode = file_inode(TOOLPATH_FILE);
+    stat(GCODE_FILE, &st);
+    write_file(GCODE_FILE, g_gcode, sizeof(g_gcode) - 1);
+    {
+        FILE *f = fopen(GCODE_FILE, "a");
+        if (f) {
+            fputs("G01 Z5\n", f);
+            fclose(f);
+        }
+    }
+    times.actime  = st.st_atime;
+    times.modtime = st.st_mtime;
+    utime(GCODE_FILE, &times);
+    if (toolpath_open(&tp, GCODE_FILE, TOOLPATH_FILE) != 0) return -1;
+    if (file_inode(TOOLPATH_FILE) == inode || tp.header->num_records != num_records + 1) {
+        fprintf(stdout, "Toolpath not compiled again after the size changed\n");
+        ret = -1;
+    }
+    toolpath_close(&tp);
+
+    /* a damaged toolpath is replaced */
+    write_file(TOOLPATH_FILE, "broken", 6);
+    if (toolpath_open(&tp, GCODE_FILE, TOOLPATH_FILE) != 0) {
+        fprintf(stdout, "Damaged toolpath not compiled again\n");
+        ret = -1;
+    } else {
+        toolpath_close(&tp);
+    }
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+
+    remove(TOOLPATH_FILE);
+    if (write_file(GCODE_FILE, g_gcode, sizeof(g_gcode) - 1) != 0) {
+        fprintf(stdout, "Failed to write %s\n", GCODE_FILE);
+        return EXIT_FAILURE;
+    }
+
+    if (test_replay() != 0) ret = -1;
+    if (ret == 0 && test_broken() != 0) ret = -1;
+    if (ret == 0 && test_outdated() != 0) ret = -1;
+    fprintf(stdout, "%s\n", ret == 0 ? "OK" : "FAILED");
+
+    remove(GCODE_FILE);
+    remove(TOOLPATH_FILE);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,466 @@
+/* small d3f batches, so a space is written in several */
+#define VOXEL_D3F_BUFFER_SIZE 50000
+#include "../voxelspace.c"
+#include "../parallel.h"
+#include <stdlib.h>
+
+/* Reference implementation: combines the spaces voxel by voxel. */
+static void reference_boolean(struct voxel_space *space, struct voxel_space *other, enum voxel_op op)
+{
+    unsigned int x, y, z;
+    struct voxel_pos a, b;
+    int va, vb, res;
+
+    for (z = 0; z < other->thickness; ++z) {
+        for (y = 0; y < other->height; ++y) {
+            for (x = 0; x < other->width; ++x) {
+                voxel_pos_set(&b, x, y, z);
+                voxel_pos_add(&a, &b, &other->pos);
+
+                if (a.x < 0 || a.x >= space->width) continue;
+                if (a.y < 0 || a.y >= space->height) continue;
+                if (a.z < 0 || a.z >= space->thickness) continue;
+
+                va = voxel_space_get_xyz(space, &a);
+                vb = voxel_space_get_xyz(other, &b);
+                switch (op) {
+                case VOXEL_OP_DIFFERENCE:   res = va && !vb; break;
+                case VOXEL_OP_UNION:        res = va || vb; break;
+                case VOXEL_OP_INTERSECTION: res = va && vb; break;
+                case VOXEL_OP_XOR:          res = va != vb; break;
+                default:                    res = va; break;
+                }
+                if (res)
+                    voxel_space_set_xyz(space, &a);
+                else
+                    voxel_space_clr_xyz(space, &a);
+            }
+        }
+    }
+}
+
+static void fill_random(struct voxel_space *space)
+{
+    size_t i;
+
+    for (i = 0; i < space->size; ++i) {
+        space->data[i] = rand() & 0xff;
+    }
+}
+
+static int compare_spaces(struct voxel_space *a, struct voxel_space *b)
+{
+    unsigned int x, y, z;
+    struct voxel_pos pos;
+
+    for (z = 0; z < a->thickness; ++z) {
+        for (y = 0; y < a->height; ++y) {
+            for (x = 0; x < a->width; ++x) {
+                voxel_pos_set(&pos, x, y, z);
+                if (voxel_space_get_xyz(a, &pos) != voxel_space_get_xyz(b, &pos)) {
+                    fprintf(stdout, "Mismatch at %u/%u/%u\n", x, y, z);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Tests one operation with random content at the given offset. */
+static int test_boolean(enum voxel_op op, int ox, int oy, int oz)
+{
+    struct voxel_space space, ref, other;
+    int ret;
+
+    voxel_space_init(&space, 611, 30, 8);
+    voxel_space_init(&ref, 611, 30, 8);
+    voxel_space_init(&other, 297, 19, 6);
+    fill_random(&space);
+    memcpy(ref.data, space.data, space.size);
+    fill_random(&other);
+    other.pos.x = ox;
+    other.pos.y = oy;
+    other.pos.z = oz;
+
+    voxel_space_boolean(&space, &other, op);
+    reference_boolean(&ref, &other, op);
+    ret = compare_spaces(&space, &ref);
+    if (ret != 0) {
+        fprintf(stdout, "Testcase: op=%i, offset=%i/%i/%i failed\n", op, ox, oy, oz);
+    }
+
+    voxel_space_clear(&space);
+    voxel_space_clear(&ref);
+    voxel_space_clear(&other);
+    return ret;
+}
+
+/* Tests that applying an operation tile by tile gives the same result. */
+static int test_boolean_clip(enum voxel_op op, int ox, int oy, int oz, int tile)
+{
+    struct voxel_space space, ref, other;
+    int x, y, ret;
+
+    voxel_space_init(&space, 611, 30, 8);
+    voxel_space_init(&ref, 611, 30, 8);
+    voxel_space_init(&other, 297, 19, 6);
+    fill_random(&space);
+    memcpy(ref.data, space.data, space.size);
+    fill_random(&other);
+    other.pos.x = ox;
+    other.pos.y = oy;
+    other.pos.z = oz;
+
+    for (y = 0; y < space.height; y += tile) {
+        for (x = 0; x < space.width; x += tile) {
+            voxel_space_boolean_clip(&space, &other, op, x, y, x + tile, y + tile);
+        }
+    }
+    voxel_space_boolean(&ref, &other, op);
+    ret = compare_spaces(&space, &ref);
+    if (ret != 0) {
+        fprintf(stdout, "Testcase: clip op=%i, offset=%i/%i/%i, tile=%i failed\n", op, ox, oy, oz, tile);
+    }
+
+    voxel_space_clear(&space);
+    voxel_space_clear(&ref);
+    voxel_space_clear(&other);
+    return ret;
+}
+
+/* Creates a space of the given layout with random voxels. */
+static void init_random(struct voxel_space *space, size_t w, size_t h, size_t t, enum voxel_layout layout)
+{
+    unsigned int x, y, z;
+    struct voxel_pos pos;
+
+    voxel_space_init_layout(space, w, h, t, layout);
+    for (z = 0; z < t; ++z) {
+        for (y = 0; y < h; ++y) {
+            for (x = 0; x < w; ++x) {
+                voxel_pos_set(&pos, x, y, z);
+                if (rand() & 1) voxel_space_set_xyz(space, &pos);
+            }
+        }
+    }
+}
+
+/* Copies the voxels of src into a new space of the given layout. */
+static void init_copy(struct voxel_space *space, struct voxel_space *src, enum voxel_layout layout)
+{
+    unsigned int x, y, z;
+    struct voxel_pos pos;
+
+    voxel_space_init_layout(space, src->width, src->height, src->thickness, layout);
+    for (z = 0; z < src->thickness; ++z) {
+        for (y = 0; y < src->height; ++y) {
+            for (x = 0; x < src->width; ++x) {
+                voxel_pos_set(&pos, x, y, z);
+                if (voxel_space_get_xyz(src, &pos)) voxel_space_set_xyz(space, &pos);
+            }
+        }
+    }
+}
+
+/* Tests one operation on spaces of the given layouts, which span several column words. */
+static int test_layout_boolean(enum voxel_op op, int ox, int oy, int oz, enum voxel_layout layout, enum voxel_layout other_layout, int tile)
+{
+    struct voxel_space space, ref, other;
+    int x, y, ret;
+
+    init_random(&space, 150, 20, 100, layout);
+    init_copy(&ref, &space, VOXEL_LAYOUT_LAYER);
+    init_random(&other, 67, 9, 70, other_layout);
+    other.pos.x = ox;
+    other.pos.y = oy;
+    other.pos.z = oz;
+
+    for (y = 0; y < space.height; y += tile) {
+        for (x = 0; x < space.width; x += tile) {
+            voxel_space_boolean_clip(&space, &other, op, x, y, x + tile, y + tile);
+        }
+    }
+    reference_boolean(&ref, &other, op);
+    ret = compare_spaces(&space, &ref);
+    if (ret != 0) {
+        fprintf(stdout, "Testcase: layouts=%s/%s, op=%i, offset=%i/%i/%i, tile=%i failed\n",
+                voxel_layout_name(layout), voxel_layout_name(other_layout), op, ox, oy, oz, tile);
+    }
+
+    voxel_space_clear(&space);
+    voxel_space_clear(&ref);
+    voxel_space_clear(&other);
+    return ret;
+}
+
+/* Tests the column and row accessors of a layout against the layer layout. */
+static int test_layout_access(enum voxel_layout layout)
+{
+    struct voxel_space space, ref;
+    int i, x, x1, y, z0, z1, ret = 0;
+
+    fprintf(stdout, "Start Testcase: layout access %s\n", voxel_layout_name(layout));
+    init_random(&ref, 70, 30, 130, VOXEL_LAYOUT_LAYER);
+    init_copy(&space, &ref, layout);
+
+    for (i = 0; i < 2000; ++i) {
+        x  = rand() % 80 - 5;
+        y  = rand() % 40 - 5;
+        z0 = rand() % 140 - 5;
+        z1 = z0 + rand() % 100;
+        switch (i % 4) {
+        case 0:
+            voxel_space_clr_column(&space, x, y, z0, z1);
+            voxel_space_clr_column(&ref, x, y, z0, z1);
+            break;
+        case 1:
+            voxel_space_clr_column_atomic(&space, x, y, z0, z1);
+            voxel_space_clr_column_atomic(&ref, x, y, z0, z1);
+            break;
+        case 2:
+            x1 = x + rand() % 30;
+            voxel_space_clr_row(&space, x, x1, y, z0);
+            voxel_space_clr_row(&ref, x, x1, y, z0);
+            break;
+        case 3:
+            x1 = x + rand() % 30;
+            voxel_space_clr_row_atomic(&space, x, x1, y, z0);
+            voxel_space_clr_row_atomic(&ref, x, x1, y, z0);
+            break;
+        }
+    }
+    if (compare_spaces(&space, &ref) != 0) ret = -1;
+
+    for (y = 0; y < ref.height; ++y) {
+        for (x = 0; x < ref.width; ++x) {
+            if (voxel_space_get_top(&space, x, y) != voxel_space_get_top(&ref, x, y)) {
+                fprintf(stdout, "Top mismatch at %i/%i\n", x, y);
+                ret = -1;
+            }
+        }
+    }
+
+    voxel_space_set_all(&space);
+    voxel_space_set_all(&ref);
+    if (compare_spaces(&space, &ref) != 0) ret = -1;
+    if (voxel_space_get_top(&space, 3, 4) != 130) ret = -1;
+    if (voxel_space_get_top(&space, 69, 29) != 130) ret = -1;
+    voxel_space_clr_all(&space);
+    if (voxel_space_get_top(&space, 3, 4) != 0) ret = -1;
+    if (ret != 0) fprintf(stdout, "Testcase: layout access %s failed\n", voxel_layout_name(layout));
+
+    voxel_space_clear(&space);
+    voxel_space_clear(&ref);
+    return ret;
+}
+
+/* Tests that Morton encoding and decoding are inverse. */
+static int test_morton(void)
+{
+    unsigned int x, y, z, i;
+    uint32_t code;
+
+    fprintf(stdout, "Start Testcase: morton\n");
+    if (voxel_morton_encode(1, 0, 0) != 1 || voxel_morton_encode(0, 1, 0) != 2 ||
+        voxel_morton_encode(0, 0, 1) != 4 || voxel_morton_encode(2, 0, 0) != 8 ||
+        voxel_morton_encode(1023, 1023, 1023) != 0x3fffffff) {
+        fprintf(stdout, "Testcase: morton encoding failed\n");
+        return -1;
+    }
+    for (i = 0; i < 10000; ++i) {
+        code = rand() & 0x3fffffff;
+        voxel_morton_decode(code, &x, &y, &z);
+        if (voxel_morton_encode(x, y, z) != code) {
+            fprintf(stdout, "Testcase: morton code %x failed\n", code);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Tests all operations on mixed layouts. */
+static int test_layouts(void)
+{
+    static const enum voxel_layout layouts[][2] = {
+        { VOXEL_LAYOUT_COLUMN, VOXEL_LAYOUT_COLUMN },
+        { VOXEL_LAYOUT_COLUMN, VOXEL_LAYOUT_LAYER },
+        { VOXEL_LAYOUT_LAYER, VOXEL_LAYOUT_COLUMN },
+        { VOXEL_LAYOUT_MORTON, VOXEL_LAYOUT_MORTON },
+        { VOXEL_LAYOUT_MORTON, VOXEL_LAYOUT_LAYER },
+        { VOXEL_LAYOUT_MORTON, VOXEL_LAYOUT_COLUMN },
+        { VOXEL_LAYOUT_LAYER, VOXEL_LAYOUT_MORTON },
+        { VOXEL_LAYOUT_COLUMN, VOXEL_LAYOUT_MORTON },
+    };
+    int result = 0;
+    enum voxel_op op;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+        for (op = VOXEL_OP_DIFFERENCE; op <= VOXEL_OP_XOR; ++op) {
+            fprintf(stdout, "Start Testcase: layouts=%s/%s, op=%i\n",
+                    voxel_layout_name(layouts[i][0]), voxel_layout_name(layouts[i][1]), op);
+            /* inside, across word boundaries in Z */
+            if (test_layout_boolean(op, 40, 5, 20, layouts[i][0], layouts[i][1], 1000) != 0) result = -1;
+            if (test_layout_boolean(op, 3, 2, 1, layouts[i][0], layouts[i][1], 1000) != 0) result = -1;
+            /* clipped at all borders */
+            if (test_layout_boolean(op, -7, -3, -9, layouts[i][0], layouts[i][1], 1000) != 0) result = -1;
+            if (test_layout_boolean(op, 120, 15, 50, layouts[i][0], layouts[i][1], 1000) != 0) result = -1;
+            /* tile by tile */
+            if (test_layout_boolean(op, 11, -2, 29, layouts[i][0], layouts[i][1], 13) != 0) result = -1;
+        }
+    }
+    if (test_layout_access(VOXEL_LAYOUT_COLUMN) != 0) result = -1;
+    if (test_layout_access(VOXEL_LAYOUT_MORTON) != 0) result = -1;
+    if (test_morton() != 0) result = -1;
+
+    return result;
+}
+
+/* Reads a whole file, returns NULL on error. */
+static uint8_t *read_file(const char *filename, size_t size)
+{
+    FILE *f = fopen(filename, "rb");
+    uint8_t *data = malloc(size + 1);
+
+    if (f == NULL || data == NULL || fread(data, 1, size + 1, f) != size) {
+        free(data);
+        data = NULL;
+    }
+    if (f) fclose(f);
+
+    return data;
+}
+
+/* Compares the d3f file and a PBM layer with the voxels. */
+static int check_export(struct voxel_space *space, unsigned int layer)
+{
+    size_t header = 6, size = header + space->width * space->height * space->thickness;
+    size_t stride = (space->width + 7) / 8;
+    unsigned int x, y, z;
+    struct voxel_pos pos;
+    uint8_t *data;
+    int bit, ret = 0;
+
+    data = read_file("voxeltest.d3f", size);
+    if (data == NULL) return -1;
+    if (data[0] != space->width >> 8 || data[1] != (space->width & 255) || data[5] != space->thickness) ret = -1;
+    for (z = 0; z < space->thickness && ret == 0; ++z) {
+        for (y = 0; y < space->height && ret == 0; ++y) {
+            for (x = 0; x < space->width && ret == 0; ++x) {
+                voxel_pos_set(&pos, x, y, z);
+                if (data[header + (z * space->height + y) * space->width + x] != (voxel_space_get_xyz(space, &pos) ? 255 : 0)) {
+                    fprintf(stdout, "d3f mismatch at %u/%u/%u\n", x, y, z);
+                    ret = -1;
+                }
+            }
+        }
+    }
+    free(data);
+
+    header = snprintf(NULL, 0, "P4\n%u %u\n", (unsigned int)space->width, (unsigned int)space->height);
+    data   = read_file("voxeltest.pbm", header + stride * space->height);
+    if (data == NULL) return -1;
+    for (y = 0; y < space->height && ret == 0; ++y) {
+        for (x = 0; x < stride * 8 && ret == 0; ++x) {
+            voxel_pos_set(&pos, x, space->height - 1 - y, layer);
+            bit = (data[header + y * stride + x / 8] >> (7 - x % 8)) & 1;
+            /* padding bits must be zero */
+            if (bit != (x < space->width && voxel_space_get_xyz(space, &pos) == 1)) {
+                fprintf(stdout, "PBM mismatch at %u/%u\n", x, y);
+                ret = -1;
+            }
+        }
+    }
+    free(data);
+
+    return ret;
+}
+
+/* Tests the d3f and layer exports of a layout with one thread and with a pool of threads. */
+static int test_export(enum voxel_layout layout)
+{
+    struct voxel_space space;
+    int i, ret = 0;
+
+    fprintf(stdout, "Start Testcase: export %s\n", voxel_layout_name(layout));
+    init_random(&space, 150, 37, 70, layout);
+    for (i = 0; i < 2; ++i) {
+        if (i == 1) parallel_init(4);
+        if (voxel_space_to_d3f(&space, "voxeltest.d3f") != 0) ret = -1;
+        if (voxel_space_layer_to_ppm(&space, "voxeltest.pbm", 67) != 0) ret = -1;
+        if (ret == 0) ret = check_export(&space, 67);
+        if (i == 1) parallel_cleanup();
+    }
+    voxel_space_clear(&space);
+    remove("voxeltest.d3f");
+    remove("voxeltest.pbm");
+    if (ret != 0) fprintf(stdout, "Testcase: export %s failed\n", voxel_layout_name(layout));
+
+    return ret;
+}
+
+/* Tests all operations with the currently selected kernel. */
+static int test_kernel(void)
+{
+    int ret, i;
+    int result = 0;
+    enum voxel_op op;
+
+    for (op = VOXEL_OP_DIFFERENCE; op <= VOXEL_OP_XOR; ++op) {
+        fprintf(stdout, "Start Testcase: kernel=%s, op=%i\n", voxel_kernel_name(), op);
+        /* inside, at various bit alignments */
+        for (i = 0; i < 24; ++i) {
+            ret = test_boolean(op, i * 13, i % 12, i % 3);
+            if (ret != 0) result = -1;
+        }
+        /* clipped at all borders */
+        ret = test_boolean(op, -5, -3, -2);
+        if (ret != 0) result = -1;
+        ret = test_boolean(op, 600, 25, 5);
+        if (ret != 0) result = -1;
+        ret = test_boolean(op, -30, 10, 2);
+        if (ret != 0) result = -1;
+        /* no overlap */
+        ret = test_boolean(op, 700, 0, 0);
+        if (ret != 0) result = -1;
+        /* tile by tile */
+        ret = test_boolean_clip(op, 37, 3, 1, 64);
+        if (ret != 0) result = -1;
+        ret = test_boolean_clip(op, -5, -3, 0, 13);
+        if (ret != 0) result = -1;
+    }
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+    int exit_code = EXIT_SUCCESS;
+    enum voxel_kernel_type kernel;
+
+    srand(1);
+
+    /* all kernels must give bit-identical results */
+    for (kernel = VOXEL_KERNEL_SCALAR; kernel <= VOXEL_KERNEL_AVX2; ++kernel) {
+        if (voxel_kernel_select(kernel) != 0) {
+            fprintf(stdout, "Kernel %i not supported, skipped.\n", kernel);
+            continue;
+        }
+        ret = test_kernel();
+        if (ret != 0) exit_code = EXIT_FAILURE;
+    }
+
+    /* the column layout must give the same results as the layer layout */
+    ret = test_layouts();
+    if (ret != 0) exit_code = EXIT_FAILURE;
+
+    if (test_export(VOXEL_LAYOUT_LAYER) != 0) exit_code = EXIT_FAILURE;
+    if (test_export(VOXEL_LAYOUT_COLUMN) != 0) exit_code = EXIT_FAILURE;
+    if (test_export(VOXEL_LAYOUT_MORTON) != 0) exit_code = EXIT_FAILURE;
+
+    return exit_code;
+}
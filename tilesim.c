@@ -0,0 +1,275 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tilesim.h"
+#include "parallel.h"
+#include <string.h>
+#include <math.h>
+
+int tilesim_init(struct tilesim *ts, struct workpart *wp)
+{
+    size_t num_tiles;
+
+    memset(ts, 0, sizeof(*ts));
+    ts->wp      = wp;
+    ts->tiles_x = (wp->width + TILESIM_TILE_SIZE - 1) / TILESIM_TILE_SIZE;
+    ts->tiles_y = (wp->height + TILESIM_TILE_SIZE - 1) / TILESIM_TILE_SIZE;
+    num_tiles   = (size_t)ts->tiles_x * ts->tiles_y;
+
+    ts->ops        = malloc(TILESIM_BATCH_SIZE * sizeof(*ts->ops));
+    ts->tile_start = malloc((num_tiles + 1) * sizeof(*ts->tile_start));
+    ts->active     = malloc(num_tiles * sizeof(*ts->active));
+    if (ts->ops == NULL || ts->tile_start == NULL || ts->active == NULL) {
+        tilesim_clear(ts);
+        return -1;
+    }
+
+    return 0;
+}
+
+void tilesim_clear(struct tilesim *ts)
+{
+    free(ts->ops);
+    free(ts->tile_start);
+    free(ts->tile_ops);
+    free(ts->active);
+    memset(ts, 0, sizeof(*ts));
+}
+
+/** Appends an operation, executes the batch first if it is full. */
+static struct tilesim_op *tilesim_add(struct tilesim *ts)
+{
+    if (ts->num_ops == TILESIM_BATCH_SIZE) tilesim_flush(ts);
+    return &ts->ops[ts->num_ops++];
+}
+
+/**
+ * Removes the tool at its current position tool->pos from the workpart.
+ * The tool's voxels are shared, so the tool must not be changed before
+ * the next tilesim_flush().
+ */
+int tilesim_stamp(struct tilesim *ts, struct voxel_space *tool, struct tool_profile *profile)
+{
+    struct tilesim_op *op = tilesim_add(ts);
+
+    op->type      = TILESIM_STAMP;
+    op->tool      = *tool;
+    op->profile   = profile;
+    op->bounds.x0 = tool->pos.x;
+    op->bounds.y0 = tool->pos.y;
+    op->bounds.x1 = tool->pos.x + (int)tool->width;
+    op->bounds.y1 = tool->pos.y + (int)tool->height;
+
+    return 0;
+}
+
+/**
+ * Removes the delta of a unit step of the tool to its position tool->pos.
+ * See workpart_stamp_delta(). The delta must not be changed before the
+ * next tilesim_flush().
+ */
+int tilesim_stamp_delta(struct tilesim *ts, struct voxel_space *tool, struct tool_profile *profile, const struct tool_delta *delta)
+{
+    int ret = tilesim_stamp(ts, tool, profile);
+
+    ts->ops[ts->num_ops - 1].type  = TILESIM_DELTA;
+    ts->ops[ts->num_ops - 1].delta = delta;
+
+    return ret;
+}
+
+/**
+ * Removes the volume of the tool moving vertically from tool->pos up to
+ * layer z1. See workpart_extrude().
+ */
+int tilesim_extrude(struct tilesim *ts, struct voxel_space *tool, struct tool_profile *profile, int z1)
+{
+    int ret = tilesim_stamp(ts, tool, profile);
+
+    ts->ops[ts->num_ops - 1].type = TILESIM_EXTRUDE;
+    ts->ops[ts->num_ops - 1].z1   = z1;
+
+    return ret;
+}
+
+/**
+ * Removes the volume swept by a linear move. See tool_sweep_line().
+ */
+int tilesim_sweep_line(struct tilesim *ts, struct tool_profile *profile, struct gvector *start, struct gvector *end)
+{
+    struct tilesim_op *op;
+    float r;
+
+    if (profile->max_radius2 < 0) return 0; /* empty tool */
+    r = sqrt(profile->max_radius2);
+
+    op = tilesim_add(ts);
+    op->type      = TILESIM_LINE;
+    op->profile   = profile;
+    op->start     = *start;
+    op->end       = *end;
+    op->bounds.x0 = floor(fminf(start->x, end->x) - r);
+    op->bounds.y0 = floor(fminf(start->y, end->y) - r);
+    op->bounds.x1 = ceil(fmaxf(start->x, end->x) + r) + 1;
+    op->bounds.y1 = ceil(fmaxf(start->y, end->y) + r) + 1;
+
+    return 0;
+}
+
+/**
+ * Removes the volume swept by an arc move. See tool_sweep_arc().
+ * The bounds cover the full circle, which is good enough for binning.
+ */
+int tilesim_sweep_arc(struct tilesim *ts, struct tool_profile *profile, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode)
+{
+    struct tilesim_op *op;
+    float r;
+
+    if (profile->max_radius2 < 0) return 0; /* empty tool */
+    r = sqrt(profile->max_radius2) + hypotf(start->x - center->x, start->y - center->y);
+
+    op = tilesim_add(ts);
+    op->type      = TILESIM_ARC;
+    op->mode      = mode;
+    op->profile   = profile;
+    op->start     = *start;
+    op->end       = *end;
+    op->center    = *center;
+    op->bounds.x0 = floor(center->x - r);
+    op->bounds.y0 = floor(center->y - r);
+    op->bounds.x1 = ceil(center->x + r) + 1;
+    op->bounds.y1 = ceil(center->y + r) + 1;
+
+    return 0;
+}
+
+/**
+ * Computes the range of tiles [tx0,tx1) x [ty0,ty1) overlapped by an operation.
+ *
+ * @return Zero if the operation is outside of the workpart.
+ */
+static int tilesim_tile_range(struct tilesim *ts, struct tilesim_op *op, int *tx0, int *ty0, int *tx1, int *ty1)
+{
+    struct workpart_rect r = op->bounds;
+
+    if (r.x0 < 0) r.x0 = 0;
+    if (r.y0 < 0) r.y0 = 0;
+    if (r.x1 > (int)ts->wp->width) r.x1 = ts->wp->width;
+    if (r.y1 > (int)ts->wp->height) r.y1 = ts->wp->height;
+    if (r.x0 >= r.x1 || r.y0 >= r.y1) return 0;
+
+    *tx0 = r.x0 / TILESIM_TILE_SIZE;
+    *ty0 = r.y0 / TILESIM_TILE_SIZE;
+    *tx1 = (r.x1 + TILESIM_TILE_SIZE - 1) / TILESIM_TILE_SIZE;
+    *ty1 = (r.y1 + TILESIM_TILE_SIZE - 1) / TILESIM_TILE_SIZE;
+    return 1;
+}
+
+/** Worker: applies all operations of one tile in program order. */
+static void tilesim_process_tile(void *arg, size_t index)
+{
+    struct tilesim *ts = arg;
+    size_t tile = ts->active[index];
+    struct workpart_rect clip;
+    struct tilesim_op *op;
+    size_t i;
+
+    clip.x0 = (tile % ts->tiles_x) * TILESIM_TILE_SIZE;
+    clip.y0 = (tile / ts->tiles_x) * TILESIM_TILE_SIZE;
+    clip.x1 = clip.x0 + TILESIM_TILE_SIZE;
+    clip.y1 = clip.y0 + TILESIM_TILE_SIZE;
+
+    for (i = ts->tile_start[tile]; i < ts->tile_start[tile + 1]; ++i) {
+        op = &ts->ops[ts->tile_ops[i]];
+        switch (op->type) {
+        case TILESIM_STAMP:
+            workpart_stamp_clip(ts->wp, &op->tool, op->profile, &clip);
+            break;
+        case TILESIM_DELTA:
+            workpart_stamp_delta_clip(ts->wp, &op->tool, op->profile, op->delta, &clip);
+            break;
+        case TILESIM_EXTRUDE:
+            workpart_extrude_clip(ts->wp, &op->tool, op->profile, op->z1, &clip);
+            break;
+        case TILESIM_LINE:
+            workpart_sweep_line_clip(ts->wp, op->profile, &op->start, &op->end, &clip);
+            break;
+        case TILESIM_ARC:
+            workpart_sweep_arc_clip(ts->wp, op->profile, &op->start, &op->end, &op->center, op->mode, &clip);
+            break;
+        }
+    }
+}
+
+/**
+ * Executes all collected operations.
+ *
+ * @return Zero on success, -1 if out of memory.
+ */
+int tilesim_flush(struct tilesim *ts)
+{
+    size_t num_tiles = (size_t)ts->tiles_x * ts->tiles_y;
+    size_t i, t, total, *list;
+    int tx, ty, tx0, ty0, tx1, ty1;
+
+    if (ts->num_ops == 0) return 0;
+
+    /* count operations per tile */
+    memset(ts->tile_start, 0, (num_tiles + 1) * sizeof(*ts->tile_start));
+    for (i = 0; i < ts->num_ops; ++i) {
+        if (!tilesim_tile_range(ts, &ts->ops[i], &tx0, &ty0, &tx1, &ty1)) continue;
+        for (ty = ty0; ty < ty1; ++ty) {
+            for (tx = tx0; tx < tx1; ++tx) {
+                ts->tile_start[ty * ts->tiles_x + tx + 1]++;
+            }
+        }
+    }
+
+    /* prefix sum, collect the active tiles */
+    ts->num_active = 0;
+    for (t = 0; t < num_tiles; ++t) {
+        if (ts->tile_start[t + 1] > 0) ts->active[ts->num_active++] = t;
+        ts->tile_start[t + 1] += ts->tile_start[t];
+    }
+    total = ts->tile_start[num_tiles];
+    if (total > ts->tile_ops_size) {
+        list = realloc(ts->tile_ops, total * sizeof(*list));
+        if (list == NULL) return -1;
+        ts->tile_ops      = list;
+        ts->tile_ops_size = total;
+    }
+
+    /* bin the operations in program order, tile_start is used as
+     * insert position and shifted back afterwards */
+    for (i = 0; i < ts->num_ops; ++i) {
+        if (!tilesim_tile_range(ts, &ts->ops[i], &tx0, &ty0, &tx1, &ty1)) continue;
+        for (ty = ty0; ty < ty1; ++ty) {
+            for (tx = tx0; tx < tx1; ++tx) {
+                ts->tile_ops[ts->tile_start[ty * ts->tiles_x + tx]++] = i;
+            }
+        }
+    }
+    for (t = num_tiles; t > 0; --t) {
+        ts->tile_start[t] = ts->tile_start[t - 1];
+    }
+    ts->tile_start[0] = 0;
+
+    parallel_for(ts->num_active, tilesim_process_tile, ts);
+    ts->num_ops = 0;
+
+    return 0;
+}
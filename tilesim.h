@@ -0,0 +1,78 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TILESIM_H_W3PXE8JN
+#define TILESIM_H_W3PXE8JN
+
+#include "workpart.h"
+
+/** Tile edge length in voxels, a multiple of BRICK_SIZE. */
+#define TILESIM_TILE_SIZE 64
+/** Number of operations collected before they are executed. */
+#define TILESIM_BATCH_SIZE 4096
+
+enum tilesim_op_type {
+    TILESIM_STAMP = 0,
+    TILESIM_DELTA,
+    TILESIM_EXTRUDE,
+    TILESIM_LINE,
+    TILESIM_ARC
+};
+
+/** One recorded stamp or sweep operation. */
+struct tilesim_op {
+    enum tilesim_op_type type;
+    enum gcode_arc_mode mode;
+    struct voxel_space tool;        /**< copy of the tool with its position, stamps only */
+    const struct tool_delta *delta; /**< delta of a unit step, deltas only */
+    int z1;                         /**< upper tool position, extrusions only */
+    struct tool_profile *profile;
+    struct gvector start, end, center;
+    struct workpart_rect bounds;    /**< affected voxels, including the tool radius */
+};
+
+/**
+ * Tile-parallel simulation.
+ * Operations are collected in batches. Each batch is binned into the
+ * tiles of the XY plane which the operations overlap, then the tiles are
+ * processed by the worker pool. Each tile applies its operations in
+ * program order, clipped to the tile, so the result does not depend on
+ * the number of threads.
+ */
+struct tilesim {
+    struct workpart *wp;
+    int tiles_x, tiles_y;
+    struct tilesim_op *ops;
+    size_t num_ops;
+    size_t *tile_start;   /**< per tile: first entry in tile_ops, plus end marker */
+    size_t *tile_ops;     /**< op indices, grouped by tile */
+    size_t tile_ops_size;
+    size_t *active;       /**< tiles with at least one op */
+    size_t num_active;
+};
+
+int tilesim_init(struct tilesim *ts, struct workpart *wp);
+void tilesim_clear(struct tilesim *ts);
+
+int tilesim_stamp(struct tilesim *ts, struct voxel_space *tool, struct tool_profile *profile);
+int tilesim_stamp_delta(struct tilesim *ts, struct voxel_space *tool, struct tool_profile *profile, const struct tool_delta *delta);
+int tilesim_extrude(struct tilesim *ts, struct voxel_space *tool, struct tool_profile *profile, int z1);
+int tilesim_sweep_line(struct tilesim *ts, struct tool_profile *profile, struct gvector *start, struct gvector *end);
+int tilesim_sweep_arc(struct tilesim *ts, struct tool_profile *profile, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode);
+int tilesim_flush(struct tilesim *ts);
+
+#endif /* end of include guard: TILESIM_H_W3PXE8JN */
@@ -0,0 +1,545 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tool.h"
+#include <string.h>
+#include <math.h>
+
+#define sqr(x) (x)*(x)
+
+/** Sub arc of a swept arc move. Angles are in radians. */
+struct tool_arc {
+    float cx, cy;   /**< center */
+    float radius;
+    float alpha;    /**< start angle */
+    float span;     /**< length of the arc in radians, always positive */
+    int cw;         /**< 1 if the arc runs clockwise */
+    float sx, sy;   /**< start point */
+    float ex, ey;   /**< end point */
+};
+
+/**
+ * Computes the profile of the given tool.
+ * The profile need not be initialized, a used one must be cleared first
+ * with tool_profile_clear().
+ *
+ * @param profile Profile to initialize.
+ * @param tool The tool's voxel space.
+ *
+ * @return Zero on success, -1 if out of memory.
+ */
+int tool_profile_init(struct tool_profile *profile, struct voxel_space *tool)
+{
+    unsigned int x, y, z;
+    int dx, dy, r2;
+    size_t i, columns = tool->width * tool->height;
+    struct voxel_pos pos;
+
+    memset(profile, 0, sizeof(*profile));
+
+    profile->radius2 = malloc(tool->thickness * sizeof(*profile->radius2));
+    profile->bottom  = malloc(columns * sizeof(*profile->bottom));
+    profile->top     = malloc(columns * sizeof(*profile->top));
+    if (profile->radius2 == NULL || profile->bottom == NULL || profile->top == NULL) {
+        tool_profile_clear(profile);
+        return -1;
+    }
+    for (i = 0; i < columns; ++i) {
+        profile->bottom[i] = -1;
+        profile->top[i]    = -1;
+    }
+    profile->width       = tool->width;
+    profile->height      = tool->height;
+    profile->thickness   = tool->thickness;
+    profile->max_radius2 = -1;
+
+    for (z = 0; z < tool->thickness; ++z) {
+        profile->radius2[z] = -1;
+        for (y = 0; y < tool->height; ++y) {
+            for (x = 0; x < tool->width; ++x) {
+                voxel_pos_set(&pos, x, y, z);
+                if (voxel_space_get_xyz(tool, &pos) != 1) continue;
+                i = y * tool->width + x;
+                if (profile->bottom[i] < 0) profile->bottom[i] = z;
+                profile->top[i] = z;
+                dx = x - tool->width/2;
+                dy = y - tool->height/2;
+                r2 = sqr(dx) + sqr(dy);
+                if (r2 > profile->radius2[z]) profile->radius2[z] = r2;
+            }
+        }
+        if (profile->radius2[z] > profile->max_radius2)
+            profile->max_radius2 = profile->radius2[z];
+    }
+
+    profile->min_bottom = -1;
+    profile->min_top    = -1;
+    for (i = 0; i < columns; ++i) {
+        if (profile->bottom[i] < 0) continue;
+        if (profile->min_bottom < 0 || profile->bottom[i] < profile->min_bottom)
+            profile->min_bottom = profile->bottom[i];
+        if (profile->min_top < 0 || profile->top[i] < profile->min_top)
+            profile->min_top = profile->top[i];
+    }
+
+    return 0;
+}
+
+void tool_profile_clear(struct tool_profile *profile)
+{
+    if (profile->radius2)
+        free(profile->radius2);
+    if (profile->bottom)
+        free(profile->bottom);
+    if (profile->top)
+        free(profile->top);
+    memset(profile, 0, sizeof(*profile));
+}
+
+/**
+ * Finds the tool layers which reach a column at the given squared distance
+ * from the tool center.
+ *
+ * @return Zero on success, -1 if no layer reaches the column.
+ */
+static int tool_profile_layers(struct tool_profile *profile, float d2, int *k0, int *k1)
+{
+    int k;
+
+    *k0 = -1;
+    for (k = 0; k < (int)profile->thickness; ++k) {
+        if (profile->radius2[k] < 0 || profile->radius2[k] < d2) continue;
+        if (*k0 < 0) *k0 = k;
+        *k1 = k;
+    }
+
+    return (*k0 < 0) ? -1 : 0;
+}
+
+/**
+ * Clears the material of one column.
+ *
+ * @param d2 Squared distance of the column to the tool path.
+ * @param zlo Lowest tool position in this column.
+ * @param zhi Highest tool position in this column.
+ */
+static void tool_sweep_column(struct tool_sweep *sweep, int x, int y, float d2, int zlo, int zhi)
+{
+    int k0, k1;
+
+    if (tool_profile_layers(sweep->profile, d2, &k0, &k1) != 0) return;
+    sweep->clear(sweep->space, x, y, zlo + k0, zhi + k1 + 1);
+}
+
+/** Clips the bounding box [x0,x1]x[y0,y1] to the sweep's clip rectangle. */
+static void tool_sweep_clip(struct tool_sweep *sweep, int *x0, int *y0, int *x1, int *y1)
+{
+    if (*x0 < sweep->x0) *x0 = sweep->x0;
+    if (*y0 < sweep->y0) *y0 = sweep->y0;
+    if (*x1 > sweep->x1 - 1) *x1 = sweep->x1 - 1;
+    if (*y1 > sweep->y1 - 1) *y1 = sweep->y1 - 1;
+}
+
+/**
+ * Removes the tool's Z range in each XY column it covers.
+ * Unlike voxel_space_difference() this treats every tool column as solid
+ * between its lowest and highest voxel.
+ *
+ * @param sweep Stamp target.
+ * @param pos Position of the tool's corner (0,0,0) in voxels.
+ *
+ * @return Zero on success.
+ */
+int tool_stamp(struct tool_sweep *sweep, struct voxel_pos *pos)
+{
+    return tool_extrude(sweep, pos, pos->z);
+}
+
+/**
+ * Removes the volume of the tool moving vertically, e.g. a drill hole.
+ * Each XY column is cleared from its lowest voxel at \c pos up to its
+ * highest voxel at layer \c z1.
+ *
+ * @param sweep Stamp target.
+ * @param pos Lowest position of the tool's corner (0,0,0) in voxels.
+ * @param z1 Highest position of the tool's corner in Z, z1 >= pos->z.
+ *
+ * @return Zero on success.
+ */
+int tool_extrude(struct tool_sweep *sweep, struct voxel_pos *pos, int z1)
+{
+    struct tool_profile *profile = sweep->profile;
+    int x, y, wx, wy;
+    size_t i;
+
+    for (y = 0; y < (int)profile->height; ++y) {
+        wy = pos->y + y;
+        if (wy < sweep->y0 || wy >= sweep->y1) continue;
+        for (x = 0; x < (int)profile->width; ++x) {
+            wx = pos->x + x;
+            if (wx < sweep->x0 || wx >= sweep->x1) continue;
+            i = y * profile->width + x;
+            if (profile->bottom[i] < 0) continue;
+            sweep->clear(sweep->space, wx, wy, pos->z + profile->bottom[i], z1 + profile->top[i] + 1);
+        }
+    }
+
+    return 0;
+}
+
+/** Returns 1 if the voxel is part of the tool, but not the voxel at offset d. */
+static int tool_delta_voxel(struct voxel_space *tool, int x, int y, int z, int dx, int dy, int dz)
+{
+    struct voxel_pos pos;
+
+    pos.x = x;
+    pos.y = y;
+    pos.z = z;
+    if (voxel_space_get_xyz(tool, &pos) != 1) return 0;
+    pos.x += dx;
+    pos.y += dy;
+    pos.z += dz;
+    /* voxel_space_get_xyz() only checks the range of the whole space */
+    if (pos.x < 0 || pos.x >= (int)tool->width) return 1;
+    if (pos.y < 0 || pos.y >= (int)tool->height) return 1;
+    if (pos.z < 0 || pos.z >= (int)tool->thickness) return 1;
+    return voxel_space_get_xyz(tool, &pos) != 1;
+}
+
+/**
+ * Appends a span to a growing array.
+ *
+ * @return Zero on success, -1 if out of memory.
+ */
+static int tool_span_add(struct tool_span **spans, size_t *num, size_t *capacity, int a, int b, int lo, int hi)
+{
+    struct tool_span *tmp;
+
+    if (*num == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        tmp = realloc(*spans, *capacity * sizeof(**spans));
+        if (tmp == NULL) return -1;
+        *spans = tmp;
+    }
+    (*spans)[*num].a  = a;
+    (*spans)[*num].b  = b;
+    (*spans)[*num].lo = lo;
+    (*spans)[*num].hi = hi;
+    (*num)++;
+
+    return 0;
+}
+
+/** Computes the X and Z runs of one delta. */
+static int tool_delta_init(struct tool_delta *delta, struct voxel_space *tool, int dx, int dy, int dz)
+{
+    int x, y, z, lo, w = tool->width, h = tool->height, t = tool->thickness;
+    size_t capacity;
+
+    capacity = 0;
+    for (z = 0; z < t; ++z) {
+        for (y = 0; y < h; ++y) {
+            for (x = 0; x < w; ++x) {
+                if (!tool_delta_voxel(tool, x, y, z, dx, dy, dz)) continue;
+                lo = x;
+                while (x + 1 < w && tool_delta_voxel(tool, x + 1, y, z, dx, dy, dz)) x++;
+                if (tool_span_add(&delta->rows, &delta->num_rows, &capacity, y, z, lo, x + 1) != 0)
+                    return -1;
+            }
+        }
+    }
+
+    capacity = 0;
+    for (y = 0; y < h; ++y) {
+        for (x = 0; x < w; ++x) {
+            for (z = 0; z < t; ++z) {
+                if (!tool_delta_voxel(tool, x, y, z, dx, dy, dz)) continue;
+                lo = z;
+                while (z + 1 < t && tool_delta_voxel(tool, x, y, z + 1, dx, dy, dz)) z++;
+                if (tool_span_add(&delta->columns, &delta->num_columns, &capacity, x, y, lo, z + 1) != 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Computes the deltas of the given tool for all 26 unit steps.
+ *
+ * @param deltas Deltas to initialize.
+ * @param tool The tool's voxel space.
+ *
+ * @return Zero on success, -1 if out of memory.
+ */
+int tool_deltas_init(struct tool_deltas *deltas, struct voxel_space *tool)
+{
+    int dx, dy, dz;
+
+    tool_deltas_clear(deltas);
+
+    for (dz = -1; dz <= 1; ++dz) {
+        for (dy = -1; dy <= 1; ++dy) {
+            for (dx = -1; dx <= 1; ++dx) {
+                if (dx == 0 && dy == 0 && dz == 0) continue;
+                if (tool_delta_init(&deltas->dir[TOOL_DELTA_INDEX(dx, dy, dz)], tool, dx, dy, dz) != 0) {
+                    tool_deltas_clear(deltas);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+void tool_deltas_clear(struct tool_deltas *deltas)
+{
+    unsigned int i;
+
+    for (i = 0; i < 27; ++i) {
+        if (deltas->dir[i].rows)
+            free(deltas->dir[i].rows);
+        if (deltas->dir[i].columns)
+            free(deltas->dir[i].columns);
+    }
+    memset(deltas, 0, sizeof(*deltas));
+}
+
+/**
+ * Same as tool_stamp(), but only removes the delta of a unit step.
+ * The tool must have been stamped at pos - d before, which is then
+ * completed to a stamp at \c pos.
+ */
+int tool_stamp_delta(struct tool_sweep *sweep, const struct tool_delta *delta, struct voxel_pos *pos)
+{
+    const struct tool_span *span;
+    int wx, wy;
+    size_t i;
+
+    for (i = 0; i < delta->num_columns; ++i) {
+        span = &delta->columns[i];
+        wx = pos->x + span->a;
+        wy = pos->y + span->b;
+        if (wx < sweep->x0 || wx >= sweep->x1) continue;
+        if (wy < sweep->y0 || wy >= sweep->y1) continue;
+        sweep->clear(sweep->space, wx, wy, pos->z + span->lo, pos->z + span->hi);
+    }
+
+    return 0;
+}
+
+/** Squared distance of point p to the line segment a-b. */
+static float segment_dist2(float px, float py, float ax, float ay, float bx, float by)
+{
+    float dx = bx - ax;
+    float dy = by - ay;
+    float len2 = sqr(dx) + sqr(dy);
+    float t = 0;
+
+    if (len2 > 0) {
+        t = ((px - ax) * dx + (py - ay) * dy) / len2;
+        if (t < 0) t = 0;
+        if (t > 1) t = 1;
+    }
+    px -= ax + t * dx;
+    py -= ay + t * dy;
+
+    return sqr(px) + sqr(py);
+}
+
+/**
+ * Removes the volume swept by the tool moving along a straight line.
+ *
+ * Positions are in voxel units: X/Y is the tool center, Z the lowest tool layer.
+ * Moves with a Z component are split into slices of one voxel height. The
+ * Z range of a slice over-estimates the cut by less than one voxel.
+ * Pure Z moves are removed in one go.
+ *
+ * @param sweep Sweep target.
+ * @param start Start position of the tool.
+ * @param end End position of the tool.
+ *
+ * @return Zero on success.
+ */
+int tool_sweep_line(struct tool_sweep *sweep, struct gvector *start, struct gvector *end)
+{
+    struct gvector diff, a, b;
+    unsigned int i, num_slices = 1;
+    int x, y, x0, y0, x1, y1, zlo, zhi;
+    float r, d2;
+
+    if (sweep->profile->max_radius2 < 0) return 0; /* empty tool */
+    r = sqrt(sweep->profile->max_radius2);
+
+    gvector_sub(&diff, end, start);
+    if (diff.x != 0 || diff.y != 0) {
+        num_slices = ceil(fabs(diff.z));
+        if (num_slices == 0) num_slices = 1;
+    }
+
+    for (i = 0; i < num_slices; ++i) {
+        a = diff;
+        gvector_mul(&a, (float)i / num_slices);
+        gvector_add(&a, &a, start);
+        b = diff;
+        gvector_mul(&b, (float)(i + 1) / num_slices);
+        gvector_add(&b, &b, start);
+
+        zlo = floor(fminf(a.z, b.z));
+        zhi = floor(fmaxf(a.z, b.z));
+        x0 = floor(fminf(a.x, b.x) - r);
+        y0 = floor(fminf(a.y, b.y) - r);
+        x1 = ceil(fmaxf(a.x, b.x) + r);
+        y1 = ceil(fmaxf(a.y, b.y) + r);
+        tool_sweep_clip(sweep, &x0, &y0, &x1, &y1);
+
+        for (y = y0; y <= y1; ++y) {
+            for (x = x0; x <= x1; ++x) {
+                d2 = segment_dist2(x, y, a.x, a.y, b.x, b.y);
+                tool_sweep_column(sweep, x, y, d2, zlo, zhi);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/** Squared distance of point p to the given arc. */
+static float arc_dist2(struct tool_arc *arc, float px, float py)
+{
+    float dx = px - arc->cx;
+    float dy = py - arc->cy;
+    float phi, d, d2;
+
+    /* angle relative to the start in direction of the arc */
+    phi = atan2(dy, dx) - arc->alpha;
+    if (arc->cw) phi = -phi;
+    phi = fmod(phi, 2*M_PI);
+    if (phi < 0) phi += 2*M_PI;
+
+    if (phi <= arc->span) {
+        d = sqrt(sqr(dx) + sqr(dy)) - arc->radius;
+        return sqr(d);
+    }
+
+    /* closest point is one of the end points */
+    d  = sqr(px - arc->sx) + sqr(py - arc->sy);
+    d2 = sqr(px - arc->ex) + sqr(py - arc->ey);
+    return (d < d2) ? d : d2;
+}
+
+/** Computes the bounding box of an arc, inflated by \c r. */
+static void arc_bounds(struct tool_arc *arc, float r, int *x0, int *y0, int *x1, int *y1)
+{
+    float minx, miny, maxx, maxy, phi, px, py;
+    int i;
+
+    minx = fminf(arc->sx, arc->ex);
+    maxx = fmaxf(arc->sx, arc->ex);
+    miny = fminf(arc->sy, arc->ey);
+    maxy = fmaxf(arc->sy, arc->ey);
+    /* add the extreme points at 0°, 90°, 180° and 270° if the arc passes them */
+    for (i = 0; i < 4; ++i) {
+        phi = i * M_PI / 2 - arc->alpha;
+        if (arc->cw) phi = -phi;
+        phi = fmod(phi, 2*M_PI);
+        if (phi < 0) phi += 2*M_PI;
+        if (phi > arc->span) continue;
+        px = arc->cx + arc->radius * cos(i * M_PI / 2);
+        py = arc->cy + arc->radius * sin(i * M_PI / 2);
+        minx = fminf(minx, px);
+        maxx = fmaxf(maxx, px);
+        miny = fminf(miny, py);
+        maxy = fmaxf(maxy, py);
+    }
+    *x0 = floor(minx - r);
+    *y0 = floor(miny - r);
+    *x1 = ceil(maxx + r);
+    *y1 = ceil(maxy + r);
+}
+
+/**
+ * Removes the volume swept by the tool moving along an arc.
+ *
+ * Positions are in voxel units like in tool_sweep_line(). A Z difference
+ * between start and end makes the arc a helix, which gets sliced like linear
+ * moves. If start and end are identical the arc is a full circle.
+ *
+ * @param sweep Sweep target.
+ * @param start Start position of the tool.
+ * @param end End position of the tool.
+ * @param center Absolute arc center.
+ * @param mode ARC_CW or ARC_CCW.
+ *
+ * @return Zero on success.
+ */
+int tool_sweep_arc(struct tool_sweep *sweep, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode)
+{
+    struct tool_arc arc;
+    float s_alpha, e_alpha, d_alpha, dir, r, d2, z0, z1;
+    unsigned int i, num_slices;
+    int x, y, x0, y0, x1, y1, zlo, zhi;
+
+    if (sweep->profile->max_radius2 < 0) return 0; /* empty tool */
+    r = sqrt(sweep->profile->max_radius2);
+
+    arc.cx     = center->x;
+    arc.cy     = center->y;
+    arc.radius = sqrt(sqr(start->x - center->x) + sqr(start->y - center->y));
+    arc.cw     = (mode == ARC_CW);
+    s_alpha = atan2(start->y - center->y, start->x - center->x);
+    e_alpha = atan2(end->y - center->y, end->x - center->x);
+    if (arc.cw) {
+        d_alpha = s_alpha - e_alpha;
+        dir = -1;
+    } else {
+        d_alpha = e_alpha - s_alpha;
+        dir = 1;
+    }
+    if (d_alpha <= 0) d_alpha += 2*M_PI;
+
+    num_slices = ceil(fabs(end->z - start->z));
+    if (num_slices == 0) num_slices = 1;
+
+    arc.span = d_alpha / num_slices;
+    for (i = 0; i < num_slices; ++i) {
+        arc.alpha = s_alpha + dir * i * arc.span;
+        arc.sx = arc.cx + arc.radius * cos(arc.alpha);
+        arc.sy = arc.cy + arc.radius * sin(arc.alpha);
+        arc.ex = arc.cx + arc.radius * cos(arc.alpha + dir * arc.span);
+        arc.ey = arc.cy + arc.radius * sin(arc.alpha + dir * arc.span);
+
+        z0 = start->z + (end->z - start->z) * i / num_slices;
+        z1 = start->z + (end->z - start->z) * (i + 1) / num_slices;
+        zlo = floor(fminf(z0, z1));
+        zhi = floor(fmaxf(z0, z1));
+
+        arc_bounds(&arc, r, &x0, &y0, &x1, &y1);
+        tool_sweep_clip(sweep, &x0, &y0, &x1, &y1);
+
+        for (y = y0; y <= y1; ++y) {
+            for (x = x0; x <= x1; ++x) {
+                d2 = arc_dist2(&arc, x, y);
+                tool_sweep_column(sweep, x, y, d2, zlo, zhi);
+            }
+        }
+    }
+
+    return 0;
+}
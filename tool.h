@@ -0,0 +1,94 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TOOL_H_Q8ZK2VNB
+#define TOOL_H_Q8ZK2VNB
+
+#include "voxelspace.h"
+#include "gcode.h"
+
+/**
+ * Profile of a rotationally symmetric tool.
+ * This is derived from the tool's voxel space and describes the tool
+ * by one squared radius per layer, measured in voxels from the tool
+ * center (width/2, height/2), and by the Z range it occupies in each
+ * XY column.
+ */
+struct tool_profile {
+    size_t width;
+    size_t height;
+    size_t thickness;
+    int max_radius2; /**< largest squared radius of all layers */
+    int min_bottom;  /**< lowest solid layer of all columns, -1 for empty tools */
+    int min_top;     /**< lowest top layer of all columns, -1 for empty tools */
+    int *radius2;    /**< squared radius per layer, -1 for empty layers */
+    int *bottom;     /**< lowest solid layer per column, -1 for empty columns */
+    int *top;        /**< highest solid layer per column, -1 for empty columns */
+};
+
+int tool_profile_init(struct tool_profile *profile, struct voxel_space *tool);
+void tool_profile_clear(struct tool_profile *profile);
+
+/** Run of voxels along one axis, [lo,hi) is the range on that axis. */
+struct tool_span {
+    int a, b;
+    int lo, hi;
+};
+
+/**
+ * Voxels which a tool removes when it moves by one voxel in direction d:
+ * all voxels v of the tool for which v+d is not part of the tool.
+ * The voxels are stored twice, as X runs for the voxel backend and as
+ * Z runs for the column based backends.
+ */
+struct tool_delta {
+    size_t num_rows;
+    struct tool_span *rows;    /**< a=y, b=z, [lo,hi) in X */
+    size_t num_columns;
+    struct tool_span *columns; /**< a=x, b=y, [lo,hi) in Z */
+};
+
+/** Index of the delta for a step of dx,dy,dz in {-1,0,1}. */
+#define TOOL_DELTA_INDEX(dx, dy, dz) (((dz) + 1) * 9 + ((dy) + 1) * 3 + (dx) + 1)
+
+/** Deltas of all 26 neighbour directions, the center entry is empty. */
+struct tool_deltas {
+    struct tool_delta dir[27];
+};
+
+int tool_deltas_init(struct tool_deltas *deltas, struct voxel_space *tool);
+void tool_deltas_clear(struct tool_deltas *deltas);
+
+/**
+ * Describes the target of a stamp or swept volume operation.
+ * These functions compute the material removed by the tool per
+ * XY column and pass it as Z range to the \c clear callback.
+ */
+struct tool_sweep {
+    struct tool_profile *profile;
+    int x0, y0, x1, y1; /**< clip rectangle in voxels, x1 and y1 are exclusive */
+    void (*clear)(void *space, int x, int y, int z0, int z1); /**< clears [z0,z1) */
+    void *space;
+};
+
+int tool_stamp(struct tool_sweep *sweep, struct voxel_pos *pos);
+int tool_extrude(struct tool_sweep *sweep, struct voxel_pos *pos, int z1);
+int tool_stamp_delta(struct tool_sweep *sweep, const struct tool_delta *delta, struct voxel_pos *pos);
+int tool_sweep_line(struct tool_sweep *sweep, struct gvector *start, struct gvector *end);
+int tool_sweep_arc(struct tool_sweep *sweep, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode);
+
+#endif /* end of include guard: TOOL_H_Q8ZK2VNB */
@@ -0,0 +1,265 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "toolpath.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+extern volatile int g_terminate;
+
+/* State of the running compilation, the parser callbacks have no user data. */
+static FILE *g_tpfile = NULL;
+static uint64_t g_num_records = 0;
+static unsigned int g_tool = 0;
+static uint32_t g_line = 0; /* line of the last move */
+
+static void toolpath_write(struct toolpath_record *rec)
+{
+    if (fwrite(rec, sizeof(*rec), 1, g_tpfile) == 1) g_num_records++;
+}
+
+static int toolpath_move_cb(struct gcode_ctx *ctx, struct gcode_move *move)
+{
+    struct toolpath_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type      = move->mode;
+    rec.tool      = g_tool;
+    rec.start[0]  = move->start.x;
+    rec.start[1]  = move->start.y;
+    rec.start[2]  = move->start.z;
+    rec.end[0]    = move->end.x;
+    rec.end[1]    = move->end.y;
+    rec.end[2]    = move->end.z;
+    rec.center[0] = move->center.x;
+    rec.center[1] = move->center.y;
+    rec.center[2] = move->center.z;
+    rec.line      = ctx->lineno;
+    rec.feedrate  = ctx->feedrate;
+    g_line        = ctx->lineno;
+    toolpath_write(&rec);
+
+    return 0;
+}
+
+static void toolpath_toolchange_cb(unsigned int tool)
+{
+    struct toolpath_record rec;
+
+    /* tool changes have no context, they belong to the last move's line */
+    memset(&rec, 0, sizeof(rec));
+    rec.type = TOOLPATH_TOOL;
+    rec.tool = tool;
+    rec.line = g_line;
+    g_tool   = tool;
+    toolpath_write(&rec);
+}
+
+static int toolpath_stat(const char *filename, uint64_t *size, int64_t *mtime)
+{
+    struct stat st;
+
+    if (stat(filename, &st) != 0) return -1;
+    *size  = st.st_size;
+    *mtime = st.st_mtime;
+    return 0;
+}
+
+/**
+ * Compiles a GCode file into a binary toolpath.
+ * The file is written to a temporary file first and renamed when complete,
+ * so a concurrent reader never sees a partial toolpath.
+ *
+ * @param filename The GCode file.
+ * @param tpfilename The toolpath file to create.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int toolpath_compile(const char *filename, const char *tpfilename)
+{
+    char tmpname[PATH_MAX];
+    struct toolpath_header header;
+    int ret;
+
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, TOOLPATH_MAGIC, sizeof(header.magic));
+    header.version        = TOOLPATH_VERSION;
+    header.byte_order     = TOOLPATH_BYTEORDER;
+    header.header_size    = sizeof(header);
+    header.record_size    = sizeof(struct toolpath_record);
+    header.records_offset = sizeof(header);
+    gcode_get_offset(&header.offset[0], &header.offset[1], &header.offset[2]);
+    ret = toolpath_stat(filename, &header.source_size, &header.source_mtime);
+    if (ret != 0) return -1;
+
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", tpfilename);
+    g_tpfile = fopen(tmpname, "wb");
+    if (g_tpfile == NULL) return -1;
+    /* header is rewritten with the number of records at the end */
+    fwrite(&header, sizeof(header), 1, g_tpfile);
+
+    g_num_records = 0;
+    g_tool = 0;
+    g_line = 0;
+    ret = gcode_parse(filename, NULL, toolpath_move_cb, toolpath_toolchange_cb);
+    if (ret != 0 || g_terminate) goto error;
+
+    header.num_records = g_num_records;
+    if (fseek(g_tpfile, 0, SEEK_SET) != 0) goto error;
+    if (fwrite(&header, sizeof(header), 1, g_tpfile) != 1) goto error;
+    ret = fclose(g_tpfile);
+    g_tpfile = NULL;
+    if (ret != 0) goto error;
+
+#ifdef _WIN32
+    remove(tpfilename);
+#endif
+    if (rename(tmpname, tpfilename) != 0) goto error;
+
+    return 0;
+error:
+    if (g_tpfile) fclose(g_tpfile);
+    g_tpfile = NULL;
+    remove(tmpname);
+    return -1;
+}
+
+/**
+ * Maps a toolpath file into memory and validates its header.
+ *
+ * @return Zero on success, -1 if the file cannot be read or is no valid toolpath.
+ */
+int toolpath_load(struct toolpath *tp, const char *tpfilename)
+{
+    const struct toolpath_header *h;
+    size_t size;
+
+    memset(tp, 0, sizeof(*tp));
+    if (mapped_file_open(&tp->file, tpfilename) != 0) return -1;
+    size = tp->file.size;
+    if (size < sizeof(*h)) goto error;
+
+    h = tp->file.data;
+    if (memcmp(h->magic, TOOLPATH_MAGIC, sizeof(TOOLPATH_MAGIC)) != 0) goto error;
+    if (h->version != TOOLPATH_VERSION) goto error;
+    if (h->byte_order != TOOLPATH_BYTEORDER) goto error;
+    if (h->header_size != sizeof(*h)) goto error;
+    if (h->record_size != sizeof(struct toolpath_record)) goto error;
+    if (h->records_offset < sizeof(*h) || h->records_offset > size) goto error;
+    if (h->num_records > (size - h->records_offset) / h->record_size) goto error;
+    tp->header  = h;
+    tp->records = (const struct toolpath_record *)((const char *)tp->file.data + h->records_offset);
+
+    return 0;
+error:
+    toolpath_close(tp);
+    return -1;
+}
+
+void toolpath_close(struct toolpath *tp)
+{
+    mapped_file_close(&tp->file);
+    memset(tp, 0, sizeof(*tp));
+}
+
+/** Checks if the toolpath has been compiled from the current GCode file with the current offsets. */
+static int toolpath_is_current(struct toolpath *tp, const char *filename)
+{
+    const struct toolpath_header *h = tp->header;
+    uint64_t size;
+    int64_t mtime;
+    float offset[3];
+
+    if (toolpath_stat(filename, &size, &mtime) != 0) return 0;
+    if (h->source_size != size || h->source_mtime != mtime) return 0;
+    gcode_get_offset(&offset[0], &offset[1], &offset[2]);
+    if (memcmp(h->offset, offset, sizeof(offset)) != 0) return 0;
+
+    return 1;
+}
+
+/**
+ * Opens the compiled toolpath of a GCode file. The toolpath is (re)compiled
+ * if it does not exist, or if it is outdated.
+ *
+ * @param tp The toolpath to open.
+ * @param filename The GCode file.
+ * @param tpfilename The toolpath file, usually the GCode filename + TOOLPATH_SUFFIX.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int toolpath_open(struct toolpath *tp, const char *filename, const char *tpfilename)
+{
+    if (toolpath_load(tp, tpfilename) == 0) {
+        if (toolpath_is_current(tp, filename)) return 0;
+        toolpath_close(tp);
+    }
+
+    printf("Compiling '%s' to '%s'.\n", filename, tpfilename);
+    if (toolpath_compile(filename, tpfilename) != 0) return -1;
+
+    return toolpath_load(tp, tpfilename);
+}
+
+/**
+ * Replays a compiled toolpath. The callbacks are called exactly like by
+ * gcode_parse(), but without parsing any text.
+ *
+ * @return Zero on success.
+ */
+int toolpath_replay(struct toolpath *tp, void (*newpos_cb)(struct gcode_ctx *ctx), gcode_move_cb move_cb, void (*toolchange_cb)(unsigned int tool))
+{
+    const struct toolpath_record *rec;
+    struct gcode_ctx ctx;
+    struct gcode_move move;
+    uint64_t i;
+
+    gcode_ctx_init(&ctx);
+    ctx.newpos_cb     = newpos_cb;
+    ctx.move_cb       = move_cb;
+    ctx.toolchange_cb = toolchange_cb;
+
+    for (i = 0; i < tp->header->num_records && !g_terminate; ++i) {
+        rec = &tp->records[i];
+        if (rec->type == TOOLPATH_TOOL) {
+            if (toolchange_cb) toolchange_cb(rec->tool);
+            continue;
+        }
+
+        ctx.lineno   = rec->line;
+        ctx.feedrate = rec->feedrate;
+        move.mode     = rec->type;
+        move.start.x  = rec->start[0];
+        move.start.y  = rec->start[1];
+        move.start.z  = rec->start[2];
+        move.end.x    = rec->end[0];
+        move.end.y    = rec->end[1];
+        move.end.z    = rec->end[2];
+        move.center.x = rec->center[0];
+        move.center.y = rec->center[1];
+        move.center.z = rec->center[2];
+        gcode_replay_move(&ctx, &move);
+    }
+    if (g_terminate) {
+        printf("Stopped replay on user request at line %u\n", ctx.lineno);
+    }
+
+    return 0;
+}
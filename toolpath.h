@@ -0,0 +1,80 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TOOLPATH_H_B8LD4RQS
+#define TOOLPATH_H_B8LD4RQS
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "gcode.h"
+#include "mapfile.h"
+
+#define TOOLPATH_MAGIC     "GCSIMTP"
+#define TOOLPATH_VERSION   2
+#define TOOLPATH_BYTEORDER 0x01020304
+/** Suffix of the compiled toolpath, appended to the GCode filename. */
+#define TOOLPATH_SUFFIX    ".gtp"
+
+/** Record types, the move types are the values of enum gcode_arc_mode. */
+enum toolpath_type {
+    TOOLPATH_LINEAR = ARC_NONE,
+    TOOLPATH_ARC_CW = ARC_CW,
+    TOOLPATH_ARC_CCW = ARC_CCW,
+    TOOLPATH_TOOL                /**< tool change */
+};
+
+/** One move or tool change, fixed size. */
+struct toolpath_record {
+    uint8_t type;        /**< enum toolpath_type */
+    uint8_t reserved;
+    uint16_t tool;       /**< active tool, or the new tool of a tool change */
+    uint32_t line;       /**< line number in the GCode file */
+    float start[3];
+    float end[3];
+    float center[3];     /**< absolute arc center */
+    float feedrate;      /**< mm/min */
+};
+
+/** File header, the records follow at records_offset. */
+struct toolpath_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;      /**< TOOLPATH_BYTEORDER in native byte order */
+    uint32_t header_size;
+    uint32_t record_size;
+    uint64_t records_offset;
+    uint64_t num_records;
+    uint64_t source_size;     /**< size of the GCode file */
+    int64_t source_mtime;     /**< modification time of the GCode file */
+    float offset[3];          /**< offsets applied when compiling */
+    uint32_t reserved;
+};
+
+/** A memory mapped toolpath. */
+struct toolpath {
+    struct mapped_file file;
+    const struct toolpath_header *header;
+    const struct toolpath_record *records;
+};
+
+int toolpath_compile(const char *filename, const char *tpfilename);
+int toolpath_open(struct toolpath *tp, const char *filename, const char *tpfilename);
+void toolpath_close(struct toolpath *tp);
+int toolpath_load(struct toolpath *tp, const char *filename);
+int toolpath_replay(struct toolpath *tp, void (*newpos_cb)(struct gcode_ctx *ctx), gcode_move_cb move_cb, void (*toolchange_cb)(unsigned int tool));
+
+#endif /* end of include guard: TOOLPATH_H_B8LD4RQS */
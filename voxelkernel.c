@@ -0,0 +1,218 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "voxelkernel.h"
+
+/* SIMD kernels are compiled with target attributes, so no special compiler
+ * flags are needed and the binary still runs on older CPUs.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+# define VOXEL_KERNEL_X86
+# include <immintrin.h>
+#endif
+
+/**
+ * Row kernel: combines n full destination words with n source words.
+ * The source words start at \c src, shifted right by \c shift bits (0..7).
+ */
+typedef void (*voxel_kernel_fn)(unsigned char *dst, const unsigned char *src, unsigned int shift, size_t n);
+
+struct voxel_kernel {
+    const char *name;
+    voxel_kernel_fn op[4]; /**< indexed by enum voxel_op */
+};
+
+/** Reads the source word \c i of a row kernel. */
+static inline uint64_t voxel_kernel_src(const unsigned char *src, unsigned int shift, size_t i)
+{
+    uint64_t val = voxel_load64(src + 8 * i) >> shift;
+    if (shift) val |= voxel_load64(src + 8 * i + 8) << (64 - shift);
+    return val;
+}
+
+#define VOXEL_KERNEL_SCALAR_FN(name, expr) \
+static void voxel_kernel_scalar_##name(unsigned char *dst, const unsigned char *src, unsigned int shift, size_t n) \
+{ \
+    uint64_t d, s; \
+    size_t i; \
+    for (i = 0; i < n; ++i) { \
+        s = voxel_kernel_src(src, shift, i); \
+        d = voxel_load64(dst + 8 * i); \
+        voxel_store64(dst + 8 * i, expr); \
+    } \
+}
+
+VOXEL_KERNEL_SCALAR_FN(difference, d & ~s)
+VOXEL_KERNEL_SCALAR_FN(union, d | s)
+VOXEL_KERNEL_SCALAR_FN(intersection, d & s)
+VOXEL_KERNEL_SCALAR_FN(xor, d ^ s)
+
+static const struct voxel_kernel g_kernel_scalar = {
+    "scalar",
+    {
+        voxel_kernel_scalar_difference,
+        voxel_kernel_scalar_union,
+        voxel_kernel_scalar_intersection,
+        voxel_kernel_scalar_xor
+    }
+};
+
+#ifdef VOXEL_KERNEL_X86
+/* SSE2 kernels: 128 bits per iteration.
+ * The unaligned source is loaded twice, 8 bytes apart, so that each 64 bit
+ * lane can be funnel shifted with its successor.
+ */
+#define VOXEL_KERNEL_SSE2_FN(name, expr) \
+__attribute__((target("sse2"))) \
+static void voxel_kernel_sse2_##name(unsigned char *dst, const unsigned char *src, unsigned int shift, size_t n) \
+{ \
+    __m128i sr = _mm_cvtsi32_si128(shift); \
+    __m128i sl = _mm_cvtsi32_si128(64 - shift); \
+    __m128i lo, hi, s, d; \
+    size_t i; \
+    for (i = 0; i + 2 <= n; i += 2) { \
+        lo = _mm_loadu_si128((const __m128i *)(src + 8 * i)); \
+        hi = _mm_loadu_si128((const __m128i *)(src + 8 * i + 8)); \
+        s  = _mm_or_si128(_mm_srl_epi64(lo, sr), _mm_sll_epi64(hi, sl)); \
+        d  = _mm_loadu_si128((const __m128i *)(dst + 8 * i)); \
+        _mm_storeu_si128((__m128i *)(dst + 8 * i), expr); \
+    } \
+    voxel_kernel_scalar_##name(dst + 8 * i, src + 8 * i, shift, n - i); \
+}
+
+VOXEL_KERNEL_SSE2_FN(difference, _mm_andnot_si128(s, d))
+VOXEL_KERNEL_SSE2_FN(union, _mm_or_si128(d, s))
+VOXEL_KERNEL_SSE2_FN(intersection, _mm_and_si128(d, s))
+VOXEL_KERNEL_SSE2_FN(xor, _mm_xor_si128(d, s))
+
+static const struct voxel_kernel g_kernel_sse2 = {
+    "SSE2",
+    {
+        voxel_kernel_sse2_difference,
+        voxel_kernel_sse2_union,
+        voxel_kernel_sse2_intersection,
+        voxel_kernel_sse2_xor
+    }
+};
+
+/* AVX2 kernels: 256 bits per iteration. */
+#define VOXEL_KERNEL_AVX2_FN(name, expr) \
+__attribute__((target("avx2"))) \
+static void voxel_kernel_avx2_##name(unsigned char *dst, const unsigned char *src, unsigned int shift, size_t n) \
+{ \
+    __m128i sr = _mm_cvtsi32_si128(shift); \
+    __m128i sl = _mm_cvtsi32_si128(64 - shift); \
+    __m256i lo, hi, s, d; \
+    size_t i; \
+    for (i = 0; i + 4 <= n; i += 4) { \
+        lo = _mm256_loadu_si256((const __m256i *)(src + 8 * i)); \
+        hi = _mm256_loadu_si256((const __m256i *)(src + 8 * i + 8)); \
+        s  = _mm256_or_si256(_mm256_srl_epi64(lo, sr), _mm256_sll_epi64(hi, sl)); \
+        d  = _mm256_loadu_si256((const __m256i *)(dst + 8 * i)); \
+        _mm256_storeu_si256((__m256i *)(dst + 8 * i), expr); \
+    } \
+    voxel_kernel_scalar_##name(dst + 8 * i, src + 8 * i, shift, n - i); \
+}
+
+VOXEL_KERNEL_AVX2_FN(difference, _mm256_andnot_si256(s, d))
+VOXEL_KERNEL_AVX2_FN(union, _mm256_or_si256(d, s))
+VOXEL_KERNEL_AVX2_FN(intersection, _mm256_and_si256(d, s))
+VOXEL_KERNEL_AVX2_FN(xor, _mm256_xor_si256(d, s))
+
+static const struct voxel_kernel g_kernel_avx2 = {
+    "AVX2",
+    {
+        voxel_kernel_avx2_difference,
+        voxel_kernel_avx2_union,
+        voxel_kernel_avx2_intersection,
+        voxel_kernel_avx2_xor
+    }
+};
+#endif /* VOXEL_KERNEL_X86 */
+
+static const struct voxel_kernel *g_kernel = NULL;
+
+/**
+ * Selects the row kernel implementation.
+ *
+ * @param type The kernel to use. VOXEL_KERNEL_AUTO picks the fastest kernel
+ * supported by the CPU.
+ *
+ * @return Zero on success, -1 if the kernel is not supported on this CPU.
+ */
+int voxel_kernel_select(enum voxel_kernel_type type)
+{
+    switch (type) {
+    case VOXEL_KERNEL_AUTO:
+#ifdef VOXEL_KERNEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            g_kernel = &g_kernel_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            g_kernel = &g_kernel_sse2;
+        } else {
+            g_kernel = &g_kernel_scalar;
+        }
+#else
+        g_kernel = &g_kernel_scalar;
+#endif
+        return 0;
+    case VOXEL_KERNEL_SCALAR:
+        g_kernel = &g_kernel_scalar;
+        return 0;
+#ifdef VOXEL_KERNEL_X86
+    case VOXEL_KERNEL_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2")) return -1;
+        g_kernel = &g_kernel_sse2;
+        return 0;
+    case VOXEL_KERNEL_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) return -1;
+        g_kernel = &g_kernel_avx2;
+        return 0;
+#endif
+    default:
+        break;
+    }
+
+    return -1;
+}
+
+/**
+ * Returns the name of the selected kernel.
+ */
+const char *voxel_kernel_name(void)
+{
+    if (g_kernel == NULL) voxel_kernel_select(VOXEL_KERNEL_AUTO);
+    return g_kernel->name;
+}
+
+/**
+ * Combines n full 64 bit words of a row.
+ *
+ * @param dst Destination, starting at a word boundary of the voxel space.
+ * @param src Source byte containing the first source bit.
+ * @param shift Bit index of the first source bit inside this byte.
+ * @param n Number of words.
+ * @param op The boolean operation.
+ */
+void voxel_kernel_row(unsigned char *dst, const unsigned char *src, unsigned int shift, size_t n, enum voxel_op op)
+{
+    if (g_kernel == NULL) voxel_kernel_select(VOXEL_KERNEL_AUTO);
+    g_kernel->op[op](dst, src, shift, n);
+}
@@ -0,0 +1,59 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef VOXELKERNEL_H_3MDL0EWA
+#define VOXELKERNEL_H_3MDL0EWA
+
+#include <stdint.h>
+#include <string.h>
+#include "voxelspace.h"
+
+/** Available implementations of the row kernels. */
+enum voxel_kernel_type {
+    VOXEL_KERNEL_AUTO = 0, /**< best kernel supported by the CPU */
+    VOXEL_KERNEL_SCALAR,
+    VOXEL_KERNEL_SSE2,
+    VOXEL_KERNEL_AVX2
+};
+
+int voxel_kernel_select(enum voxel_kernel_type type);
+const char *voxel_kernel_name(void);
+void voxel_kernel_row(unsigned char *dst, const unsigned char *src, unsigned int shift, size_t n, enum voxel_op op);
+
+/**
+ * Loads 64 bits from the given byte address.
+ * Voxel bits are stored LSB first, so this is a little endian load.
+ */
+static inline uint64_t voxel_load64(const unsigned char *p)
+{
+    uint64_t val;
+    memcpy(&val, p, sizeof(val));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap64(val);
+#endif
+    return val;
+}
+
+static inline void voxel_store64(unsigned char *p, uint64_t val)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap64(val);
+#endif
+    memcpy(p, &val, sizeof(val));
+}
+
+#endif /* end of include guard: VOXELKERNEL_H_3MDL0EWA */
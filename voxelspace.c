@@ -16,12 +16,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "voxelspace.h"
+#include "pnm.h"
+#include "voxelkernel.h"
+#include "parallel.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <limits.h>
 #ifdef _WIN32
 /* Building for Windows */
+# include <malloc.h> /* for _aligned_malloc */
 # ifdef __GNUC__
    /* with MinGw we can use built-in functions like on Linux */
 #  define htons(x) __builtin_bswap16(x)
@@ -70,29 +74,320 @@ static int voxel_space_index(struct voxel_space *space, struct voxel_pos *pos, s
     return 0;
 }
 
+/**
+ * Reads up to 64 bits starting at an arbitrary bit index.
+ *
+ * @param data Bit array.
+ * @param bit Index of first bit.
+ * @param n Number of bits to read (1..64).
+ *
+ * @return The bits, right aligned.
+ */
+static inline uint64_t voxel_bits_read(const unsigned char *data, size_t bit, unsigned int n)
+{
+    const unsigned char *p = data + (bit >> 3);
+    unsigned int shift = bit & 7;
+    uint64_t val = voxel_load64(p) >> shift;
+
+    if (shift + n > 64) val |= (uint64_t)p[8] << (64 - shift);
+    if (n < 64) val &= (UINT64_C(1) << n) - 1;
+
+    return val;
+}
+
+/**
+ * Returns the words of an XY column in the column layout.
+ * The coordinates are not checked.
+ */
+static inline uint64_t *voxel_space_column(struct voxel_space *space, int x, int y)
+{
+    return (uint64_t *)space->data + ((size_t)y * space->width + x) * space->words;
+}
+
+/** Returns a mask of the bits [lo,hi) of a word, 0 <= lo < hi <= 64. */
+static inline uint64_t voxel_word_mask(unsigned int lo, unsigned int hi)
+{
+    uint64_t mask = (hi == 64) ? ~UINT64_C(0) : (UINT64_C(1) << hi) - 1;
+
+    return mask & (~UINT64_C(0) << lo);
+}
+
+/** Number of 64 bit words of a brick of 8x8x8 voxels, one cache line. */
+#define VOXEL_BRICK_WORDS 8
+
+/** Spreads the lower 10 bits of v to every third bit. */
+static inline uint32_t voxel_morton_spread(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+/** Inverse of voxel_morton_spread(). */
+static inline uint32_t voxel_morton_compact(uint32_t v)
+{
+    v &= 0x09249249;
+    v = (v | (v >> 2)) & 0x030c30c3;
+    v = (v | (v >> 4)) & 0x0300f00f;
+    v = (v | (v >> 8)) & 0x030000ff;
+    v = (v | (v >> 16)) & 0x000003ff;
+    return v;
+}
+
+/**
+ * Interleaves the bits of the coordinates to a Morton (Z-order) code,
+ * x in bit 0, y in bit 1, z in bit 2 and so on. Each coordinate may
+ * have up to 10 bits.
+ */
+uint32_t voxel_morton_encode(unsigned int x, unsigned int y, unsigned int z)
+{
+    return voxel_morton_spread(x) | (voxel_morton_spread(y) << 1) | (voxel_morton_spread(z) << 2);
+}
+
+/** Splits a Morton code into its coordinates. */
+void voxel_morton_decode(uint32_t code, unsigned int *x, unsigned int *y, unsigned int *z)
+{
+    *x = voxel_morton_compact(code);
+    *y = voxel_morton_compact(code >> 1);
+    *z = voxel_morton_compact(code >> 2);
+}
+
+/**
+ * Returns the brick containing a voxel in the Morton layout.
+ * The coordinates are not checked.
+ */
+static inline uint64_t *voxel_space_brick(struct voxel_space *space, int x, int y, int z)
+{
+    size_t brick = ((size_t)(z >> 3) * space->bricks_y + (y >> 3)) * space->bricks_x + (x >> 3);
+
+    return (uint64_t *)space->data + brick * VOXEL_BRICK_WORDS;
+}
+
+/** Returns voxel_morton_encode(x & 7, y & 7, 0), the first bit of a column inside of its brick. */
+static inline unsigned int voxel_brick_base(int x, int y)
+{
+    unsigned int bx = x & 7, by = y & 7;
+
+    return (bx & 1) | ((bx & 2) << 2) | ((bx & 4) << 4) | (((by & 1) | ((by & 2) << 2) | ((by & 4) << 4)) << 1);
+}
+
+/*
+ * Inside of a brick the Z bits of an XY column are spread over two words.
+ * The column starts at bit voxel_morton_encode(x & 7, y & 7, 0). Layers
+ * 0..3 are at offsets 0, 4, 32 and 36 of that bit, layers 4..7 at the same
+ * offsets four words later.
+ */
+
+/** Spreads 4 Z bits to their positions in a brick word. */
+static inline uint64_t voxel_brick_spread(unsigned int v)
+{
+    return (v & 1) | ((uint64_t)(v & 2) << 3) | ((uint64_t)(v & 4) << 30) | ((uint64_t)(v & 8) << 33);
+}
+
+/** Inverse of voxel_brick_spread(). */
+static inline unsigned int voxel_brick_gather(uint64_t w)
+{
+    return (w & 1) | ((w >> 3) & 2) | ((w >> 30) & 4) | ((w >> 33) & 8);
+}
+
+/** Reads the 8 Z bits of the column starting at Morton index base of a brick. */
+static inline unsigned int voxel_brick_column_read(const uint64_t *brick, unsigned int base)
+{
+    const uint64_t *p = brick + (base >> 6);
+    unsigned int shift = base & 63;
+
+    return voxel_brick_gather(p[0] >> shift) | (voxel_brick_gather(p[4] >> shift) << 4);
+}
+
+/**
+ * Reads the 8 X bits of the row starting at Morton index base of a brick,
+ * base is voxel_morton_encode(0, y & 7, z & 7). The bits at offsets 0, 1,
+ * 8 and 9 from base are voxels 0 to 3, voxels 4 to 7 are one word later.
+ */
+static inline unsigned int voxel_brick_row_read(const uint64_t *brick, unsigned int base)
+{
+    const uint64_t *p = brick + (base >> 6);
+    uint64_t lo = p[0] >> (base & 63), hi = p[1] >> (base & 63);
+
+    return (lo & 3) | ((lo >> 6) & 0xc) | ((hi & 3) << 4) | ((hi >> 2) & 0xc0);
+}
+
+/**
+ * Finds the word and bit of a voxel in the column or Morton layout.
+ *
+ * @return Zero on success, -1 if the pos is out of range.
+ */
+static int voxel_space_word_bit(struct voxel_space *space, struct voxel_pos *pos, uint64_t **word, uint64_t *mask)
+{
+    unsigned int index;
+
+    if (pos->x < 0 || pos->x >= (int)space->width) return -1;
+    if (pos->y < 0 || pos->y >= (int)space->height) return -1;
+    if (pos->z < 0 || pos->z >= (int)space->thickness) return -1;
+
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        index = voxel_morton_encode(pos->x & 7, pos->y & 7, pos->z & 7);
+        *word = voxel_space_brick(space, pos->x, pos->y, pos->z) + (index >> 6);
+        *mask = UINT64_C(1) << (index & 63);
+        return 0;
+    }
+
+    *word = voxel_space_column(space, pos->x, pos->y) + (pos->z >> 6);
+    *mask = UINT64_C(1) << (pos->z & 63);
+    return 0;
+}
+
+static const char *g_layout_names[] = {
+    "layer",
+    "column",
+    "morton"
+};
+
+/**
+ * Parses a layout name given on the commandline.
+ *
+ * @return Zero on success, -1 if the name is unknown.
+ */
+int voxel_layout_parse(const char *name, enum voxel_layout *layout)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(g_layout_names) / sizeof(g_layout_names[0]); ++i) {
+        if (strcmp(name, g_layout_names[i]) == 0) {
+            *layout = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *voxel_layout_name(enum voxel_layout layout)
+{
+    return g_layout_names[layout];
+}
+
+/** Allocates voxel data aligned to cache lines, so each brick is one cache line. */
+static unsigned char *voxel_alloc(size_t size)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, 64);
+#else
+    void *p;
+
+    if (posix_memalign(&p, 64, size) != 0) return NULL;
+    return p;
+#endif
+}
+
+static void voxel_free(unsigned char *data)
+{
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
 int voxel_space_init(struct voxel_space *space, size_t w, size_t h, size_t t)
 {
+    return voxel_space_init_layout(space, w, h, t, VOXEL_LAYOUT_LAYER);
+}
+
+/**
+ * Initializes an empty voxel space with the given memory layout.
+ * All functions work with all layouts. The column layout keeps the Z
+ * bits of each column in its own words, so finding the top of a column
+ * and clearing a Z range are word operations. The Morton layout stores
+ * bricks of 8x8x8 voxels in one cache line each, so a stamp touches few
+ * cache lines.
+ *
+ * @return Zero on success, -1 if out of memory.
+ */
+int voxel_space_init_layout(struct voxel_space *space, size_t w, size_t h, size_t t, enum voxel_layout layout)
+{
+    size_t alloc;
+
     space->width     = w;
     space->height    = h;
     space->thickness = t;
-    space->size      = w* h * t / 8;
-    space->data      = malloc(space->size);
+    space->layout    = layout;
+    space->words     = 0;
+    space->bricks_x  = 0;
+    space->bricks_y  = 0;
+    if (layout == VOXEL_LAYOUT_COLUMN) {
+        space->words = (t + 63) / 64;
+        space->size  = w * h * space->words * sizeof(uint64_t);
+    } else if (layout == VOXEL_LAYOUT_MORTON) {
+        space->bricks_x = (w + 7) / 8;
+        space->bricks_y = (h + 7) / 8;
+        space->size     = space->bricks_x * space->bricks_y * ((t + 7) / 8) * VOXEL_BRICK_WORDS * sizeof(uint64_t);
+    } else {
+        space->size  = (w * h * t + 7) / 8;
+    }
+    /* round up to whole 64 bit words and add one word of padding,
+     * so word-wise operations never access memory out of bounds */
+    alloc = ((space->size + 7) & ~(size_t)7) + 8;
+    space->data      = voxel_alloc(alloc);
     if (space->data == NULL) return -1;
-    voxel_space_clr_all(space);
+    memset(space->data, 0, alloc);
     return 0;
 }
 
 void voxel_space_clear(struct voxel_space *space)
 {
     if (space->data)
-        free(space->data);
+        voxel_free(space->data);
     memset(space, 0, sizeof(*space));
 }
 
 
+/** Clears the voxels of the bricks at the upper borders, which are outside of the space. */
+static void voxel_space_clr_brick_padding(struct voxel_space *space)
+{
+    size_t bx, by, bz, bricks_z = (space->thickness + 7) / 8;
+    unsigned int i, x, y, z;
+    uint64_t *brick;
+
+    for (bz = 0; bz < bricks_z; ++bz) {
+        for (by = 0; by < space->bricks_y; ++by) {
+            for (bx = 0; bx < space->bricks_x; ++bx) {
+                if ((bx + 1) * 8 <= space->width && (by + 1) * 8 <= space->height &&
+                    (bz + 1) * 8 <= space->thickness) continue;
+                brick = voxel_space_brick(space, bx * 8, by * 8, bz * 8);
+                for (i = 0; i < 512; ++i) {
+                    voxel_morton_decode(i, &x, &y, &z);
+                    if (bx * 8 + x >= space->width || by * 8 + y >= space->height || bz * 8 + z >= space->thickness)
+                        brick[i >> 6] &= ~(UINT64_C(1) << (i & 63));
+                }
+            }
+        }
+    }
+}
+
 void voxel_space_set_all(struct voxel_space *space)
 {
-    memset(space->data, 0xff, space->size);
+    uint64_t *word, last;
+    size_t i, j, columns;
+
+    if (space->layout != VOXEL_LAYOUT_COLUMN) {
+        memset(space->data, 0xff, space->size);
+        if (space->layout == VOXEL_LAYOUT_MORTON) voxel_space_clr_brick_padding(space);
+        return;
+    }
+
+    /* the bits above the top layer stay clear */
+    if (space->words == 0) return;
+    last    = voxel_word_mask(0, space->thickness - (space->words - 1) * 64);
+    columns = space->width * space->height;
+    word    = (uint64_t *)space->data;
+    for (i = 0; i < columns; ++i) {
+        for (j = 0; j < space->words - 1; ++j) *word++ = ~UINT64_C(0);
+        *word++ = last;
+    }
 }
 
 void voxel_space_clr_all(struct voxel_space *space)
@@ -104,7 +399,16 @@ int voxel_space_set_xyz(struct voxel_space *space, struct voxel_pos *pos)
 {
     size_t index;
     unsigned char bit;
-    int ret = voxel_space_index(space, pos, &index, &bit);
+    uint64_t *word, mask;
+    int ret;
+
+    if (space->layout != VOXEL_LAYOUT_LAYER) {
+        ret = voxel_space_word_bit(space, pos, &word, &mask);
+        if (ret == 0) *word |= mask;
+        return ret;
+    }
+
+    ret = voxel_space_index(space, pos, &index, &bit);
     if (ret != 0) return ret;
 
     space->data[index] |= (1 << bit);
@@ -116,7 +420,16 @@ int voxel_space_clr_xyz(struct voxel_space *space, struct voxel_pos *pos)
 {
     size_t index;
     unsigned char bit;
-    int ret = voxel_space_index(space, pos, &index, &bit);
+    uint64_t *word, mask;
+    int ret;
+
+    if (space->layout != VOXEL_LAYOUT_LAYER) {
+        ret = voxel_space_word_bit(space, pos, &word, &mask);
+        if (ret == 0) *word &= ~mask;
+        return ret;
+    }
+
+    ret = voxel_space_index(space, pos, &index, &bit);
     if (ret != 0) return ret;
 
     space->data[index] &= ~(1 << bit);
@@ -136,7 +449,16 @@ int voxel_space_get_xyz(struct voxel_space *space, struct voxel_pos *pos)
 {
     size_t index;
     unsigned char bit;
-    int ret = voxel_space_index(space, pos, &index, &bit);
+    uint64_t *word, mask;
+    int ret;
+
+    if (space->layout != VOXEL_LAYOUT_LAYER) {
+        ret = voxel_space_word_bit(space, pos, &word, &mask);
+        if (ret != 0) return ret;
+        return (*word & mask) ? 1 : 0;
+    }
+
+    ret = voxel_space_index(space, pos, &index, &bit);
     if (ret != 0) return ret;
 
     if (space->data[index] & (1 << bit)) return 1;
@@ -144,6 +466,696 @@ int voxel_space_get_xyz(struct voxel_space *space, struct voxel_pos *pos)
     return 0;
 }
 
+/** Clears the bits [z0,z1) of a column in the column layout. */
+static void voxel_column_clr(uint64_t *col, int z0, int z1)
+{
+    int i, lo, hi;
+
+    if (z0 >= z1) return;
+    for (i = z0 >> 6; i <= (z1 - 1) >> 6; ++i) {
+        lo = (i == z0 >> 6) ? (z0 & 63) : 0;
+        hi = (i == (z1 - 1) >> 6) ? ((z1 - 1) & 63) + 1 : 64;
+        col[i] &= ~voxel_word_mask(lo, hi);
+    }
+}
+
+/**
+ * Clears the bits [z0,z1) of a column in the Morton layout.
+ *
+ * @param atomic If non-zero the words are modified atomically, they are
+ * shared with neighbouring columns.
+ */
+static void voxel_brick_column_clr(struct voxel_space *space, int x, int y, int z0, int z1, int atomic)
+{
+    unsigned int base = voxel_brick_base(x, y);
+    unsigned int shift = base & 63, m;
+    uint64_t *p, lo, hi;
+    int z;
+
+    if (z0 >= z1) return;
+    for (z = z0 & ~7; z < z1; z += 8) {
+        m = 0xff;
+        if (z < z0) m &= 0xff << (z0 - z);
+        if (z + 8 > z1) m &= 0xff >> (z + 8 - z1);
+        p  = voxel_space_brick(space, x, y, z) + (base >> 6);
+        lo = voxel_brick_spread(m & 15) << shift;
+        hi = voxel_brick_spread(m >> 4) << shift;
+        if (atomic) {
+            if (lo) __atomic_fetch_and(&p[0], ~lo, __ATOMIC_RELAXED);
+            if (hi) __atomic_fetch_and(&p[4], ~hi, __ATOMIC_RELAXED);
+        } else {
+            p[0] &= ~lo;
+            p[4] &= ~hi;
+        }
+    }
+}
+
+/**
+ * Clears a range of voxels in one XY column.
+ * The range gets clipped to the voxel space.
+ *
+ * @param space The voxel space.
+ * @param x X coordinate of the column.
+ * @param y Y coordinate of the column.
+ * @param z0 First voxel to clear.
+ * @param z1 End of range (exclusive).
+ *
+ * @return Zero on success, -1 if the column is out of range.
+ */
+int voxel_space_clr_column(struct voxel_space *space, int x, int y, int z0, int z1)
+{
+    struct voxel_pos pos;
+    int z;
+
+    if (x < 0 || x >= space->width) return -1;
+    if (y < 0 || y >= space->height) return -1;
+    if (z0 < 0) z0 = 0;
+    if (z1 > (int)space->thickness) z1 = space->thickness;
+
+    if (space->layout == VOXEL_LAYOUT_COLUMN) {
+        voxel_column_clr(voxel_space_column(space, x, y), z0, z1);
+        return 0;
+    }
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        voxel_brick_column_clr(space, x, y, z0, z1, 0);
+        return 0;
+    }
+
+    for (z = z0; z < z1; ++z) {
+        voxel_pos_set(&pos, x, y, z);
+        voxel_space_clr_xyz(space, &pos);
+    }
+
+    return 0;
+}
+
+/**
+ * Gets the height of the topmost material in a column.
+ *
+ * @return Index of the topmost solid layer plus one, 0 if the column is empty,
+ * -1 if the column is out of range.
+ */
+int voxel_space_get_top(struct voxel_space *space, int x, int y)
+{
+    size_t bit, i, layer = space->width * space->height;
+    unsigned int base, v;
+    uint64_t *col;
+    int z;
+
+    if (x < 0 || x >= (int)space->width) return -1;
+    if (y < 0 || y >= (int)space->height) return -1;
+
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        /* the topmost set bit of the highest non-empty brick */
+        base = voxel_brick_base(x, y);
+        for (z = ((int)space->thickness - 1) & ~7; z >= 0; z -= 8) {
+            v = voxel_brick_column_read(voxel_space_brick(space, x, y, z), base);
+            if (v) return z + 32 - __builtin_clz(v);
+        }
+        return 0;
+    }
+
+    if (space->layout == VOXEL_LAYOUT_COLUMN) {
+        /* the topmost set bit of the highest non-empty word */
+        col = voxel_space_column(space, x, y);
+        for (i = space->words; i > 0; --i) {
+            if (col[i - 1]) return (i - 1) * 64 + 64 - __builtin_clzll(col[i - 1]);
+        }
+        return 0;
+    }
+
+    bit = ((size_t)(space->thickness - 1) * space->height + y) * space->width + x;
+    for (z = space->thickness; z > 0; --z, bit -= layer) {
+        if (space->data[bit >> 3] & (1 << (bit & 7))) return z;
+    }
+
+    return 0;
+}
+
+/**
+ * Same as voxel_space_clr_column(), but the bytes are modified atomically,
+ * so other threads may modify neighbouring columns concurrently.
+ */
+int voxel_space_clr_column_atomic(struct voxel_space *space, int x, int y, int z0, int z1)
+{
+    size_t bit;
+    int z;
+
+    if (x < 0 || x >= space->width) return -1;
+    if (y < 0 || y >= space->height) return -1;
+    if (z0 < 0) z0 = 0;
+    if (z1 > (int)space->thickness) z1 = space->thickness;
+
+    if (space->layout == VOXEL_LAYOUT_COLUMN) {
+        /* the words of a column are not shared with other columns */
+        voxel_column_clr(voxel_space_column(space, x, y), z0, z1);
+        return 0;
+    }
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        voxel_brick_column_clr(space, x, y, z0, z1, 1);
+        return 0;
+    }
+
+    for (z = z0; z < z1; ++z) {
+        bit = ((size_t)z * space->height + y) * space->width + x;
+        __atomic_fetch_and(&space->data[bit >> 3], (unsigned char)~(1 << (bit & 7)), __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+/**
+ * Clears the voxels [x0,x1) of row y in layer z in the column layout.
+ * Columns do not share words, so this needs no atomic operations.
+ */
+static void voxel_column_clr_row(struct voxel_space *space, int x0, int x1, int y, int z)
+{
+    uint64_t *col = voxel_space_column(space, x0, y) + (z >> 6);
+    uint64_t mask = ~(UINT64_C(1) << (z & 63));
+    int x;
+
+    for (x = x0; x < x1; ++x, col += space->words) *col &= mask;
+}
+
+/** Clears the voxels [x0,x1) of row y in layer z in the Morton layout. */
+static void voxel_brick_clr_row(struct voxel_space *space, int x0, int x1, int y, int z, int atomic)
+{
+    unsigned int index;
+    uint64_t *p;
+    int x;
+
+    for (x = x0; x < x1; ++x) {
+        index = voxel_morton_encode(x & 7, y & 7, z & 7);
+        p = voxel_space_brick(space, x, y, z) + (index >> 6);
+        if (atomic) {
+            __atomic_fetch_and(p, ~(UINT64_C(1) << (index & 63)), __ATOMIC_RELAXED);
+        } else {
+            *p &= ~(UINT64_C(1) << (index & 63));
+        }
+    }
+}
+
+/**
+ * Clears the voxels [x0,x1) of the row y in layer z.
+ *
+ * @return Zero on success, -1 if the row is outside of the space.
+ */
+int voxel_space_clr_row(struct voxel_space *space, int x0, int x1, int y, int z)
+{
+    size_t row, lo, hi, i;
+    unsigned char mask;
+
+    if (y < 0 || y >= (int)space->height) return -1;
+    if (z < 0 || z >= (int)space->thickness) return -1;
+    if (x0 < 0) x0 = 0;
+    if (x1 > (int)space->width) x1 = space->width;
+    if (x0 >= x1) return 0;
+
+    if (space->layout == VOXEL_LAYOUT_COLUMN) {
+        voxel_column_clr_row(space, x0, x1, y, z);
+        return 0;
+    }
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        voxel_brick_clr_row(space, x0, x1, y, z, 0);
+        return 0;
+    }
+
+    row = ((size_t)z * space->height + y) * space->width;
+    lo = row + x0;
+    hi = row + x1;
+    for (i = lo >> 3; i <= (hi - 1) >> 3; ++i) {
+        mask = 0xff;
+        if (i == lo >> 3) mask &= 0xff << (lo & 7);
+        if (i == (hi - 1) >> 3) mask &= 0xff >> (7 - ((hi - 1) & 7));
+        space->data[i] &= ~mask;
+    }
+
+    return 0;
+}
+
+/**
+ * Same as voxel_space_clr_row(), but the bytes are modified atomically,
+ * so other threads may modify neighbouring voxels concurrently.
+ */
+int voxel_space_clr_row_atomic(struct voxel_space *space, int x0, int x1, int y, int z)
+{
+    size_t row, lo, hi, i;
+    unsigned char mask;
+
+    if (y < 0 || y >= (int)space->height) return -1;
+    if (z < 0 || z >= (int)space->thickness) return -1;
+    if (x0 < 0) x0 = 0;
+    if (x1 > (int)space->width) x1 = space->width;
+    if (x0 >= x1) return 0;
+
+    if (space->layout == VOXEL_LAYOUT_COLUMN) {
+        voxel_column_clr_row(space, x0, x1, y, z);
+        return 0;
+    }
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        voxel_brick_clr_row(space, x0, x1, y, z, 1);
+        return 0;
+    }
+
+    row = ((size_t)z * space->height + y) * space->width;
+    lo = row + x0;
+    hi = row + x1;
+    for (i = lo >> 3; i <= (hi - 1) >> 3; ++i) {
+        mask = 0xff;
+        if (i == lo >> 3) mask &= 0xff << (lo & 7);
+        if (i == (hi - 1) >> 3) mask &= 0xff >> (7 - ((hi - 1) & 7));
+        __atomic_fetch_and(&space->data[i], (unsigned char)~mask, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+/**
+ * Combines the bits [lo,hi) which must be inside of one destination word.
+ *
+ * @param dst Destination bit array.
+ * @param lo Bit index of the first destination bit.
+ * @param hi End of the destination bit range (exclusive).
+ * @param src Source bit array.
+ * @param s Bit index of the first source bit.
+ * @param op The boolean operation.
+ */
+static void voxel_word_op(unsigned char *dst, size_t lo, size_t hi, const unsigned char *src, size_t s, enum voxel_op op)
+{
+    unsigned char *p = dst + ((lo >> 6) << 3);
+    uint64_t bits, mask, word;
+
+    bits = voxel_bits_read(src, s, hi - lo) << (lo & 63);
+    mask = (hi - lo == 64) ? ~UINT64_C(0) : ((UINT64_C(1) << (hi - lo)) - 1) << (lo & 63);
+
+    word = voxel_load64(p);
+    switch (op) {
+    case VOXEL_OP_DIFFERENCE:
+        word &= ~bits;
+        break;
+    case VOXEL_OP_UNION:
+        word |= bits;
+        break;
+    case VOXEL_OP_INTERSECTION:
+        word &= bits | ~mask;
+        break;
+    case VOXEL_OP_XOR:
+        word ^= bits;
+        break;
+    }
+    voxel_store64(p, word);
+}
+
+/**
+ * Same as voxel_word_op(), but the destination word is modified by an
+ * atomic read-modify-write. This is used for words which are shared
+ * with voxels owned by other threads.
+ */
+static void voxel_word_op_atomic(unsigned char *dst, size_t lo, size_t hi, const unsigned char *src, size_t s, enum voxel_op op)
+{
+    uint64_t *p = (uint64_t *)(dst + ((lo >> 6) << 3));
+    uint64_t bits, mask;
+
+    bits = voxel_bits_read(src, s, hi - lo) << (lo & 63);
+    mask = (hi - lo == 64) ? ~UINT64_C(0) : ((UINT64_C(1) << (hi - lo)) - 1) << (lo & 63);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap64(bits);
+    mask = __builtin_bswap64(mask);
+#endif
+
+    switch (op) {
+    case VOXEL_OP_DIFFERENCE:
+        __atomic_fetch_and(p, ~bits, __ATOMIC_RELAXED);
+        break;
+    case VOXEL_OP_UNION:
+        __atomic_fetch_or(p, bits, __ATOMIC_RELAXED);
+        break;
+    case VOXEL_OP_INTERSECTION:
+        __atomic_fetch_and(p, bits | ~mask, __ATOMIC_RELAXED);
+        break;
+    case VOXEL_OP_XOR:
+        __atomic_fetch_xor(p, bits, __ATOMIC_RELAXED);
+        break;
+    }
+}
+
+/**
+ * Combines one row of bits using 64 bit word operations.
+ * The destination is processed in aligned words, the source bits are
+ * shifted into place. Full words are handed to the SIMD row kernel,
+ * only the partial words at both ends are done here.
+ *
+ * @param dst Destination bit array.
+ * @param d Bit index of the first destination bit.
+ * @param src Source bit array.
+ * @param s Bit index of the first source bit.
+ * @param n Number of bits.
+ * @param op The boolean operation.
+ * @param atomic If non-zero the partial words are modified atomically.
+ */
+static void voxel_row_op(unsigned char *dst, size_t d, const unsigned char *src, size_t s, size_t n, enum voxel_op op, int atomic)
+{
+    void (*word_op)(unsigned char *, size_t, size_t, const unsigned char *, size_t, enum voxel_op) =
+        atomic ? voxel_word_op_atomic : voxel_word_op;
+    size_t lo, hi, end = d + n;
+    size_t first = (d + 63) & ~(size_t)63; /* first full word */
+    size_t last  = end & ~(size_t)63;      /* end of last full word */
+    size_t sbit;
+
+    if (first >= last) {
+        /* no full word inside of this row */
+        for (lo = d; lo < end; lo = hi) {
+            hi = (lo & ~(size_t)63) + 64;
+            if (hi > end) hi = end;
+            word_op(dst, lo, hi, src, s + (lo - d), op);
+        }
+        return;
+    }
+
+    if (d < first) word_op(dst, d, first, src, s, op);
+    sbit = s + (first - d);
+    voxel_kernel_row(dst + (first >> 3), src + (sbit >> 3), sbit & 7, (last - first) >> 6, op);
+    if (last < end) word_op(dst, last, end, src, s + (last - d), op);
+}
+
+/** Reads up to 64 bits [z,z+n) of a column in the column layout, right aligned. */
+static inline uint64_t voxel_column_read(const uint64_t *col, int z, int n)
+{
+    uint64_t val;
+
+    col += z >> 6;
+    val = col[0] >> (z & 63);
+    if ((z & 63) + n > 64) val |= col[1] << (64 - (z & 63));
+    if (n < 64) val &= (UINT64_C(1) << n) - 1;
+    return val;
+}
+
+/**
+ * Reads up to 64 bits [z,z+n) of an XY column, in any layout.
+ *
+ * @return The bits, right aligned.
+ */
+static uint64_t voxel_space_column_read(struct voxel_space *space, int x, int y, int z, int n)
+{
+    size_t bit, layer = space->width * space->height;
+    unsigned int base;
+    uint64_t val;
+    int i, k;
+
+    if (space->layout == VOXEL_LAYOUT_COLUMN) return voxel_column_read(voxel_space_column(space, x, y), z, n);
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        base = voxel_brick_base(x, y);
+        for (i = 0, val = 0; i < n; i += k, z += k) {
+            k = 8 - (z & 7);
+            if (k > n - i) k = n - i;
+            val |= (uint64_t)((voxel_brick_column_read(voxel_space_brick(space, x, y, z), base) >> (z & 7)) &
+                              ((1u << k) - 1)) << i;
+        }
+        return val;
+    }
+
+    bit = ((size_t)z * space->height + y) * space->width + x;
+    for (i = 0, val = 0; i < n; ++i, bit += layer) {
+        if (space->data[bit >> 3] & (1 << (bit & 7))) val |= UINT64_C(1) << i;
+    }
+
+    return val;
+}
+
+/** Combines the bits selected by mask of one word. */
+static inline void voxel_word_apply(uint64_t *p, uint64_t bits, uint64_t mask, enum voxel_op op)
+{
+    switch (op) {
+    case VOXEL_OP_DIFFERENCE:
+        *p &= ~bits;
+        break;
+    case VOXEL_OP_UNION:
+        *p |= bits;
+        break;
+    case VOXEL_OP_INTERSECTION:
+        *p &= bits | ~mask;
+        break;
+    case VOXEL_OP_XOR:
+        *p ^= bits;
+        break;
+    }
+}
+
+/** Combines up to 64 bits [z,z+n) of a column in the column layout. */
+static void voxel_column_op(uint64_t *col, int z, int n, uint64_t bits, enum voxel_op op)
+{
+    uint64_t *p = col + (z >> 6);
+    unsigned int lo = z & 63;
+    uint64_t mask = (n == 64) ? ~UINT64_C(0) : (UINT64_C(1) << n) - 1;
+
+    voxel_word_apply(p, bits << lo, mask << lo, op);
+    if (lo + n > 64) voxel_word_apply(p + 1, bits >> (64 - lo), mask >> (64 - lo), op);
+}
+
+/**
+ * Combines the block [x0,x1) x [y0,y1) x [z0,z1) of \c other, given in
+ * coordinates of \c other, with a space in the column layout.
+ * Each column is combined with up to 64 bits per word operation.
+ */
+static void voxel_space_boolean_columns(struct voxel_space *space, struct voxel_space *other, enum voxel_op op,
+                                        int x0, int y0, int z0, int x1, int y1, int z1)
+{
+    const uint64_t *src = NULL;
+    uint64_t *col, bits;
+    int x, y, z, n;
+
+    for (y = y0; y < y1; ++y) {
+        /* the columns of an X row are contiguous in both spaces */
+        col = voxel_space_column(space, x0 + other->pos.x, y + other->pos.y);
+        if (other->layout == VOXEL_LAYOUT_COLUMN) src = voxel_space_column(other, x0, y);
+        for (x = x0; x < x1; ++x, col += space->words) {
+            for (z = z0; z < z1; z += n) {
+                n = (z1 - z < 64) ? z1 - z : 64;
+                bits = src ? voxel_column_read(src, z, n) : voxel_space_column_read(other, x, y, z, n);
+                if (bits == 0 && op != VOXEL_OP_INTERSECTION) continue;
+                voxel_column_op(col, z + other->pos.z, n, bits, op);
+            }
+            if (src) src += other->words;
+        }
+    }
+}
+
+/**
+ * Same as voxel_word_apply(), but the word is modified by an atomic
+ * read-modify-write.
+ */
+static inline void voxel_word_apply_atomic(uint64_t *p, uint64_t bits, uint64_t mask, enum voxel_op op)
+{
+    switch (op) {
+    case VOXEL_OP_DIFFERENCE:
+        __atomic_fetch_and(p, ~bits, __ATOMIC_RELAXED);
+        break;
+    case VOXEL_OP_UNION:
+        __atomic_fetch_or(p, bits, __ATOMIC_RELAXED);
+        break;
+    case VOXEL_OP_INTERSECTION:
+        __atomic_fetch_and(p, bits | ~mask, __ATOMIC_RELAXED);
+        break;
+    case VOXEL_OP_XOR:
+        __atomic_fetch_xor(p, bits, __ATOMIC_RELAXED);
+        break;
+    }
+}
+
+/**
+ * Clips the range [lo,hi) to the brick starting at b.
+ *
+ * @return Zero if the brick has no voxels inside of the range.
+ */
+static inline int voxel_brick_clip(int b, int lo, int hi, int *a, int *e)
+{
+    *a = (lo > b) ? lo : b;
+    *e = (hi < b + 8) ? hi : b + 8;
+    return *a < *e;
+}
+
+/**
+ * Combines the block [x0,x1) x [y0,y1) x [z0,z1) of \c other, given in
+ * coordinates of \c other, with a space in the Morton layout.
+ * The XY columns are visited brick by brick, so the stack of bricks of
+ * one column is loaded once for all of its 64 columns. Each column of
+ * \c other is read once and combined with two word operations per brick.
+ *
+ * @param atomic If non-zero the words are modified atomically, they are
+ * shared with columns outside of the block.
+ */
+static void voxel_space_boolean_bricks(struct voxel_space *space, struct voxel_space *other, enum voxel_op op,
+                                       int x0, int y0, int z0, int x1, int y1, int z1, int atomic)
+{
+    void (*apply)(uint64_t *, uint64_t, uint64_t, enum voxel_op) = atomic ? voxel_word_apply_atomic : voxel_word_apply;
+    int bx, by, xa, xe, ya, ye, x, y, z, za, ze, n;
+    unsigned int base, shift, bits, mask;
+    uint64_t col, *p;
+
+    /* block in coordinates of space */
+    x0 += other->pos.x;
+    x1 += other->pos.x;
+    y0 += other->pos.y;
+    y1 += other->pos.y;
+    z0 += other->pos.z;
+    z1 += other->pos.z;
+
+    for (by = y0 & ~7; by < y1; by += 8) {
+        voxel_brick_clip(by, y0, y1, &ya, &ye);
+        for (bx = x0 & ~7; bx < x1; bx += 8) {
+            voxel_brick_clip(bx, x0, x1, &xa, &xe);
+            for (y = ya; y < ye; ++y) {
+                for (x = xa; x < xe; ++x) {
+                    base  = voxel_brick_base(x, y);
+                    shift = base & 63;
+                    for (z = z0; z < z1; z += n) {
+                        n = (z1 - z < 64) ? z1 - z : 64;
+                        col = voxel_space_column_read(other, x - other->pos.x, y - other->pos.y, z - other->pos.z, n);
+                        if (col == 0 && op != VOXEL_OP_INTERSECTION) continue;
+                        for (za = z; za < z + n; za = ze) {
+                            ze = (za & ~7) + 8;
+                            if (ze > z + n) ze = z + n;
+                            mask = (1u << (ze - za)) - 1;
+                            bits = ((col >> (za - z)) & mask) << (za & 7);
+                            mask <<= za & 7;
+                            p = voxel_space_brick(space, x, y, za) + (base >> 6);
+                            if (mask & 0x0f) {
+                                apply(p, voxel_brick_spread(bits & 15) << shift,
+                                      voxel_brick_spread(mask & 15) << shift, op);
+                            }
+                            if (mask & 0xf0) {
+                                apply(p + 4, voxel_brick_spread(bits >> 4) << shift,
+                                      voxel_brick_spread(mask >> 4) << shift, op);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Combines a block voxel by voxel. This is only used for a space in the
+ * layer layout and \c other in another layout.
+ */
+static void voxel_space_boolean_voxels(struct voxel_space *space, struct voxel_space *other, enum voxel_op op,
+                                       int x0, int y0, int z0, int x1, int y1, int z1)
+{
+    struct voxel_pos pos, dst;
+    int a, b, res = 0;
+
+    for (pos.z = z0; pos.z < z1; ++pos.z) {
+        for (pos.y = y0; pos.y < y1; ++pos.y) {
+            for (pos.x = x0; pos.x < x1; ++pos.x) {
+                voxel_pos_add(&dst, &pos, &other->pos);
+                a = voxel_space_get_xyz(space, &dst);
+                b = voxel_space_get_xyz(other, &pos);
+                switch (op) {
+                case VOXEL_OP_DIFFERENCE:   res = a & !b; break;
+                case VOXEL_OP_UNION:        res = a | b;  break;
+                case VOXEL_OP_INTERSECTION: res = a & b;  break;
+                case VOXEL_OP_XOR:          res = a ^ b;  break;
+                }
+                if (res != a) {
+                    if (res) {
+                        voxel_space_set_xyz(space, &dst);
+                    } else {
+                        voxel_space_clr_xyz(space, &dst);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Combines the block of \c other which overlaps with the rectangle
+ * [x0,x1) x [y0,y1) of \c space.
+ */
+static int voxel_space_boolean_block(struct voxel_space *space, struct voxel_space *other, enum voxel_op op,
+                                     int rx0, int ry0, int rx1, int ry1, int atomic)
+{
+    int x0, y0, z0, x1, y1, z1, y, z;
+    size_t s, d;
+
+    /* compute overlapping block in coordinates of other */
+    x0 = rx0 - other->pos.x;
+    y0 = ry0 - other->pos.y;
+    z0 = (other->pos.z < 0) ? -other->pos.z : 0;
+    x1 = rx1 - other->pos.x;
+    y1 = ry1 - other->pos.y;
+    z1 = other->thickness;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > (int)other->width) x1 = other->width;
+    if (y1 > (int)other->height) y1 = other->height;
+    if (other->pos.z + z1 > (int)space->thickness) z1 = (int)space->thickness - other->pos.z;
+    if (x0 >= x1 || y0 >= y1 || z0 >= z1) return 0;
+
+    if (space->layout == VOXEL_LAYOUT_COLUMN) {
+        /* columns do not share words, so atomic is not needed */
+        voxel_space_boolean_columns(space, other, op, x0, y0, z0, x1, y1, z1);
+        return 0;
+    }
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        voxel_space_boolean_bricks(space, other, op, x0, y0, z0, x1, y1, z1, atomic);
+        return 0;
+    }
+    if (other->layout != VOXEL_LAYOUT_LAYER) {
+        voxel_space_boolean_voxels(space, other, op, x0, y0, z0, x1, y1, z1);
+        return 0;
+    }
+
+    for (z = z0; z < z1; ++z) {
+        for (y = y0; y < y1; ++y) {
+            s = ((size_t)z * other->height + y) * other->width + x0;
+            d = ((size_t)(z + other->pos.z) * space->height + (y + other->pos.y)) * space->width
+                + (x0 + other->pos.x);
+            voxel_row_op(space->data, d, other->data, s, x1 - x0, op, atomic);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Combines two voxel spaces using a boolean operation.
+ * \c other is placed at offset other->pos inside \c space. Only the
+ * overlapping block is modified, voxels of \c space outside of
+ * \c other are left untouched. Clipping is done once per row, the
+ * rows are processed word-wise.
+ *
+ * @param space Space to operate on
+ * @param other Space to combine with \c space
+ * @param op The boolean operation.
+ *
+ * @return Zero on success.
+ */
+int voxel_space_boolean(struct voxel_space *space, struct voxel_space *other, enum voxel_op op)
+{
+    return voxel_space_boolean_block(space, other, op, 0, 0, space->width, space->height, 0);
+}
+
+/**
+ * Same as voxel_space_boolean(), but only modifies the voxels of \c space
+ * inside the rectangle [x0,x1) x [y0,y1). Words which are shared with
+ * voxels outside of the rectangle are modified atomically, so other
+ * threads may work on other rectangles of the same space concurrently.
+ *
+ * @return Zero on success.
+ */
+int voxel_space_boolean_clip(struct voxel_space *space, struct voxel_space *other, enum voxel_op op,
+                             int x0, int y0, int x1, int y1)
+{
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > (int)space->width) x1 = space->width;
+    if (y1 > (int)space->height) y1 = space->height;
+
+    return voxel_space_boolean_block(space, other, op, x0, y0, x1, y1, 1);
+}
+
 /**
  * Computes the difference of the two given voxel spaces.
  * space = space - other
@@ -155,118 +1167,174 @@ int voxel_space_get_xyz(struct voxel_space *space, struct voxel_pos *pos)
  */
 int voxel_space_difference(struct voxel_space *space, struct voxel_space *other)
 {
-    unsigned int x, y, z;
-    struct voxel_pos a, b;
+    return voxel_space_boolean(space, other, VOXEL_OP_DIFFERENCE);
+}
+
+/**
+ * Computes the union of the two given voxel spaces.
+ * space = space | other
+ */
+int voxel_space_union(struct voxel_space *space, struct voxel_space *other)
+{
+    return voxel_space_boolean(space, other, VOXEL_OP_UNION);
+}
+
+/**
+ * Computes the intersection of the two given voxel spaces inside of
+ * the overlapping block.
+ * space = space & other
+ */
+int voxel_space_intersection(struct voxel_space *space, struct voxel_space *other)
+{
+    return voxel_space_boolean(space, other, VOXEL_OP_INTERSECTION);
+}
 
-    for (z = 0; z < other->thickness; ++z) {
-        for (y = 0; y < other->height; ++y) {
-           for (x = 0; x < other->width; ++x) {
-               voxel_pos_set(&b, x, y, z);
-               voxel_pos_add(&a, &b, &other->pos);
+/**
+ * Computes the symmetric difference of the two given voxel spaces.
+ * space = space ^ other
+ */
+int voxel_space_xor(struct voxel_space *space, struct voxel_space *other)
+{
+    return voxel_space_boolean(space, other, VOXEL_OP_XOR);
+}
+
+/** Bytes of 8 voxels in d3f files, 255 for each set bit, bit 0 first. */
+static uint8_t g_voxel_expand[256][8];
+/** Bytes with reversed bit order, PBM rows start with the most significant bit. */
+static uint8_t g_voxel_reverse[256];
+static int g_voxel_tables_init = 0;
 
-               /* range check */
-               if (a.x < 0 || a.x >= space->width) continue;
-               if (a.y < 0 || a.y >= space->height) continue;
-               if (a.z < 0 || a.z >= space->thickness) continue;
+/** Initializes the tables of the exporters, before they start threads. */
+static void voxel_tables_init(void)
+{
+    unsigned int i, j;
 
-               if (voxel_space_get_xyz(other, &b)) {
-                   voxel_space_clr_xyz(space, &a);
-               }
-           }
+    if (g_voxel_tables_init) return;
+    for (i = 0; i < 256; ++i) {
+        g_voxel_reverse[i] = 0;
+        for (j = 0; j < 8; ++j) {
+            g_voxel_expand[i][j] = (i & (1 << j)) ? 255 : 0;
+            if (i & (1 << j)) g_voxel_reverse[i] |= 0x80 >> j;
         }
     }
-
-    return 0;
+    g_voxel_tables_init = 1;
 }
 
-int voxel_space_layer_to_ppm(struct voxel_space *space, const char *filename, unsigned int layer)
+/**
+ * Reads the voxels of the X row at y and z, bit x & 7 of byte x >> 3 is
+ * voxel x. The bits behind the last voxel are zero.
+ */
+static void voxel_space_read_row(struct voxel_space *space, int y, int z, uint8_t *bits)
 {
-    FILE *f;
-    int x, y, i;
-    struct voxel_pos pos;
+    size_t bit = ((size_t)z * space->height + y) * space->width;
+    unsigned int base, n, i, x;
+    const uint64_t *col;
+    uint64_t val;
 
-    f = fopen(filename, "w");
-    if (f == NULL) return -1;
-
-    fprintf(f, "P1\n");
-    fprintf(f, "%u %u\n", (unsigned int)space->width, (unsigned int)space->height);
-    for (y = space->height-1, i = 0; y >= 0; --y) {
-        for (x = 0; x < space->width; ++x) {
-            voxel_pos_set(&pos, x, y, layer);
-            if (voxel_space_get_xyz(space, &pos)) {
-                fprintf(f, "1");
-            } else {
-                fprintf(f, "0");
-            }
-            i++;
-            if (i == 70) {
-                fprintf(f, "\n");
-                i = 0;
-            }
+    memset(bits, 0, (space->width + 7) / 8);
+    if (space->layout == VOXEL_LAYOUT_MORTON) {
+        base = voxel_morton_encode(0, y & 7, z & 7);
+        for (x = 0; x < space->width; x += 8) {
+            bits[x >> 3] = voxel_brick_row_read(voxel_space_brick(space, x, y, z), base);
         }
+        if (space->width & 7) bits[space->width >> 3] &= (1 << (space->width & 7)) - 1;
+        return;
     }
-    fclose(f);
 
-    return 0;
+    if (space->layout == VOXEL_LAYOUT_COLUMN) {
+        col = voxel_space_column(space, 0, y) + (z >> 6);
+        for (x = 0; x < space->width; ++x, col += space->words) {
+            if (*col & (UINT64_C(1) << (z & 63))) bits[x >> 3] |= 1 << (x & 7);
+        }
+        return;
+    }
+
+    /* the row is contiguous, copy 64 bits at once */
+    for (x = 0; x < space->width; x += 64) {
+        n   = (space->width - x < 64) ? space->width - x : 64;
+        val = voxel_bits_read(space->data, bit + x, n);
+        for (i = 0; i < n; i += 8) bits[(x + i) >> 3] = val >> i;
+    }
+}
+
+struct voxel_space_layer {
+    struct voxel_space *space;
+    unsigned int layer;
+};
+
+/** PBM row callback, image row 0 is the highest Y. */
+static void voxel_space_layer_row(void *arg, unsigned int row, uint8_t *bits)
+{
+    struct voxel_space_layer *l = arg;
+    struct voxel_space *space = l->space;
+    size_t i;
+
+    voxel_space_read_row(space, space->height - 1 - row, l->layer, bits);
+    for (i = 0; i < (space->width + 7) / 8; ++i) bits[i] = g_voxel_reverse[bits[i]];
+}
+
+/**
+ * Stores one layer as black and white image, set voxels are black.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int voxel_space_layer_to_ppm(struct voxel_space *space, const char *filename, unsigned int layer)
+{
+    struct voxel_space_layer l;
+
+    if (layer >= space->thickness) return -1;
+    voxel_tables_init();
+    l.space = space;
+    l.layer = layer;
+
+    return pnm_write_pbm(filename, space->width, space->height, voxel_space_layer_row, &l);
 }
 
 /**
- * Stores the given voxel space into a series of PPM files,
- * one file for earch layer.
+ * Stores the given voxel space into a series of PBM files,
+ * one file for earch layer. The rows of each layer are converted in
+ * parallel if worker threads are running.
  *
  * @param space
  * @param basename
  *
- * @return
+ * @return Zero on success, -1 if a file could not be written.
  */
 int voxel_space_to_ppm(struct voxel_space *space, const char *basename)
 {
     char filename[PATH_MAX];
     unsigned int z;
+    int ret = 0;
 
     for (z = 0; z < space->thickness; ++z) {
         snprintf(filename, sizeof(filename), "%s%03u.ppm", basename, z);
-        voxel_space_layer_to_ppm(space, filename, z);
+        if (voxel_space_layer_to_ppm(space, filename, z) != 0) ret = -1;
     }
 
-    return 0;
+    return ret;
 }
 
-int voxel_space_to_pgm(struct voxel_space *space, const char *filename)
+/** PGM row callback: the gray value is the index of the topmost voxel. */
+static void voxel_space_pgm_row(void *arg, unsigned int row, uint16_t *values)
 {
-    FILE *f;
-    int x, y, z, i;
-    struct voxel_pos pos;
+    struct voxel_space *space = arg;
+    int x, y = space->height - 1 - row, z;
 
-    f = fopen(filename, "w");
-    if (f == NULL) return -1;
-
-    /* print format P2=grayscale */
-    fprintf(f, "P2\n");
-    /* print resolution */
-    fprintf(f, "%u %u\n", (unsigned int)space->width, (unsigned int)space->height);
-    /* print number of gray values */
-    fprintf(f, "%u\n", (unsigned int)space->thickness);
-    /* print pixel data */
-    for (y = space->height-1, i = 0; y >= 0; --y) {
-        for (x = 0; x < space->width; ++x) {
-            /* find topmost voxel for x/y => gray value */
-            for (z = space->thickness-1; z > 0; --z) {
-                voxel_pos_set(&pos, x, y, z);
-                if (voxel_space_get_xyz(space, &pos)) break;
-            }
-            fprintf(f, "%u ", z);
-            i++;
-            /* line wrap at max X, or at 70, whatever comes first */
-            if (i == 70 || i == space->width) {
-                fprintf(f, "\n");
-                i = 0;
-            }
-        }
+    for (x = 0; x < space->width; ++x) {
+        z = voxel_space_get_top(space, x, y);
+        values[x] = (z > 0) ? z - 1 : 0;
     }
-    fclose(f);
+}
 
-    return 0;
+/**
+ * Stores the height of each XY column as grayscale image.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int voxel_space_to_pgm(struct voxel_space *space, const char *filename)
+{
+    return pnm_write_pgm(filename, space->width, space->height, space->thickness,
+                         voxel_space_pgm_row, space);
 }
 
 static void voxel_space_write_uint16(FILE *f, uint16_t val)
@@ -275,27 +1343,126 @@ static void voxel_space_write_uint16(FILE *f, uint16_t val)
     fwrite(&val, 2, 1, f);
 }
 
-static void voxel_space_write_byte(FILE *f, uint8_t val)
+#ifndef VOXEL_D3F_BUFFER_SIZE
+/** Size of the buffer of d3f layers, which is written at once. */
+#define VOXEL_D3F_BUFFER_SIZE (64 << 20)
+#endif
+
+/** A batch of d3f layers which is converted by parallel_for(). */
+struct voxel_space_d3f {
+    struct voxel_space *space;
+    unsigned int z0, num_layers;
+    uint8_t *buf;
+    int error;
+};
+
+/** Transposes a matrix of 8x8 bits, bit j of byte i becomes bit i of byte j. */
+static inline uint64_t voxel_transpose8(uint64_t m)
+{
+    uint64_t t;
+
+    t = (m ^ (m >> 7)) & UINT64_C(0x00aa00aa00aa00aa);
+    m ^= t ^ (t << 7);
+    t = (m ^ (m >> 14)) & UINT64_C(0x0000cccc0000cccc);
+    m ^= t ^ (t << 14);
+    t = (m ^ (m >> 28)) & UINT64_C(0x00000000f0f0f0f0);
+    m ^= t ^ (t << 28);
+
+    return m;
+}
+
+/**
+ * Reads the X rows at y of the layers [z,z+n), n <= 64, in the column
+ * layout like voxel_space_read_row(). The Z bits of 8 columns are read
+ * at once and transposed into the rows.
+ */
+static void voxel_space_read_columns(struct voxel_space *space, int y, unsigned int z, unsigned int n,
+                                     uint8_t *bits, size_t stride)
+{
+    unsigned int x, i, j, k;
+    uint64_t w[8], m;
+
+    for (x = 0; x < space->width; x += 8) {
+        for (i = 0; i < 8; ++i) {
+            w[i] = (x + i < space->width) ? voxel_column_read(voxel_space_column(space, x + i, y), z, n) : 0;
+        }
+        for (k = 0; k < n; k += 8) {
+            for (i = 0, m = 0; i < 8; ++i) m |= ((w[i] >> k) & 0xff) << (8 * i);
+            m = voxel_transpose8(m);
+            for (j = 0; j < 8 && k + j < n; ++j) bits[(k + j) * stride + (x >> 3)] = m >> (8 * j);
+        }
+    }
+}
+
+/** Converts the bits of a row to d3f bytes. */
+static void voxel_d3f_expand(const uint8_t *bits, size_t width, uint8_t *out)
+{
+    size_t i;
+
+    for (i = 0; 8 * i + 8 <= width; ++i) memcpy(out + 8 * i, g_voxel_expand[bits[i]], 8);
+    if (width & 7) memcpy(out + 8 * i, g_voxel_expand[bits[i]], width & 7);
+}
+
+/** parallel_for() callback, converts row y of all layers of the batch to bytes. */
+static void voxel_space_d3f_row(void *arg, size_t y)
 {
-    fwrite(&val, 1, 1, f);
+    struct voxel_space_d3f *job = arg;
+    struct voxel_space *space = job->space;
+    size_t layer = space->width * space->height, nbytes = (space->width + 7) / 8;
+    uint8_t *out = job->buf + y * space->width, *bits;
+    unsigned int z, i, n;
+
+    bits = malloc(64 * nbytes);
+    if (bits == NULL) {
+        job->error = 1;
+        return;
+    }
+    for (z = 0; z < job->num_layers; z += n) {
+        if (space->layout == VOXEL_LAYOUT_COLUMN) {
+            n = (job->num_layers - z < 64) ? job->num_layers - z : 64;
+            voxel_space_read_columns(space, y, job->z0 + z, n, bits, nbytes);
+        } else {
+            n = 1;
+            voxel_space_read_row(space, y, job->z0 + z, bits);
+        }
+        for (i = 0; i < n; ++i) voxel_d3f_expand(bits + i * nbytes, space->width, out + (z + i) * layer);
+    }
+    free(bits);
 }
 
 /**
- * Writes a d3f file for rendering with POVRay.
+ * Writes a d3f file for rendering with POVRay, one byte per voxel. The
+ * layers are converted in batches, in parallel if worker threads are
+ * running, and each batch is written at once.
  *
  * @param space
  * @param filename
  *
- * @return
+ * @return Zero on success, -1 on error.
  */
 int voxel_space_to_d3f(struct voxel_space *space, const char *filename)
 {
+    struct voxel_space_d3f job;
+    size_t layer = space->width * space->height;
+    unsigned int batch;
     FILE *f;
-    int x, y, z;
-    struct voxel_pos pos;
+    int ret = 0;
 
-    f = fopen(filename, "w");
-    if (f == NULL) return -1;
+    if (space->width > 65535 || space->height > 65535 || space->thickness > 65535) return -1;
+    voxel_tables_init();
+    memset(&job, 0, sizeof(job));
+    job.space = space;
+    batch = (layer > 0) ? VOXEL_D3F_BUFFER_SIZE / layer : 1;
+    if (batch < 1) batch = 1;
+    if (batch > space->thickness) batch = space->thickness;
+    job.buf = malloc(batch * layer + 1);
+    if (job.buf == NULL) return -1;
+
+    f = fopen(filename, "wb");
+    if (f == NULL) {
+        free(job.buf);
+        return -1;
+    }
 
     /* write d3f header, 3 16 bit values (big endian) for the size of the voxelspace.
      * http://www.povray.org/documentation/view/3.6.1/374/
@@ -304,20 +1471,14 @@ int voxel_space_to_d3f(struct voxel_space *space, const char *filename)
     voxel_space_write_uint16(f, space->height);
     voxel_space_write_uint16(f, space->thickness);
     /* print pixel data */
-    for (z = 0; z < space->thickness; ++z) {
-        for (y = 0; y < space->height; ++y) {
-            for (x = 0; x < space->width; ++x) {
-                voxel_pos_set(&pos, x, y, z);
-                if (voxel_space_get_xyz(space, &pos)) {
-                    voxel_space_write_byte(f, 255);
-                } else {
-                    voxel_space_write_byte(f, 0);
-                }
-            }
-        }
+    for (job.z0 = 0; job.z0 < space->thickness && ret == 0; job.z0 += batch) {
+        job.num_layers = (space->thickness - job.z0 < batch) ? space->thickness - job.z0 : batch;
+        parallel_for(space->height, voxel_space_d3f_row, &job);
+        if (job.error || fwrite(job.buf, layer, job.num_layers, f) != job.num_layers) ret = -1;
     }
-    fclose(f);
+    if (fclose(f) != 0) ret = -1;
+    free(job.buf);
 
-    return 0;
+    return ret;
 }
 
@@ -19,6 +19,7 @@
 #define VOXELSPACE_H_NPCYSM3K
 
 #include <stdlib.h>
+#include <stdint.h>
 
 struct voxel_pos {
     int x, y, z;
@@ -27,16 +28,39 @@ struct voxel_pos {
 void voxel_pos_set(struct voxel_pos *pos, unsigned int x, unsigned int y, unsigned int z);
 void voxel_pos_add(struct voxel_pos *result, struct voxel_pos *a, struct voxel_pos *b);
 
+/** Memory layout of the voxel bits. */
+enum voxel_layout {
+    VOXEL_LAYOUT_LAYER = 0, /**< layer by layer, the X rows are contiguous */
+    VOXEL_LAYOUT_COLUMN,    /**< the Z bits of each XY column are packed into 64 bit words */
+    VOXEL_LAYOUT_MORTON     /**< bricks of 8x8x8 voxels in one cache line, Morton order inside of a brick */
+};
+
 struct voxel_space {
     struct voxel_pos pos;
     size_t width;
     size_t height;
     size_t thickness;
     size_t size; /**< size in bytes */
+    enum voxel_layout layout;
+    size_t words; /**< 64 bit words per XY column, only for VOXEL_LAYOUT_COLUMN */
+    size_t bricks_x, bricks_y; /**< bricks per row and per layer of bricks, only for VOXEL_LAYOUT_MORTON */
     unsigned char *data;
 };
 
+/** Boolean operations for combining two voxel spaces. */
+enum voxel_op {
+    VOXEL_OP_DIFFERENCE = 0, /**< space = space - other */
+    VOXEL_OP_UNION,          /**< space = space | other */
+    VOXEL_OP_INTERSECTION,   /**< space = space & other */
+    VOXEL_OP_XOR             /**< space = space ^ other */
+};
+
 int voxel_space_init(struct voxel_space *space, size_t w, size_t h, size_t t);
+int voxel_space_init_layout(struct voxel_space *space, size_t w, size_t h, size_t t, enum voxel_layout layout);
+int voxel_layout_parse(const char *name, enum voxel_layout *layout);
+const char *voxel_layout_name(enum voxel_layout layout);
+uint32_t voxel_morton_encode(unsigned int x, unsigned int y, unsigned int z);
+void voxel_morton_decode(uint32_t code, unsigned int *x, unsigned int *y, unsigned int *z);
 void voxel_space_clear(struct voxel_space *space);
 
 void voxel_space_set_all(struct voxel_space *space);
@@ -44,7 +68,18 @@ void voxel_space_clr_all(struct voxel_space *space);
 int voxel_space_set_xyz(struct voxel_space *space, struct voxel_pos *pos);
 int voxel_space_clr_xyz(struct voxel_space *space, struct voxel_pos *pos);
 int voxel_space_get_xyz(struct voxel_space *space, struct voxel_pos *pos);
+int voxel_space_get_top(struct voxel_space *space, int x, int y);
+int voxel_space_clr_column(struct voxel_space *space, int x, int y, int z0, int z1);
+int voxel_space_clr_column_atomic(struct voxel_space *space, int x, int y, int z0, int z1);
+int voxel_space_clr_row(struct voxel_space *space, int x0, int x1, int y, int z);
+int voxel_space_clr_row_atomic(struct voxel_space *space, int x0, int x1, int y, int z);
+int voxel_space_boolean(struct voxel_space *space, struct voxel_space *other, enum voxel_op op);
+int voxel_space_boolean_clip(struct voxel_space *space, struct voxel_space *other, enum voxel_op op,
+                             int x0, int y0, int x1, int y1);
 int voxel_space_difference(struct voxel_space *space, struct voxel_space *other);
+int voxel_space_union(struct voxel_space *space, struct voxel_space *other);
+int voxel_space_intersection(struct voxel_space *space, struct voxel_space *other);
+int voxel_space_xor(struct voxel_space *space, struct voxel_space *other);
 
 int voxel_space_to_ppm(struct voxel_space *space, const char *basename);
 int voxel_space_to_pgm(struct voxel_space *space, const char *filename);
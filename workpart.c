@@ -0,0 +1,656 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "workpart.h"
+#include "pnm.h"
+#include "parallel.h"
+#include <string.h>
+
+static const char *g_backend_names[] = {
+    "voxel",
+    "heightmap",
+    "dexel",
+    "brick"
+};
+
+/**
+ * Parses a backend name given on the commandline.
+ *
+ * @return Zero on success, -1 if the name is unknown.
+ */
+int workpart_backend_parse(const char *name, enum workpart_backend *backend)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(g_backend_names) / sizeof(g_backend_names[0]); ++i) {
+        if (strcmp(name, g_backend_names[i]) == 0) {
+            *backend = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *workpart_backend_name(enum workpart_backend backend)
+{
+    return g_backend_names[backend];
+}
+
+int workpart_init(struct workpart *wp, enum workpart_backend backend, size_t w, size_t h, size_t t)
+{
+    return workpart_init_layout(wp, backend, VOXEL_LAYOUT_LAYER, w, h, t);
+}
+
+/**
+ * Same as workpart_init(), but selects the memory layout of the voxel
+ * backend. The layout is ignored by the other backends.
+ */
+int workpart_init_layout(struct workpart *wp, enum workpart_backend backend, enum voxel_layout layout, size_t w, size_t h, size_t t)
+{
+    memset(wp, 0, sizeof(*wp));
+    wp->backend   = backend;
+    wp->width     = w;
+    wp->height    = h;
+    wp->thickness = t;
+
+    switch (backend) {
+    case WORKPART_VOXEL:
+        if (t > UINT16_MAX) return -1;
+        /* the empty workpart has height 0 everywhere */
+        wp->top_tiles_x = (w + WORKPART_TOP_TILE - 1) / WORKPART_TOP_TILE;
+        wp->top_tiles_y = (h + WORKPART_TOP_TILE - 1) / WORKPART_TOP_TILE;
+        wp->top       = calloc(w * h, sizeof(*wp->top));
+        wp->top_dirty = calloc(wp->top_tiles_x * wp->top_tiles_y, 1);
+        wp->top_changed = calloc(wp->top_tiles_x * wp->top_tiles_y, sizeof(*wp->top_changed));
+        wp->top_generation = 1;
+        if (wp->top == NULL || wp->top_dirty == NULL || wp->top_changed == NULL) return -1;
+        return voxel_space_init_layout(&wp->voxel, w, h, t, layout);
+    case WORKPART_HEIGHTMAP:
+        return heightmap_init(&wp->heightmap, w, h, t);
+    case WORKPART_DEXEL:
+        return dexel_space_init(&wp->dexel, w, h, t);
+    case WORKPART_BRICK:
+        return brick_space_init(&wp->brick, w, h, t);
+    }
+
+    return -1;
+}
+
+void workpart_clear(struct workpart *wp)
+{
+    if (wp->top) free(wp->top);
+    if (wp->top_dirty) free(wp->top_dirty);
+    if (wp->top_changed) free(wp->top_changed);
+    voxel_space_clear(&wp->voxel);
+    heightmap_clear(&wp->heightmap);
+    dexel_space_clear(&wp->dexel);
+    brick_space_clear(&wp->brick);
+    memset(wp, 0, sizeof(*wp));
+}
+
+/**
+ * Returns the memory used by the workpart in bytes.
+ */
+size_t workpart_size(struct workpart *wp)
+{
+    switch (wp->backend) {
+    case WORKPART_VOXEL:
+        return wp->voxel.size + wp->width * wp->height * sizeof(*wp->top);
+    case WORKPART_HEIGHTMAP:
+        return wp->heightmap.size;
+    case WORKPART_DEXEL:
+        return wp->dexel.size;
+    case WORKPART_BRICK:
+        return wp->brick.size;
+    }
+
+    return 0;
+}
+
+void workpart_set_all(struct workpart *wp)
+{
+    size_t i;
+
+    switch (wp->backend) {
+    case WORKPART_VOXEL:
+        voxel_space_set_all(&wp->voxel);
+        for (i = 0; i < wp->width * wp->height; ++i) wp->top[i] = wp->thickness;
+        memset(wp->top_dirty, 0, wp->top_tiles_x * wp->top_tiles_y);
+        for (i = 0; i < (size_t)(wp->top_tiles_x * wp->top_tiles_y); ++i) wp->top_changed[i] = wp->top_generation;
+        break;
+    case WORKPART_HEIGHTMAP:
+        heightmap_set_all(&wp->heightmap);
+        break;
+    case WORKPART_DEXEL:
+        dexel_space_set_all(&wp->dexel);
+        break;
+    case WORKPART_BRICK:
+        brick_space_set_all(&wp->brick);
+        break;
+    }
+}
+
+/** Recomputes the cached heights of a tile of the voxel backend. */
+static void workpart_top_update(struct workpart *wp, int tx, int ty)
+{
+    int x, y, x1, y1;
+
+    x1 = (tx + 1) * WORKPART_TOP_TILE;
+    y1 = (ty + 1) * WORKPART_TOP_TILE;
+    if (x1 > (int)wp->width) x1 = wp->width;
+    if (y1 > (int)wp->height) y1 = wp->height;
+    for (y = ty * WORKPART_TOP_TILE; y < y1; ++y) {
+        for (x = tx * WORKPART_TOP_TILE; x < x1; ++x) {
+            wp->top[(size_t)y * wp->width + x] = voxel_space_get_top(&wp->voxel, x, y);
+        }
+    }
+    wp->top_dirty[ty * wp->top_tiles_x + tx] = 0;
+}
+
+/** parallel_for() callback, updates the dirty tiles of one row of tiles. */
+static void workpart_top_update_row(void *arg, size_t ty)
+{
+    struct workpart *wp = arg;
+    int tx;
+
+    for (tx = 0; tx < wp->top_tiles_x; ++tx) {
+        if (wp->top_dirty[ty * wp->top_tiles_x + tx]) workpart_top_update(wp, tx, ty);
+    }
+}
+
+/**
+ * Marks the cached heights of the columns [x0,x1) x [y0,y1) for update.
+ * The rectangle must be inside of the workpart.
+ */
+static void workpart_top_mark(struct workpart *wp, int x0, int y0, int x1, int y1)
+{
+    int tx, ty;
+
+    if (x0 >= x1 || y0 >= y1) return;
+    for (ty = y0 / WORKPART_TOP_TILE; ty <= (y1 - 1) / WORKPART_TOP_TILE; ++ty) {
+        for (tx = x0 / WORKPART_TOP_TILE; tx <= (x1 - 1) / WORKPART_TOP_TILE; ++tx) {
+            wp->top_dirty[ty * wp->top_tiles_x + tx]   = 1;
+            wp->top_changed[ty * wp->top_tiles_x + tx] = wp->top_generation;
+        }
+    }
+}
+
+/**
+ * Gets the height of the topmost material in a column.
+ * The voxel backend caches the heights and only rescans the tiles from
+ * which material has been removed since.
+ *
+ * @return Index of the topmost solid layer plus one, 0 if the column is empty,
+ * -1 if the column is out of range.
+ */
+int workpart_get_top(struct workpart *wp, int x, int y)
+{
+    switch (wp->backend) {
+    case WORKPART_VOXEL:
+        if (x < 0 || x >= (int)wp->width || y < 0 || y >= (int)wp->height) return -1;
+        if (wp->top_dirty[(y / WORKPART_TOP_TILE) * wp->top_tiles_x + x / WORKPART_TOP_TILE]) {
+            workpart_top_update(wp, x / WORKPART_TOP_TILE, y / WORKPART_TOP_TILE);
+        }
+        return wp->top[(size_t)y * wp->width + x];
+    case WORKPART_HEIGHTMAP:
+        return heightmap_get(&wp->heightmap, x, y);
+    case WORKPART_DEXEL:
+        return dexel_space_get_top(&wp->dexel, x, y);
+    case WORKPART_BRICK:
+        return brick_space_get_top(&wp->brick, x, y);
+    }
+
+    return -1;
+}
+
+/**
+ * Updates all stale heights of the cache of the voxel backend. Afterwards
+ * workpart_get_top() only reads and may be called by several threads
+ * until material is removed again.
+ */
+void workpart_update_top(struct workpart *wp)
+{
+    if (wp->backend == WORKPART_VOXEL) parallel_for(wp->top_tiles_y, workpart_top_update_row, wp);
+}
+
+/**
+ * Gets a single voxel of the workpart.
+ *
+ * @return 1 if the voxel is solid, 0 if not, -1 if it is out of range.
+ */
+int workpart_get_xyz(struct workpart *wp, int x, int y, int z)
+{
+    struct voxel_pos pos;
+    int top;
+
+    switch (wp->backend) {
+    case WORKPART_VOXEL:
+        voxel_pos_set(&pos, x, y, z);
+        return voxel_space_get_xyz(&wp->voxel, &pos);
+    case WORKPART_HEIGHTMAP:
+        top = heightmap_get(&wp->heightmap, x, y);
+        if (top < 0 || z < 0 || z >= (int)wp->thickness) return -1;
+        return z < top;
+    case WORKPART_DEXEL:
+        return dexel_space_get_xyz(&wp->dexel, x, y, z);
+    case WORKPART_BRICK:
+        return brick_space_get_xyz(&wp->brick, x, y, z);
+    }
+
+    return -1;
+}
+
+/** Arguments of workpart_copy_row(). */
+struct workpart_copy {
+    struct workpart *wp;
+    unsigned int since;
+    uint16_t *values;
+    unsigned char *rows;
+};
+
+/** parallel_for() callback, copies the changed tiles of one row of tiles. */
+static void workpart_copy_row(void *arg, size_t ty)
+{
+    struct workpart_copy *copy = arg;
+    struct workpart *wp = copy->wp;
+    const uint16_t *top;
+    uint16_t *values;
+    int i, tx, x, y, x1, y1;
+
+    y1 = (ty + 1) * WORKPART_TOP_TILE;
+    if (y1 > (int)wp->height) y1 = wp->height;
+    for (tx = 0; tx < wp->top_tiles_x; ++tx) {
+        i = ty * wp->top_tiles_x + tx;
+        if (wp->top_changed[i] < copy->since) continue;
+        if (wp->top_dirty[i]) workpart_top_update(wp, tx, ty);
+        x1 = (tx + 1) * WORKPART_TOP_TILE;
+        if (x1 > (int)wp->width) x1 = wp->width;
+        for (y = ty * WORKPART_TOP_TILE; y < y1; ++y) {
+            top    = &wp->top[(size_t)y * wp->width];
+            values = &copy->values[(size_t)(wp->height - 1 - y) * wp->width];
+            for (x = tx * WORKPART_TOP_TILE; x < x1; ++x) values[x] = (top[x] > 0) ? top[x] - 1 : 0;
+            copy->rows[wp->height - 1 - y] = 1;
+        }
+    }
+}
+
+/**
+ * Copies the gray values of workpart_to_pgm() which changed since the last
+ * call with the same since into an image of width x height values and sets
+ * the flags of the changed image rows. Each user of the changes has its
+ * own since, which must be zero before the first call, so the first call
+ * copies all rows. The voxel backend only copies the tiles from which
+ * material has been removed, the other backends copy all rows.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int workpart_copy_changes(struct workpart *wp, unsigned int *since, uint16_t *values, unsigned char *rows)
+{
+    struct workpart_copy copy = { wp, *since, values, rows };
+    int x, y, z;
+
+    if (wp->backend == WORKPART_VOXEL) {
+        parallel_for(wp->top_tiles_y, workpart_copy_row, &copy);
+        /* tiles cut from now on are newer than all copies */
+        *since = ++wp->top_generation;
+        return 0;
+    }
+    for (y = 0; y < (int)wp->height; ++y) {
+        for (x = 0; x < (int)wp->width; ++x) {
+            z = workpart_get_top(wp, x, y);
+            if (z < 0) return -1;
+            values[(size_t)(wp->height - 1 - y) * wp->width + x] = (z > 0) ? z - 1 : 0;
+        }
+        rows[wp->height - 1 - y] = 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Marks the cached heights of the columns covered by a tool at pos for
+ * update, clipped to the sweep's clip rectangle.
+ */
+static void workpart_top_mark_tool(struct workpart *wp, struct tool_sweep *sweep, struct voxel_pos *pos)
+{
+    int x0 = pos->x, y0 = pos->y;
+    int x1 = pos->x + (int)sweep->profile->width, y1 = pos->y + (int)sweep->profile->height;
+
+    if (x0 < sweep->x0) x0 = sweep->x0;
+    if (y0 < sweep->y0) y0 = sweep->y0;
+    if (x1 > sweep->x1) x1 = sweep->x1;
+    if (y1 > sweep->y1) y1 = sweep->y1;
+    workpart_top_mark(wp, x0, y0, x1, y1);
+}
+
+static void workpart_clr_voxel_column(void *space, int x, int y, int z0, int z1)
+{
+    struct workpart *wp = space;
+
+    if (voxel_space_clr_column(&wp->voxel, x, y, z0, z1) == 0) workpart_top_mark(wp, x, y, x + 1, y + 1);
+}
+
+static void workpart_clr_voxel_column_atomic(void *space, int x, int y, int z0, int z1)
+{
+    struct workpart *wp = space;
+
+    if (voxel_space_clr_column_atomic(&wp->voxel, x, y, z0, z1) == 0) workpart_top_mark(wp, x, y, x + 1, y + 1);
+}
+
+static void workpart_clr_heightmap_column(void *space, int x, int y, int z0, int z1)
+{
+    heightmap_clr_column(space, x, y, z0, z1);
+}
+
+static void workpart_clr_dexel_column(void *space, int x, int y, int z0, int z1)
+{
+    dexel_space_clr_column(space, x, y, z0, z1);
+}
+
+static void workpart_clr_brick_column(void *space, int x, int y, int z0, int z1)
+{
+    brick_space_clr_column(space, x, y, z0, z1);
+}
+
+/**
+ * Returns true if the workpart is stored in layers with contiguous X rows.
+ * All other backends and layouts are cleared column by column.
+ */
+static int workpart_has_rows(struct workpart *wp)
+{
+    return wp->backend == WORKPART_VOXEL && wp->voxel.layout == VOXEL_LAYOUT_LAYER;
+}
+
+/**
+ * Prepares a sweep on the workpart.
+ *
+ * @param clip Optional clip rectangle, NULL for the whole workpart.
+ */
+static void workpart_sweep_init(struct workpart *wp, struct tool_sweep *sweep, struct tool_profile *profile, const struct workpart_rect *clip)
+{
+    sweep->profile = profile;
+    sweep->x0      = 0;
+    sweep->y0      = 0;
+    sweep->x1      = wp->width;
+    sweep->y1      = wp->height;
+    if (clip) {
+        if (clip->x0 > sweep->x0) sweep->x0 = clip->x0;
+        if (clip->y0 > sweep->y0) sweep->y0 = clip->y0;
+        if (clip->x1 < sweep->x1) sweep->x1 = clip->x1;
+        if (clip->y1 < sweep->y1) sweep->y1 = clip->y1;
+    }
+
+    switch (wp->backend) {
+    case WORKPART_VOXEL:
+        /* columns of neighbouring rectangles share bytes */
+        sweep->clear = clip ? workpart_clr_voxel_column_atomic : workpart_clr_voxel_column;
+        sweep->space = wp;
+        break;
+    case WORKPART_HEIGHTMAP:
+        sweep->clear = workpart_clr_heightmap_column;
+        sweep->space = &wp->heightmap;
+        break;
+    case WORKPART_DEXEL:
+        sweep->clear = workpart_clr_dexel_column;
+        sweep->space = &wp->dexel;
+        break;
+    case WORKPART_BRICK:
+        sweep->clear = workpart_clr_brick_column;
+        sweep->space = &wp->brick;
+        break;
+    }
+}
+
+/**
+ * Removes the tool at its current position tool->pos from the workpart.
+ * The voxel backend subtracts the tool's voxel space, the heightmap
+ * backend lowers each column to the bottom of the tool's profile, the
+ * dexel and brick backends and the Morton layout of the voxel backend
+ * clear the tool's Z range in each column.
+ *
+ * @param wp The workpart.
+ * @param tool The tool's voxel space.
+ * @param profile The tool's profile.
+ *
+ * @return Zero on success.
+ */
+int workpart_stamp(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile)
+{
+    return workpart_stamp_clip(wp, tool, profile, NULL);
+}
+
+/**
+ * Same as workpart_stamp(), but only modifies the workpart inside of \c clip.
+ * Other threads may modify the workpart outside of \c clip concurrently.
+ *
+ * @param clip Clip rectangle, NULL for the whole workpart.
+ */
+int workpart_stamp_clip(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, const struct workpart_rect *clip)
+{
+    struct tool_sweep sweep;
+
+    switch (wp->backend) {
+    case WORKPART_VOXEL:
+        if (wp->voxel.layout == VOXEL_LAYOUT_MORTON) {
+            /* a brick word holds 4 voxels of a column, reading the tool
+             * would cost as much as clearing, so use the profile */
+            workpart_sweep_init(wp, &sweep, profile, clip);
+            return tool_stamp(&sweep, &tool->pos);
+        }
+        workpart_sweep_init(wp, &sweep, profile, clip);
+        workpart_top_mark_tool(wp, &sweep, &tool->pos);
+        if (clip) {
+            return voxel_space_boolean_clip(&wp->voxel, tool, VOXEL_OP_DIFFERENCE,
+                                            clip->x0, clip->y0, clip->x1, clip->y1);
+        }
+        return voxel_space_difference(&wp->voxel, tool);
+    case WORKPART_HEIGHTMAP:
+    case WORKPART_DEXEL:
+    case WORKPART_BRICK:
+        workpart_sweep_init(wp, &sweep, profile, clip);
+        return tool_stamp(&sweep, &tool->pos);
+    }
+
+    return -1;
+}
+
+/**
+ * Completes the stamp of a tool, which has been stamped one voxel step
+ * before, to a stamp at its current position tool->pos by removing only
+ * the delta of the step.
+ *
+ * @param wp The workpart.
+ * @param tool The tool's voxel space.
+ * @param profile The tool's profile.
+ * @param delta The tool's delta of the step.
+ *
+ * @return Zero on success.
+ */
+int workpart_stamp_delta(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, const struct tool_delta *delta)
+{
+    return workpart_stamp_delta_clip(wp, tool, profile, delta, NULL);
+}
+
+/**
+ * Same as workpart_stamp_delta(), but only modifies the workpart inside of \c clip.
+ */
+int workpart_stamp_delta_clip(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, const struct tool_delta *delta, const struct workpart_rect *clip)
+{
+    struct tool_sweep sweep;
+    const struct tool_span *span;
+    int x0, x1, y;
+    size_t i;
+
+    if (workpart_has_rows(wp) && delta->num_rows * 2 >= tool->height * tool->thickness) {
+        /* X steps touch every row, the word-wise difference is faster then */
+        return workpart_stamp_clip(wp, tool, profile, clip);
+    }
+
+    workpart_sweep_init(wp, &sweep, profile, clip);
+    if (!workpart_has_rows(wp)) return tool_stamp_delta(&sweep, delta, &tool->pos);
+    workpart_top_mark_tool(wp, &sweep, &tool->pos);
+
+    /* the voxel rows are contiguous in X */
+    for (i = 0; i < delta->num_rows; ++i) {
+        span = &delta->rows[i];
+        y = tool->pos.y + span->a;
+        if (y < sweep.y0 || y >= sweep.y1) continue;
+        x0 = tool->pos.x + span->lo;
+        x1 = tool->pos.x + span->hi;
+        if (x0 < sweep.x0) x0 = sweep.x0;
+        if (x1 > sweep.x1) x1 = sweep.x1;
+        if (clip) {
+            voxel_space_clr_row_atomic(&wp->voxel, x0, x1, y, tool->pos.z + span->b);
+        } else {
+            voxel_space_clr_row(&wp->voxel, x0, x1, y, tool->pos.z + span->b);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Removes the volume of the tool moving vertically from its position
+ * tool->pos up to layer \c z1 at once. See tool_extrude().
+ *
+ * @param wp The workpart.
+ * @param tool The tool's voxel space, tool->pos is the lower position.
+ * @param profile The tool's profile.
+ * @param z1 Upper position of the tool, z1 >= tool->pos.z.
+ *
+ * @return Zero on success.
+ */
+int workpart_extrude(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, int z1)
+{
+    return workpart_extrude_clip(wp, tool, profile, z1, NULL);
+}
+
+/**
+ * Same as workpart_extrude(), but only modifies the workpart inside of \c clip.
+ */
+int workpart_extrude_clip(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, int z1, const struct workpart_rect *clip)
+{
+    struct tool_sweep sweep;
+    struct voxel_pos *pos = &tool->pos;
+    int x, y, z, x0, x1, i, w = profile->width;
+
+    if (z1 <= pos->z) return workpart_stamp_clip(wp, tool, profile, clip);
+
+    workpart_sweep_init(wp, &sweep, profile, clip);
+    if (!workpart_has_rows(wp)) return tool_extrude(&sweep, pos, z1);
+    workpart_top_mark_tool(wp, &sweep, pos);
+
+    /* clear the X runs of the extruded cross section of each layer */
+    if (profile->min_bottom < 0) return 0;
+    for (z = pos->z + profile->min_bottom; z < z1 + (int)profile->thickness; ++z) {
+        for (y = 0; y < (int)profile->height; ++y) {
+            if (pos->y + y < sweep.y0 || pos->y + y >= sweep.y1) continue;
+            for (x = 0; x < w; ++x) {
+                i = y * w + x;
+                if (profile->bottom[i] < 0 || z < pos->z + profile->bottom[i] || z > z1 + profile->top[i]) continue;
+                x0 = x;
+                while (x + 1 < w && profile->bottom[i + 1] >= 0 &&
+                       z >= pos->z + profile->bottom[i + 1] && z <= z1 + profile->top[i + 1]) {
+                    x++;
+                    i++;
+                }
+                x0 += pos->x;
+                x1 = pos->x + x + 1;
+                if (x0 < sweep.x0) x0 = sweep.x0;
+                if (x1 > sweep.x1) x1 = sweep.x1;
+                if (clip) {
+                    voxel_space_clr_row_atomic(&wp->voxel, x0, x1, pos->y + y, z);
+                } else {
+                    voxel_space_clr_row(&wp->voxel, x0, x1, pos->y + y, z);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Removes the volume swept by a linear move. See tool_sweep_line().
+ */
+int workpart_sweep_line(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end)
+{
+    return workpart_sweep_line_clip(wp, profile, start, end, NULL);
+}
+
+/**
+ * Same as workpart_sweep_line(), but only modifies the workpart inside of \c clip.
+ */
+int workpart_sweep_line_clip(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end, const struct workpart_rect *clip)
+{
+    struct tool_sweep sweep;
+
+    workpart_sweep_init(wp, &sweep, profile, clip);
+    return tool_sweep_line(&sweep, start, end);
+}
+
+/**
+ * Removes the volume swept by an arc move. See tool_sweep_arc().
+ */
+int workpart_sweep_arc(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode)
+{
+    return workpart_sweep_arc_clip(wp, profile, start, end, center, mode, NULL);
+}
+
+/**
+ * Same as workpart_sweep_arc(), but only modifies the workpart inside of \c clip.
+ */
+int workpart_sweep_arc_clip(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode, const struct workpart_rect *clip)
+{
+    struct tool_sweep sweep;
+
+    workpart_sweep_init(wp, &sweep, profile, clip);
+    return tool_sweep_arc(&sweep, start, end, center, mode);
+}
+
+/**
+ * PGM row callback of all backends: the gray value is the index of the
+ * topmost solid voxel. The voxel backend reads the updated height cache.
+ */
+static void workpart_pgm_row(void *arg, unsigned int row, uint16_t *values)
+{
+    struct workpart *wp = arg;
+    int x, y = wp->height - 1 - row, top;
+
+    for (x = 0; x < (int)wp->width; ++x) {
+        if (wp->backend == WORKPART_VOXEL) {
+            top = wp->top[(size_t)y * wp->width + x];
+        } else {
+            top = workpart_get_top(wp, x, y);
+        }
+        values[x] = (top > 0) ? top - 1 : 0;
+    }
+}
+
+/**
+ * Stores the height of each XY column as grayscale image.
+ * The voxel backend only rescans the tiles from which material has
+ * been removed since the last image.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int workpart_to_pgm(struct workpart *wp, const char *filename)
+{
+    workpart_update_top(wp);
+    return pnm_write_pgm(filename, wp->width, wp->height, wp->thickness, workpart_pgm_row, wp);
+}
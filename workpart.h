@@ -0,0 +1,90 @@
+/*
+ * GCode Simulator
+ * Copyright (C) 2017 Gerhard Gappmeier
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WORKPART_H_J2WV8DXE
+#define WORKPART_H_J2WV8DXE
+
+#include "voxelspace.h"
+#include "heightmap.h"
+#include "dexel.h"
+#include "brickspace.h"
+#include "tool.h"
+
+/** Storage backends for the simulated workpart. */
+enum workpart_backend {
+    WORKPART_VOXEL = 0, /**< full voxel cube, exact */
+    WORKPART_HEIGHTMAP, /**< one height per XY column (2.5D) */
+    WORKPART_DEXEL,     /**< list of solid Z intervals per XY column, exact */
+    WORKPART_BRICK      /**< sparse voxels, only bricks at the surface use memory */
+};
+
+/** Rectangle in voxels, x1 and y1 are exclusive. */
+struct workpart_rect {
+    int x0, y0, x1, y1;
+};
+
+/**
+ * Edge length of the tiles of the height cache in voxels. It divides the
+ * tile size of the tile-parallel simulation, so each tile of the cache
+ * is only written by one thread.
+ */
+#define WORKPART_TOP_TILE 16
+
+struct workpart {
+    enum workpart_backend backend;
+    size_t width;
+    size_t height;
+    size_t thickness;
+    struct voxel_space voxel;
+    /* height cache of the voxel backend */
+    uint16_t *top;            /**< workpart_get_top() of each column */
+    unsigned char *top_dirty; /**< per tile: material has been removed since the heights were computed */
+    unsigned int *top_changed; /**< per tile: generation in which material was removed last */
+    unsigned int top_generation; /**< incremented by each workpart_copy_changes() */
+    int top_tiles_x, top_tiles_y;
+    struct heightmap heightmap;
+    struct dexel_space dexel;
+    struct brick_space brick;
+};
+
+int workpart_backend_parse(const char *name, enum workpart_backend *backend);
+const char *workpart_backend_name(enum workpart_backend backend);
+
+int workpart_init(struct workpart *wp, enum workpart_backend backend, size_t w, size_t h, size_t t);
+int workpart_init_layout(struct workpart *wp, enum workpart_backend backend, enum voxel_layout layout, size_t w, size_t h, size_t t);
+void workpart_clear(struct workpart *wp);
+size_t workpart_size(struct workpart *wp);
+
+void workpart_set_all(struct workpart *wp);
+int workpart_get_top(struct workpart *wp, int x, int y);
+void workpart_update_top(struct workpart *wp);
+int workpart_get_xyz(struct workpart *wp, int x, int y, int z);
+int workpart_copy_changes(struct workpart *wp, unsigned int *since, uint16_t *values, unsigned char *rows);
+int workpart_stamp(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile);
+int workpart_stamp_delta(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, const struct tool_delta *delta);
+int workpart_extrude(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, int z1);
+int workpart_sweep_line(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end);
+int workpart_sweep_arc(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode);
+int workpart_stamp_clip(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, const struct workpart_rect *clip);
+int workpart_stamp_delta_clip(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, const struct tool_delta *delta, const struct workpart_rect *clip);
+int workpart_extrude_clip(struct workpart *wp, struct voxel_space *tool, struct tool_profile *profile, int z1, const struct workpart_rect *clip);
+int workpart_sweep_line_clip(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end, const struct workpart_rect *clip);
+int workpart_sweep_arc_clip(struct workpart *wp, struct tool_profile *profile, struct gvector *start, struct gvector *end, struct gvector *center, enum gcode_arc_mode mode, const struct workpart_rect *clip);
+
+int workpart_to_pgm(struct workpart *wp, const char *filename);
+
+#endif /* end of include guard: WORKPART_H_J2WV8DXE */